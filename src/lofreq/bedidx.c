@@ -44,6 +44,8 @@ typedef struct {
     int n, m;
     uint64_t *a;
     int *idx;
+    int n_merged;
+    uint64_t *merged; // a with overlapping and adjacent intervals merged
 } bed_reglist_t;
 
 #include "htslib/khash.h"
@@ -81,6 +83,24 @@ int *bed_index_core(int n, uint64_t *a, int *n_idx)
     return idx;
 }
 
+/* Merges overlapping or adjacent intervals of sorted a into merged,
+   which must be able to hold n intervals. Returns number of merged
+   intervals. */
+static int bed_merge_core(int n, const uint64_t *a, uint64_t *merged)
+{
+    int i, n_merged = 0;
+    for (i = 0; i < n; ++i) {
+        uint32_t beg = a[i]>>32, end = (uint32_t)a[i];
+        if (n_merged && beg <= (uint32_t)merged[n_merged-1]) {
+            if (end > (uint32_t)merged[n_merged-1])
+                merged[n_merged-1] = (merged[n_merged-1]>>32)<<32 | end;
+        } else {
+            merged[n_merged++] = a[i];
+        }
+    }
+    return n_merged;
+}
+
 void bed_index(void *_h)
 {
     reghash_t *h = (reghash_t*)_h;
@@ -91,6 +111,13 @@ void bed_index(void *_h)
             if (p->idx) free(p->idx);
             ks_introsort(uint64_t, p->n, p->a);
             p->idx = bed_index_core(p->n, p->a, &p->m);
+            free(p->merged);
+            if (NULL == (p->merged = malloc((p->n ? p->n : 1) * sizeof(uint64_t)))) {
+                fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                        __FILE__, __FUNCTION__, __LINE__);
+                exit(1);
+            }
+            p->n_merged = bed_merge_core(p->n, p->a, p->merged);
         }
     }
 }
@@ -99,10 +126,11 @@ int bed_overlap_core(const bed_reglist_t *p, int beg, int end)
 {
     int i, min_off;
     if (p->n == 0) return 0;
-    min_off = (beg>>LIDX_SHIFT >= p->n)? p->idx[p->n-1] : p->idx[beg>>LIDX_SHIFT];
+    // p->m is the size of the linear index
+    min_off = (beg>>LIDX_SHIFT >= p->m)? p->idx[p->m-1] : p->idx[beg>>LIDX_SHIFT];
     if (min_off < 0) { // TODO: this block can be improved, but speed should not matter too much here
         int n = beg>>LIDX_SHIFT;
-        if (n > p->n) n = p->n;
+        if (n > p->m) n = p->m;
         for (i = n - 1; i >= 0; --i)
             if (p->idx[i] >= 0) break;
         min_off = i >= 0? p->idx[i] : 0;
@@ -125,6 +153,98 @@ int bed_overlap(const void *_h, const char *chr, int beg, int end)
     return bed_overlap_core(&kh_val(h, k), beg, end);
 }
 
+/* Returns the intervals of chr merged by bed_merge_core() (overlapping
+   or adjacent ones) and sorted, encoded as beg<<32|end, in *regs.
+   *regs points into h and must not be freed. Return value is the
+   number of intervals (0 if chr is not in the BED). */
+int bed_merged_intervals(const void *_h, const char *chr, const uint64_t **regs)
+{
+    const reghash_t *h = (const reghash_t*)_h;
+    const bed_reglist_t *p;
+    khint_t k;
+
+    *regs = NULL;
+    if (!h) return 0;
+    k = kh_get(reg, h, chr);
+    if (k == kh_end(h)) return 0;
+    p = &kh_val(h, k);
+    *regs = p->merged;
+    return p->n_merged;
+}
+
+/* Cursor for overlap queries with (mostly) increasing start positions,
+   as in a pileup or a sorted BAM or VCF file. The chromosome is only
+   looked up when it changes and the cursor advances over the merged
+   intervals, so that each query is amortized O(1). Queries with a
+   smaller start than the previous one on the same chromosome fall back
+   to a binary search. A cursor must not be shared between threads. */
+typedef struct {
+    const reghash_t *h;
+    int tid; // caller's id of chr; -1 if chromosomes are compared by name
+    char *chr; // NULL if no query yet
+    const uint64_t *a; // merged intervals of chr
+    int n, i; // i: first interval not ending before last_beg
+    int last_beg;
+} bed_cursor_t;
+
+void *bed_cursor_new(const void *_h)
+{
+    bed_cursor_t *c = calloc(1, sizeof(bed_cursor_t));
+    if (NULL == c) return NULL;
+    c->h = (const reghash_t*)_h;
+    c->tid = -1;
+    return c;
+}
+
+void bed_cursor_destroy(void *_c)
+{
+    bed_cursor_t *c = (bed_cursor_t*)_c;
+    if (!c) return;
+    free(c->chr);
+    free(c);
+}
+
+/* Like bed_overlap(). tid is the caller's numeric id of chr (e.g. the
+   BAM target id), which makes the check for a chromosome change
+   cheap. Pass -1 if unknown, in which case names are compared. */
+int bed_cursor_overlap(void *_c, int tid, const char *chr, int beg, int end)
+{
+    bed_cursor_t *c = (bed_cursor_t*)_c;
+    const uint64_t *a;
+    int i;
+
+    if (!c->h) return 0;
+    if (!c->chr || (tid >= 0? tid != c->tid : strcmp(chr, c->chr) != 0)) {
+        khint_t k = kh_get(reg, c->h, chr);
+        free(c->chr);
+        if (NULL == (c->chr = strdup(chr))) return bed_overlap(c->h, chr, beg, end);
+        c->tid = tid;
+        if (k == kh_end(c->h)) {
+            c->a = NULL, c->n = 0;
+        } else {
+            c->a = kh_val(c->h, k).merged, c->n = kh_val(c->h, k).n_merged;
+        }
+        c->i = 0;
+        c->last_beg = beg;
+    }
+    a = c->a;
+    if (beg < c->last_beg) { // went back: find first interval ending after beg
+        int lo = 0, hi = c->n;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if ((int32_t)a[mid] > beg) hi = mid;
+            else lo = mid + 1;
+        }
+        c->i = lo;
+    } else {
+        while (c->i < c->n && (int32_t)a[c->i] <= beg) ++c->i;
+    }
+    c->last_beg = beg;
+    i = c->i;
+    // merged intervals are disjoint, so only interval i can overlap
+    return i < c->n && (int)(a[i]>>32) < end;
+}
+
 /* "BED" file reader, which actually reads two different formats.
 
    BED files contain between three and nine fields per line, of which
@@ -251,6 +371,7 @@ void bed_destroy(void *_h)
         if (kh_exist(h, k)) {
             free(kh_val(h, k).a);
             free(kh_val(h, k).idx);
+            free(kh_val(h, k).merged);
             free((char*)kh_key(h, k));
         }
     }
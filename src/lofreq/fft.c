@@ -0,0 +1,230 @@
+/* -*- c-file-style: "k&r"; indent-tabs-mode: nil; -*- */
+/*********************************************************************
+* The MIT License (MIT)
+* 
+* Copyright (c) 2013,2014 Genome Institute of Singapore
+* 
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation files
+* (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify, merge,
+* publish, distribute, sublicense, and/or sell copies of the Software,
+* and to permit persons to whom the Software is furnished to do so,
+* subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+* BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+* ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+* CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+************************************************************************/
+
+
+/* Real polynomial multiplication (i.e. convolution of real
+ * sequences), using an iterative radix-2 FFT for large inputs and
+ * direct convolution for small ones.
+ *
+ * Absolute error of the FFT path is in the order of 1e-16 * log2(n)
+ * times the largest output coefficient. Coefficients that are much
+ * smaller than that are noise, so callers should make sure the mass
+ * they care about is near the maximum (e.g. by tilting).
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "fft.h"
+
+
+
+/* use direct convolution if the shorter input is at most this long */
+#define DIRECT_CONV_MAX_LEN 48
+
+/* log2 of largest supported FFT length */
+#define TWIDDLE_MAX_LOG2N 30
+
+
+/* cos/sin tables per FFT length n = 2^i, computed on first use and
+ * kept until exit. shared between threads: entries are only ever
+ * set once (under twiddle_lock) and never changed afterwards */
+static double *twiddle_cos[TWIDDLE_MAX_LOG2N+1];
+static double *twiddle_sin[TWIDDLE_MAX_LOG2N+1];
+static pthread_mutex_t twiddle_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* sets cos_tab and sin_tab to the cached tables of cos/sin(2*pi*j/n)
+ * for j < n/2, where n = 2^log2n. returns -1 on error */
+static int
+twiddle_get(const int log2n, const double **cos_tab, const double **sin_tab)
+{
+     const int n = 1<<log2n;
+     int rc = 0;
+
+     if (log2n > TWIDDLE_MAX_LOG2N) {
+          return -1;
+     }
+
+     pthread_mutex_lock(& twiddle_lock);
+     if (NULL == twiddle_cos[log2n]) {
+          double *c = NULL, *s = NULL;
+          int i;
+
+          if (NULL == (c = malloc(n/2 * sizeof(double)))
+              || NULL == (s = malloc(n/2 * sizeof(double)))) {
+               fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                       __FILE__, __FUNCTION__, __LINE__);
+               free(c);
+               rc = -1;
+          } else {
+               for (i=0; i<n/2; i++) {
+                    c[i] = cos(2.0*M_PI*i/n);
+                    s[i] = sin(2.0*M_PI*i/n);
+               }
+               twiddle_cos[log2n] = c;
+               twiddle_sin[log2n] = s;
+          }
+     }
+     *cos_tab = twiddle_cos[log2n];
+     *sin_tab = twiddle_sin[log2n];
+     pthread_mutex_unlock(& twiddle_lock);
+
+     return rc;
+}
+
+
+
+/* in-place complex FFT of length n (power of two) on separate real
+ * and imaginary arrays. inverse if sign is +1, forward if -1. no
+ * scaling. cos_tab and sin_tab hold cos/sin(2*pi*j/n) for j < n/2
+ */
+static void
+fft(double *re, double *im, const int n, const int sign,
+    const double *cos_tab, const double *sin_tab)
+{
+     int i, j, k, len;
+
+     /* bit reversal permutation */
+     for (i=1, j=0; i<n; i++) {
+          int bit = n >> 1;
+          for (; j & bit; bit >>= 1) {
+               j ^= bit;
+          }
+          j ^= bit;
+          if (i < j) {
+               double t;
+               t = re[i]; re[i] = re[j]; re[j] = t;
+               t = im[i]; im[i] = im[j]; im[j] = t;
+          }
+     }
+
+     for (len=2; len<=n; len<<=1) {
+          int half = len >> 1;
+          int step = n / len;
+          for (i=0; i<n; i+=len) {
+               for (k=0; k<half; k++) {
+                    double wr = cos_tab[k*step];
+                    double wi = sign * sin_tab[k*step];
+                    int u = i+k;
+                    int v = i+k+half;
+                    double xr = re[v]*wr - im[v]*wi;
+                    double xi = re[v]*wi + im[v]*wr;
+                    re[v] = re[u] - xr;
+                    im[v] = im[u] - xi;
+                    re[u] += xr;
+                    im[u] += xi;
+               }
+          }
+     }
+}
+/* fft() */
+
+
+
+/**
+ * @brief Multiplies polynomials a (na coefficients) and b (nb
+ * coefficients) and writes the na+nb-1 coefficients of the product
+ * to out (which must not overlap a or b).
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+poly_mult(double *out, const double *a, const int na,
+          const double *b, const int nb)
+{
+     double *re = NULL, *im = NULL;
+     const double *cos_tab = NULL, *sin_tab = NULL;
+     int nout = na+nb-1;
+     int n, log2n, i;
+
+     if (na < 1 || nb < 1) {
+          return -1;
+     }
+
+     if (na <= DIRECT_CONV_MAX_LEN || nb <= DIRECT_CONV_MAX_LEN) {
+          int j;
+          memset(out, 0, nout * sizeof(double));
+          for (i=0; i<na; i++) {
+               for (j=0; j<nb; j++) {
+                    out[i+j] += a[i] * b[j];
+               }
+          }
+          return 0;
+     }
+
+     for (n=1, log2n=0; n<nout; n<<=1, log2n++) {
+          ;
+     }
+     if (twiddle_get(log2n, & cos_tab, & sin_tab)) {
+          return -1;
+     }
+
+     if (NULL == (re = calloc(n, sizeof(double)))
+         || NULL == (im = calloc(n, sizeof(double)))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          free(re);
+          return -1;
+     }
+
+     /* both real inputs in one complex transform: z = a + i*b */
+     memcpy(re, a, na * sizeof(double));
+     memcpy(im, b, nb * sizeof(double));
+     fft(re, im, n, -1, cos_tab, sin_tab);
+
+     /* A_k = (Z_k + conj(Z_n-k))/2, B_k = (Z_k - conj(Z_n-k))/2i,
+      * product A_k*B_k computed for k and n-k at the same time */
+     for (i=0; i<=n/2; i++) {
+          int j = (n-i) & (n-1);
+          double ar = 0.5*(re[i] + re[j]);
+          double ai = 0.5*(im[i] - im[j]);
+          double br = 0.5*(im[i] + im[j]);
+          double bi = -0.5*(re[i] - re[j]);
+          double pr = ar*br - ai*bi;
+          double pi = ar*bi + ai*br;
+          /* product at n-k is the conjugate (real output) */
+          re[i] = pr;
+          im[i] = pi;
+          re[j] = pr;
+          im[j] = -pi;
+     }
+
+     fft(re, im, n, +1, cos_tab, sin_tab);
+     for (i=0; i<nout; i++) {
+          out[i] = re[i] / n;
+     }
+
+     free(re);
+     free(im);
+     return 0;
+}
+/* poly_mult() */
@@ -43,6 +43,16 @@
 
 static float g_qual2prob[256];
 
+/* fill g_qual2prob. called lazily by kpa_ext_glocal(), but needs
+ * to be called explicitly before running it from several threads */
+void kpa_ext_init(void)
+{
+	int i;
+	if (g_qual2prob[0] != 0) return;
+	for (i = 255; i >= 0; --i) /* [0] last: it's the init marker */
+		g_qual2prob[i] = pow(10, -i/10.);
+}
+
 #define set_u(u, b, i, k) { int x=(i)-(b); x=x>0?x:0; (u)=((k)-x+1)*3; }
 
 kpa_ext_par_t kpa_ext_par_def = { 0.001, 0.1, 10 };
@@ -115,9 +125,7 @@ int kpa_ext_glocal(const uint8_t *_ref, int l_ref, const uint8_t *_query, int l_
 	s = calloc(l_query+2, sizeof(double)); // s[] is the scaling factor to avoid underflow
 	// initialize qual
 	_qual = calloc(l_query, sizeof(float));
-	if (g_qual2prob[0] == 0)
-		for (i = 0; i < 256; ++i)
-			g_qual2prob[i] = pow(10, -i/10.);
+	if (g_qual2prob[0] == 0) kpa_ext_init();
 	for (i = 0; i < l_query; ++i) _qual[i] = g_qual2prob[iqual? iqual[i] : 30];
 	qual = _qual - 1;
 	// initialize transition probability
@@ -37,6 +37,7 @@ typedef struct {
 extern "C" {
 #endif
 
+	void kpa_ext_init(void);
 	int kpa_ext_glocal(const uint8_t *_ref, int l_ref, const uint8_t *_query, int l_query, 
     const uint8_t *iqual, const kpa_ext_par_t *c, int *state, uint8_t *q, double **pd, 
     int *ret_bw);
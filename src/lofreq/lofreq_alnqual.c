@@ -28,8 +28,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include "htslib/faidx.h"
-#include "sam.h"
+#include "refpack.h"
+#include "htslib/sam.h"
 
 #include "utils.h"
 #include "bam_md_ext.h"
@@ -70,8 +70,9 @@ static void usage()
 int main_alnqual(int argc, char *argv[])
 {
      int c, tid = -2, ret, len, is_bam_out, is_sam_in, is_uncompressed;
-     samfile_t *fp, *fpout = 0;
-     faidx_t *fai;
+     samFile *fp, *fpout = 0;
+     bam_hdr_t *hdr;
+     ref_file_t *ref_file;
      char *ref = 0, mode_w[8], mode_r[8];
      bam1_t *b;
      int baq_flag = 1;
@@ -104,13 +105,11 @@ int main_alnqual(int argc, char *argv[])
           return 1;
      }
 
-     if (!is_sam_in) strcat(mode_r, "b");
+     /* input format is detected by sam_open() */
      if (is_bam_out) {
           strcat(mode_w, "b");
-     } else{
-          strcat(mode_w, "h");
      }
-     if (is_uncompressed) strcat(mode_w, "u");
+     if (is_uncompressed) strcat(mode_w, "0");
      
      if (redo) {
           if (baq_flag) {
@@ -126,44 +125,52 @@ int main_alnqual(int argc, char *argv[])
           return 1;
      }
 
-     fp = samopen(argv[optind], mode_r, 0);
+     fp = sam_open(argv[optind], mode_r);
      if (fp == 0) return 1;
-     if (is_sam_in && (fp->header == 0 || fp->header->n_targets == 0)) {
+     hdr = sam_hdr_read(fp);
+     if (hdr == 0 || (is_sam_in && hdr->n_targets == 0)) {
           fprintf(stderr, "FATAL: %s: input SAM does not have header\n", MYNAME);
           return 1;
      }
-     fpout = samopen("-", mode_w, fp->header);
+     fpout = sam_open("-", mode_w);
+     if (fpout == 0 || sam_hdr_write(fpout, hdr) != 0) {
+          fprintf(stderr, "FATAL: %s: couldn't write header to stdout\n", MYNAME);
+          return 1;
+     }
 
-     fai = fai_load(argv[optind+1]);
-     if (! fai) {
-          fprintf(stderr, "FATAL: %s: failed to load fai index\n", MYNAME);
+     ref_file = ref_file_load(argv[optind+1]);
+     if (! ref_file) {
+          fprintf(stderr, "FATAL: %s: failed to load reference\n", MYNAME);
           return 1;
      }
 
      b = bam_init1();
-     while ((ret = samread(fp, b)) >= 0) {
+     while ((ret = sam_read1(fp, hdr, b)) >= 0) {
           if (b->core.tid >= 0) {
                if (tid != b->core.tid) {
                     free(ref);
-                    ref = fai_fetch(fai, fp->header->target_name[b->core.tid], &len);
-                    strtoupper(ref);/* safeguard */
+                    ref = ref_file_fetch(ref_file, hdr->target_name[b->core.tid], &len);
                     tid = b->core.tid;
                     if (ref == 0) {
                          fprintf(stderr, "FATAL: %s failed to find sequence '%s' in the reference.\n",
-                                   MYNAME, fp->header->target_name[tid]);
+                                   MYNAME, hdr->target_name[tid]);
                          return 1;
                     }
                }
                
                bam_prob_realn_core_ext(b, ref, baq_flag, ext_baq, idaq_flag);
           }
-          samwrite(fpout, b);
+          if (sam_write1(fpout, hdr, b) < 0) {
+               fprintf(stderr, "FATAL: %s: writing to stdout failed\n", MYNAME);
+               return 1;
+          }
      }
      bam_destroy1(b);
      
      free(ref);
-     fai_destroy(fai);
-     samclose(fp); 
-     samclose(fpout);
+     ref_file_destroy(ref_file);
+     bam_hdr_destroy(hdr);
+     sam_close(fp);
+     sam_close(fpout);
      return 0;
 }
@@ -41,7 +41,9 @@
 /* from bedidx.c */
 void *bed_read(const char *fn);
 void bed_destroy(void *_h);
-int bed_overlap(const void *_h, const char *chr, int beg, int end);
+void *bed_cursor_new(const void *_h);
+void bed_cursor_destroy(void *_c);
+int bed_cursor_overlap(void *_c, int tid, const char *chr, int beg, int end);
 
 /* lofreq includes */
 #include "log.h"
@@ -64,6 +66,7 @@ typedef struct {
      char *fa;
      faidx_t *fai;
      void *bed;
+     void *bed_cursor; /* overlap with bed for sorted reads */
      int samflags_on;
      int samflags_off;
      FILE *out;
@@ -100,9 +103,9 @@ typedef struct {
 /* adopted from sam_view.c:__g_skip_aln */
 static inline int 
 skip_aln(const bam_header_t *h, const bam1_t *b,
-         const int min_mq, const int flag_on, const int flag_off, void *bed)
+         const int min_mq, const int flag_on, const int flag_off, void *bed_cursor)
 {
-     if (bed && b->core.tid >= 0 && !bed_overlap(bed, h->target_name[b->core.tid], b->core.pos, bam_calend(&b->core, bam1_cigar(b)))) {
+     if (bed_cursor && b->core.tid >= 0 && !bed_cursor_overlap(bed_cursor, b->core.tid, h->target_name[b->core.tid], b->core.pos, bam_calend(&b->core, bam1_cigar(b)))) {
           /*fprintf(stderr, "Skipping because of bed: h->target_name[b->core.tid=%d] = %s; b->core.pos = %d\n", b->core.tid, h->target_name[b->core.tid], b->core.pos);*/
           return 1;
      }
@@ -213,7 +216,7 @@ bamstats(samfile_t *sam, bamstats_conf_t *bamstats_conf)
           int ref_len = -1;
           if (skip_aln(sam->header, b, bamstats_conf->min_mq, 
                        bamstats_conf->samflags_on, bamstats_conf->samflags_off,
-                       bamstats_conf->bed)) {
+                       bamstats_conf->bed_cursor)) {
                num_ign_reads += 1;
                continue;
           }
@@ -454,6 +457,11 @@ main_bamstats(int argc, char *argv[])
                rc = 1;
                goto free_and_exit;
           }
+          if (NULL == (bamstats_conf.bed_cursor = bed_cursor_new(bamstats_conf.bed))) {
+               fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                       __FILE__, __FUNCTION__, __LINE__);
+               exit(1);
+          }
      }
 
 
@@ -478,6 +486,7 @@ free_and_exit:
 
      free(bedfile);
      if (bamstats_conf.bed) {
+          bed_cursor_destroy(bamstats_conf.bed_cursor);
           bed_destroy(bamstats_conf.bed);
      }
 
@@ -46,10 +46,11 @@
 #include <float.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include <pthread.h>
 
-/* libbam includes */
+/* htslib includes */
 #include "htslib/faidx.h"
-#include "sam.h"
+#include "htslib/sam.h"
 #include "htslib/kstring.h"
 
 /* from bedidx.c */
@@ -62,10 +63,13 @@ int bed_overlap(const void *_h, const char *chr, int beg, int end);
 /* lofreq includes */
 #include "snpcaller.h"
 #include "vcf.h"
+#include "varspool.h"
+#include "lofreq_filter.h"
 #include "fet.h"
 #include "utils.h"
 #include "log.h"
 #include "plp.h"
+#include "kprobaln_ext.h"
 #include "defaults.h"
 
 #if 1
@@ -75,12 +79,9 @@ int bed_overlap(const void *_h, const char *chr, int beg, int end);
 #endif
 
 
-#define BUF_SIZE 1<<16
-
-
 /* number of tests performed (CONSVAR doesn't count). for downstream
  * multiple testing correction. corresponds to bonf if bonf_dynamic is
- * true. */
+ * true. updated atomically since --threads workers share them. */
 long long int num_snv_tests = 0;
 long long int num_indel_tests = 0;
 /* FIXME extend to keep some more stats, e.g. num_pos_with_cov etc */
@@ -90,8 +91,9 @@ long int indel_calls_wo_idaq = 0;
 
 /* variant reporter to be used for all types */
 void
-report_var(vcf_file_t *vcf_file, const plp_col_t *p, const char *ref,
+report_var(varcall_conf_t *conf, const plp_col_t *p, const char *ref,
            const char *alt, const float af, const int qual,
+           const long double pvalue,
            const int is_indel, const int is_consvar,
            const dp4_counts_t *dp4)
 {
@@ -104,7 +106,7 @@ report_var(vcf_file_t *vcf_file, const plp_col_t *p, const char *ref,
      var->pos = p->pos;
 
      if (is_indel && ! p->has_indel_aqs) {
-          indel_calls_wo_idaq += 1;
+          __sync_fetch_and_add(& indel_calls_wo_idaq, 1);
      }
      /* var->id = NA */
      var->ref = strdup(ref);
@@ -129,8 +131,17 @@ report_var(vcf_file_t *vcf_file, const plp_col_t *p, const char *ref,
      }
      vcf_var_sprintf_info(var, is_indel? p->coverage_plp - p->num_tails : p->coverage_plp,
                           af, sb_qual, dp4, is_indel, p->hrun, is_consvar);
+     var->typed_info.pvalue = pvalue;
 
-     vcf_write_var(vcf_file, var);
+     if (conf->spool) {
+          if (var_spool_add(conf->spool, var)) {
+               LOG_FATAL("%s\n", "Couldn't spool variant");
+               exit(1);
+          }
+     } else if (vcf_write_var(& conf->vcf_out, var)) {
+          LOG_FATAL("Couldn't write to %s\n", conf->vcf_out.path);
+          exit(1);
+     }
      vcf_free_var(&var);
 }
 /* report_var() */
@@ -163,8 +174,8 @@ report_cons_sub(const plp_col_t *p, varcall_conf_t *conf){
 
      LOG_DEBUG("cons var snp: %s %d %c>%s\n",
                p->target, p->pos+1, p->ref_base, p->cons_base);
-     report_var(& conf->vcf_out, p, report_ref, p->cons_base,
-                af, qual, is_indel, is_consvar, &dp4);
+     report_var(conf, p, report_ref, p->cons_base,
+                af, qual, -1, is_indel, is_consvar, &dp4);
 }
 
 /* report consensus insertion */
@@ -175,7 +186,7 @@ report_cons_ins(const plp_col_t *p, varcall_conf_t *conf) {
      const int is_consvar = 1;
      const int qual = -1;
      char cons_ins_key[MAX_INDELSIZE];
-     ins_event *it_ins = NULL;
+     const indel_event_t *it_ins = NULL;
      char report_ins_ref[2];
      char report_ins_alt[MAX_INDELSIZE];
      int ins_length;
@@ -184,7 +195,7 @@ report_cons_ins(const plp_col_t *p, varcall_conf_t *conf) {
      dp4_counts_t dp4;
 
      strncpy(cons_ins_key, p->cons_base+1, MAX_INDELSIZE-1);
-     it_ins = find_ins_sequence(&p->ins_event_counts, cons_ins_key);
+     it_ins = indel_table_find(& p->ins_events, cons_ins_key);
 
      ins_length = strlen(cons_ins_key);
      report_ins_ref[0] = report_ins_alt[0] = p->ref_base;
@@ -202,8 +213,8 @@ report_cons_ins(const plp_col_t *p, varcall_conf_t *conf) {
 
      LOG_DEBUG("Consensus insertion: %s %d %s>%s\n",
                p->target, p->pos+1, report_ins_ref, report_ins_alt);
-     report_var(& conf->vcf_out, p, report_ins_ref, report_ins_alt,
-                af, qual, is_indel, is_consvar, &dp4);
+     report_var(conf, p, report_ins_ref, report_ins_alt,
+                af, qual, -1, is_indel, is_consvar, &dp4);
      return;
 }
 
@@ -218,13 +229,13 @@ report_cons_del(const plp_col_t *p, varcall_conf_t *conf) {
      char report_del_alt[2];
      int j;
      char cons_del_key[MAX_INDELSIZE];
-     del_event *it_del = NULL;
+     const indel_event_t *it_del = NULL;
      int del_length;
      dp4_counts_t dp4;
      float af;
 
      strncpy(cons_del_key, p->cons_base+1, MAX_INDELSIZE-1);
-     it_del = find_del_sequence(&p->del_event_counts, cons_del_key);
+     it_del = indel_table_find(& p->del_events, cons_del_key);
 
      del_length = strlen(cons_del_key);
      report_del_ref[0] = report_del_alt[0] = p->ref_base;
@@ -242,8 +253,8 @@ report_cons_del(const plp_col_t *p, varcall_conf_t *conf) {
 
      LOG_DEBUG("Consensus deletion: %s %d %s>%s\n",
                p->target, p->pos+1, report_del_ref, report_del_alt);
-     report_var(&conf->vcf_out, p, report_del_ref, report_del_alt,
-                af, qual, is_indel, is_consvar, &dp4);
+     report_var(conf, p, report_del_ref, report_del_alt,
+                af, qual, -1, is_indel, is_consvar, &dp4);
 
 }
 #endif
@@ -252,7 +263,7 @@ report_cons_del(const plp_col_t *p, varcall_conf_t *conf) {
 /* converts del event to reference and alt string representation.
    ref and alt are allocated here and must be freed by user */
 void
-del_to_str(const del_event *it, const char refbase, 
+del_to_str(const indel_event_t *it, const char refbase, 
            char **refstr, char **altstr)
 {
      int j;
@@ -278,7 +289,7 @@ del_to_str(const del_event *it, const char refbase,
 /* converts ins event to reference and alt string representation.
    ref and alt are allocated here and must be freed by user */
 void
-ins_to_str(const ins_event *it, const char refbase, 
+ins_to_str(const indel_event_t *it, const char refbase, 
            char **refstr, char **altstr)
 {
      int j;
@@ -300,28 +311,12 @@ ins_to_str(const ins_event *it, const char refbase,
      (*refstr)[1] = (*altstr)[j+1] = '\0';     
 }
 
+/* reports insertion it if its pvalue is significant. pvalue
+ * computed by call_indel_events() */
 int
-call_alt_ins(const plp_col_t *p, double *bi_err_probs, int bi_num_err_probs,
-             varcall_conf_t *conf, ins_event *it) {
-
-     int ins_counts[3];
-     long double bi_pvalues[3];
-
-     // prep for snpcaller
-     ins_counts[0] = it->count;
-     ins_counts[1] = ins_counts[2] = 0;
-     LOG_DEBUG("%s %d: passing down %d quals with noncons_ins_counts"
-               "(%d, %d, %d) to snpcaller()\n", p->target, p->pos+1,
-               bi_num_err_probs, ins_counts[0], ins_counts[1], ins_counts[2]);
-     // compute p-value for insertion
-     if (snpcaller(bi_pvalues, bi_err_probs, bi_num_err_probs, ins_counts,
-                   conf->bonf_indel, conf->sig)) {
-          fprintf(stderr, "FATAL: snpcaller() failed at %s:%s():%d\n",
-                  __FILE__, __FUNCTION__, __LINE__);
-          return 1;
-     }
-     // see if there was an insertion
-     long double bi_pvalue = bi_pvalues[0];
+call_alt_ins(const plp_col_t *p, const long double bi_pvalue,
+             varcall_conf_t *conf, const indel_event_t *it) {
+
      if (bi_pvalue*conf->bonf_indel < conf->sig) {
           char *report_ins_ref;
           char *report_ins_alt;
@@ -341,8 +336,8 @@ call_alt_ins(const plp_col_t *p, double *bi_err_probs, int bi_num_err_probs,
           LOG_DEBUG("Low freq insertion: %s %d %s>%s pv-prob:%Lg;pv-qual:%d\n",
                     p->target, p->pos+1, report_ins_ref, report_ins_alt,
                     bi_pvalue, qual);
-          report_var(&conf->vcf_out, p, report_ins_ref, report_ins_alt,
-                     af, qual, is_indel, is_consvar, &dp4);
+          report_var(conf, p, report_ins_ref, report_ins_alt,
+                     af, qual, bi_pvalue, is_indel, is_consvar, &dp4);
 
           free(report_ins_ref); free(report_ins_alt);
      } 
@@ -357,36 +352,11 @@ else if (debug) {
      return 0;
 }
 
-int call_alt_del(const plp_col_t *p, double *bd_err_probs, int bd_num_err_probs,
-                 varcall_conf_t *conf, del_event *it) {
+/* reports deletion it if its pvalue is significant. pvalue computed
+ * by call_indel_events() */
+int call_alt_del(const plp_col_t *p, const long double bd_pvalue,
+                 varcall_conf_t *conf, const indel_event_t *it) {
 
-     int del_counts[3];
-     long double bd_pvalues[3];
-
-     /* prep for snpcaller */
-     del_counts[0] = it->count;
-     del_counts[1] = del_counts[2] = 0;
-    
-#if 0 
-     int k;
-     for (k = 0; k < bd_num_err_probs; k++) {
-          LOG_DEBUG("bd_err_prob: %lg\n", bd_err_probs[k]);
-     }
-#endif
-     
-     LOG_DEBUG("%s %d: passing down %d quals with noncons_del_counts"
-               "(%d, %d, %d) to snpcaller()\n", p->target, p->pos+1,
-               bd_num_err_probs, del_counts[0], del_counts[1], del_counts[2]);
-
-     /* snpcaller for deletion */
-     if (snpcaller(bd_pvalues, bd_err_probs, bd_num_err_probs, del_counts,
-                   conf->bonf_indel, conf->sig)) {
-          fprintf(stderr, "FATAL: snpcaller() failed at %s:%s():%d\n",
-                  __FILE__, __FUNCTION__, __LINE__);
-          return 1;
-     }
-     /* compute p-value deletion */
-     long double bd_pvalue = bd_pvalues[0];
      if (bd_pvalue*conf->bonf_indel < conf->sig) {
           const int is_indel = 1;
           const int is_consvar = 0;
@@ -407,8 +377,8 @@ int call_alt_del(const plp_col_t *p, double *bd_err_probs, int bd_num_err_probs,
           LOG_DEBUG("Low freq deletion: %s %d %s>%s pv-prob:%Lg;pv-qual:%d\n",
                     p->target, p->pos+1, report_del_ref, report_del_alt,
                     bd_pvalue, qual);
-          report_var(&conf->vcf_out, p, report_del_ref, report_del_alt,
-                     af, qual, is_indel, is_consvar, &dp4);
+          report_var(conf, p, report_del_ref, report_del_alt,
+                     af, qual, bd_pvalue, is_indel, is_consvar, &dp4);
           free(report_del_ref);
           free(report_del_alt);
      } 
@@ -461,7 +431,7 @@ plp_summary(const plp_col_t *plp_col, void* confp)
                X = 4;/* bq, baq, mq, sq */
           }
           /* assuming we have base quals for all */
-          if (! plp_col->base_quals[i].n) {
+          if (! plp_col->quals[i].n) {
                continue;
           }
           for (x=0; x<X; x++) {
@@ -469,16 +439,16 @@ plp_summary(const plp_col_t *plp_col, void* confp)
                int nt = bam_nt4_rev_table[i];
                fprintf(stream, "  %c\t%s =\t", nt, title[x]);
                /* assuming we have base quals for all */
-               for (j=0; j<plp_col->base_quals[i].n; j++) {
+               for (j=0; j<plp_col->quals[i].n; j++) {
                     int q = -1;
                     if (x==0) {
-                         q = plp_col->base_quals[i].data[j];
+                         q = plp_col->quals[i].bq[j];
                     } else if (x==1 && conf->flag & VARCALL_USE_BAQ) {
-                         q = plp_col->baq_quals[i].data[j];
+                         q = PLP_QUAL_TO_INT(plp_col->quals[i].baq[j]);
                     } else if (x==2) {
-                         q = plp_col->map_quals[i].data[j];
+                         q = plp_col->quals[i].mq[j];
                     } else if (x==3) {
-                         q = plp_col->source_quals[i].data[j];
+                         q = PLP_QUAL_TO_INT(plp_col->quals[i].sq[j]);
                     }
                     fprintf(stream, " %d", q);
                }
@@ -491,11 +461,10 @@ plp_summary(const plp_col_t *plp_col, void* confp)
      {
           char *types = "+-"; char *t;
           for (t=types; *t!='\0'; t++) {
-               int idq, aq, mq, sq, i;
+               int idq, aq, mq, sq, i, j;
                const int_varray_t *id_quals = NULL;
                const int_varray_t *id_mquals = NULL;
-               ins_event *ins_it, *ins_it_tmp;
-               del_event *del_it, *del_it_tmp;
+               const indel_table_t *events = NULL;
 
                /* non-indel qualities first 
                 */
@@ -504,11 +473,13 @@ plp_summary(const plp_col_t *plp_col, void* confp)
                       plp_col->num_ins, plp_col->ins_quals.n);*/
                     id_quals = & plp_col->ins_quals;
                     id_mquals = & plp_col->ins_map_quals;
+                    events = & plp_col->ins_events;
                } else if (*t=='-') {
                     /*fprintf(stream, "  DEL events & (non-del) qualities: %d & %lu\n", 
                       plp_col->num_dels, plp_col->del_quals.n);*/
                     id_quals = & plp_col->del_quals;
                     id_mquals = & plp_col->del_map_quals;
+                    events = & plp_col->del_events;
                } else {
                     LOG_FATAL("%s\n", "Should never get here");
                     exit(1);
@@ -528,68 +499,36 @@ plp_summary(const plp_col_t *plp_col, void* confp)
 
                /* now the actual indels
                 */
-               if (*t=='+') {
-                    /* WARN copy below for dels */
-                    HASH_ITER(hh_ins, plp_col->ins_event_counts, ins_it, ins_it_tmp) {
-                         fprintf(stream, "  %c%s\tIQ =\t", *t, ins_it->key);
-                         for (i = 0; i < ins_it->ins_quals.n; i++) {
-                              idq = ins_it->ins_quals.data[i];
-                              fprintf(stream, " %d", idq);
-                         }
-                         fprintf(stream, "\n");
-                         
-                         fprintf(stream, "  %c%s\tMQ =\t", *t,  ins_it->key);
-                         for (i = 0; i < ins_it->ins_quals.n; i++) {
-                              mq = ins_it->ins_map_quals.data[i];
-                              fprintf(stream, " %d", mq);
-                         }
-                         fprintf(stream, "\n");
-                         
-                         fprintf(stream, "  %c%s\tAQ =\t",  *t, ins_it->key);
-                         for (i = 0; i < ins_it->ins_quals.n; i++) {
-                              aq = ins_it->ins_aln_quals.data[i];
-                              fprintf(stream, " %d", aq);
-                         }
-                         fprintf(stream, "\n");
-                         
-                         fprintf(stream, "  %c%s\tSQ =\t", *t, ins_it->key);
-                         for (i = 0; i < ins_it->ins_quals.n; i++) {
-                              sq = ins_it->ins_source_quals.data[i];
-                              fprintf(stream, " %d", sq);
-                         }
-                         fprintf(stream, "\n");
+               for (j=0; j<events->n; j++) {
+                    const indel_event_t *it = & events->events[j];
+                    /* labels kept as before: IQ for insertions, IDQ for deletions */
+                    fprintf(stream, "  %c%s\t%s =\t", *t, it->key, *t=='+' ? "IQ" : "IDQ");
+                    for (i = 0; i < it->quals.n; i++) {
+                         idq = PLP_QUAL_TO_INT(it->quals.bq[i]);
+                         fprintf(stream, " %d", idq);
                     }
-               } else if (*t=='-') {
-                    /* WARN copy above for dels */
-                    HASH_ITER(hh_del, plp_col->del_event_counts, del_it, del_it_tmp) {
-                         fprintf(stream, "  %c%s\tIDQ =\t", *t, del_it->key);
-                         for (i = 0; i < del_it->del_quals.n; i++) {
-                              idq = del_it->del_quals.data[i];
-                              fprintf(stream, " %d", idq);
-                         }
-                         fprintf(stream, "\n");
-                         
-                         fprintf(stream, "  %c%s\tMQ =\t", *t,  del_it->key);
-                         for (i = 0; i < del_it->del_quals.n; i++) {
-                              mq = del_it->del_map_quals.data[i];
-                              fprintf(stream, " %d", mq);
-                         }
-                         fprintf(stream, "\n");
-                         
-                         fprintf(stream, "  %c%s\tAQ =\t",  *t, del_it->key);
-                         for (i = 0; i < del_it->del_quals.n; i++) {
-                              aq = del_it->del_aln_quals.data[i];
-                              fprintf(stream, " %d", aq);
-                         }
-                         fprintf(stream, "\n");
-                         
-                         fprintf(stream, "  %c%s\tSQ =\t", *t, del_it->key);
-                         for (i = 0; i < del_it->del_quals.n; i++) {
-                              sq = del_it->del_source_quals.data[i];
-                              fprintf(stream, " %d", sq);
-                         }
-                         fprintf(stream, "\n");
-                    }                  
+                    fprintf(stream, "\n");
+
+                    fprintf(stream, "  %c%s\tMQ =\t", *t,  it->key);
+                    for (i = 0; i < it->quals.n; i++) {
+                         mq = it->quals.mq[i];
+                         fprintf(stream, " %d", mq);
+                    }
+                    fprintf(stream, "\n");
+
+                    fprintf(stream, "  %c%s\tAQ =\t",  *t, it->key);
+                    for (i = 0; i < it->quals.n; i++) {
+                         aq = PLP_QUAL_TO_INT(it->quals.baq[i]);
+                         fprintf(stream, " %d", aq);
+                    }
+                    fprintf(stream, "\n");
+
+                    fprintf(stream, "  %c%s\tSQ =\t", *t, it->key);
+                    for (i = 0; i < it->quals.n; i++) {
+                         sq = PLP_QUAL_TO_INT(it->quals.sq[i]);
+                         fprintf(stream, " %d", sq);
+                    }
+                    fprintf(stream, "\n");
                }
           }
      }
@@ -613,12 +552,106 @@ warn_old_fai(const char *fa)
 }
 
 
+/* tests all insertion (is_del=0) or deletion events at a column and
+ * reports the significant ones. the error probabilities are built and
+ * sorted once per column and only patched per event (see
+ * indel_errprobs_init()). if alignment qualities are not used, all
+ * events share one poissbin() run. returns non-zero on error.
+ */
+static int
+call_indel_events(const plp_col_t *p, varcall_conf_t *conf, const int is_del,
+                  const int ign_indels[NUM_NT4])
+{
+     const indel_table_t *events = is_del ? & p->del_events : & p->ins_events;
+     indel_errprobs_t ep;
+     long double *pvalues = NULL;
+     int *counts = NULL;
+     int rc = 0;
+     int i;
+
+     if (! events->n) {
+          return 0;
+     }
+     if (indel_errprobs_init(&ep, p, conf, is_del)) {
+          return 1;
+     }
+     if (NULL == (pvalues = malloc(events->n * sizeof(long double)))
+         || NULL == (counts = malloc(events->n * sizeof(int)))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          rc = 1;
+          goto free_and_exit;
+     }
+
+     /* count 0: not tested */
+     for (i=0; i<events->n; i++) {
+          const indel_event_t *it = & events->events[i];
+          if (strlen(it->key)==1 && ign_indels[bam_nt4_table[(int)it->key[0]]]) {
+               counts[i] = 0;
+          } else {
+               counts[i] = it->count;
+          }
+     }
+
+     if (! ep.use_aq) {
+          /* one vector for all: compute all pvalues at once. the
+           * first event tested gets the smallest bonferroni factor,
+           * which is what snpcaller_counts() needs for pruning */
+          const long long int bonf = conf->bonf_indel + (conf->bonf_dynamic ? 1 : 0);
+          LOG_DEBUG("%s %d: passing down %d quals and %d %s counts to snpcaller_counts()\n",
+                    p->target, p->pos+1, ep.num_base, events->n, is_del ? "del" : "ins");
+          if (snpcaller_counts(pvalues, ep.base, ep.num_base, counts, events->n,
+                               bonf, conf->sig)) {
+               fprintf(stderr, "FATAL: snpcaller_counts() failed at %s:%s():%d\n",
+                       __FILE__, __FUNCTION__, __LINE__);
+               rc = 1;
+               goto free_and_exit;
+          }
+     }
+
+     for (i=0; i<events->n; i++) {
+          const indel_event_t *it = & events->events[i];
+          if (! counts[i]) {
+               continue;
+          }
+          if (conf->bonf_dynamic) {
+               conf->bonf_indel += 1;
+          }
+          __sync_fetch_and_add(& num_indel_tests, 1);
+
+          if (ep.use_aq) {
+               int num_err_probs;
+               const double *err_probs = indel_errprobs_event(&ep, i, &num_err_probs);
+               LOG_DEBUG("%s %d: passing down %d quals with %s count %d to snpcaller_counts()\n",
+                         p->target, p->pos+1, num_err_probs, is_del ? "del" : "ins", counts[i]);
+               if (snpcaller_counts(&pvalues[i], err_probs, num_err_probs, &counts[i], 1,
+                                    conf->bonf_indel, conf->sig)) {
+                    fprintf(stderr, "FATAL: snpcaller_counts() failed at %s:%s():%d\n",
+                            __FILE__, __FUNCTION__, __LINE__);
+                    rc = 1;
+                    goto free_and_exit;
+               }
+          }
+
+          if (is_del) {
+               call_alt_del(p, pvalues[i], conf, it);
+          } else {
+               call_alt_ins(p, pvalues[i], conf, it);
+          }
+     }
+
+free_and_exit:
+     free(counts);
+     free(pvalues);
+     indel_errprobs_free(&ep);
+     return rc;
+}
+
+
 void 
 call_indels(const plp_col_t *p, varcall_conf_t *conf)
 {
 
-     double *bi_err_probs, *bd_err_probs; /* error probs for indel calling */
-     int bi_num_err_probs, bd_num_err_probs;
      int ign_indels[NUM_NT4] = {0};
 
      if (p->num_non_indels + p->num_ins + p->num_dels < conf->min_cov) {
@@ -646,21 +679,21 @@ call_indels(const plp_col_t *p, varcall_conf_t *conf)
        */
       if (p->num_ins && p->ins_quals.n && p->num_dels && p->del_quals.n) {
            const float max_af = 0.05;
-           ins_event *ins_ev, *ins_ev_tmp;
-           del_event *del_ev, *del_ev_tmp;
            /* counts of observed 1-base indels */
            int ins_dict[NUM_NT4] = {0};
            int del_dict[NUM_NT4] = {0};
            int i;
            const char at[] = "AT\0";
 
-           HASH_ITER(hh_ins, p->ins_event_counts, ins_ev, ins_ev_tmp) {
+           for (i=0; i<p->ins_events.n; i++) {
+                const indel_event_t *ins_ev = & p->ins_events.events[i];
                 /*LOG_FIXME("ins: %s count=%d fw/rv=%d/%d\n", ins_ev->key, ins_ev->count, ins_ev->fw_rv[0], ins_ev->fw_rv[1]);*/
                 if (strlen(ins_ev->key)==1 && strchr(at, ins_ev->key[0])!=NULL) {
                      ins_dict[bam_nt4_table[(int)ins_ev->key[0]]] = ins_ev->count;
                 }
            }
-           HASH_ITER(hh_del, p->del_event_counts, del_ev, del_ev_tmp) {
+           for (i=0; i<p->del_events.n; i++) {
+                const indel_event_t *del_ev = & p->del_events.events[i];
                 /*LOG_FIXME("del: %s count=%d fw/rv=%d/%d\n", del_ev->key, del_ev->count, del_ev->fw_rv[0], del_ev->fw_rv[1]);*/
                 if (strlen(del_ev->key)==1 && strchr(at, del_ev->key[0])!=NULL) {
                      del_dict[bam_nt4_table[(int)del_ev->key[0]]] = del_ev->count;
@@ -680,45 +713,15 @@ call_indels(const plp_col_t *p, varcall_conf_t *conf)
 
       /*if (p->num_ins && p->ins_quals.n) { FIXME check for ins_quals.n breaks if 100% consvar. why was this needed? see also del */
       if (p->num_ins) {
-           ins_event *it, *it_tmp;
-           HASH_ITER(hh_ins, p->ins_event_counts, it, it_tmp) {
-                if (strlen(it->key)==1 && ign_indels[bam_nt4_table[(int)it->key[0]]]) {
-                     continue;
-                }
-                plp_to_ins_errprobs(&bi_err_probs, &bi_num_err_probs,
-                                    p, conf, it->key);
-                qsort(bi_err_probs, bi_num_err_probs, sizeof(double), dbl_cmp);
-                if (conf->bonf_dynamic) {
-                     conf->bonf_indel += 1;
-                }
-                num_indel_tests += 1;
-                if (call_alt_ins(p, bi_err_probs, bi_num_err_probs, conf, it)) {
-                     free(bi_err_probs);
-                     return;
-                }
-                free(bi_err_probs);
+           if (call_indel_events(p, conf, 0, ign_indels)) {
+                return;
            }
       }
 
       /*if (p->num_dels && p->del_quals.n) { FIXME check for del_quals.n breaks if 100% consvar. why was this needed? see also ins */
       if (p->num_dels) {
-           del_event *it, *it_tmp;
-           HASH_ITER(hh_del, p->del_event_counts, it, it_tmp) {
-                if (strlen(it->key)==1 && ign_indels[bam_nt4_table[(int)it->key[0]]]) {
-                     continue;
-                }
-                plp_to_del_errprobs(&bd_err_probs, &bd_num_err_probs,
-                                    p, conf, it->key);
-                qsort(bd_err_probs, bd_num_err_probs, sizeof(double), dbl_cmp);
-                if (conf->bonf_dynamic) {
-                     conf->bonf_indel += 1;
-                }
-                num_indel_tests += 1;
-                if (call_alt_del(p, bd_err_probs, bd_num_err_probs, conf, it)) {
-                     free(bd_err_probs);
-                     return;
-                }
-                free(bd_err_probs);
+           if (call_indel_events(p, conf, 1, ign_indels)) {
+                return;
            }
       }
 }
@@ -779,7 +782,7 @@ call_snvs(const plp_col_t *p, varcall_conf_t *conf)
 
       /* sorting in ascending order should in theory be numerically
        * more stable and also make snpcaller faster */
-      qsort(bc_err_probs, bc_num_err_probs, sizeof(double), dbl_cmp);
+      errprobs_sort(bc_err_probs, bc_num_err_probs);
 
  #ifdef TRACE
       {
@@ -796,7 +799,7 @@ call_snvs(const plp_col_t *p, varcall_conf_t *conf)
                 conf->bonf_subst += NUM_NONCONS_BASES; /* will do one test per non-cons nuc */
            }
       }
-      num_snv_tests += NUM_NONCONS_BASES;
+      __sync_fetch_and_add(& num_snv_tests, NUM_NONCONS_BASES);
 
       LOG_DEBUG("%s %d: passing down %d quals with noncons_counts"
                 " (%d, %d, %d) to snpcaller(num_snv_tests=%lld conf->bonf=%lld, conf->sig=%f)\n", p->target, p->pos+1,
@@ -849,8 +852,8 @@ call_snvs(const plp_col_t *p, varcall_conf_t *conf)
                 dp4.alt_fw = p->fw_counts[alt_nt4];
                 dp4.alt_rv = p->rv_counts[alt_nt4];
 
-                report_var(& conf->vcf_out, p, report_ref, report_alt,
-                           af, PROB_TO_PHREDQUAL(pvalue),
+                report_var(conf, p, report_ref, report_alt,
+                           af, PROB_TO_PHREDQUAL(pvalue), pvalue,
                            is_indel, is_consvar, &dp4);
                 LOG_DEBUG("low freq snp: %s %d %c>%c pv-prob:%Lg;pv-qual:%d"
                           " counts-raw:%d/%d=%.6f counts-filt:%d/%d=%.6f\n",
@@ -927,6 +930,344 @@ call_vars(const plp_col_t *p, void *confp)
 
 
 
+/* --threads support: the input (or the requested region) is split
+ * into chunks which are picked up by worker threads, each running its
+ * own mpileup(). vcf output (or spooled variants) is buffered per
+ * chunk and written in chunk (i.e. genome) order by the main thread as
+ * soon as possible.
+ */
+#define CALL_CHUNKS_PER_THREAD 8
+#define CALL_MIN_CHUNK_SIZE 10000
+#define CALL_MAX_CHUNK_SIZE 5000000
+
+typedef struct {
+     char *reg; /* region string handed down to mpileup() */
+     char *buf; /* buffered vcf output */
+     size_t buf_len;
+     var_spool_t spool; /* used instead of buf if variants are spooled */
+     int done;
+     int rc;
+} call_chunk_t;
+
+typedef struct {
+     call_chunk_t *chunks;
+     int num_chunks;
+     int next_chunk;
+     const char *bam_file;
+     const mplp_conf_t *mplp_conf;
+     const varcall_conf_t *varcall_conf;
+     pthread_mutex_t lock;
+     pthread_cond_t chunk_done;
+} call_workers_t;
+
+
+/* splits bam_file's targets (or only mplp_conf->reg if set) into
+ * chunks, skipping those not overlapping with mplp_conf->bed. returns
+ * number of chunks or -1 on error */
+static int
+call_chunks_new(call_chunk_t **chunks, const char *bam_file,
+                const mplp_conf_t *mplp_conf, const int num_threads)
+{
+     samFile *fp;
+     bam_hdr_t *h;
+     int tid, reg_tid = -1, reg_beg = 0, reg_end = 0;
+     long long int total_len = 0, chunk_size;
+     int num_chunks = 0, max_chunks = 0;
+
+     *chunks = NULL;
+     if (NULL == (fp = sam_open(bam_file, "r"))) {
+          LOG_ERROR("Couldn't open %s\n", bam_file);
+          return -1;
+     }
+     if (mplp_conf->ref_file && mplp_conf->ref_file->fasta) {
+          hts_set_fai_filename(fp, mplp_conf->ref_file->fasta);
+     }
+     if (NULL == (h = sam_hdr_read(fp))) {
+          LOG_ERROR("Couldn't read header of %s\n", bam_file);
+          sam_close(fp);
+          return -1;
+     }
+
+     if (mplp_conf->reg) {
+          const char *name_end = hts_parse_reg(mplp_conf->reg, &reg_beg, &reg_end);
+          if (name_end) {
+               char *name = strndup(mplp_conf->reg, name_end - mplp_conf->reg);
+               reg_tid = bam_name2id(h, name);
+               free(name);
+          }
+          if (reg_tid < 0) {
+               LOG_ERROR("Malformatted region or wrong seqname: %s\n", mplp_conf->reg);
+               bam_hdr_destroy(h);
+               sam_close(fp);
+               return -1;
+          }
+          if (reg_end > h->target_len[reg_tid]) {
+               reg_end = h->target_len[reg_tid];
+          }
+          total_len = reg_end - reg_beg;
+     } else {
+          for (tid=0; tid<h->n_targets; tid++) {
+               total_len += h->target_len[tid];
+          }
+     }
+
+     chunk_size = total_len / (num_threads * CALL_CHUNKS_PER_THREAD);
+     if (chunk_size < CALL_MIN_CHUNK_SIZE) {
+          chunk_size = CALL_MIN_CHUNK_SIZE;
+     } else if (chunk_size > CALL_MAX_CHUNK_SIZE) {
+          chunk_size = CALL_MAX_CHUNK_SIZE;
+     }
+
+     for (tid=0; tid<h->n_targets; tid++) {
+          int beg = 0, end = h->target_len[tid], cbeg;
+          if (reg_tid >= 0) {
+               if (tid != reg_tid) {
+                    continue;
+               }
+               beg = reg_beg;
+               end = reg_end;
+          }
+          for (cbeg=beg; cbeg<end; cbeg+=chunk_size) {
+               int cend = cbeg+chunk_size < end ? cbeg+chunk_size : end;
+               call_chunk_t *c;
+
+               if (mplp_conf->bed && ! bed_overlap(mplp_conf->bed, h->target_name[tid], cbeg, cend)) {
+                    continue;
+               }
+               if (num_chunks == max_chunks) {
+                    max_chunks = max_chunks ? 2*max_chunks : 64;
+                    *chunks = realloc(*chunks, max_chunks * sizeof(call_chunk_t));
+                    if (NULL == *chunks) {
+                         fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                                 __FILE__, __FUNCTION__, __LINE__);
+                         bam_hdr_destroy(h);
+                         sam_close(fp);
+                         return -1;
+                    }
+               }
+               c = & (*chunks)[num_chunks++];
+               memset(c, 0, sizeof(call_chunk_t));
+               /* mpileup() region strings are one-based and end-inclusive */
+               c->reg = malloc(strlen(h->target_name[tid]) + 32);
+               sprintf(c->reg, "%s:%d-%d", h->target_name[tid], cbeg+1, cend);
+          }
+     }
+
+     bam_hdr_destroy(h);
+     sam_close(fp);
+     return num_chunks;
+}
+
+
+static void *
+call_worker(void *arg)
+{
+     call_workers_t *w = (call_workers_t *) arg;
+
+     while (1) {
+          call_chunk_t *chunk;
+          mplp_conf_t mplp_conf;
+          varcall_conf_t varcall_conf;
+          int idx;
+          int rc = 1;
+
+          pthread_mutex_lock(& w->lock);
+          idx = w->next_chunk++;
+          pthread_mutex_unlock(& w->lock);
+          if (idx >= w->num_chunks) {
+               break;
+          }
+          chunk = & w->chunks[idx];
+
+          memcpy(& mplp_conf, w->mplp_conf, sizeof(mplp_conf_t));
+          mplp_conf.reg = chunk->reg;
+          memcpy(& varcall_conf, w->varcall_conf, sizeof(varcall_conf_t));
+          /* dynamic bonf: count from scratch per chunk. this only makes
+           * the early exit during calling less aggressive. the final
+           * bonf is computed from the global test counters and applied
+           * by the filter afterwards */
+          if (varcall_conf.bonf_dynamic) {
+               varcall_conf.bonf_subst = 1;
+               varcall_conf.bonf_indel = 1;
+          }
+          memset(& varcall_conf.vcf_out, 0, sizeof(vcf_file_t));
+          /* binary output can't be assembled from text buffers */
+          if (w->varcall_conf->spool || w->varcall_conf->vcf_out.bin) {
+               /* in memory only. spilled when appended to main spool */
+               if (var_spool_init(& chunk->spool, NULL, 0)) {
+                    LOG_ERROR("Couldn't create variant spool for region %s\n", chunk->reg);
+               } else {
+                    varcall_conf.spool = & chunk->spool;
+                    rc = mpileup(& mplp_conf, &call_vars, (void*) & varcall_conf,
+                                 1, & w->bam_file);
+               }
+          } else {
+               varcall_conf.vcf_out.mode = 'w';
+               varcall_conf.vcf_out.fh = open_memstream(& chunk->buf, & chunk->buf_len);
+               if (NULL == varcall_conf.vcf_out.fh) {
+                    LOG_ERROR("Couldn't create output buffer for region %s\n", chunk->reg);
+               } else {
+                    rc = mpileup(& mplp_conf, &call_vars, (void*) & varcall_conf,
+                                 1, & w->bam_file);
+                    fclose(varcall_conf.vcf_out.fh);
+                    free(varcall_conf.vcf_out.line.s);
+               }
+          }
+
+          pthread_mutex_lock(& w->lock);
+          chunk->rc = rc;
+          chunk->done = 1;
+          pthread_cond_broadcast(& w->chunk_done);
+          pthread_mutex_unlock(& w->lock);
+     }
+     return NULL;
+}
+
+
+/* assigns num threads that can't get a region of their own to a
+ * single mpileup(): BAQ/IDAQ/source quality computation is usually
+ * the bottleneck. if none of these is needed, use them for
+ * decompression instead */
+static void
+assign_helper_threads(mplp_conf_t *mplp_conf, const int num)
+{
+     if (num < 1) {
+          return;
+     }
+     if (mplp_conf->flag & (MPLP_BAQ | MPLP_IDAQ | MPLP_USE_SQ)) {
+          mplp_conf->baq_threads = num;
+     } else {
+          mplp_conf->hts_threads = num;
+     }
+}
+
+
+/* runs call_vars() on bam_file with num_threads threads, writing to
+ * varcall_conf->vcf_out (header has to be written already) or
+ * varcall_conf->spool if set. updates varcall_conf->bonf_* if
+ * dynamic. returns non-zero on error */
+static int
+call_vars_threaded(const char *bam_file, mplp_conf_t *mplp_conf,
+                   varcall_conf_t *varcall_conf, int num_threads)
+{
+     call_workers_t w;
+     pthread_t *threads;
+     int i, num_chunks;
+     int num_spare_threads = 0;
+     int rc = 0;
+
+     num_chunks = call_chunks_new(& w.chunks, bam_file, mplp_conf, num_threads);
+     if (num_chunks < 0) {
+          return 1;
+     }
+     LOG_VERBOSE("Processing %d chunks with %d threads\n", num_chunks, num_threads);
+     if (num_threads > num_chunks) {
+          /* left-over threads help each worker */
+          if (num_chunks) {
+               assign_helper_threads(mplp_conf, num_threads / num_chunks - 1);
+               num_spare_threads = num_threads % num_chunks;
+          }
+          num_threads = num_chunks;
+     }
+     /* if writing directly, only threads not used for calling may
+      * compress output (spooled output is compressed after calling
+      * with all threads) */
+     if (! varcall_conf->spool && num_spare_threads > 1 &&
+         vcf_file_set_threads(& varcall_conf->vcf_out, num_spare_threads)) {
+          LOG_WARN("Couldn't use %d threads for compressing %s. Using one\n",
+                   num_spare_threads, varcall_conf->vcf_out.path);
+     }
+
+     /* initialize lazily computed tables before going parallel */
+     init_phred_tables();
+     kpa_ext_init();
+     mplp_conf->ref_cache = ref_cache_new(mplp_conf->ref_file);
+     if (NULL == mplp_conf->ref_cache) {
+          free(w.chunks);
+          return 1;
+     }
+
+     w.num_chunks = num_chunks;
+     w.next_chunk = 0;
+     w.bam_file = bam_file;
+     w.mplp_conf = mplp_conf;
+     w.varcall_conf = varcall_conf;
+     pthread_mutex_init(& w.lock, NULL);
+     pthread_cond_init(& w.chunk_done, NULL);
+
+     threads = calloc(num_threads, sizeof(pthread_t));
+     for (i=0; i<num_threads; i++) {
+          if (pthread_create(& threads[i], NULL, call_worker, & w)) {
+               LOG_FATAL("%s\n", "Couldn't create thread");
+               exit(1);
+          }
+     }
+
+     /* write output in order as soon as chunks are done */
+     for (i=0; i<num_chunks; i++) {
+          call_chunk_t *chunk = & w.chunks[i];
+          pthread_mutex_lock(& w.lock);
+          while (! chunk->done) {
+               pthread_cond_wait(& w.chunk_done, & w.lock);
+          }
+          pthread_mutex_unlock(& w.lock);
+
+          if (chunk->rc) {
+               LOG_ERROR("Processing of region %s failed\n", chunk->reg);
+               rc = chunk->rc;
+          } else if (varcall_conf->spool) {
+               if (var_spool_append(varcall_conf->spool, & chunk->spool)) {
+                    LOG_ERROR("Couldn't spool variants of region %s\n", chunk->reg);
+                    rc = 1;
+               }
+          } else if (varcall_conf->vcf_out.bin) {
+               var_t *var;
+               int spool_rc;
+               if (var_spool_rewind(& chunk->spool)) {
+                    spool_rc = -1;
+               } else {
+                    while (1) {
+                         vcf_new_var(& var);
+                         spool_rc = var_spool_next(& chunk->spool, var);
+                         if (0 == spool_rc && vcf_write_var(& varcall_conf->vcf_out, var)) {
+                              spool_rc = -1;
+                         }
+                         vcf_free_var(& var);
+                         if (spool_rc) {
+                              break;
+                         }
+                    }
+               }
+               if (spool_rc < 0) {
+                    LOG_ERROR("Couldn't write variants of region %s\n", chunk->reg);
+                    rc = 1;
+               }
+          } else if (chunk->buf_len) {
+               vcf_file_write(& varcall_conf->vcf_out, chunk->buf, chunk->buf_len);
+          }
+          var_spool_free(& chunk->spool);
+          free(chunk->buf);
+          free(chunk->reg);
+     }
+
+     for (i=0; i<num_threads; i++) {
+          pthread_join(threads[i], NULL);
+     }
+     free(threads);
+     pthread_cond_destroy(& w.chunk_done);
+     pthread_mutex_destroy(& w.lock);
+     free(w.chunks);
+     ref_cache_destroy(mplp_conf->ref_cache);
+     mplp_conf->ref_cache = NULL;
+
+     if (varcall_conf->bonf_dynamic) {
+          varcall_conf->bonf_subst = num_snv_tests ? num_snv_tests : 1;
+          varcall_conf->bonf_indel = 1 + num_indel_tests;
+     }
+     return rc;
+}
+
+
 static void
 usage(const mplp_conf_t *mplp_conf, const varcall_conf_t *varcall_conf)
 {
@@ -939,7 +1280,7 @@ usage(const mplp_conf_t *mplp_conf, const varcall_conf_t *varcall_conf)
      fprintf(stderr, "       -f | --ref FILE              Indexed reference fasta file (gzip supported) [null]\n");
 
      fprintf(stderr, "- Output:\n");
-     fprintf(stderr, "       -o | --out FILE              Vcf output file [- = stdout]\n");
+     fprintf(stderr, "       -o | --out FILE              Vcf output file [- = stdout; binary if ending in .lfb]\n");
 
      fprintf(stderr, "- Regions:\n");
      fprintf(stderr, "       -r | --region STR            Limit calls to this region (chrom:start-end) [null]\n");
@@ -981,10 +1322,16 @@ usage(const mplp_conf_t *mplp_conf, const varcall_conf_t *varcall_conf)
      fprintf(stderr, "       -C | --min-cov INT           Test only positions having at least this coverage [%d]\n", varcall_conf->min_cov);
      fprintf(stderr, "                                    (note: without --no-default-filter default filters (incl. coverage) kick in after predictions are done)\n");
      fprintf(stderr, "       -d | --max-depth INT         Cap coverage at this depth [%d]\n", mplp_conf->max_depth);
+     fprintf(stderr, "       -t | --threads INT           Number of threads. Input is processed by region in parallel (requires index) [1]\n");
      fprintf(stderr, "            --illumina-1.3          Assume the quality is Illumina-1.3-1.7/ASCII+64 encoded\n");
      fprintf(stderr, "            --use-orphan            Count anomalous read pairs (i.e. where mate is not aligned properly)\n");
      fprintf(stderr, "            --plp-summary-only      No variant calling. Just output pileup summary per column\n");
      fprintf(stderr, "            --no-default-filter     Don't run default 'lofreq filter' automatically after calling variants\n");
+     fprintf(stderr, "            --index-on-the-fly      Build tabix index of bgzipped output while writing it (instead of reading it again afterwards; disables parallel compression)\n");
+     fprintf(stderr, "            --pb-scalar             Use scalar instead of SIMD Poisson-binomial kernel (slower; for validation)\n");
+     fprintf(stderr, "            --pb-no-grouped         Never use quality-grouped Poisson-binomial engine (slower; for validation)\n");
+     fprintf(stderr, "            --pb-no-prescreen       Don't skip columns that provably can't be significant (slower; for validation)\n");
+     fprintf(stderr, "            --pb-no-fft             Never use FFT Poisson-binomial engine for large alt counts (slower; for validation)\n");
      fprintf(stderr, "            --verbose               Be verbose\n");
      fprintf(stderr, "            --debug                 Enable debugging\n");
 }
@@ -1002,18 +1349,25 @@ main_call(int argc, char *argv[])
 
      static int plp_summary_only = 0;
      static int no_default_filter = 0;
+     static int index_on_the_fly = 0;
+     static int pb_scalar = 0;
+     static int pb_no_grouped = 0;
+     static int pb_no_prescreen = 0;
+     static int pb_no_fft = 0;
      static int illumina_1_3 = 0;
      char *bam_file = NULL;
      char *bed_file = NULL;
      char *vcf_out = NULL; /* == - == stdout */
-     char vcf_tmp_template[] = "/tmp/lofreq2-call-dyn-bonf.XXXXXX";
-     char *vcf_tmp_out = NULL; /* write to this file first, then filter */
+     var_spool_t spool; /* variants kept here if they need filtering */
+     int use_spool = 0;
      mplp_conf_t mplp_conf;
      varcall_conf_t varcall_conf;
      /*void (*plp_proc_func)(const plp_col_t*, const varcall_conf_t*);*/
      void (*plp_proc_func)(const plp_col_t*, void*);
      int rc = 0;
      char *ign_vcf = NULL;
+     int num_threads = 1;
+     int num_out_threads; /* for output compression, see vcf_file_set_threads() */
 
 
 /* FIXME add sens test:
@@ -1087,11 +1441,17 @@ for cov in coverage_range:
 
               {"min-cov", required_argument, NULL, 'C'},
               {"max-depth", required_argument, NULL, 'd'},
+              {"threads", required_argument, NULL, 't'},
 
               {"illumina-1.3", no_argument, &illumina_1_3, 1},
               {"use-orphan", no_argument, &use_orphan, 1},
               {"plp-summary-only", no_argument, &plp_summary_only, 1},
               {"no-default-filter", no_argument, &no_default_filter, 1},
+              {"index-on-the-fly", no_argument, &index_on_the_fly, 1},
+              {"pb-scalar", no_argument, &pb_scalar, 1},
+              {"pb-no-grouped", no_argument, &pb_no_grouped, 1},
+              {"pb-no-prescreen", no_argument, &pb_no_prescreen, 1},
+              {"pb-no-fft", no_argument, &pb_no_fft, 1},
               {"verbose", no_argument, &verbose, 1},
               {"debug", no_argument, &debug, 1},
               {"help", no_argument, NULL, 'h'},
@@ -1100,7 +1460,7 @@ for cov in coverage_range:
          };
 
          /* keep in sync with long_opts and usage */
-         static const char *long_opts_str = "r:l:f:o:q:Q:R:j:J:K:DeBAm:M:NsS:T:a:b:C:d:h";
+         static const char *long_opts_str = "r:l:f:o:q:Q:R:j:J:K:DeBAm:M:NsS:T:a:b:C:d:t:h";
          /* getopt_long stores the option index here. */
          int long_opts_index = 0;
          c = getopt_long(argc-1, argv+1, /* skipping 'lofreq', just leaving 'command', i.e. call */
@@ -1127,21 +1487,22 @@ for cov in coverage_range:
                    return 1;
               }
               mplp_conf.fa = strdup(optarg);
-              mplp_conf.fai = fai_load(optarg);
-              if (mplp_conf.fai == 0)  {
+              mplp_conf.ref_file = ref_file_load(optarg);
+              if (mplp_conf.ref_file == 0)  {
                    free(mplp_conf.fa);
                    return 1;
               } else {
                    /* if this was create with GATK (version?) then fai structure is different. 
                       htslib happily parses it anyway but it's member values are all wrong (most
                       telling offset etc). accessing them here for a check is tricky. easiest is
-                      to use API and check whether all length are identical which is another indicator */
-                   faidx_t *fai = mplp_conf.fai;
+                      to use API and check whether all length are identical which is another indicator.
+                      images are built from the fai, so check them as well */
+                   ref_file_t *rf = mplp_conf.ref_file;
                    int i;
                    int all_same_len = 1;
                    int prev_len = -1;
-                   for (i=0; i< faidx_nseq(fai); i++) {
-                        int cur_len = faidx_seq_len(fai, faidx_iseq(fai, i));
+                   for (i=0; i< ref_file_nseq(rf); i++) {
+                        int cur_len = ref_file_seq_len(rf, ref_file_iseq(rf, i));
                         if (i) {
                              if (prev_len != cur_len) {
                                   all_same_len = 0;
@@ -1152,11 +1513,14 @@ for cov in coverage_range:
                    }
                    /* only seen in human cases */
                    if (i>20 && i<200 && all_same_len) {
-                        LOG_FATAL("Fasta index looks weird. Please try reindexing. Exiting...\n");
+                        LOG_FATAL("%s looks weird. Please try reindexing%s. Exiting...\n",
+                                  rf->fai ? "Fasta index" : "Reference image",
+                                  rf->fai ? "" : " and recreating it with lofreq refpack");
                         return 1;
                    }
+                   /* fasta is NULL if only an image was given */
+                   warn_old_fai(rf->fasta);
               }
-              warn_old_fai(mplp_conf.fa);
               break;
 
          case 'o':
@@ -1270,6 +1634,14 @@ for cov in coverage_range:
               mplp_conf.max_depth = atoi(optarg);
               break;
 
+         case 't':
+              num_threads = atoi(optarg);
+              if (num_threads < 1) {
+                   LOG_FATAL("%s\n", "Number of threads must be at least 1");
+                   return 1;
+              }
+              break;
+
          case 'h':
               usage(& mplp_conf, & varcall_conf);
               return 0; /* WARN: not printing defaults if some args where parsed */
@@ -1293,6 +1665,18 @@ for cov in coverage_range:
 
     varcall_conf.no_indels = no_indels;
     varcall_conf.only_indels = only_indels;
+    if (pb_scalar) {
+         pb_engine_flag |= PB_SCALAR_KERNEL;
+    }
+    if (pb_no_grouped) {
+         pb_engine_flag |= PB_NO_GROUPED;
+    }
+    if (pb_no_prescreen) {
+         pb_engine_flag |= PB_NO_PRESCREEN;
+    }
+    if (pb_no_fft) {
+         pb_engine_flag |= PB_NO_FFT;
+    }
 #ifdef DISABLE_INDELS
     varcall_conf.no_indels = 1;
 #endif
@@ -1372,10 +1756,38 @@ for cov in coverage_range:
     }
 
     /* if we don't apply a default filter and bonf is not dynamic then
-     * we can directly write to requested output file. otherwise we
-     * use a tmp file that gets filtered.
+     * we can directly write to requested output file. otherwise
+     * variants are spooled and filtered at the end, when the final
+     * thresholds are known. a spool that gets too big is spilled next
+     * to the output file (or to TMPDIR if writing to stdout).
      */
-    if (no_default_filter && ! varcall_conf.bonf_dynamic) {
+    use_spool = ! plp_summary_only && ! (no_default_filter && ! varcall_conf.bonf_dynamic);
+    if (use_spool) {
+         char *spill_dir = NULL;
+         if (vcf_out && 0 != strcmp(vcf_out, "-")) {
+              const char *slash = strrchr(vcf_out, '/');
+              if (NULL == slash) {
+                   spill_dir = strdup(".");
+              } else if (NULL != (spill_dir = strdup(vcf_out))) {
+                   spill_dir[slash == vcf_out ? 1 : slash-vcf_out] = '\0';
+              }
+              if (NULL == spill_dir) {
+                   fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                           __FILE__, __FUNCTION__, __LINE__);
+                   exit(1);
+              }
+         } else if (getenv("TMPDIR")) {
+              spill_dir = strdup(getenv("TMPDIR"));
+         }
+         if (var_spool_init(& spool, spill_dir, VAR_SPOOL_DEF_MAX_MEM)) {
+              LOG_FATAL("%s\n", "Couldn't create variant spool");
+              free(spill_dir);
+              return 1;
+         }
+         free(spill_dir);
+         varcall_conf.spool = & spool;
+
+    } else if (! plp_summary_only) {
          if (NULL == vcf_out || 0 == strcmp(vcf_out, "-")) {
               if (vcf_file_open(& varcall_conf.vcf_out, "-",
                                 0, 'w')) {
@@ -1388,18 +1800,12 @@ for cov in coverage_range:
                    LOG_ERROR("Couldn't open %s\n", vcf_out);
                    return 1;
               }
-         }
-    } else {
-         vcf_tmp_out = strdup(mktemp(vcf_tmp_template));
-         if (NULL == vcf_tmp_out) {
-              LOG_FATAL("%s\n", "Couldn't create temporary vcf file");
-              return 1;
-         }
-         if (vcf_file_open(& varcall_conf.vcf_out, vcf_tmp_out,
-                           HAS_GZIP_EXT(vcf_tmp_out), 'w')) {
-              LOG_ERROR("Couldn't open %s\n", vcf_tmp_out);
-              free(vcf_tmp_out);
-              return 1;
+              if (index_on_the_fly) {
+                   /* only possible for bgzip output */
+                   (void) vcf_file_index_on_the_fly(& varcall_conf.vcf_out, -1);
+              }
+              /* compression threads are set up in call_vars_threaded(),
+               * since they have to share num_threads with calling */
          }
     }
 
@@ -1416,7 +1822,6 @@ for cov in coverage_range:
          mplp_conf.bed = bed_read(bed_file);
          if (! mplp_conf.bed) {
               LOG_ERROR("Couldn't read %s\n", bed_file);
-              free(vcf_tmp_out);
               return 1;
          }
     }
@@ -1430,9 +1835,8 @@ for cov in coverage_range:
          /* note strtok destroys input i.e. ign_vcf */
          char *f = strtok(ign_vcf, ",");
          while (NULL != f) {
-              if (source_qual_load_ign_vcf(f, mplp_conf.bed)) {
+              if (source_qual_load_ign_vcf(f, mplp_conf.bed, mplp_conf.reg)) {
                    LOG_FATAL("Loading of ignore positions from %s failed.", f);
-                   free(vcf_tmp_out);
                    return 1;
               }
               f = strtok(NULL, " ");
@@ -1445,15 +1849,33 @@ for cov in coverage_range:
 
     } else {
          /* or use PACKAGE_STRING */
-         vcf_write_new_header(& varcall_conf.vcf_out,
-                              mplp_conf.cmdline, mplp_conf.fa);
+         if (! use_spool && vcf_write_new_header(& varcall_conf.vcf_out,
+                                                 mplp_conf.cmdline, mplp_conf.fa)) {
+              LOG_FATAL("Couldn't write to %s\n", varcall_conf.vcf_out.path);
+              return 1;
+         }
          plp_proc_func = &call_vars;
+         /* call_vars() ignores columns without mismatch or indel */
+         mplp_conf.flag |= MPLP_SKIP_REF_COLS;
     }
 
-    rc = mpileup(&mplp_conf, plp_proc_func, (void*)&varcall_conf,
-                 1, (const char **) argv + optind + 1);
+    num_out_threads = num_threads;
+    if (num_threads > 1 && (plp_summary_only || 0 == strcmp(bam_file, "-"))) {
+         /* input can't be split into regions */
+         assign_helper_threads(& mplp_conf, num_threads - 1);
+         num_threads = 1;
+    }
+
+    if (num_threads > 1) {
+         rc = call_vars_threaded(bam_file, &mplp_conf, &varcall_conf, num_threads);
+    } else {
+         rc = mpileup(&mplp_conf, plp_proc_func, (void*)&varcall_conf,
+                      1, (const char **) argv + optind + 1);
+    }
     if (rc) {
-         free(vcf_tmp_out);
+         if (use_spool) {
+              var_spool_free(& spool);
+         }
          return rc;
     }
 
@@ -1462,7 +1884,9 @@ for cov in coverage_range:
                   " Did you forget to indel alignment-quality to your bam-file?\n", indel_calls_wo_idaq);
     }
 
-    vcf_file_close(& varcall_conf.vcf_out);
+    if (! use_spool && ! plp_summary_only) {
+         vcf_file_close(& varcall_conf.vcf_out);
+    }
 
     /* snv calling completed. now filter according to the following rules:
      *  1. no_default_filter and ! dyn
@@ -1480,16 +1904,12 @@ for cov in coverage_range:
          LOG_VERBOSE("%s\n", "No filtering needed or requested: variants already written to final destination");
 
     } else {
-         char cmd[BUF_SIZE];
-         int len;
+         filter_conf_t filter_conf;
+         char *header;
 
-         snprintf(cmd, BUF_SIZE,
-                  "lofreq filter -i %s -o %s",
-                  vcf_tmp_out, NULL==vcf_out ? "-" : vcf_out);
-         len = strlen(cmd);
-
-         if (no_default_filter) {
-              len += sprintf(cmd+len, " %s", "--no-defaults");
+         init_filter_conf(& filter_conf);
+         if (! no_default_filter) {
+              filter_conf_set_defaults(& filter_conf);
          }
 
          if (varcall_conf.bonf_dynamic) {
@@ -1508,23 +1928,38 @@ for cov in coverage_range:
                         indelqual_thresh = 0;
                    }
               }         
-                             
-              len += sprintf(cmd+len,/* appending to str with format. see http://stackoverflow.com/questions/14023024/strcat-for-formatted-strings */
-                             " --snvqual-thresh %d --indelqual-thresh %d",
-                             snvqual_thresh, indelqual_thresh);
+              filter_conf.snvqual_filter.thresh = snvqual_thresh;
+              filter_conf.indelqual_filter.thresh = indelqual_thresh;
          } else {
               LOG_VERBOSE("%s\n", "No SNV/indel-quality filtering needed (already applied during call since bonf was fixed)");
          }
+         LOG_VERBOSE("Filtering %ld spooled variants\n", spool.num_vars);
 
-         LOG_VERBOSE("Executing %s\n", cmd);
-         if (0 != (rc = system(cmd))) {
-              LOG_ERROR("The following command failed: %s\n", cmd);
+         if (NULL == vcf_out) {
+              vcf_out = strdup("-");
+         }
+         if (vcf_file_open(& filter_conf.vcf_out, vcf_out,
+                           HAS_GZIP_EXT(vcf_out), 'w')) {
+              LOG_ERROR("Couldn't open %s\n", vcf_out);
               rc = 1;
-
          } else {
-              /*if (! debug)*/
-              (void) unlink(vcf_tmp_out);
+              if (index_on_the_fly) {
+                   (void) vcf_file_index_on_the_fly(& filter_conf.vcf_out, -1);
+              }
+              /* calling is done, so all threads can compress */
+              if (vcf_file_set_threads(& filter_conf.vcf_out, num_out_threads)) {
+                   LOG_WARN("Couldn't use %d threads for compressing %s. Using one\n",
+                            num_out_threads, vcf_out);
+              }
+              header = vcf_new_header(mplp_conf.cmdline, mplp_conf.fa);
+              if (0 != (rc = filter_spool(& filter_conf, & spool, & header))) {
+                   LOG_ERROR("%s\n", "Filtering of variants failed");
+                   rc = 1;
+              }
+              free(header);
+              vcf_file_close(& filter_conf.vcf_out);
          }
+         var_spool_free(& spool);
     }
 
     if (! plp_summary_only && rc==0) {
@@ -1539,17 +1974,19 @@ for cov in coverage_range:
          LOG_VERBOSE("Number of indel tests performed: %lld\n", num_indel_tests);
          verbose = org_verbose;
     }
+    if (! plp_summary_only) {
+         LOG_VERBOSE("Number of tests skipped by pre-screen (can't be significant): %lld\n", pb_num_prescreened);
+    }
+    LOG_VERBOSE("Number of columns skipped (reference only): %lld\n", plp_num_ref_cols_skipped);
+    LOG_VERBOSE("Peak memory usage (RSS): %ld kB\n", peak_rss_kb());
 
     source_qual_free_ign_vars();
 
-    free(vcf_tmp_out);
     free(vcf_out);
     free(mplp_conf.alnerrprof_file);
     free(mplp_conf.reg);
     free(mplp_conf.fa);
-    if (mplp_conf.fai) {
-         fai_destroy(mplp_conf.fai);
-    }
+    ref_file_destroy(mplp_conf.ref_file);
     free(bed_file);
     if (mplp_conf.bed) {
          bed_destroy(mplp_conf.bed);
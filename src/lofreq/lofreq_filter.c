@@ -39,6 +39,7 @@
 /* lofreq includes */
 #include "lofreq_filter.h"
 #include "vcf.h"
+#include "varspool.h"
 #include "log.h"
 #include "utils.h"
 #include "multtest.h"
@@ -51,66 +52,10 @@
 #define MYNAME PACKAGE
 #endif
 
-#define FILTER_ID_STRSIZE 64
 #define FILTER_STRSIZE 128
 
 #define ALT_STRAND_RATIO 0.85
 
-typedef struct {
-     int min;
-     char id_min[FILTER_ID_STRSIZE];
-     int max;
-     char id_max[FILTER_ID_STRSIZE];
-} dp_filter_t;
-
-typedef struct {
-     float min;
-     char id_min[FILTER_ID_STRSIZE];
-     float max;
-     char id_max[FILTER_ID_STRSIZE];
-} af_filter_t;
-
-typedef struct {
-     int thresh;/* use if > 0; otherwise use multiple testing correction that's if >0 */
-     int mtc_type;/* holm; holmbonf; fdr; none */
-     double alpha;
-     long int ntests;
-     char id[FILTER_ID_STRSIZE];
-     int no_compound; /* otherwise ALT_STRAND_RATIO of var bases have to be on one strand as well */
-     int incl_indels; /* if 1, also apply to indels */
-} sb_filter_t;
-
-typedef struct {
-     int thresh;/* use if > 0; otherwise use multiple testing correction that's if >0 */
-     int mtc_type;/* holm; holmbonf; fdr; none */
-     double alpha;
-     long int ntests;
-     char id[FILTER_ID_STRSIZE];
-} snvqual_filter_t;
-
-typedef struct {
-     int thresh;/* use if > 0; otherwise use multiple testing correction that's if >0 */
-     int mtc_type;/* holm; holmbonf; fdr; none */
-     double alpha;
-     long int ntests;
-     char id[FILTER_ID_STRSIZE];
-} indelqual_filter_t;
-
-typedef struct {
-     vcf_file_t vcf_in;
-     vcf_file_t vcf_out;
-     int print_only_passed;
-     int only_snvs;
-     int only_indels;
-
-     /* each allowed to be NULL if not set */
-     dp_filter_t dp_filter;
-     af_filter_t af_filter;
-     sb_filter_t sb_filter;
-     snvqual_filter_t snvqual_filter;
-     indelqual_filter_t indelqual_filter;
-} filter_conf_t;
-
 typedef struct mtc_qual_s {
      int is_indel;/* if not, snv assumed */
      int var_qual;
@@ -158,7 +103,7 @@ usage(const filter_conf_t* filter_conf)
      fprintf(stderr,"Options:\n");
      fprintf(stderr, "  Files:\n");
      fprintf(stderr, "  -i | --in FILE                 VCF input file (no streaming supported; gzip supported)\n");
-     fprintf(stderr, "  -o | --out FILE                VCF output file (default: - for stdout; gzip supported).\n");
+     fprintf(stderr, "  -o | --out FILE                VCF output file (default: - for stdout; gzip supported; binary if ending in .lfb).\n");
 
      fprintf(stderr, "  Coverage (DP):\n");
      fprintf(stderr, "  -v | --cov-min INT             Minimum coverage allowed (<1=off)\n");
@@ -198,6 +143,7 @@ usage(const filter_conf_t* filter_conf)
      fprintf(stderr, "       --only-snvs               Keep SNVs only\n");
      fprintf(stderr, "       --print-all               Print all, not just passed variants\n");
      fprintf(stderr, "       --no-defaults             Remove all default filter settings\n");
+     fprintf(stderr, "       --index-on-the-fly        Build tabix index of bgzipped output while writing it (output is then compressed without threads)\n");
      fprintf(stderr, "       --verbose                 Be verbose\n");
      fprintf(stderr, "       --debug                   Enable debugging\n");
      fprintf(stderr, "\nNOTE: without --no-defaults LoFreq's predefined filters are on (run with --verbose to see details)\n");
@@ -238,28 +184,23 @@ int alt_mostly_on_one_strand(var_t *var)
 
 void apply_af_filter(var_t *var, af_filter_t *af_filter)
 {
-     char *af_char = NULL;
      float af;
+     int rc;
 
      if (af_missing_warning_printed) {
           return;
      }
 
      if (af_filter->min > 0 || af_filter->max > 0) {
-          if ( ! vcf_var_has_info_key(&af_char, var, "AF")) {
-               if ( ! af_missing_warning_printed) {
+          if (0 != (rc = vcf_var_get_af(var, &af))) {
+               if (rc > 0) {
                     LOG_WARN("%s\n", "Requested AF filtering failed since AF tag is missing in variant");
-                    af_missing_warning_printed = 1;
-                    return;
+               } else {
+                    LOG_ERROR("%s\n", "Couldn't parse AF. Disabling AF filtering");
                }
-          }
-          af = strtof(af_char, (char **)NULL); /* atof */
-          if (errno==ERANGE) {
-               LOG_ERROR("Couldn't parse EF from af_char %s. Disabling AF filtering", af_char);
                af_missing_warning_printed = 1;
                return;
           }
-          free(af_char);
 
           if (af_filter->min > 0.0 && af < af_filter->min) {
                vcf_var_add_to_filter(var, af_filter->id_min);
@@ -273,32 +214,23 @@ void apply_af_filter(var_t *var, af_filter_t *af_filter)
 
 void apply_dp_filter(var_t *var, dp_filter_t *dp_filter)
 {
-     char *dp_char = NULL;
      int cov;
+     int rc;
 
      if (dp_missing_warning_printed) {
           return;
      }
 
      if (dp_filter->min > 0 || dp_filter->max > 0) {
-          if ( ! vcf_var_has_info_key(&dp_char, var, "DP")) {
-               if ( ! dp_missing_warning_printed) {
-#ifdef DEBUG
-                    vcf_file_t f; f.fh = stderr; f.gz = 0; vcf_write_var(&f, var);
-#endif
-                    LOG_WARN("%s\n", "Requested coverage filtering failed since DP tag is missing in variant");
-                    dp_missing_warning_printed = 1;
-                    return;
+          if (0 != (rc = vcf_var_get_dp(var, &cov))) {
+               if (rc < 0) {
+                    LOG_FATAL("%s\n", "errpr during int conversion");
+                    exit(1);
                }
+               LOG_WARN("%s\n", "Requested coverage filtering failed since DP tag is missing in variant");
+               dp_missing_warning_printed = 1;
+               return;
           }
-          errno = 0;
-          /*cov = atoi(dp_char);*/
-          cov = strtol(dp_char, (char **) NULL, 10);
-          if (errno) {
-               LOG_FATAL("%s\n", "errpr during int conversion");
-               exit(1);
-          }
-          free(dp_char);
  
           if (dp_filter->min > 0 && cov < dp_filter->min) {
                vcf_var_add_to_filter(var, dp_filter->id_min);
@@ -336,22 +268,19 @@ void apply_indelqual_threshold(var_t *var, indelqual_filter_t *indelqual_filter)
 
 void apply_sb_threshold(var_t *var, sb_filter_t *sb_filter)
 {
-     char *sb_char = NULL;
      int sb;
 
      if (! sb_filter->thresh) {
           return;
      }
 
-     if ( ! vcf_var_has_info_key(&sb_char, var, "SB")) {
+     if (0 != vcf_var_get_sb(var, &sb)) {
           if ( ! sb_missing_warning_printed) {
                LOG_WARN("%s\n", "Requested SB filtering failed since SB tag is missing in variant");
                sb_missing_warning_printed = 1;
           }
           return;
      }
-     sb = atoi(sb_char);
-     free(sb_char);
 
      if (sb > sb_filter->thresh) {
           if (sb_filter->no_compound || alt_mostly_on_one_strand(var)) {
@@ -393,7 +322,7 @@ int apply_snvqual_filter_mtc(mtc_qual_t *mtc_quals, snvqual_filter_t *snvqual_fi
                num_ign += 1;
                continue;
           }          
-          errprobs[i-num_ign] = PHREDQUAL_TO_PROB(mtc_quals[i].var_qual);
+          errprobs[i-num_ign] = phredqual_to_prob(mtc_quals[i].var_qual);
           orig_idx[i-num_ign] = i;
      }
      if (num_vars-num_ign <= 0) {
@@ -499,7 +428,7 @@ int apply_indelqual_filter_mtc(mtc_qual_t *mtc_quals, indelqual_filter_t *indelq
                num_ign += 1;
                continue;
           }
-          errprobs[i-num_ign] = PHREDQUAL_TO_PROB(mtc_quals[i].var_qual);
+          errprobs[i-num_ign] = phredqual_to_prob(mtc_quals[i].var_qual);
           orig_idx[i-num_ign] = i;
      }
      if (num_vars-num_ign <= 0) {
@@ -602,7 +531,7 @@ int apply_sb_filter_mtc(mtc_qual_t *mtc_quals, sb_filter_t *sb_filter, const lon
                continue;
           }
 
-          sb_probs[i-num_ign] = PHREDQUAL_TO_PROB(mtc_quals[i].sb_qual);
+          sb_probs[i-num_ign] = phredqual_to_prob(mtc_quals[i].sb_qual);
           orig_idx[i-num_ign] = i;
      }
      if (num_vars-num_ign <= 0) {
@@ -774,6 +703,42 @@ void cfg_filter_to_vcf_header(filter_conf_t *cfg, char **header)
 }
 
 
+/* sets values needed for multiple testing correction from var */
+static void
+mtc_qual_from_var(mtc_qual_t *mtc_qual, var_t *var)
+{
+     int sb;
+
+     mtc_qual->is_indel = vcf_var_is_indel(var);
+
+     /* variant quality */
+     if (var->qual==-1) {
+          /* missing qualities to fake value */
+          var->qual = INT_MAX;
+          if (! varq_missing_warning_printed) {
+               LOG_WARN("%s\n", "Missing variant quality in at least once case. Assuming INT_MAX");
+               varq_missing_warning_printed = 1;
+          }
+          mtc_qual->var_qual = INT_MAX;
+     } else {
+          mtc_qual->var_qual = var->qual;
+     }
+
+     /* strand bias */
+     if (0 != vcf_var_get_sb(var, &sb)) {
+          if ( ! sb_missing_warning_printed) {
+               LOG_WARN("%s\n", "At least one variant has no SB tag! Assuming 0");
+               sb_missing_warning_printed = 1;
+          }
+          mtc_qual->sb_qual = 0;
+     } else {
+          mtc_qual->sb_qual = sb;
+     }
+
+     mtc_qual->is_alt_mostly_on_one_strand = alt_mostly_on_one_strand(var);
+}
+
+
 /* mtc_quals allocated here. size returned on exit or -1 on error */
 long int
 mtc_quals_from_vcf_file(mtc_qual_t **mtc_quals, const char *vcf_in)
@@ -800,9 +765,6 @@ mtc_quals_from_vcf_file(mtc_qual_t **mtc_quals, const char *vcf_in)
     while (1) {
          var_t *var;
          int rc;
-         int is_indel = 0;
-         char *sb_char = NULL;
-         
 
          vcf_new_var(&var);
          rc = vcf_parse_var(&vcffh, var);
@@ -819,36 +781,8 @@ mtc_quals_from_vcf_file(mtc_qual_t **mtc_quals, const char *vcf_in)
               (*mtc_quals) = realloc((*mtc_quals), mtc_qual_size * sizeof(mtc_qual_t));
          }
 
-        
-         is_indel = vcf_var_is_indel(var);
-         (*mtc_quals)[num_vars-1].is_indel = is_indel;
-
-         /* variant quality */
-         if (var->qual==-1) {
-              /* missing qualities to fake value */
-              var->qual = INT_MAX;
-              if (! varq_missing_warning_printed) {
-                   LOG_WARN("%s\n", "Missing variant quality in at least once case. Assuming INT_MAX");
-                   varq_missing_warning_printed = 1;
-              }
-              (*mtc_quals)[num_vars-1].var_qual = INT_MAX;
-         } else {
-              (*mtc_quals)[num_vars-1].var_qual = var->qual;
-         }
-
-         /* strand bias */
-         if ( ! vcf_var_has_info_key(&sb_char, var, "SB")) {
-               if ( ! sb_missing_warning_printed) {
-                    LOG_WARN("%s\n", "At least one variant has no SB tag! Assuming 0");
-                    sb_missing_warning_printed = 1;
-               }
-               (*mtc_quals)[num_vars-1].sb_qual = 0;
-         } else {
-              (*mtc_quals)[num_vars-1].sb_qual = atoi(sb_char);
-              free(sb_char);
-         }
 
-         (*mtc_quals)[num_vars-1].is_alt_mostly_on_one_strand =  alt_mostly_on_one_strand(var);
+         mtc_qual_from_var(& (*mtc_quals)[num_vars-1], var);
 
          vcf_free_var(&var);
     }
@@ -857,6 +791,260 @@ mtc_quals_from_vcf_file(mtc_qual_t **mtc_quals, const char *vcf_in)
     return num_vars;
 }
 
+
+/* as mtc_quals_from_vcf_file() but reading from spool */
+static long int
+mtc_quals_from_spool(mtc_qual_t **mtc_quals, var_spool_t *spool)
+{
+     long int num_vars = 0;
+     int rc = 0;
+
+     if (var_spool_rewind(spool)) {
+          return -1;
+     }
+     (*mtc_quals) = calloc(spool->num_vars ? spool->num_vars : 1, sizeof(mtc_qual_t));
+     if (NULL == (*mtc_quals)) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     while (num_vars < spool->num_vars) {
+          var_t *var;
+
+          vcf_new_var(&var);
+          if (0 != (rc = var_spool_next(spool, var))) {
+               vcf_free_var(&var);
+               break;
+          }
+          mtc_qual_from_var(& (*mtc_quals)[num_vars], var);
+          num_vars += 1;
+          vcf_free_var(&var);
+     }
+     if (rc < 0) {
+          free(*mtc_quals);
+          *mtc_quals = NULL;
+          return -1;
+     }
+     return num_vars;
+}
+
+
+/* runs all requested multiple testing corrections on mtc_quals.
+ * returns non-zero on error */
+static int
+apply_mtc_filters(filter_conf_t *cfg, mtc_qual_t *mtc_quals, const long int num_vars)
+{
+#ifdef TRACE
+     long int i = 0;
+#endif
+
+     if (cfg->sb_filter.mtc_type != MTC_NONE) {
+          if (apply_sb_filter_mtc(mtc_quals, & cfg->sb_filter, num_vars)) {
+               LOG_FATAL("%s\n", "Multiple testing correction on strand-bias pvalues failed");
+               return -1;
+          }
+     }
+     if (cfg->indelqual_filter.mtc_type != MTC_NONE) {
+          if (apply_indelqual_filter_mtc(mtc_quals, & cfg->indelqual_filter, num_vars)) {
+               LOG_FATAL("%s\n", "Multiple testing correction on indel quality pvalues failed");
+               return -1;
+          }
+     }
+     if (cfg->snvqual_filter.mtc_type != MTC_NONE) {
+          if (apply_snvqual_filter_mtc(mtc_quals, & cfg->snvqual_filter, num_vars)) {
+               LOG_FATAL("%s\n", "Multiple testing correction on SNV quality pvalues failed");
+               return -1;
+          }
+     }
+#ifdef TRACE
+     for (i=0; i<num_vars; i++) {
+          LOG_WARN("mtc_quals #%ld sb_qual=%d var_qual=%d is_indel=%d\n", 
+                   i, mtc_quals[i].sb_qual, mtc_quals[i].var_qual, mtc_quals[i].is_indel);
+     }
+#endif
+     LOG_VERBOSE("%s\n", "MTC application completed");
+     return 0;
+}
+
+
+static int
+filter_needs_mtc(const filter_conf_t *cfg)
+{
+     return cfg->sb_filter.mtc_type != MTC_NONE
+          || cfg->snvqual_filter.mtc_type != MTC_NONE
+          || cfg->indelqual_filter.mtc_type != MTC_NONE;
+}
+
+
+/* applies all filters to var. mtc_qual is the variant's result of
+ * apply_mtc_filters() (only used if multiple testing correction was
+ * requested). returns 1 if var should be printed, 0 otherwise */
+static int
+filter_var(filter_conf_t *cfg, var_t *var, const mtc_qual_t *mtc_qual)
+{
+     int is_indel = vcf_var_is_indel(var);
+
+     if (cfg->only_snvs && is_indel) {
+          return 0;
+     } else if (cfg->only_indels && ! is_indel) {
+          return 0;
+     }
+
+     /* filters applying to all types of variants
+      */
+     apply_af_filter(var, & cfg->af_filter);
+     apply_dp_filter(var, & cfg->dp_filter);
+
+     /* quality threshold per variant type
+      */
+     if (! is_indel) {
+          if (cfg->snvqual_filter.thresh) {
+               assert(cfg->snvqual_filter.mtc_type == MTC_NONE);
+               apply_snvqual_threshold(var, & cfg->snvqual_filter);
+          } else if (cfg->snvqual_filter.mtc_type != MTC_NONE) {
+               if (mtc_qual->var_qual != -1) {
+                    vcf_var_add_to_filter(var, cfg->snvqual_filter.id);
+               }
+          }
+
+     } else {
+          if (cfg->indelqual_filter.thresh) {
+               assert(cfg->indelqual_filter.mtc_type == MTC_NONE);
+               apply_indelqual_threshold(var, & cfg->indelqual_filter);
+          } else if (cfg->indelqual_filter.mtc_type != MTC_NONE) {
+               if (mtc_qual->var_qual != -1) {
+                    vcf_var_add_to_filter(var, cfg->indelqual_filter.id);
+               }
+          }
+     }
+
+     /* sb filter 
+      */
+     if (cfg->sb_filter.thresh) {
+          if (! is_indel || cfg->sb_filter.incl_indels) {
+               assert(cfg->sb_filter.mtc_type == MTC_NONE);
+               apply_sb_threshold(var, & cfg->sb_filter);
+          }
+     } else if (cfg->sb_filter.mtc_type != MTC_NONE) {
+          if (! is_indel || cfg->sb_filter.incl_indels) {
+               if (mtc_qual->sb_qual == -1) {
+                    vcf_var_add_to_filter(var, cfg->sb_filter.id);
+               }
+          }              
+     }
+
+     /* output
+      */
+     if (cfg->print_only_passed && ! (VCF_VAR_PASSES(var))) {
+          return 0;
+     }
+
+     /* add pass if no filters were set */
+     if (! var->filter || strlen(var->filter)<=1) {
+          char pass_str[] = "PASS";
+          if (var->filter) {
+               free(var->filter);
+          }
+          var->filter = strdup(pass_str);
+     }
+     return 1;
+}
+
+
+void
+init_filter_conf(filter_conf_t *cfg)
+{
+     memset(cfg, 0, sizeof(filter_conf_t));
+     cfg->print_only_passed = 1;
+     cfg->dp_filter.min = cfg->dp_filter.max = -1;
+     cfg->af_filter.min = cfg->af_filter.max = -1;
+     cfg->sb_filter.alpha = DEFAULT_SIG;
+     cfg->snvqual_filter.alpha = DEFAULT_SIG;
+     cfg->indelqual_filter.alpha = DEFAULT_SIG;
+}
+
+
+/* LoFreq's predefined filters, for settings not already set by user */
+void
+filter_conf_set_defaults(filter_conf_t *cfg)
+{
+     if (cfg->sb_filter.mtc_type==MTC_NONE && ! cfg->sb_filter.thresh) {
+          LOG_VERBOSE("%s\n", "Setting default SB filtering method to FDR");
+          cfg->sb_filter.mtc_type = MTC_FDR;
+          cfg->sb_filter.alpha = 0.001;
+     }
+     if (cfg->dp_filter.min<0) {
+          cfg->dp_filter.min = 10;
+          LOG_VERBOSE("Setting default minimum coverage to %d\n", cfg->dp_filter.min);
+     }
+}
+
+
+/* filters variants from spool and writes them to cfg->vcf_out, which
+ * has to be opened by caller, like main_filter() does for vcf
+ * input. header will be extended with the filter descriptions.
+ * returns non-zero on error */
+int
+filter_spool(filter_conf_t *cfg, var_spool_t *spool, char **header)
+{
+     mtc_qual_t *mtc_quals = NULL;
+     long int num_vars = 0;
+     long int var_idx = -1;
+     int rc = 0;
+
+     if (filter_needs_mtc(cfg)) {
+          LOG_VERBOSE("%s\n", "At least one type of multiple testing correction requested. Doing first pass of spooled variants");
+          if ((num_vars = mtc_quals_from_spool(& mtc_quals, spool)) < 0) {
+               LOG_ERROR("%s\n", "Couldn't read spooled variants");
+               return 1;
+          }
+          if (apply_mtc_filters(cfg, mtc_quals, num_vars)) {
+               free(mtc_quals);
+               return -1;
+          }
+     }
+
+     /* also sets filter names */
+     cfg_filter_to_vcf_header(cfg, header);
+     if (vcf_write_header(& cfg->vcf_out, *header)) {
+          LOG_ERROR("Couldn't write to %s\n", cfg->vcf_out.path);
+          free(mtc_quals);
+          return 1;
+     }
+
+     if (var_spool_rewind(spool)) {
+          free(mtc_quals);
+          return 1;
+     }
+     while (1) {
+          var_t *var;
+
+          vcf_new_var(&var);
+          if (0 != (rc = var_spool_next(spool, var))) {
+               vcf_free_var(&var);
+               break;
+          }
+          var_idx += 1;
+
+          if (filter_var(cfg, var, mtc_quals ? & mtc_quals[var_idx] : NULL)
+              && vcf_write_var(& cfg->vcf_out, var)) {
+               LOG_ERROR("Couldn't write to %s\n", cfg->vcf_out.path);
+               vcf_free_var(&var);
+               free(mtc_quals);
+               return 1;
+          }
+          vcf_free_var(&var);
+     }
+     free(mtc_quals);
+
+     if (rc < 0) {
+          LOG_ERROR("%s\n", "Couldn't read spooled variants");
+          return 1;
+     }
+     return 0;
+}
+
+
 int
 main_filter(int argc, char *argv[])
 {
@@ -871,15 +1059,12 @@ main_filter(int argc, char *argv[])
      mtc_qual_t *mtc_quals = NULL;
      long int num_vars;
      static int no_defaults = 0;
+     static int index_on_the_fly = 0;
      long int var_idx = -1;
+     int write_failed = 0;
 
      /* default filter options */
-     memset(&cfg, 0, sizeof(filter_conf_t));
-     cfg.dp_filter.min = cfg.dp_filter.max = -1;
-     cfg.af_filter.min = cfg.af_filter.max = -1;
-     cfg.sb_filter.alpha = DEFAULT_SIG;
-     cfg.snvqual_filter.alpha = DEFAULT_SIG;
-     cfg.indelqual_filter.alpha = DEFAULT_SIG;
+     init_filter_conf(&cfg);
 
 
     /* keep in sync with long_opts_str and usage
@@ -895,6 +1080,7 @@ main_filter(int argc, char *argv[])
               {"debug", no_argument, &debug, 1},
               {"print-all", no_argument, &print_only_passed, 0},
               {"no-defaults", no_argument, &no_defaults, 1},
+              {"index-on-the-fly", no_argument, &index_on_the_fly, 1},
               {"only-indels", no_argument, &only_indels, 1},
               {"only-snvs", no_argument, &only_snvs, 1},
 
@@ -1087,15 +1273,7 @@ main_filter(int argc, char *argv[])
     }
     
     if (! no_defaults) {
-         if (cfg.sb_filter.mtc_type==MTC_NONE && ! cfg.sb_filter.thresh) {
-              LOG_VERBOSE("%s\n", "Setting default SB filtering method to FDR");
-              cfg.sb_filter.mtc_type = MTC_FDR;
-              cfg.sb_filter.alpha = 0.001;
-         }
-         if (cfg.dp_filter.min<0) {
-              cfg.dp_filter.min = 10;
-              LOG_VERBOSE("Setting default minimum coverage to %d\n", cfg.dp_filter.min);
-         }
+         filter_conf_set_defaults(& cfg);
     } else {
          LOG_VERBOSE("%s\n", "Skipping default settings");
     }
@@ -1157,10 +1335,7 @@ main_filter(int argc, char *argv[])
 
     /* First pass parsing to get qualities for MTC computation (if needed)
      */
-    if (cfg.sb_filter.mtc_type != MTC_NONE || cfg.snvqual_filter.mtc_type != MTC_NONE || cfg.indelqual_filter.mtc_type != MTC_NONE) {
-#ifdef TRACE
-         long int i = 0;
-#endif
+    if (filter_needs_mtc(& cfg)) {
          LOG_VERBOSE("%s\n", "At least one type of multiple testing correction requested. Doing first pass of vcf");
 
          if ((num_vars = mtc_quals_from_vcf_file(& mtc_quals, vcf_in)) < 0) {
@@ -1168,31 +1343,9 @@ main_filter(int argc, char *argv[])
               return 1;
          }
 
-         if (cfg.sb_filter.mtc_type != MTC_NONE) {
-              if (apply_sb_filter_mtc(mtc_quals, & cfg.sb_filter, num_vars)) {
-                   LOG_FATAL("%s\n", "Multiple testing correction on strand-bias pvalues failed");
-                   return -1;
-              }
-         }
-         if (cfg.indelqual_filter.mtc_type != MTC_NONE) {
-              if (apply_indelqual_filter_mtc(mtc_quals, & cfg.indelqual_filter, num_vars)) {
-                   LOG_FATAL("%s\n", "Multiple testing correction on indel quality pvalues failed");
-                   return -1;
-              }
-         }
-         if (cfg.snvqual_filter.mtc_type != MTC_NONE) {
-              if (apply_snvqual_filter_mtc(mtc_quals, & cfg.snvqual_filter, num_vars)) {
-                   LOG_FATAL("%s\n", "Multiple testing correction on SNV quality pvalues failed");
-                   return -1;
-              }
-         }
-#ifdef TRACE
-         for (i=0; i<num_vars; i++) {
-              LOG_WARN("mtc_quals #%ld sb_qual=%d var_qual=%d is_indel=%d\n", 
-                       i, mtc_quals[i].sb_qual, mtc_quals[i].var_qual, mtc_quals[i].is_indel);
+         if (apply_mtc_filters(& cfg, mtc_quals, num_vars)) {
+              return -1;
          }
-#endif
-         LOG_VERBOSE("%s\n", "MTC application completed");
     } else {
          LOG_VERBOSE("%s\n", "No multiple testing correction requested. First pass of vcf skipped");
 
@@ -1209,6 +1362,10 @@ main_filter(int argc, char *argv[])
          LOG_ERROR("Couldn't open %s\n", vcf_out);
          return 1;
     }
+    if (index_on_the_fly) {
+         /* only possible for bgzip output */
+         (void) vcf_file_index_on_the_fly(& cfg.vcf_out, -1);
+    }
     free(vcf_in);
     free(vcf_out);
 
@@ -1224,16 +1381,18 @@ main_filter(int argc, char *argv[])
     }
     /* also sets filter names */
     cfg_filter_to_vcf_header(& cfg, &vcf_header);
-    vcf_write_header(& cfg.vcf_out, vcf_header);
+    if (vcf_write_header(& cfg.vcf_out, vcf_header)) {
+         LOG_ERROR("Couldn't write to %s\n", cfg.vcf_out.path);
+         write_failed = 1;
+    }
     free(vcf_header);
 
 
     /* read in variants
      */
-    while (1) {
+    while (! write_failed) {
          var_t *var;
          int rc;
-         int is_indel = 0;
 
          vcf_new_var(&var);
          rc = vcf_parse_var(& cfg.vcf_in, var);
@@ -1243,78 +1402,15 @@ main_filter(int argc, char *argv[])
          }
          var_idx += 1;
 
-         is_indel = vcf_var_is_indel(var);
-
-         if (cfg.only_snvs && is_indel) {
-              vcf_free_var(&var);
-              continue;
-         } else if (cfg.only_indels && ! is_indel) {
-              vcf_free_var(&var);
-              continue;
-         }
-
-
-         /* filters applying to all types of variants
-          */
-         apply_af_filter(var, & cfg.af_filter);
-         apply_dp_filter(var, & cfg.dp_filter);
-
-         /* quality threshold per variant type
-          */
-         if (! is_indel) {
-              if (cfg.snvqual_filter.thresh) {
-                   assert(cfg.snvqual_filter.mtc_type == MTC_NONE);
-                   apply_snvqual_threshold(var, & cfg.snvqual_filter);
-              } else if (cfg.snvqual_filter.mtc_type != MTC_NONE) {
-                   if (mtc_quals[var_idx].var_qual != -1) {
-                        vcf_var_add_to_filter(var, cfg.snvqual_filter.id);
-                   }
-              }
-
-         } else {
-              if (cfg.indelqual_filter.thresh) {
-                   assert(cfg.indelqual_filter.mtc_type == MTC_NONE);
-                   apply_indelqual_threshold(var, & cfg.indelqual_filter);
-              } else if (cfg.indelqual_filter.mtc_type != MTC_NONE) {
-                   if (mtc_quals[var_idx].var_qual != -1) {
-                        vcf_var_add_to_filter(var, cfg.indelqual_filter.id);
-                   }
-              }
-         }
-         
-         /* sb filter 
-          */
-         if (cfg.sb_filter.thresh) {
-              if (! is_indel || cfg.sb_filter.incl_indels) {
-                   assert(cfg.sb_filter.mtc_type == MTC_NONE);
-                   apply_sb_threshold(var, & cfg.sb_filter);
-              }
-         } else if (cfg.sb_filter.mtc_type != MTC_NONE) {
-              if (! is_indel || cfg.sb_filter.incl_indels) {
-                   if (mtc_quals[var_idx].sb_qual == -1) {
-                        vcf_var_add_to_filter(var, cfg.sb_filter.id);
-                   }
-              }              
-         }
-         
-
-         /* output
-          */
-         if (cfg.print_only_passed && ! (VCF_VAR_PASSES(var))) {
+         if (! filter_var(& cfg, var, mtc_quals ? & mtc_quals[var_idx] : NULL)) {
               vcf_free_var(&var);
               continue;
          }
 
-         /* add pass if no filters were set */
-         if (! var->filter || strlen(var->filter)<=1) {
-              char pass_str[] = "PASS";
-              if (var->filter) {
-                   free(var->filter);
-              }
-              var->filter = strdup(pass_str);
+         if (vcf_write_var(& cfg.vcf_out, var)) {
+              LOG_ERROR("Couldn't write to %s\n", cfg.vcf_out.path);
+              write_failed = 1;
          }
-
-         vcf_write_var(& cfg.vcf_out, var);
          vcf_free_var(&var);
 
          if (var_idx%1000==0) {
@@ -1327,6 +1423,9 @@ main_filter(int argc, char *argv[])
 
     free(mtc_quals);
 
+    if (write_failed) {
+         return 1;
+    }
     LOG_VERBOSE("%s\n", "Successful exit.");
 
     return 0;
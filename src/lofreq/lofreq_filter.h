@@ -28,6 +28,73 @@
 #ifndef LOFREQ_FILTER_H
 #define LOFREQ_FILTER_H
 
+#include "vcf.h"
+#include "varspool.h"
+
+#define FILTER_ID_STRSIZE 64
+
+typedef struct {
+     int min;
+     char id_min[FILTER_ID_STRSIZE];
+     int max;
+     char id_max[FILTER_ID_STRSIZE];
+} dp_filter_t;
+
+typedef struct {
+     float min;
+     char id_min[FILTER_ID_STRSIZE];
+     float max;
+     char id_max[FILTER_ID_STRSIZE];
+} af_filter_t;
+
+typedef struct {
+     int thresh;/* use if > 0; otherwise use multiple testing correction that's if >0 */
+     int mtc_type;/* holm; holmbonf; fdr; none */
+     double alpha;
+     long int ntests;
+     char id[FILTER_ID_STRSIZE];
+     int no_compound; /* otherwise ALT_STRAND_RATIO of var bases have to be on one strand as well */
+     int incl_indels; /* if 1, also apply to indels */
+} sb_filter_t;
+
+typedef struct {
+     int thresh;/* use if > 0; otherwise use multiple testing correction that's if >0 */
+     int mtc_type;/* holm; holmbonf; fdr; none */
+     double alpha;
+     long int ntests;
+     char id[FILTER_ID_STRSIZE];
+} snvqual_filter_t;
+
+typedef struct {
+     int thresh;/* use if > 0; otherwise use multiple testing correction that's if >0 */
+     int mtc_type;/* holm; holmbonf; fdr; none */
+     double alpha;
+     long int ntests;
+     char id[FILTER_ID_STRSIZE];
+} indelqual_filter_t;
+
+typedef struct {
+     vcf_file_t vcf_in;
+     vcf_file_t vcf_out;
+     int print_only_passed;
+     int only_snvs;
+     int only_indels;
+
+     /* each allowed to be NULL if not set */
+     dp_filter_t dp_filter;
+     af_filter_t af_filter;
+     sb_filter_t sb_filter;
+     snvqual_filter_t snvqual_filter;
+     indelqual_filter_t indelqual_filter;
+} filter_conf_t;
+
+
+void init_filter_conf(filter_conf_t *cfg);
+
+void filter_conf_set_defaults(filter_conf_t *cfg);
+
+int filter_spool(filter_conf_t *cfg, var_spool_t *spool, char **header);
+
 int main_filter(int argc, char *argv[]);
 
 #endif
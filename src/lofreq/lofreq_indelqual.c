@@ -31,8 +31,9 @@
 #include <string.h>
 #include <getopt.h>
 
-#include "htslib/faidx.h"
-#include "sam.h" 
+#include "refpack.h"
+#include "htslib/sam.h"
+#include "samutils.h"
 #include "log.h"
 #include "utils.h"
 #include "defaults.h"
@@ -44,18 +45,21 @@ char DINDELQ2[] = "!CCCBA;963210/----,"; /* *10 */
 
 
 typedef struct {
-     samfile_t *in;
-     bamFile out;
+     samFile *in;
+     bam_hdr_t *hdr;
+     samFile *out;
      int iq;
      int dq;
 } data_t_uniform;
 
 
 typedef struct {
-     samfile_t *in;
-     bamFile out;
-     faidx_t *fai;
-     int *hpcount;
+     samFile *in;
+     bam_hdr_t *hdr;
+     samFile *out;
+     ref_file_t *ref_file;
+     const uint8_t *hrun_track; /* homopolymer track of tid. points to hrun_buf or into refpack image */
+     uint8_t *hrun_buf;
      int rlen;
      uint32_t tid;
 } data_t_dindel;
@@ -93,7 +97,7 @@ static int uniform_fetch_func(bam1_t *b, void *data)
      }
      bam_aux_append(b, BD_TAG, 'Z', c->l_qseq+1, (uint8_t*) dq);
 
-     bam_write1(tmp->out, b);
+     sam_write1(tmp->out, tmp->hdr, b);
 
      free(iq);
      free(dq);
@@ -102,33 +106,9 @@ static int uniform_fetch_func(bam1_t *b, void *data)
 }
 
 
-/* Stores an array of ints that corresponds to the length of the
- * homopolymer at the start of each homopolymer*/
-int find_homopolymers(char *query, int *count, int qlen)
-{
-     int i, j;
-     int curr_i = 0;
-     int curr_count = 1;
-     for (i = 1; i < qlen; i++) {
-          if (query[i] == query[curr_i]) {
-                  curr_count += 1; /* keep incrementing count if in homopolymer region */
-          } else {
-                  count[curr_i] = curr_count; /* record length of homopolymer region */
-               for (j = curr_i+1; j < i; j++) {
-                       count[j] = 1; /* all other positions get a count of 1 */
-               }
-               curr_i = i;
-               curr_count = 1;
-          }
-     }
-     if (curr_i < i) { /* take care of edge case at the end of the read */
-          count[curr_i] = curr_count;
-          for (j = curr_i+1; j < i; j++) {
-               count[j] = 1;
-          }
-     }
-     return 0;
-}
+/* length of the homopolymer at the start of each homopolymer, 1 for
+ * all other positions (saturated at HRUN_TRACK_MAX) */
+#define HPCOUNT(track, x) (HRUN_TRACK_IS_START((track)[x]) ? HRUN_TRACK_LEN((track)[x]) : 1)
 
 
 static int dindel_fetch_func(bam1_t *b, void *data)
@@ -140,29 +120,40 @@ static int dindel_fetch_func(bam1_t *b, void *data)
 
      /* don't change reads failing default mask: BAM_FUNMAP | BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP */
      if (c->flag & BAM_DEF_MASK) {
-          /* fprintf(stderr, "skipping read: %s at pos %d\n", bam1_qname(b), c->pos); */
-          bam_write1(tmp->out, b);
+          /* fprintf(stderr, "skipping read: %s at pos %d\n", bam_get_qname(b), c->pos); */
+          sam_write1(tmp->out, tmp->hdr, b);
           return 0;
      }
 
-     /* get the reference sequence and compute homopolymer array */
+     /* get the homopolymer track, precomputed if using a refpack
+      * image, otherwise computed from reference sequence */
      if (tmp->tid != c->tid) {
-             /*fprintf(stderr, "fetching reference sequence %s\n",
-               tmp->in->header->target_name[c->tid]); */
-          char *ref = fai_fetch(tmp->fai, tmp->in->header->target_name[c->tid], &rlen);
-          strtoupper(ref);/* safeguard */
-          int rlen = strlen(ref);
+          const char *name = tmp->hdr->target_name[c->tid];
+          free(tmp->hrun_buf);
+          tmp->hrun_buf = NULL;
+          tmp->hrun_track = ref_file_hrun_track(tmp->ref_file, name, &rlen);
+          if (! tmp->hrun_track) {
+               char *ref = ref_file_fetch(tmp->ref_file, name, &rlen);
+               if (! ref) {
+                    LOG_FATAL("Failed to fetch sequence %s from reference\n", name);
+                    exit(1);
+               }
+               rlen = strlen(ref);
+               if (NULL == (tmp->hrun_buf = malloc(rlen + 1))) {
+                    fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                            __FILE__, __FUNCTION__, __LINE__);
+                    exit(1);
+               }
+               hrun_track_compute(ref, rlen, tmp->hrun_buf);
+               free(ref);
+               tmp->hrun_track = tmp->hrun_buf;
+          }
           tmp->tid = c->tid;
-          if (tmp->hpcount) free(tmp->hpcount);
-          tmp->hpcount = (int*)malloc(rlen*sizeof(int));
-          find_homopolymers(ref, tmp->hpcount, rlen);
-          free(ref);
           tmp->rlen = rlen;
-          /* fprintf(stderr, "fetched reference sequence\n");*/
      }
 
      /* parse the cigar string */
-     uint32_t *cigar = bam1_cigar(b);
+     uint32_t *cigar = bam_get_cigar(b);
      uint8_t indelq[c->l_qseq+1];
      /* fprintf(stderr, "l_qseq:%d\n", c->l_qseq); */
      int i;
@@ -173,10 +164,10 @@ static int dindel_fetch_func(bam1_t *b, void *data)
           if (op == BAM_CMATCH || op == BAM_CEQUAL || op == BAM_CDIFF) {
                for (j = 0; j < oplen; j++) {
                        /*fprintf(stderr, "query:%d, ref:%d, count:%d\n", 
-                         y, x, tmp->hpcount[x+1]); */
+                         y, x, HPCOUNT(tmp->hrun_track, x+1)); */
                     /* FIXME clang complains: The left operand of '>' is a garbage value */
-                    indelq[y] = (x > tmp->rlen-2) ? DINDELQ[0] : (tmp->hpcount[x+1]>18 ?
-                         DINDELQ[0] : DINDELQ[tmp->hpcount[x+1]]);
+                    indelq[y] = (x > tmp->rlen-2) ? DINDELQ[0] : (HPCOUNT(tmp->hrun_track, x+1)>18 ?
+                         DINDELQ[0] : DINDELQ[HPCOUNT(tmp->hrun_track, x+1)]);
                     x++; 
                     y++;
                }
@@ -190,7 +181,7 @@ static int dindel_fetch_func(bam1_t *b, void *data)
                     y++;
                }
           } else {
-               LOG_FATAL("unknown op %d for read %s\n", op, bam1_qname(b));/* FIXME skip? seen this somewhere else properly handled */
+               LOG_FATAL("unknown op %d for read %s\n", op, bam_get_qname(b));/* FIXME skip? seen this somewhere else properly handled */
                exit(1);
           }
      }
@@ -208,7 +199,7 @@ static int dindel_fetch_func(bam1_t *b, void *data)
      }
      bam_aux_append(b, BD_TAG, 'Z', c->l_qseq+1, indelq);
 
-     bam_write1(tmp->out, b);
+     sam_write1(tmp->out, tmp->hdr, b);
      return 0;
 }
 
@@ -222,7 +213,8 @@ int add_uniform(const char *bam_in, const char *bam_out,
     bam1_t *b = NULL;
     int count = 0;
 
-	if ((tmp.in = samopen(bam_in, "rb", 0)) == 0) {
+	if ((tmp.in = sam_open(bam_in, "r")) == 0
+        || (tmp.hdr = sam_hdr_read(tmp.in)) == 0) {
          LOG_FATAL("Failed to open BAM file %s\n", bam_in);
          return 1;
     }
@@ -230,22 +222,22 @@ int add_uniform(const char *bam_in, const char *bam_out,
     tmp.iq = iq;
     tmp.dq = dq;
 
-    if (!bam_out || bam_out[0] == '-') {
-         tmp.out = bam_dopen(fileno(stdout), "w");
-    } else {
-         tmp.out = bam_open(bam_out, "w");
+    if ((tmp.out = sam_open(bam_out ? bam_out : "-", "wb")) == 0
+        || sam_hdr_write(tmp.out, tmp.hdr) != 0) {
+         LOG_FATAL("Failed to write BAM header to %s\n", bam_out ? bam_out : "-");
+         return 1;
     }
-    bam_header_write(tmp.out, tmp.in->header);
     
     b = bam_init1();
-    while (samread(tmp.in, b) >= 0) {
+    while (sam_read1(tmp.in, tmp.hdr, b) >= 0) {
          count++;
          uniform_fetch_func(b, &tmp); 
     }
     bam_destroy1(b);
     
-    samclose(tmp.in);
-    bam_close(tmp.out);
+    bam_hdr_destroy(tmp.hdr);
+    sam_close(tmp.in);
+    sam_close(tmp.out);
     LOG_VERBOSE("Processed %d reads\n", count);
     return 0;
 }
@@ -257,37 +249,39 @@ int add_dindel(const char *bam_in, const char *bam_out, const char *ref)
     int count = 0;
     bam1_t *b = NULL;
 
-	if ((tmp.in = samopen(bam_in, "rb", 0)) == 0) {
+	if ((tmp.in = sam_open(bam_in, "r")) == 0
+        || (tmp.hdr = sam_hdr_read(tmp.in)) == 0) {
          LOG_FATAL("Failed to open BAM file %s\n", bam_in);
              return 1;
         }
-    if ((tmp.fai = fai_load(ref)) == 0) {
+    if ((tmp.ref_file = ref_file_load(ref)) == 0) {
          LOG_FATAL("Failed to open reference file %s\n", ref);
          return 1;
     }
     /*warn_old_fai(ref);*/
 
-    if (!bam_out || bam_out[0] == '-') {
-         tmp.out = bam_dopen(fileno(stdout), "w");
-    } else {
-         tmp.out = bam_open(bam_out, "w");
+    if ((tmp.out = sam_open(bam_out ? bam_out : "-", "wb")) == 0
+        || sam_hdr_write(tmp.out, tmp.hdr) != 0) {
+         LOG_FATAL("Failed to write BAM header to %s\n", bam_out ? bam_out : "-");
+         return 1;
     }
-    bam_header_write(tmp.out, tmp.in->header);
     
     b = bam_init1();
     tmp.tid = -1;
-    tmp.hpcount = 0;
+    tmp.hrun_track = NULL;
+    tmp.hrun_buf = NULL;
     tmp.rlen = 0;
-    while (samread(tmp.in, b) >= 0) {
+    while (sam_read1(tmp.in, tmp.hdr, b) >= 0) {
          count++;
          dindel_fetch_func(b, &tmp); 
     }
     bam_destroy1(b);
     
-    if (tmp.hpcount) free(tmp.hpcount);
-    samclose(tmp.in);
-    bam_close(tmp.out);
-    fai_destroy(tmp.fai);
+    free(tmp.hrun_buf);
+    bam_hdr_destroy(tmp.hdr);
+    sam_close(tmp.in);
+    sam_close(tmp.out);
+    ref_file_destroy(tmp.ref_file);
 	LOG_VERBOSE("Processed %d reads\n", count);
 	return 0;
 }
@@ -5,9 +5,9 @@
 #include <ctype.h>
 #include <assert.h>
 
-/* samtools includes */
-#include "bam.h"
-#include "sam.h"
+/* htslib includes */
+#include "htslib/sam.h"
+#include "htslib/faidx.h"
 
 /* bam_index actually part of API but bam_idxstats not */
 int bam_index(int argc, char *argv[]);
@@ -26,15 +26,16 @@ int bam_idxstats(int argc, char *argv[]);
 
 int main_faidx(int argc, char *argv[]) 
 {
-     char *fi; char *fa;
+     faidx_t *fai; char *fa;
      
      fa = argv[2];
-     fi = samfaipath(fa);
-     if (! fi) {
+     /* builds the index if missing */
+     fai = fai_load(fa);
+     if (! fai) {
           return 1;
      }
 
-     free(fi);
+     fai_destroy(fai);
      return 0;
 }
 
@@ -42,7 +43,7 @@ int
 main_index(int argc, char *argv[])
 {
      char *b = argv[2];
-     return bam_index_build(b);
+     return sam_index_build(b, 0);
 }
 
 int
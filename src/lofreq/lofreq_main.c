@@ -44,6 +44,7 @@
 #include "lofreq_filter.h"
 #include "lofreq_index.h"
 #include "lofreq_indelqual.h"
+#include "lofreq_refpack.h"
 #include "lofreq_call.h"
 #include "lofreq_uniq.h"
 #include "lofreq_vcfset.h"
@@ -176,6 +177,7 @@ static void usage(const char *myname)
      fprintf(stderr, "    filter        : Filter variants in VCF file\n");
      fprintf(stderr, "    uniq          : Test whether variants predicted in only one sample really are unique\n");
      fprintf(stderr, "    plpsummary    : Print pileup summary per position\n");
+     fprintf(stderr, "    refpack       : Create packed reference image for faster loading\n");
 #ifdef USE_ALNERRPROF
      fprintf(stderr, "    bamstats      : Collect BAM statistics\n");
 #endif
@@ -201,6 +203,7 @@ static void usage(const char *myname)
 int main(int argc, char *argv[])
 {
      add_local_dir_to_path(argv[0]);
+     init_phred_tables();
 
      if (argc < 2) {
           usage(BASENAME(argv[0]));
@@ -236,6 +239,9 @@ int main(int argc, char *argv[])
      } else if (strcmp(argv[1], "checkref") == 0) {
           return main_checkref(argc, argv);
 
+     } else if (strcmp(argv[1], "refpack") == 0) {
+          return main_refpack(argc, argv);
+
      } else if (strcmp(argv[1], "info") == 0) {
           LOG_FIXME("%s\n", "NOT IMPLEMENTED YET: has BI, has BD, readlen, has extra BAQ. is_paired. all based on first, say, 10k read\n");
           return 1;
@@ -0,0 +1,124 @@
+/* -*- c-file-style: "k&r"; indent-tabs-mode: nil; -*- */
+/*********************************************************************
+* The MIT License (MIT)
+* 
+* Copyright (c) 2013,2014 Genome Institute of Singapore
+* 
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation files
+* (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify, merge,
+* publish, distribute, sublicense, and/or sell copies of the Software,
+* and to permit persons to whom the Software is furnished to do so,
+* subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+* BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+* ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+* CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+/* lofreq includes */
+#include "log.h"
+#include "utils.h"
+#include "refpack.h"
+#include "lofreq_refpack.h"
+
+#define MYNAME "lofreq refpack"
+
+
+static void
+usage()
+{
+     fprintf(stderr,
+             "\n%s: Create packed reference image for faster loading\n\n", MYNAME);
+     fprintf(stderr,"Usage: %s [options] ref.fa\n\n", MYNAME);
+     fprintf(stderr,"Options:\n");
+     fprintf(stderr,"       -o | --out FILE  Output file (default: ref.fa%s)\n", REFPACK_EXT);
+     fprintf(stderr,"       --verbose        Be verbose\n");
+     fprintf(stderr,"\n");
+     fprintf(stderr,"The image is used automatically by all commands if it is found next to\n"
+             "the fasta file (and is newer). It can also be given directly instead of\n"
+             "the fasta file (not for CRAM input).\n\n");
+}
+
+
+int
+main_refpack(int argc, char *argv[])
+{
+     char *fasta_file;
+     char *out = NULL;
+     int rc;
+
+     while (1) {
+          int c;
+          static struct option long_opts[] = {
+               {"out", required_argument, NULL, 'o'},
+               {"verbose", no_argument, &verbose, 1},
+               {"help", no_argument, NULL, 'h'},
+               {0, 0, 0, 0}
+          };
+          static const char *long_opts_str = "o:h";
+          int long_opts_index = 0;
+
+          c = getopt_long(argc-1, argv+1, long_opts_str, long_opts, &long_opts_index);
+          if (c == -1) {
+               break;
+          }
+          switch (c) {
+          case 0:
+               break;
+          case 'o':
+               free(out);
+               out = strdup(optarg);
+               break;
+          case 'h':
+               usage();
+               free(out);
+               return 0;
+          case '?':
+          default:
+               LOG_FATAL("%s\n", "Unrecognized arguments found. Exiting...\n");
+               free(out);
+               return 1;
+          }
+     }
+     if (1 != argc-optind-1) {
+          usage();
+          free(out);
+          return 1;
+     }
+     fasta_file = argv[optind+1];
+     if (! file_exists(fasta_file)) {
+          LOG_FATAL("Fasta file %s does not exist. Exiting...\n", fasta_file);
+          free(out);
+          return 1;
+     }
+
+     if (! out) {
+          out = malloc(strlen(fasta_file) + strlen(REFPACK_EXT) + 1);
+          sprintf(out, "%s%s", fasta_file, REFPACK_EXT);
+     }
+
+     rc = refpack_build(fasta_file, out);
+     if (rc) {
+          LOG_FATAL("Couldn't create %s\n", out);
+     } else {
+          LOG_VERBOSE("Packed reference written to %s\n", out);
+     }
+     free(out);
+     return rc;
+}
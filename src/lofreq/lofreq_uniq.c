@@ -164,7 +164,7 @@ apply_uniq_filter_mtc(uniq_filter_t *uniq_filter, var_t **vars, const int num_va
           exit(1);
      }
      for (i=0; i<num_vars; i++) {
-          uniq_probs[i] = PHREDQUAL_TO_PROB(uniq_phred_from_var(vars[i]));
+          uniq_probs[i] = phredqual_to_prob(uniq_phred_from_var(vars[i]));
      }
 
      /* multiple testing correction
@@ -222,7 +222,6 @@ void
 uniq_snv(const plp_col_t *p, void *confp)
 {
      uniq_conf_t *conf = (uniq_conf_t *)confp;
-     char *af_char = NULL;
      float af;
      int is_uniq = 0;
      int is_indel;
@@ -254,13 +253,11 @@ uniq_snv(const plp_col_t *p, void *confp)
      }
 
      if (conf->uni_freq <= 0.0) {
-          if (! vcf_var_has_info_key(&af_char, conf->var, "AF")) {
+          if (0 != vcf_var_get_af(conf->var, &af)) {
                LOG_FATAL("%s\n", "Couldn't parse AF (key not found) from variant");
                /* hard to catch error later */
                exit(1);
           }
-          af = strtof(af_char, (char **)NULL); /* atof */
-          free(af_char);
           if (af < 0.0 || af > 1.0) {
                float new_af;
                new_af = af<0.0 ? 0.01 : 1.0;
@@ -308,6 +305,10 @@ uniq_snv(const plp_col_t *p, void *confp)
           alt_counts[0] = af * num_err_probs; /* don't use coverage as that is before filtering */
           alt_counts[1] = alt_counts[2] = 0;
 
+          /* sorted order is numerically more stable and lets
+           * snpcaller use the grouped engine */
+          errprobs_sort(err_probs, num_err_probs);
+
           if (snpcaller(pvalues, err_probs, num_err_probs,
                         alt_counts, bonf, alpha)) {
                fprintf(stderr, "FATAL: snpcaller() failed at %s:%s():%d\n",
@@ -346,7 +347,7 @@ uniq_snv(const plp_col_t *p, void *confp)
                if (ref_len > alt_len) { /* deletion */
                     char *del_key = malloc((strlen(conf->var->ref)+1)*sizeof(char));
                     strcpy(del_key, conf->var->ref+1);
-                    del_event *it_del = find_del_sequence(&p->del_event_counts, del_key);
+                    const indel_event_t *it_del = indel_table_find(& p->del_events, del_key);
                     if (it_del) {
                          alt_count = it_del->count;
                     } else {
@@ -357,7 +358,7 @@ uniq_snv(const plp_col_t *p, void *confp)
                } else { /* insertion */
                     char *ins_key = malloc((strlen(conf->var->alt)+1)*sizeof(char));
                     strcpy(ins_key, conf->var->alt+1);
-                    ins_event *it_ins = find_ins_sequence(&p->ins_event_counts, ins_key);
+                    const indel_event_t *it_ins = indel_table_find(& p->ins_events, ins_key);
                     if (it_ins) {
                          alt_count = it_ins->count;
                     } else {
@@ -412,7 +413,7 @@ usage(const uniq_conf_t* uniq_conf)
      fprintf(stderr,"Usage: %s [options] indexed-in.bam\n\n", MYNAME);
      fprintf(stderr,"Options:\n");
      fprintf(stderr, "  -v | --vcf-in FILE      Input vcf file listing variants [- = stdin; gzip supported]\n");
-     fprintf(stderr, "  -o | --vcf-out FILE     Output vcf file [- = stdout; gzip supported]\n");
+     fprintf(stderr, "  -o | --vcf-out FILE     Output vcf file [- = stdout; gzip supported; binary if ending in .lfb]\n");
      fprintf(stderr, "  -f | --uni-freq         Assume variants have uniform test frequency of this value (unused if <=0) [%f]\n", uniq_conf->uni_freq);
      fprintf(stderr, "  -t | --uniq-thresh INT  Minimum uniq phred-value required. Conflicts with -m. 0 for off (default=%d)\n", uniq_conf->uniq_filter.thresh);
      fprintf(stderr, "  -m | --uniq-mtc STRING  Uniq multiple testing correction type. One of 'bonf', 'holm' or 'fdr'. (default=%s)\n", mtc_type_str[uniq_conf->uniq_filter.mtc_type]);
@@ -677,7 +678,12 @@ main_uniq(int argc, char *argv[])
               }
          }
 
-         vcf_write_header(& uniq_conf.vcf_out, vcf_header);
+         if (vcf_write_header(& uniq_conf.vcf_out, vcf_header)) {
+              LOG_ERROR("Couldn't write to %s\n", uniq_conf.vcf_out.path);
+              free(vcf_header);
+              rc = 1;
+              goto clean_and_exit;
+         }
          free(vcf_header);
     }
 
@@ -735,7 +741,11 @@ main_uniq(int argc, char *argv[])
     if (uniq_conf.use_det_lim) {
          for (i=0; i<num_vars; i++) {
               var_t *var = vars[i];
-              vcf_write_var(& uniq_conf.vcf_out, var);
+              if (vcf_write_var(& uniq_conf.vcf_out, var)) {
+                   LOG_ERROR("Couldn't write to %s\n", uniq_conf.vcf_out.path);
+                   rc = 1;
+                   break;
+              }
          }
          /* all done */
          goto clean_and_exit;
@@ -752,8 +762,11 @@ main_uniq(int argc, char *argv[])
     
     for (i=0; i<num_vars; i++) {
          var_t *var = vars[i];
-         if (VCF_VAR_PASSES(var) || uniq_conf.output_all) {
-              vcf_write_var(& uniq_conf.vcf_out, var);
+         if ((VCF_VAR_PASSES(var) || uniq_conf.output_all)
+             && vcf_write_var(& uniq_conf.vcf_out, var)) {
+              LOG_ERROR("Couldn't write to %s\n", uniq_conf.vcf_out.path);
+              rc = 1;
+              break;
          }
     }
 
@@ -81,9 +81,9 @@ usage(const vcfset_conf_t* vcfset_conf)
      fprintf(stderr, "Usage: %s [options] -a op -1 1.vcf -2 2.vcf \n", MYNAME);
 
      fprintf(stderr,"Options:\n");
-     fprintf(stderr, "  -1 | --vcf1 FILE      1st VCF input file (bgzip supported)\n");
-     fprintf(stderr, "  -2 | --vcf2 FILE      2nd VCF input file (mandatory - except for concat - and needs to be tabix indexed)\n");
-     fprintf(stderr, "  -o | --vcfout         VCF output file (default: - for stdout; gzip supported).\n");
+     fprintf(stderr, "  -1 | --vcf1 FILE      1st VCF input file (bgzip supported; binary if ending in .lfb)\n");
+     fprintf(stderr, "  -2 | --vcf2 FILE      2nd VCF input file (mandatory - except for concat - and needs to be bgzipped and tabix indexed, i.e. can't be binary)\n");
+     fprintf(stderr, "  -o | --vcfout         VCF output file (default: - for stdout; gzip supported; binary if ending in .lfb).\n");
      fprintf(stderr, "  -a | --action         Set operation to perform: intersect, complement or concat.\n"
              "                        - intersect = vcf1 AND vcf2.\n"
              "                        - complement = vcf1 \\ vcf2.\n"
@@ -94,6 +94,7 @@ usage(const vcfset_conf_t* vcfset_conf)
      fprintf(stderr, "       --only-passed    Ignore variants marked as filtered\n");
      fprintf(stderr, "       --only-snvs      Ignore anything but SNVs in both input files\n");
      fprintf(stderr, "       --only-indels    Ignore anything but indels in both input files\n");
+     fprintf(stderr, "       --index-on-the-fly Build tabix index of bgzipped output while writing it (output is then compressed without threads)\n");
      fprintf(stderr, "       --verbose        Be verbose\n");
      fprintf(stderr, "       --debug          Enable debugging\n");
 
@@ -120,6 +121,7 @@ main_vcfset(int argc, char *argv[])
      static int only_snvs = 0;
      static int only_indels = 0;
      static int count_only = 0;
+     static int index_on_the_fly = 0;
      tbx_t *vcf2_tbx = NULL; /* index for second vcf file */
      htsFile *vcf2_hts = NULL;
      char *add_info_field = NULL;
@@ -152,6 +154,7 @@ main_vcfset(int argc, char *argv[])
               {"only-indels", no_argument, &only_indels, 1},
               {"only-snvs", no_argument, &only_snvs, 1},
               {"count-only", no_argument, &count_only, 1},
+              {"index-on-the-fly", no_argument, &index_on_the_fly, 1},
 
               {"vcf1", required_argument, NULL, '1'},
               {"vcf2", required_argument, NULL, '2'},
@@ -294,6 +297,11 @@ main_vcfset(int argc, char *argv[])
     }
 
     if (vcf_in2) {
+         if (vcf_has_bin_ext(vcf_in2)) {
+              LOG_FATAL("%s is binary, which can't be tabix indexed. Please use a bgzipped and tabix indexed vcf file as 2nd input (e.g. convert with lofreq filter)\n", vcf_in2);
+              free(vcf_in1); free(vcf_in2); free(vcf_out);
+              return 1;
+         }
          vcf2_hts = hts_open(vcf_in2, "r");
          if (!vcf2_hts) {
               LOG_FATAL("Couldn't load %s\n", vcf_in2);
@@ -319,6 +327,10 @@ main_vcfset(int argc, char *argv[])
               free(vcf_in1); free(vcf_in2); free(vcf_out);
               return 1;
          }
+         if (index_on_the_fly) {
+              /* only possible for bgzip output */
+              (void) vcf_file_index_on_the_fly(& vcfset_conf.vcf_out, -1);
+         }
     }
 
     /* use meta-data/header of vcf_in1 for output
@@ -334,7 +346,10 @@ main_vcfset(int argc, char *argv[])
     } else {
          if (! count_only) {
               /* vcf_write_header would write *default* header */
-              vcf_write_header(& vcfset_conf.vcf_out, vcf_header);
+              if (vcf_write_header(& vcfset_conf.vcf_out, vcf_header)) {
+                   LOG_FATAL("Couldn't write to %s\n", vcf_out);
+                   return 1;
+              }
          }
          free(vcf_header);
     }
@@ -416,7 +431,10 @@ main_vcfset(int argc, char *argv[])
          if (vcfset_conf.vcf_setop == SETOP_CONCAT) {
               num_vars_out += 1;
               if (! count_only) {
-                   vcf_write_var(& vcfset_conf.vcf_out, var1);
+                   if (vcf_write_var(& vcfset_conf.vcf_out, var1)) {
+                        LOG_FATAL("Couldn't write to %s\n", vcf_out);
+                        return 1;
+                   }
               }
               vcf_free_var(& var1);
               /* skip comparison against vcf2 */
@@ -487,14 +505,20 @@ main_vcfset(int argc, char *argv[])
               if (!var2_match) {
                    num_vars_out += 1;
                    if (! count_only) {
-                        vcf_write_var(& vcfset_conf.vcf_out, var1);
+                        if (vcf_write_var(& vcfset_conf.vcf_out, var1)) {
+                             LOG_FATAL("Couldn't write to %s\n", vcf_out);
+                             return 1;
+                        }
                    }
               }
          } else if (vcfset_conf.vcf_setop == SETOP_INTERSECT) {
               if (var2_match) {
                    num_vars_out += 1;
                    if (! count_only) {
-                        vcf_write_var(& vcfset_conf.vcf_out, var1);
+                        if (vcf_write_var(& vcfset_conf.vcf_out, var1)) {
+                             LOG_FATAL("Couldn't write to %s\n", vcf_out);
+                             return 1;
+                        }
                    }
               }
 
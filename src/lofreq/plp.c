@@ -35,9 +35,12 @@
 #include <assert.h>
 #include <errno.h>
 #include <fenv.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "htslib/kstring.h"
-#include "sam.h"
+#include "htslib/sam.h"
+#include "htslib/tbx.h"
 
 #include "log.h"
 #include "plp.h"
@@ -45,6 +48,7 @@
 #include "samutils.h"
 #include "snpcaller.h"
 #include "bam_md_ext.h"
+#include "kprobaln_ext.h"
 
 /* bam_md.c
 const char bam_nt16_nt4_table[] = { 4, 0, 1, 4, 2, 4, 4, 4, 3, 4, 4, 4, 4, 4, 4, 4 };
@@ -55,10 +59,15 @@ const char *bam_nt4_rev_table = "ACGTN";
 
 int missing_baq_warning_printed = 0;
 
+long long int plp_num_ref_cols_skipped = 0;
+
 /* from bedidx.c */
 void *bed_read(const char *fn);
 void bed_destroy(void *_h);
-int bed_overlap(const void *_h, const char *chr, int beg, int end);
+int bed_merged_intervals(const void *_h, const char *chr, const uint64_t **regs);
+void *bed_cursor_new(const void *_h);
+void bed_cursor_destroy(void *_c);
+int bed_cursor_overlap(void *_c, int tid, const char *chr, int beg, int end);
 
 /* From the SAM spec: "tags starting with `X', `Y' and `Z' or tags
  * containing lowercase letters in either position are reserved for
@@ -91,15 +100,60 @@ const unsigned char bam_nt4_table[256] = {
      4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,
 };
 
+/* aux fields of a read, looked up once when the read enters the
+ * pileup (plp_read_construct()) instead of at every column it
+ * covers. pointers are as returned by bam_aux_get(), i.e. point to
+ * the type byte, and stay valid while the read is in the pileup.
+ */
+typedef struct plp_read_s {
+     const uint8_t *baq; /* BAQ_TAG. only if MPLP_BAQ */
+     const uint8_t *bi, *bd; /* BI_TAG/BD_TAG indel qualities */
+     const uint8_t *ai, *ad; /* AI_TAG/AD_TAG indel alignment qualities */
+     int sq; /* SRC_QUAL_TAG value if MPLP_USE_SQ, otherwise -1 */
+     struct plp_read_s *next; /* free list */
+} plp_read_t;
+
+typedef struct read_pool_s read_pool_t;
+
+typedef struct sq_cache_s sq_cache_t; /* see source_qual() */
+
+/* one index query of a bed driven pileup. see bed_queries_new() */
+typedef struct {
+     int tid;
+     int beg, end;
+} bed_query_t;
+
 typedef struct {
-     bamFile fp;
-     bam_iter_t iter;
-     bam_header_t *h;
+     samFile *fp;
+     hts_itr_t *iter;
+     bam_hdr_t *h;
      int ref_id;
      char *ref;
+     int ref_beg, ref_end; /* part of ref that was fetched. see plp_ref_window() */
+     char *own_ref; /* ref fetched by mplp_func() itself. released in mpileup() */
      const mplp_conf_t *conf;
+     plp_read_t *free_reads; /* recycled plp_read_t */
+     read_pool_t *pool; /* if set, reads are preprocessed in parallel by this pool */
+     sq_cache_t *sq_cache; /* source quality cache if MPLP_USE_SQ and no pool */
+     void *bed_cursor; /* read overlap with conf->bed */
+
+     /* bed driven iteration (see mplp_bed_read()). queries are shared */
+     hts_idx_t *idx;
+     const bed_query_t *bed_queries; /* NULL if not bed driven */
+     int num_bed_queries;
+     int next_bed_query;
+     int prev_query_tid, prev_query_end; /* reads starting before were returned already */
 } mplp_aux_t;
 
+/* with a region, reference sequences are only fetched for the reads
+ * at hand (see plp_ref_window()), padded by this many bases to cover
+ * their neighbours as well */
+#define PLP_REF_PAD 100000
+
+static void plp_ref_window(const mplp_conf_t *conf, int *beg, int *end);
+static char *plp_fetch_ref(const mplp_conf_t *conf, const char *name, int beg, int end, int *len);
+static void plp_release_ref(const mplp_conf_t *conf, char *seq);
+
 typedef struct {
     int n;
     int *n_plp, *m_plp;
@@ -137,11 +191,299 @@ base_count(const plp_col_t *p, char base)
 
 
 
+static void
+plp_quals_init(plp_quals_t *q)
+{
+     memset(q, 0, sizeof(plp_quals_t));
+}
+
+
+static void
+plp_quals_free(plp_quals_t *q)
+{
+     free(q->bq);
+     free(q->baq);
+     free(q->mq);
+     free(q->sq);
+     plp_quals_init(q);
+}
+
+
+/* make sure there's room for at least n entries */
+static void
+plp_quals_reserve(plp_quals_t *q, const unsigned long int n)
+{
+     if (q->alloced >= n) {
+          return;
+     }
+     q->bq = realloc(q->bq, n * sizeof(uint8_t));
+     q->baq = realloc(q->baq, n * sizeof(uint8_t));
+     q->mq = realloc(q->mq, n * sizeof(uint8_t));
+     q->sq = realloc(q->sq, n * sizeof(uint8_t));
+     if (! q->bq || ! q->baq || ! q->mq || ! q->sq) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     q->alloced = n;
+}
+
+
+/* adds one entry. negative values (and values that don't fit) are
+ * stored as PLP_QUAL_NA, except mq which is stored as is */
+static inline void
+plp_quals_add(plp_quals_t *q, const int bq, const int baq, const int mq, const int sq)
+{
+     if (q->n == q->alloced) {
+          plp_quals_reserve(q, q->alloced ? 2*q->alloced : 64);
+     }
+     q->bq[q->n] = bq < 0 ? PLP_QUAL_NA : (bq < PLP_QUAL_NA ? bq : PLP_QUAL_NA-1);
+     q->baq[q->n] = baq < 0 ? PLP_QUAL_NA : (baq < PLP_QUAL_NA ? baq : PLP_QUAL_NA-1);
+     q->mq[q->n] = mq < 0 ? PLP_QUAL_NA : (mq <= 255 ? mq : 255);
+     q->sq[q->n] = sq < 0 ? PLP_QUAL_NA : (sq < PLP_QUAL_NA ? sq : PLP_QUAL_NA-1);
+     q->n += 1;
+}
+
+
+/* median of base-call qualities (same semantics as int_median()), but
+ * computed in linear time from a histogram */
+int
+plp_quals_median_bq(const plp_quals_t *q)
+{
+     unsigned long int hist[256] = { 0 };
+     unsigned long int i, cum = 0;
+     int lo = -1, hi = -1;
+     int b;
+
+     if (0 == q->n) {
+          return 0;
+     }
+     for (i=0; i<q->n; i++) {
+          hist[q->bq[i]] += 1;
+     }
+     /* elements at sorted index (n-1)/2 and n/2 */
+     for (b=0; b<256; b++) {
+          cum += hist[b];
+          if (lo < 0 && cum > (q->n-1)/2) {
+               lo = b;
+          }
+          if (cum > q->n/2) {
+               hi = b;
+               break;
+          }
+     }
+     return (lo + hi) / 2.0;
+}
+
+
+
+/* indel event table. see indel_table_t */
+
+#define INDEL_KEY_BLOCK_SIZE 4096 /* > MAX_INDELSIZE, i.e. every key fits */
+
+struct indel_key_block_s {
+     char data[INDEL_KEY_BLOCK_SIZE];
+     size_t used;
+     struct indel_key_block_s *next;
+};
+
+
+static void
+indel_table_init(indel_table_t *t)
+{
+     memset(t, 0, sizeof(indel_table_t));
+}
+
+
+/* forget all events, but keep all storage */
+static void
+indel_table_reset(indel_table_t *t)
+{
+     indel_key_block_t *b;
+
+     if (t->n) {
+          memset(t->index, 0, t->index_size * sizeof(int));
+          t->n = 0;
+     }
+     for (b=t->keys; b; b=b->next) {
+          b->used = 0;
+     }
+     t->cur_keys = t->keys;
+}
+
+
+static void
+indel_table_free(indel_table_t *t)
+{
+     indel_key_block_t *b, *next;
+     int i;
+
+     for (i=0; i<t->alloced; i++) {
+          plp_quals_free(& t->events[i].quals);
+     }
+     free(t->events);
+     free(t->index);
+     for (b=t->keys; b; b=next) {
+          next = b->next;
+          free(b);
+     }
+     indel_table_init(t);
+}
+
+
+/* FNV-1a */
+static inline unsigned int
+indel_key_hash(const char *key)
+{
+     unsigned int h = 2166136261u;
+     for (; *key; key++) {
+          h = (h ^ (unsigned char)*key) * 16777619u;
+     }
+     return h;
+}
+
+
+/* copies key (of length len) to the key arena */
+static const char *
+indel_key_intern(indel_table_t *t, const char *key, const size_t len)
+{
+     indel_key_block_t *b = t->cur_keys;
+     char *k;
+
+     if (! b || b->used + len + 1 > INDEL_KEY_BLOCK_SIZE) {
+          if (b && b->next) {
+               b = b->next;
+          } else {
+               indel_key_block_t *new_b;
+               if (NULL == (new_b = calloc(1, sizeof(indel_key_block_t)))) {
+                    fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                            __FILE__, __FUNCTION__, __LINE__);
+                    exit(1);
+               }
+               if (b) {
+                    b->next = new_b;
+               } else {
+                    t->keys = new_b;
+               }
+               b = new_b;
+          }
+          b->used = 0;
+          t->cur_keys = b;
+     }
+     k = b->data + b->used;
+     memcpy(k, key, len+1);
+     b->used += len+1;
+     return k;
+}
+
+
+static void
+indel_table_grow_index(indel_table_t *t)
+{
+     int i, mask;
+
+     t->index_size = t->index_size ? 2*t->index_size : 16;
+     free(t->index);
+     if (NULL == (t->index = calloc(t->index_size, sizeof(int)))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     mask = t->index_size - 1;
+     for (i=0; i<t->n; i++) {
+          int j = t->events[i].hash & mask;
+          while (t->index[j]) {
+               j = (j+1) & mask;
+          }
+          t->index[j] = i+1;
+     }
+}
+
+
+/* returns index slot for key, which is either empty or holds key */
+static inline int
+indel_table_slot(const indel_table_t *t, const char *key, const unsigned int hash)
+{
+     const int mask = t->index_size - 1;
+     int j = hash & mask;
+
+     while (t->index[j]) {
+          const indel_event_t *it = & t->events[t->index[j]-1];
+          if (it->hash == hash && 0 == strcmp(it->key, key)) {
+               break;
+          }
+          j = (j+1) & mask;
+     }
+     return j;
+}
+
+
+indel_event_t *
+indel_table_find(const indel_table_t *t, const char *key)
+{
+     int j;
+
+     if (! t->n) {
+          return NULL;
+     }
+     j = indel_table_slot(t, key, indel_key_hash(key));
+     return t->index[j] ? & t->events[t->index[j]-1] : NULL;
+}
+
+
+/* adds one observation of key (nul-terminated, uppercase, shorter than
+ * MAX_INDELSIZE) with the given qualities */
+static void
+indel_table_add(indel_table_t *t, const char *key, const int qual,
+                const int aln_qual, const int map_qual, const int source_qual,
+                const int fw_rv)
+{
+     const unsigned int hash = indel_key_hash(key);
+     indel_event_t *it;
+     int j;
+
+     if (2*(t->n+1) > t->index_size) {
+          indel_table_grow_index(t);
+     }
+     j = indel_table_slot(t, key, hash);
+     if (t->index[j]) {
+          it = & t->events[t->index[j]-1];
+          it->count += 1;
+          it->cons_quals += qual;
+     } else {
+          if (t->n == t->alloced) {
+               int i;
+               t->alloced = t->alloced ? 2*t->alloced : 8;
+               if (NULL == (t->events = realloc(t->events, t->alloced * sizeof(indel_event_t)))) {
+                    fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                            __FILE__, __FUNCTION__, __LINE__);
+                    exit(1);
+               }
+               for (i=t->n; i<t->alloced; i++) {
+                    plp_quals_init(& t->events[i].quals);
+               }
+          }
+          it = & t->events[t->n];
+          t->index[j] = ++t->n;
+          it->key = indel_key_intern(t, key, strlen(key));
+          it->hash = hash;
+          it->count = 1;
+          it->cons_quals = qual;
+          it->fw_rv[0] = it->fw_rv[1] = 0;
+          it->quals.n = 0;
+     }
+     it->fw_rv[fw_rv] += 1;
+     plp_quals_add(& it->quals, qual, aln_qual, map_qual, source_qual);
+}
+
+
 void
 plp_col_init(plp_col_t *p) {
     int i;
 
+#ifdef USE_ALNERRPROF
     const int grow_by_size = 1000;
+#endif
 
     p->target =  NULL;
     p->pos = -INT_MAX;
@@ -152,10 +494,7 @@ plp_col_init(plp_col_t *p) {
     p->num_ign_indels = 0;
     p->num_non_indels = 0;
     for (i=0; i<NUM_NT4; i++) {
-         int_varray_init(& p->base_quals[i], grow_by_size);
-         int_varray_init(& p->baq_quals[i], grow_by_size);
-         int_varray_init(& p->map_quals[i], grow_by_size);
-         int_varray_init(& p->source_quals[i], grow_by_size);
+         plp_quals_init(& p->quals[i]);
 #ifdef USE_ALNERRPROF
          int_varray_init(& p->alnerr_qual[i], grow_by_size);
 #endif
@@ -169,13 +508,13 @@ plp_col_init(plp_col_t *p) {
     int_varray_init(& p->ins_quals, 0);
     int_varray_init(& p->ins_map_quals, 0);
     int_varray_init(& p->ins_source_quals, 0);
-    p->ins_event_counts = NULL;
+    indel_table_init(& p->ins_events);
 
     p->num_dels = p->sum_dels = 0;
     int_varray_init(& p->del_quals, 0);
     int_varray_init(& p->del_map_quals, 0);
     int_varray_init(& p->del_source_quals, 0);
-    p->del_event_counts = NULL;
+    indel_table_init(& p->del_events);
 
     p->non_ins_fw_rv[0] = p->non_ins_fw_rv[1] = 0;
     p->non_del_fw_rv[0] = p->non_del_fw_rv[1] = 0;
@@ -191,10 +530,7 @@ plp_col_free(plp_col_t *p) {
 
     free(p->target);
     for (i=0; i<NUM_NT4; i++) {
-         int_varray_free(& p->base_quals[i]);
-         int_varray_free(& p->baq_quals[i]);
-         int_varray_free(& p->map_quals[i]);
-         int_varray_free(& p->source_quals[i]);
+         plp_quals_free(& p->quals[i]);
 #ifdef USE_ALNERRPROF
          int_varray_free(& p->alnerr_qual[i]);
 #endif
@@ -207,8 +543,60 @@ plp_col_free(plp_col_t *p) {
     int_varray_free(& p->del_map_quals);
     int_varray_free(& p->del_source_quals);
 
-    destruct_ins_event_counts(&p->ins_event_counts);
-    destruct_del_event_counts(&p->del_event_counts);
+    indel_table_free(& p->ins_events);
+    indel_table_free(& p->del_events);
+}
+
+
+/* prepare an initialized (plp_col_init()) or previously used column
+ * for target_name. unlike plp_col_free() followed by plp_col_init()
+ * this keeps all allocated quality arrays, so that reusing a column
+ * doesn't cost any malloc/free once the arrays reached the typical
+ * depth. target is only copied if it changed.
+ */
+void
+plp_col_reset(plp_col_t *p, const char *target_name) {
+    int i;
+
+    if (NULL == p->target || 0 != strcmp(p->target, target_name)) {
+         free(p->target);
+         p->target = strdup(target_name);
+    }
+    p->pos = -INT_MAX;
+    p->ref_base = '\0';
+    p->cons_base[0] = 'N'; p->cons_base[1] = '\0';
+    p->coverage_plp = 0;
+    p->num_bases = 0;
+    p->num_ign_indels = 0;
+    p->num_non_indels = 0;
+    for (i=0; i<NUM_NT4; i++) {
+         p->quals[i].n = 0;
+#ifdef USE_ALNERRPROF
+         int_varray_reset(& p->alnerr_qual[i]);
+#endif
+         p->fw_counts[i] = 0;
+         p->rv_counts[i] = 0;
+    }
+
+    p->num_heads = p->num_tails = 0;
+
+    p->num_ins = p->sum_ins = 0;
+    int_varray_reset(& p->ins_quals);
+    int_varray_reset(& p->ins_map_quals);
+    int_varray_reset(& p->ins_source_quals);
+    indel_table_reset(& p->ins_events);
+
+    p->num_dels = p->sum_dels = 0;
+    int_varray_reset(& p->del_quals);
+    int_varray_reset(& p->del_map_quals);
+    int_varray_reset(& p->del_source_quals);
+    indel_table_reset(& p->del_events);
+
+    p->non_ins_fw_rv[0] = p->non_ins_fw_rv[1] = 0;
+    p->non_del_fw_rv[0] = p->non_del_fw_rv[1] = 0;
+
+    p->has_indel_aqs = 0;
+    p->hrun = 0;
 }
 
 
@@ -233,9 +621,9 @@ void plp_col_debug_print(const plp_col_t *p, FILE *stream)
 #if 0
      for (i=0; i<NUM_NT4; i++) {
           int j;
-          fprintf(stream, "%c BQs (%lu): " , bam_nt4_rev_table[i], p->base_quals[i].n);
-          for (j=0; j<p->base_quals[i].n; j++) {
-               fprintf(stream, " %d", p->base_quals[i].data[j]);
+          fprintf(stream, "%c BQs (%lu): " , bam_nt4_rev_table[i], p->quals[i].n);
+          for (j=0; j<p->quals[i].n; j++) {
+               fprintf(stream, " %d", p->quals[i].bq[j]);
           }
           fprintf(stream, "\n");
      }
@@ -254,9 +642,9 @@ plp_col_mpileup_print(const plp_col_t *p, FILE *stream)
      fprintf(stream, "%s\t%d\t%c\t%d\t",
              p->target, p->pos+1, p->ref_base,p->coverage_plp);
      for (i=0; i<NUM_NT4; i++) {
-          for (j=0; j<p->base_quals[i].n; j++) {
+          for (j=0; j<p->quals[i].n; j++) {
                fprintf(stream, "%c%c",
-                       bam_nt4_rev_table[i],  p->base_quals[i].data[j]+33);
+                       bam_nt4_rev_table[i],  p->quals[i].bq[j]+33);
           }
      }
 
@@ -285,6 +673,7 @@ dump_mplp_conf(const mplp_conf_t *c, FILE *stream)
      fprintf(stream, "  flag & MPLP_REDO_IDAQ = %d\n", c->flag & MPLP_REDO_IDAQ ? 1:0);
      fprintf(stream, "  flag & MPLP_USE_SQ     = %d\n", c->flag & MPLP_USE_SQ ? 1:0);
      fprintf(stream, "  flag & MPLP_ILLUMINA13 = %d\n", c->flag & MPLP_ILLUMINA13 ? 1:0);
+     fprintf(stream, "  flag & MPLP_SKIP_REF_COLS = %d\n", c->flag & MPLP_SKIP_REF_COLS ? 1:0);
 
      fprintf(stream, "  max_depth    = %d\n", c->max_depth);
      fprintf(stream, "  min_plp_bq   = %d\n", c->min_plp_bq);
@@ -292,8 +681,10 @@ dump_mplp_conf(const mplp_conf_t *c, FILE *stream)
      fprintf(stream, "  def_nm_q     = %d\n", c->def_nm_q);
      fprintf(stream, "  reg          = %s\n", c->reg);
      fprintf(stream, "  fa           = %p\n", c->fa);
-     /*fprintf(stream, "  fai          = %p\n", c->fai);*/
+     /*fprintf(stream, "  ref_file     = %p\n", c->ref_file);*/
      fprintf(stream, "  bed          = %p\n", c->bed);
+     fprintf(stream, "  hts_threads  = %d\n", c->hts_threads);
+     fprintf(stream, "  baq_threads  = %d\n", c->baq_threads);
      fprintf(stream, "  cmdline      = %s\n", c->cmdline);
 }
 /* dump_mplp_conf() */
@@ -302,57 +693,321 @@ dump_mplp_conf(const mplp_conf_t *c, FILE *stream)
 
 
 
-static var_hash_t *source_qual_ign_vars_hash = NULL; /* must be declared NULL ! */
+/* source quality ignore list: sorted, unique positions per
+ * chromosome. lookups don't allocate. see ign_list_for_target() */
+struct ign_pos_list_s {
+     char *chrom;
+     uint32_t *pos;
+     int n;
+     int alloced;
+     UT_hash_handle hh;
+};
+
+static ign_pos_list_t *source_qual_ign_lists = NULL; /* must be declared NULL ! */
+
+
+/* returns ignore positions for target or NULL if there are none.
+ * meant to be called once per read, not per position */
+const ign_pos_list_t *
+ign_list_for_target(const char *target)
+{
+     ign_pos_list_t *l = NULL;
+
+     if (! source_qual_ign_lists || ! target) {
+          return NULL;
+     }
+     HASH_FIND_STR(source_qual_ign_lists, target, l);
+     return l;
+}
 
 
 int
-var_in_ign_list(var_t *var) {
-     char *key = NULL;
-     var_hash_t *match = NULL;
+ign_list_has_pos(const ign_pos_list_t *l, const long int pos)
+{
+     int lo, hi;
+
+     if (! l || pos < 0) {
+          return 0;
+     }
+     lo = 0;
+     hi = l->n;
+     while (lo < hi) {
+          int mid = lo + (hi-lo)/2;
+          if (l->pos[mid] < pos) {
+               lo = mid+1;
+          } else {
+               hi = mid;
+          }
+     }
+     return lo < l->n && l->pos[lo] == pos;
+}
 
-     /* using key_pos_only i.e. chrom and pos only
+
+int
+var_in_ign_list(var_t *var) {
+     /* using chrom and pos only
       *
       * NOTE: source quality will pass down fake vars without ref and
-      * alt so only vcf_var_key_pos_only will work!
+      * alt so only chrom and pos can be used!
       */
-     vcf_var_key_pos_only(&key, var);
-     HASH_FIND_STR(source_qual_ign_vars_hash, key, match);
-     free(key);
+     return ign_list_has_pos(ign_list_for_target(var->chrom), var->pos);
+}
 
-     if (NULL == match) {
-          return 0;
-     } else {
-          return 1;
+
+static void
+ign_list_add(const char *chrom, const long int pos)
+{
+     ign_pos_list_t *l = NULL;
+
+     HASH_FIND_STR(source_qual_ign_lists, chrom, l);
+     if (! l) {
+          if (NULL == (l = calloc(1, sizeof(ign_pos_list_t)))
+              || NULL == (l->chrom = strdup(chrom))) {
+               fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                       __FILE__, __FUNCTION__, __LINE__);
+               exit(1);
+          }
+          HASH_ADD_KEYPTR(hh, source_qual_ign_lists, l->chrom, strlen(l->chrom), l);
+     }
+     if (l->n == l->alloced) {
+          l->alloced = l->alloced ? 2*l->alloced : 1024;
+          if (NULL == (l->pos = realloc(l->pos, l->alloced * sizeof(uint32_t)))) {
+               fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                       __FILE__, __FUNCTION__, __LINE__);
+               exit(1);
+          }
+     }
+     l->pos[l->n++] = pos;
+}
+
+
+static int
+uint32_cmp(const void *a, const void *b)
+{
+     const uint32_t ua = *(const uint32_t *)a;
+     const uint32_t ub = *(const uint32_t *)b;
+     return ua<ub ? -1 : ua>ub ? 1 : 0;
+}
+
+
+/* sorts and uniqs all lists. returns total number of positions */
+static long int
+ign_lists_finalize()
+{
+     ign_pos_list_t *l, *l_tmp;
+     long int num_pos = 0;
+
+     HASH_ITER(hh, source_qual_ign_lists, l, l_tmp) {
+          int i, n;
+          qsort(l->pos, l->n, sizeof(uint32_t), uint32_cmp);
+          for (i=n=0; i<l->n; i++) {
+               if (n && l->pos[n-1] == l->pos[i]) {
+                    continue;
+               }
+               l->pos[n++] = l->pos[i];
+          }
+          l->n = n;
+          num_pos += n;
      }
+     return num_pos;
 }
 
 
 void
 source_qual_free_ign_vars()
 {
-     var_hash_free_table(source_qual_ign_vars_hash);
+     ign_pos_list_t *l, *l_tmp;
+
+     HASH_ITER(hh, source_qual_ign_lists, l, l_tmp) {
+          HASH_DEL(source_qual_ign_lists, l);
+          free(l->chrom);
+          free(l->pos);
+          free(l);
+     }
+}
+
+
+/* adds var to ignore list if it passes bed and region filter. returns
+ * 1 if added, 0 otherwise */
+static int
+ign_list_add_var(const var_t *var, void *bed_cursor,
+                 const char *reg_chrom, const int reg_beg, const int reg_end)
+{
+     if (reg_chrom) {
+          if (0 != strcmp(var->chrom, reg_chrom)
+              || var->pos < reg_beg || var->pos >= reg_end) {
+               return 0;
+          }
+     }
+     if (bed_cursor && ! bed_cursor_overlap(bed_cursor, -1, var->chrom, var->pos, var->pos+1)) {
+          return 0;
+     }
+     ign_list_add(var->chrom, var->pos);
+     return 1;
+}
+
+
+/* known variants are needed for every read overlapping reg, not only
+ * for those inside it. reads can start up to this many bases before
+ * reg and end up to this many bases after it (long, spliced or
+ * clipped reads included), so reg is padded by this much before being
+ * used to restrict loading. keeps call-parallel bins identical to a
+ * serial run.
+ */
+#define SQ_IGN_REG_PAD 1000000
+
+
+/* returns 1 if index file path + ext exists. if replace_ext is set
+ * path's own extension is replaced by ext instead (as in x.bai for
+ * x.bam) */
+static int
+index_file_exists(const char *path, const char *ext, const int replace_ext)
+{
+     char *idx_path;
+     char *dot;
+     int found;
+
+     if (NULL == (idx_path = malloc(strlen(path) + strlen(ext) + 1))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     strcpy(idx_path, path);
+     if (replace_ext) {
+          dot = strrchr(idx_path, '.');
+          if (! dot || strchr(dot, '/')) {
+               free(idx_path);
+               return 0;
+          }
+          *dot = '\0';
+     }
+     strcat(idx_path, ext);
+     found = (0 == access(idx_path, R_OK));
+     free(idx_path);
+     return found;
+}
+
+
+/* returns 1 if a tabix or csi index exists for vcf_path. checked
+ * before tbx_index_load to avoid htslib error messages */
+static int
+vcf_has_tbx_index(const char *vcf_path)
+{
+     return index_file_exists(vcf_path, ".tbi", 0) ||
+          index_file_exists(vcf_path, ".csi", 0);
+}
+
+
+/* returns 1 if an index exists for bam_path at one of the places
+ * sam_index_load() looks at. checked before sam_index_load() to avoid
+ * htslib warnings if an index is optional */
+static int
+bam_has_index(const char *bam_path)
+{
+     return index_file_exists(bam_path, ".bai", 0) ||
+          index_file_exists(bam_path, ".bai", 1) ||
+          index_file_exists(bam_path, ".csi", 0) ||
+          index_file_exists(bam_path, ".crai", 0);
 }
 
 
-/* FIXME ignore variants outside given region  (mplp_conf.reg)
- (on top of bed as well)
- * and use tabix API if indexed */
+/* loads positions of variants in vcf_path into the source quality
+ * ignore list. only variants in bed (if not NULL) and reg (if not
+ * NULL, padded by SQ_IGN_REG_PAD) are kept. if reg is given and
+ * vcf_path is bgzipped and indexed only that padded region is read.
+ * returns non-zero on error.
+ */
 int
-source_qual_load_ign_vcf(const char *vcf_path, void *bed)
+source_qual_load_ign_vcf(const char *vcf_path, void *bed, const char *reg)
 {
      vcf_file_t vcf_file;
      const int read_only_passed = 0;
      unsigned int num_total_vars = 0;
      unsigned int num_kept_vars = 0;
+     char *reg_chrom = NULL;
+     int reg_beg = 0, reg_end = INT_MAX;
+     void *bed_cursor = NULL; /* vcf is sorted, so lookups are mostly sequential */
+
+     if (reg) {
+          const char *q = hts_parse_reg(reg, &reg_beg, &reg_end);
+          if (! q) {
+               LOG_ERROR("Couldn't parse region %s\n", reg);
+               return 1;
+          }
+          if (NULL == (reg_chrom = strndup(reg, q-reg))) {
+               fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                       __FILE__, __FUNCTION__, __LINE__);
+               exit(1);
+          }
+          reg_beg = reg_beg > SQ_IGN_REG_PAD ? reg_beg - SQ_IGN_REG_PAD : 0;
+          reg_end = reg_end < INT_MAX - SQ_IGN_REG_PAD ? reg_end + SQ_IGN_REG_PAD : INT_MAX;
+     }
+     if (bed && NULL == (bed_cursor = bed_cursor_new(bed))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+
+     /* tabix access if possible */
+     if (reg && HAS_GZIP_EXT(vcf_path) && vcf_has_tbx_index(vcf_path)) {
+          tbx_t *tbx = NULL;
+          htsFile *hts = NULL;
+          hts_itr_t *itr = NULL;
+          kstring_t line = {0, 0, NULL};
+          int tid;
+          int rc = 0;
+
+          tbx = tbx_index_load(vcf_path);
+          if (tbx && NULL != (hts = hts_open(vcf_path, "r"))) {
+               /* tid < 0 or no itr: region not in vcf */
+               if ((tid = tbx_name2id(tbx, reg_chrom)) >= 0) {
+                    itr = tbx_itr_queryi(tbx, tid, reg_beg, reg_end);
+               }
+               while (itr && tbx_itr_next(hts, tbx, itr, &line) >= 0) {
+                    var_t *var;
+                    vcf_new_var(&var);
+                    if (vcf_parse_var_from_line(line.s, var)) {
+                         LOG_ERROR("Error while parsing variant returned from tabix for %s\n", vcf_path);
+                         vcf_free_var(&var);
+                         rc = 1;
+                         break;
+                    }
+                    num_total_vars += 1;
+                    if (! read_only_passed || VCF_VAR_PASSES(var)) {
+                         num_kept_vars += ign_list_add_var(var, bed_cursor, reg_chrom, reg_beg, reg_end);
+                    }
+                    vcf_free_var(&var);
+               }
+               if (itr) {
+                    tbx_itr_destroy(itr);
+               }
+               hts_close(hts);
+               tbx_destroy(tbx);
+               free(line.s);
+               free(reg_chrom);
+               if (rc) {
+                    bed_cursor_destroy(bed_cursor);
+                    return rc;
+               }
+               goto finalize;
+          }
+          if (tbx) {
+               tbx_destroy(tbx);
+          }
+     }
 
      if (vcf_file_open(& vcf_file, vcf_path,
                       HAS_GZIP_EXT(vcf_path), 'r')) {
          LOG_ERROR("Couldn't open %s\n", vcf_path);
+         free(reg_chrom);
+         bed_cursor_destroy(bed_cursor);
          return 1;
      }
 
      if (0 !=  vcf_skip_header(& vcf_file)) {
          LOG_WARN("%s\n", "vcf_skip_header() failed");
+         free(reg_chrom);
+         bed_cursor_destroy(bed_cursor);
          return 1;
      }
 
@@ -361,7 +1016,6 @@ source_qual_load_ign_vcf(const char *vcf_path, void *bed)
      */
     while (1) {
          var_t *var;
-         char *key;
          int rc;
 
          vcf_new_var(&var);
@@ -377,35 +1031,174 @@ source_qual_load_ign_vcf(const char *vcf_path, void *bed)
               continue;
          }
 
-         if (bed && ! bed_overlap(bed, var->chrom, var->pos, var->pos+1)) {
-              vcf_free_var(&var);
-              continue;
-         }
-
-         /* using key_pos_only i.e. chrom and pos only */
-         vcf_var_key_pos_only(&key, var);
-         /* since we only need the key and no other info we do
-          * not need to save the var (and save NULL instead) */
+         /* using chrom and pos only. since we need no other info we
+          * do not need to save the var */
+         num_kept_vars += ign_list_add_var(var, bed_cursor, reg_chrom, reg_beg, reg_end);
          vcf_free_var(&var);
-         var_hash_add(& source_qual_ign_vars_hash, key, NULL);
-         /* FIXME key used within vcf_free_var; dont free! */
     }
+    vcf_file_close(& vcf_file);
+    free(reg_chrom);
 
-    num_kept_vars = HASH_COUNT(source_qual_ign_vars_hash);
+finalize:
+    bed_cursor_destroy(bed_cursor);
     if (num_kept_vars) {
-         LOG_VERBOSE("Ignoring %d variants for SQ computation after reading %s\n",
-                     num_kept_vars, vcf_path);
+         LOG_VERBOSE("Ignoring %ld positions for SQ computation after reading %d variants from %s\n",
+                     ign_lists_finalize(), num_kept_vars, vcf_path);
     } else {
          LOG_WARN("None of the %d variants in %s were kept\n",
                   num_total_vars, vcf_path);
     }
-    vcf_file_close(& vcf_file);
 
     return 0;
 }
 
 
 
+/* source quality cache, one per thread (no locking). the source
+ * quality of a read only depends on the multiset of its op qualities
+ * and the number of non-matches, so these form the key: the number of
+ * non-matches followed by (quality, count) pairs for all qualities
+ * present in ascending order. bounded in size, the least recently used
+ * entry is evicted. also holds the scratch buffers of source_qual().
+ */
+#define SQ_CACHE_MAX_ENTRIES 8192
+#define SQ_CACHE_NUM_QUALS 256 /* key only possible for quals below */
+#define SQ_CACHE_KEY_MAX (1+2*SQ_CACHE_NUM_QUALS)
+
+typedef struct {
+     uint16_t *key;
+     int key_len; /* in bytes */
+     int src_qual;
+     UT_hash_handle hh;
+} sq_cache_entry_t;
+
+struct sq_cache_s {
+     sq_cache_entry_t *entries; /* uthash, least recently used first */
+     int num_entries;
+     long long int num_hits;
+     long long int num_lookups;
+
+     /* scratch */
+     int *op_quals[NUM_OP_CATS];
+     double *err_probs;
+     int size; /* allocated elements of each op_quals and err_probs */
+     int qual_hist[SQ_CACHE_NUM_QUALS];
+     uint16_t key[SQ_CACHE_KEY_MAX];
+};
+
+
+static sq_cache_t *
+sq_cache_new()
+{
+     sq_cache_t *c;
+     if (NULL == (c = calloc(1, sizeof(sq_cache_t)))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     return c;
+}
+
+
+static void
+sq_cache_destroy(sq_cache_t *c)
+{
+     sq_cache_entry_t *e, *e_tmp;
+     int i;
+
+     if (! c) {
+          return;
+     }
+     LOG_DEBUG("source quality cache: %lld hits in %lld lookups\n",
+               c->num_hits, c->num_lookups);
+     HASH_ITER(hh, c->entries, e, e_tmp) {
+          HASH_DEL(c->entries, e);
+          free(e->key);
+          free(e);
+     }
+     for (i=0; i<NUM_OP_CATS; i++) {
+          free(c->op_quals[i]);
+     }
+     free(c->err_probs);
+     free(c);
+}
+
+
+/* makes sure scratch buffers hold at least n elements */
+static void
+sq_cache_reserve(sq_cache_t *c, const int n)
+{
+     int i;
+
+     if (n <= c->size) {
+          return;
+     }
+     c->size = n;
+     for (i=0; i<NUM_OP_CATS; i++) {
+          if (NULL == (c->op_quals[i] = realloc(c->op_quals[i], c->size * sizeof(int)))) {
+               fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                       __FILE__, __FUNCTION__, __LINE__);
+               exit(1);
+          }
+     }
+     if (NULL == (c->err_probs = realloc(c->err_probs, c->size * sizeof(double)))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+}
+
+
+static sq_cache_entry_t *
+sq_cache_find(sq_cache_t *c, const int key_len)
+{
+     sq_cache_entry_t *e = NULL;
+
+     c->num_lookups += 1;
+     HASH_FIND(hh, c->entries, c->key, key_len, e);
+     if (e) {
+          /* move to end, i.e. mark as most recently used */
+          HASH_DELETE(hh, c->entries, e);
+          HASH_ADD_KEYPTR(hh, c->entries, e->key, e->key_len, e);
+          c->num_hits += 1;
+     }
+     return e;
+}
+
+
+static void
+sq_cache_add(sq_cache_t *c, const int key_len, const int src_qual)
+{
+     sq_cache_entry_t *e;
+
+     if (c->num_entries >= SQ_CACHE_MAX_ENTRIES) {
+          /* evict least recently used and reuse it */
+          e = c->entries;
+          HASH_DELETE(hh, c->entries, e);
+          if (e->key_len < key_len) {
+               free(e->key);
+               e->key = NULL;
+          }
+     } else {
+          if (NULL == (e = calloc(1, sizeof(sq_cache_entry_t)))) {
+               fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                       __FILE__, __FUNCTION__, __LINE__);
+               exit(1);
+          }
+          c->num_entries += 1;
+     }
+     if (! e->key && NULL == (e->key = malloc(key_len))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     memcpy(e->key, c->key, key_len);
+     e->key_len = key_len;
+     e->src_qual = src_qual;
+     HASH_ADD_KEYPTR(hh, c->entries, e->key, e->key_len, e);
+}
+
+
 /* Estimate as to how likely it is that this read, given the mapping,
  * comes from this reference genome. P(r not from g|mapping) = 1 - P(r
  * from g).
@@ -430,10 +1223,12 @@ source_qual_load_ign_vcf(const char *vcf_path, void *bed)
  */
 int
 source_qual(const bam1_t *b, const char *ref,
-            const int nonmatch_qual, char *target, int min_bq)
+            const int nonmatch_qual, char *target, int min_bq,
+            sq_cache_t *cache)
 {
      int op_counts[NUM_OP_CATS];
-     int **op_quals = NULL;
+     int **op_quals = cache->op_quals;
+     int *qual_hist = cache->qual_hist;
 
      double *probvec = NULL;
      int num_non_matches = -1; /* non-matching operations */
@@ -445,25 +1240,15 @@ source_qual(const bam1_t *b, const char *ref,
      int src_qual = -1;
      double src_prob = -1; /* prob of this read coming from genome */
      int err_prob_idx;
-     int i, j;
+     int use_cache = 1;
+     int key_len = 0;
+     int i, j, q;
 
      int qlen = b->core.l_qseq;
 
-     /* alloc op_quals
-      */
-     if (NULL == (op_quals = malloc(NUM_OP_CATS * sizeof(int *)))) {
-          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
-                  __FILE__, __FUNCTION__, __LINE__);
-          exit(1);
-     }
-     for (i=0; i<NUM_OP_CATS; i++) {
-          if (NULL == (op_quals[i] = malloc(qlen * sizeof(int)))) {/* over allocating */
-               fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
-                       __FILE__, __FUNCTION__, __LINE__);
-               free(op_quals);
-               exit(1);
-          }
-     }
+     /* over allocating: every base is at most one op and deletions
+      * (one op each) need bases in between */
+     sq_cache_reserve(cache, 2*(qlen+1));
 
      /* count match operations and get qualities for them
       */
@@ -471,20 +1256,17 @@ source_qual(const bam1_t *b, const char *ref,
      num_err_probs = count_cigar_ops(op_counts, op_quals, b, ref, min_bq, target);
      if (1 > num_err_probs) {
 #ifdef TRACE
-          LOG_DEBUG("count_cigar_ops returned %d counts on read %s\n", num_err_probs, bam1_qname(b));
+          LOG_DEBUG("count_cigar_ops returned %d counts on read %s\n", num_err_probs, bam_get_qname(b));
 #endif
           src_qual = -1;
           goto free_and_exit;
      }
 
-     /* alloc and fill err_probs with quals returned per op-cat from
-      * count_cigar_ops
+     /* histogram of the qualities (replaced with nonmatch_qual if
+      * given) which together with the number of non-matches is all
+      * the result depends on
       */
-     if (NULL == (err_probs = malloc(num_err_probs * sizeof(double)))) {
-          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
-                  __FILE__, __FUNCTION__, __LINE__);
-          exit(1);
-     }
+     memset(qual_hist, 0, SQ_CACHE_NUM_QUALS * sizeof(int));
      num_non_matches = 0;
      err_prob_idx = 0;
      for (i=0; i<NUM_OP_CATS; i++) {
@@ -505,12 +1287,18 @@ source_qual(const bam1_t *b, const char *ref,
                } else {
                     qual = op_quals[i][j];
                }
-               err_probs[err_prob_idx] = PHREDQUAL_TO_PROB(qual);
-               /*LOG_FIXME("err_probs[%d] = %f (nonmatch_qual=%d op_quals[i=%d][j=%d]=%d)\n", err_prob_idx, err_probs[err_prob_idx], nonmatch_qual, i, j, op_quals[i][j]);*/
+               if (qual >= 0 && qual < SQ_CACHE_NUM_QUALS) {
+                    qual_hist[qual] += 1;
+               } else {
+                    use_cache = 0;
+               }
                err_prob_idx += 1;
           }
      }
      assert(err_prob_idx == num_err_probs);
+#ifdef SOURCEQUAL_USES_PAIRS
+     use_cache = 0; /* result depends on read flags as well */
+#endif
 
      /*  need num_non_matches-1 */
      orig_num_non_matches = num_non_matches;
@@ -526,6 +1314,59 @@ source_qual(const bam1_t *b, const char *ref,
           goto free_and_exit;
      }
 
+     if (use_cache && num_non_matches <= UINT16_MAX) {
+          cache->key[key_len++] = num_non_matches;
+          for (q=0; q<SQ_CACHE_NUM_QUALS && use_cache; q++) {
+               if (! qual_hist[q]) {
+                    continue;
+               }
+               if (qual_hist[q] > UINT16_MAX) {
+                    use_cache = 0;
+               }
+               cache->key[key_len++] = q;
+               cache->key[key_len++] = qual_hist[q];
+          }
+          if (use_cache) {
+               sq_cache_entry_t *e = sq_cache_find(cache, key_len * sizeof(uint16_t));
+               if (e) {
+                    src_qual = e->src_qual;
+                    goto free_and_exit;
+               }
+          }
+     } else {
+          use_cache = 0;
+     }
+
+     /* fill err_probs with quals returned per op-cat from
+      * count_cigar_ops. sorting in theory should be numerically more
+      * stable and also make poissbin faster. the histogram gives
+      * them sorted for free (high qual = low error prob first)
+      */
+     err_probs = cache->err_probs;
+     err_prob_idx = 0;
+     if (use_cache) {
+          for (q=SQ_CACHE_NUM_QUALS-1; q>=0; q--) {
+               const double e = phredqual_to_prob(q);
+               for (j=0; j<qual_hist[q]; j++) {
+                    err_probs[err_prob_idx++] = e;
+               }
+          }
+     } else {
+          for (i=0; i<NUM_OP_CATS; i++) {
+#ifdef SOURCEQUAL_IGNORES_INDELS
+               if (i==OP_INS || i==OP_DEL) {
+                    continue;
+               }
+#endif
+               for (j=0; j<op_counts[i]; j++) {
+                    int qual = nonmatch_qual >= 0 ? nonmatch_qual : op_quals[i][j];
+                    err_probs[err_prob_idx++] = phredqual_to_prob(qual);
+               }
+          }
+          errprobs_sort(err_probs, num_err_probs);
+     }
+     assert(err_prob_idx == num_err_probs);
+
 #ifdef SOURCEQUAL_USES_PAIRS
      if ((b->core.flag&BAM_FPAIRED) && (b->core.flag&BAM_FPROPER_PAIR)) {
           double median_err = dbl_median(err_probs, num_err_probs);
@@ -535,15 +1376,13 @@ source_qual(const bam1_t *b, const char *ref,
              current one */
           
           num_err_probs *= 2;
-          if (NULL == (err_probs = realloc(err_probs, num_err_probs * sizeof(double)))) {
-               fprintf(stderr, "FATAL: couldn't reallocate memory at %s:%s():%d\n",
-                       __FILE__, __FUNCTION__, __LINE__);
-               exit(1);
-          }
+          sq_cache_reserve(cache, num_err_probs);
+          err_probs = cache->err_probs;
           for (i=err_prob_idx-1; i<num_err_probs; i++) {
                err_probs[i] = median_err;
           }
           LOG_FIXME("median_err = %f\n", median_err);
+          errprobs_sort(err_probs, num_err_probs);
      }
 #endif
 
@@ -551,10 +1390,6 @@ source_qual(const bam1_t *b, const char *ref,
       * given quals? or: how likely is this read from the genome.
       * 1-src_value = prob read is not from genome
       */
-
-     /* sorting in theory should be numerically more stable and also
-      * make poissbin faster */
-     qsort(err_probs, num_err_probs, sizeof(double), dbl_cmp);
      probvec = poissbin(&unused_pval, err_probs,
                         num_err_probs, num_non_matches, 1.0, 0.05);
      /* need prob not pv */
@@ -572,15 +1407,11 @@ source_qual(const bam1_t *b, const char *ref,
      free(probvec);
      src_qual = PROB_TO_PHREDQUAL(1.0 - src_prob);
 
-
-free_and_exit:
-     for (i=0; i<NUM_OP_CATS; i++) {
-          free(op_quals[i]);
+     if (use_cache) {
+          sq_cache_add(cache, key_len * sizeof(uint16_t), src_qual);
      }
-     free(op_quals);
-
-     free(err_probs);
 
+free_and_exit:
      /* if we wanted to use softening from precomputed stats then add
       * all non-matches up instead of using the matches */
 #if 0
@@ -598,21 +1429,78 @@ free_and_exit:
 
 
 
-/* not part of offical samtools/htslib API but part of samtools */
+/* switches ma->iter to the next bed query. returns 0 if there is
+ * none */
 static int
-mplp_func(void *data, bam1_t *b)
+mplp_next_bed_query(mplp_aux_t *ma)
+{
+     const bed_query_t *q;
+
+     if (ma->iter) {
+          hts_itr_destroy(ma->iter);
+          ma->iter = NULL;
+          q = & ma->bed_queries[ma->next_bed_query-1];
+          ma->prev_query_tid = q->tid;
+          ma->prev_query_end = q->end;
+     }
+     if (ma->next_bed_query >= ma->num_bed_queries) {
+          return 0;
+     }
+     q = & ma->bed_queries[ma->next_bed_query++];
+     if (NULL == (ma->iter = sam_itr_queryi(ma->idx, q->tid, q->beg, q->end))) {
+          LOG_FATAL("Index query failed for %s:%d-%d\n",
+                    ma->h->target_name[q->tid], q->beg+1, q->end);
+          exit(1);
+     }
+     return 1;
+}
+
+
+/* reads the next read overlapping a bed query. a read overlapping
+ * two queries is returned only once: if it starts before the end of
+ * the previous query it also overlaps that one, i.e. it was returned
+ * already */
+static int
+mplp_bed_read(mplp_aux_t *ma, bam1_t *b)
+{
+     int ret;
+
+     while (1) {
+          ret = ma->iter ? sam_itr_next(ma->fp, ma->iter, b) : -1;
+          if (ret >= 0) {
+               if (b->core.tid == ma->prev_query_tid && b->core.pos < ma->prev_query_end) {
+                    continue;
+               }
+               return ret;
+          }
+          if (ret < -1 || ! mplp_next_bed_query(ma)) {
+               return ret;
+          }
+     }
+}
+
+
+/* reads the next read passing all read-level filters into b. if
+ * fetch_ref is set, ma->ref is made to point to the read's reference
+ * sequence. not part of offical samtools/htslib API but part of
+ * samtools' mplp_func() */
+static int
+mplp_read_filtered(mplp_aux_t *ma, bam1_t *b, const int fetch_ref)
 {
-     mplp_aux_t *ma = (mplp_aux_t*)data;
      int ret, skip = 0;
 
      do {
           int has_ref;
-          ret = ma->iter? bam_iter_read(ma->fp, ma->iter, b) : bam_read1(ma->fp, b);
+          if (ma->bed_queries) {
+               ret = mplp_bed_read(ma, b);
+          } else {
+               ret = ma->iter? sam_itr_next(ma->fp, ma->iter, b) : sam_read1(ma->fp, ma->h, b);
+          }
           if (ret < 0)
                break;
 
 #ifdef TRACE
-          LOG_DEBUG("Got read %s with flag %d\n", bam1_qname(b), core.flag);
+          LOG_DEBUG("Got read %s with flag %d\n", bam_get_qname(b), core.flag);
 #endif
           if (b->core.tid < 0 || (b->core.flag&BAM_FUNMAP)) { /* exclude unmapped reads */
                skip = 1;
@@ -621,13 +1509,13 @@ mplp_func(void *data, bam1_t *b)
          
           if (b->core.flag & BAM_DEF_MASK) {/* == BAM_FUNMAP | BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP */
 #ifdef TRACE
-               LOG_DEBUG("%s BAM_DEF_MASK match\n", bam1_qname(b));
+               LOG_DEBUG("%s BAM_DEF_MASK match\n", bam_get_qname(b));
 #endif
                skip = 1; 
                continue;
           }
-          if (ma->conf->bed) { /* test overlap */
-               skip = !bed_overlap(ma->conf->bed, ma->h->target_name[b->core.tid], b->core.pos, bam_calend(&b->core, bam1_cigar(b)));
+          if (ma->bed_cursor) { /* test overlap */
+               skip = !bed_cursor_overlap(ma->bed_cursor, b->core.tid, ma->h->target_name[b->core.tid], b->core.pos, bam_endpos(b));
                if (skip)
                     continue;
           }
@@ -638,113 +1526,461 @@ mplp_func(void *data, bam1_t *b)
                for (i = 0; i < b->core.l_qseq; ++i)
                     qual[i] = qual[i] > 31? qual[i] - 31 : 0;
           }
-          has_ref = (ma->ref && ma->ref_id == b->core.tid)? 1 : 0;
+          has_ref = (ma->ref && ma->ref_id == b->core.tid &&
+                     b->core.pos >= ma->ref_beg && bam_endpos(b) <= ma->ref_end)? 1 : 0;
 
           /* lofreq fix to original samtools routines which ensures that
            * the reads mapping to first position have a reference
            * attached as well and therefore baq, sq etc can be
            * applied */
-          if (! has_ref && ma->conf->fai) {
+          if (fetch_ref && ! has_ref && ma->conf->ref_file) {
                int ref_len = -1;
-               ma->ref = faidx_fetch_seq(ma->conf->fai, ma->h->target_name[b->core.tid], 0, 0x7fffffff, &ref_len);
+               int beg = b->core.pos, end = bam_endpos(b);
+               if (ma->ref && ma->ref_id == b->core.tid) {
+                    /* grow window, so that we don't refetch for every read */
+                    beg = beg < ma->ref_beg ? beg : ma->ref_beg;
+                    end = end > ma->ref_end ? end : ma->ref_end;
+               }
+               plp_ref_window(ma->conf, &beg, &end);
+               plp_release_ref(ma->conf, ma->own_ref);
+               ma->own_ref = ma->ref = plp_fetch_ref(ma->conf, ma->h->target_name[b->core.tid],
+                                                     beg, end, &ref_len);
+               ma->ref_beg = beg;
+               ma->ref_end = end;
                if (!ma->ref) {
                     LOG_FATAL("Couldn't fetch sequence '%s'.\n", ma->h->target_name[b->core.tid]);
                     exit(1);/* FIXME just returning would just skip calls for this seq */
 
-               } else {
-                    strtoupper(ma->ref);/* safeguard */
-                    ma->ref_id = b->core.tid;
-                    has_ref = 1;
+               } else {
+                    ma->ref_id = b->core.tid;
+               }
+          }
+
+          skip = 0;
+        if (b->core.qual > ma->conf->max_mq) {
+             b->core.qual = ma->conf->max_mq;
+        } else if (b->core.qual < ma->conf->min_mq) {
+             skip = 1;
+        }
+        /* never tried RELAXED_ORPHAN. most examples I saw where orphans matter evaluate to true under both conditions anyway */
+#ifdef RELAXED_ORPHAN
+        /* only orphan if mate is wrongly mapped (but not unmapped) */
+        else if ((ma->conf->flag&MPLP_NO_ORPHAN) && (b->core.flag&BAM_FPAIRED) && !(b->core.flag&BAM_FMUNMAP)) {
+#else
+        /* orphan as in samtools: read is aligned but not as proper pair as defined by aligner */
+        else if ((ma->conf->flag&MPLP_NO_ORPHAN) && (b->core.flag&BAM_FPAIRED) && !(b->core.flag&BAM_FPROPER_PAIR)) {
+#endif
+             skip = 1;
+        }
+    } while (skip);
+
+    return ret;
+}
+
+
+/* the expensive part of read processing: computes BAQ/IDAQ and
+ * source quality if requested. ref is the read's reference sequence
+ * (or NULL). only touches b, so can be run on several reads in
+ * parallel (see read_pool_t) */
+static void
+mplp_read_finish(const mplp_conf_t *conf, bam1_t *b, const char *ref, char *target_name,
+                 sq_cache_t *sq_cache)
+{
+#if 0
+     {
+          fprintf(stderr, "before realn\n");
+          samfile_t *fp = samopen("-", "w",  ma->h);
+          samwrite(fp, b);
+          fflush(stdout);
+     }
+#endif
+     if (conf->flag & MPLP_BAQ || conf->flag & MPLP_IDAQ) {
+          int baq_flag = conf->flag & MPLP_BAQ ? 1 : 0;
+          int baq_ext =  conf->flag & MPLP_EXT_BAQ ? 1 : 0;
+          int idaq_flag = conf->flag & MPLP_IDAQ ? 1 : 0;
+
+          if (! ref) {
+               LOG_FATAL("%s\n", "Can't compute BAQ or IDAQ without reference sequence");
+               exit(1);
+          }
+          if (baq_flag && conf->flag & MPLP_REDO_BAQ) {
+               baq_flag = 2;
+          }                    
+
+          if (bam_prob_realn_core_ext(b, ref, baq_flag, baq_ext, idaq_flag)) {
+               LOG_ERROR("bam_prob_realn_core() failed for %s\n", bam_get_qname(b));
+          }
+
+#if 0
+          {
+               uint8_t *baq_aux = NULL;
+               baq_aux = bam_aux_get(b, BAQ_TAG);
+               if (! baq_aux) {
+                    LOG_ERROR("bam_prob_realn_core() didn't report an error but %s is missing. Can happen on refskips etc\n", BAQ_TAG);
+               }
+
+          }
+#endif
+     }
+
+    /* compute source qual if requested and have ref and attach as aux
+     * to bam. only disadvantage of doing this here is that we don't
+     * have BAQ info yet (only interesting if it's supposed to be used
+     * instead of BQ) only have the ref but not the cons base.
+     */
+    if (ref && conf->flag & MPLP_USE_SQ) {
+         int sq = source_qual(b, ref, conf->def_nm_q,
+                              target_name, DEFAULT_MIN_BQ/* FIXME could use->conf->min_bq which is set to a conservative 3 */,
+                              sq_cache);
+         /* -1 indicates error or NA, but can't be stored as uint. hack is to use 0 instead */
+         if (sq<0) {
+              sq=0;
+         }
+         bam_aux_append(b, SRC_QUAL_TAG, 'i', sizeof(sq), (uint8_t*) &sq);
+#if 0
+         int sq2 = bam_aux2i(bam_aux_get(b, SRC_QUAL_TAG));
+         LOG_WARN("sq=%d sq2=%d\n", sq, sq2);
+#endif
+    }
+}
+
+
+/* read pool: reads are read and filtered by the pileup thread in
+ * batches (all reads of a batch are on the same sequence). the
+ * expensive mplp_read_finish() is run by a pool of threads on the
+ * batch ahead, while the pileup consumes the previous batch. reads are
+ * handed back in input order.
+ */
+#define READ_BATCH_SIZE 4096
+#define READ_SLICE_SIZE 32 /* reads handed to a worker at once */
+
+typedef struct {
+     bam1_t **reads; /* READ_BATCH_SIZE preallocated reads */
+     int n; /* number of reads in batch */
+     int next; /* next read handed to pileup */
+     int tid;
+     char *ref; /* reference of tid (owned, i.e. release when done) */
+     int next_slice; /* first read not yet taken by a worker */
+     int num_done; /* number of reads processed by workers */
+} read_batch_t;
+
+struct read_pool_s {
+     mplp_aux_t *ma;
+     pthread_t *threads;
+     int num_threads;
+     pthread_mutex_t lock;
+     pthread_cond_t work; /* new batch or shutdown */
+     pthread_cond_t done; /* batch done */
+     read_batch_t batches[2];
+     read_batch_t *cur; /* consumed by pileup */
+     read_batch_t *ahead; /* processed by workers. NULL if none */
+     bam1_t *pending; /* first read of next batch */
+     int has_pending;
+     int eof;
+     int shutdown;
+};
+
+
+static void *
+read_pool_worker(void *arg)
+{
+     read_pool_t *pool = (read_pool_t *)arg;
+     sq_cache_t *sq_cache = NULL; /* per thread */
+
+     if (pool->ma->conf->flag & MPLP_USE_SQ) {
+          sq_cache = sq_cache_new();
+     }
+
+     pthread_mutex_lock(& pool->lock);
+     while (1) {
+          read_batch_t *batch;
+          int i, start, end;
+
+          while (! pool->shutdown &&
+                 ! (pool->ahead && pool->ahead->next_slice < pool->ahead->n)) {
+               pthread_cond_wait(& pool->work, & pool->lock);
+          }
+          if (pool->shutdown) {
+               break;
+          }
+          batch = pool->ahead;
+          start = batch->next_slice;
+          end = start + READ_SLICE_SIZE < batch->n ? start + READ_SLICE_SIZE : batch->n;
+          batch->next_slice = end;
+          pthread_mutex_unlock(& pool->lock);
+
+          for (i = start; i < end; i++) {
+               mplp_read_finish(pool->ma->conf, batch->reads[i], batch->ref,
+                                pool->ma->h->target_name[batch->tid], sq_cache);
+          }
+
+          pthread_mutex_lock(& pool->lock);
+          batch->num_done += end - start;
+          if (batch->num_done == batch->n) {
+               pthread_cond_broadcast(& pool->done);
+          }
+     }
+     pthread_mutex_unlock(& pool->lock);
+     sq_cache_destroy(sq_cache);
+     return NULL;
+}
+
+
+static void
+bam_swap(bam1_t *a, bam1_t *b)
+{
+     bam1_t tmp = *a;
+     *a = *b;
+     *b = tmp;
+}
+
+
+/* fill batch with the next filtered reads (single thread) and hand it
+ * to the workers */
+static void
+read_pool_fill(read_pool_t *pool, read_batch_t *batch)
+{
+     mplp_aux_t *ma = pool->ma;
+     int beg = INT_MAX, end = 0;
+
+     plp_release_ref(ma->conf, batch->ref);
+     batch->ref = NULL;
+     batch->tid = -1;
+     batch->n = batch->next = batch->next_slice = batch->num_done = 0;
+
+     while (! pool->eof && batch->n < READ_BATCH_SIZE) {
+          bam1_t *b = batch->reads[batch->n];
+          if (pool->has_pending) {
+               bam_swap(b, pool->pending);
+               pool->has_pending = 0;
+          } else if (mplp_read_filtered(ma, b, 0) < 0) {
+               pool->eof = 1;
+               break;
+          }
+          if (batch->tid >= 0 && b->core.tid != batch->tid) {
+               bam_swap(b, pool->pending);
+               pool->has_pending = 1;
+               break;
+          }
+          if (batch->tid < 0) {
+               batch->tid = b->core.tid;
+          }
+          if (b->core.pos < beg) {
+               beg = b->core.pos;
+          }
+          if (bam_endpos(b) > end) {
+               end = bam_endpos(b);
+          }
+          batch->n++;
+     }
+     if (batch->n && ma->conf->ref_file) {
+          int ref_len = -1;
+          plp_ref_window(ma->conf, &beg, &end);
+          batch->ref = plp_fetch_ref(ma->conf, ma->h->target_name[batch->tid], beg, end, &ref_len);
+          if (! batch->ref) {
+               LOG_FATAL("Couldn't fetch sequence '%s'.\n", ma->h->target_name[batch->tid]);
+               exit(1);
+          }
+     }
+
+     pthread_mutex_lock(& pool->lock);
+     pool->ahead = batch;
+     pthread_cond_broadcast(& pool->work);
+     pthread_mutex_unlock(& pool->lock);
+}
+
+
+/* mplp_func() replacement if a read pool is used */
+static int
+read_pool_next(read_pool_t *pool, bam1_t *b)
+{
+     read_batch_t *cur = pool->cur;
+
+     if (cur->next == cur->n) {
+          read_batch_t *recycle = cur;
+          if (! pool->ahead) {
+               if (pool->eof && ! pool->has_pending) {
+                    return -1;
                }
+               read_pool_fill(pool, recycle == & pool->batches[0] ? & pool->batches[1] : & pool->batches[0]);
+          }
+          pthread_mutex_lock(& pool->lock);
+          while (pool->ahead->num_done < pool->ahead->n) {
+               pthread_cond_wait(& pool->done, & pool->lock);
           }
+          cur = pool->cur = pool->ahead;
+          pool->ahead = NULL;
+          pthread_mutex_unlock(& pool->lock);
 
-          skip = 0;
-#if 0
-          {
-               fprintf(stderr, "before realn\n");
-               samfile_t *fp = samopen("-", "w",  ma->h);
-               samwrite(fp, b);
-               fflush(stdout);
+          if (cur->n == 0) {
+               return -1;
           }
-#endif
-          if (ma->conf->flag & MPLP_BAQ || ma->conf->flag & MPLP_IDAQ) {
-               int baq_flag = ma->conf->flag & MPLP_BAQ ? 1 : 0;
-               int baq_ext =  ma->conf->flag & MPLP_EXT_BAQ ? 1 : 0;
-               int idaq_flag = ma->conf->flag & MPLP_IDAQ ? 1 : 0;
+          /* refill the consumed batch while the pileup works on this one */
+          if (! pool->eof || pool->has_pending) {
+               read_pool_fill(pool, recycle);
+          }
+     }
 
-               if (! has_ref) {
-                    LOG_FATAL("%s\n", "Can't compute BAQ or IDAQ without reference sequence");
-                    exit(1);
-               }
-               if (baq_flag && ma->conf->flag & MPLP_REDO_BAQ) {
-                    baq_flag = 2;
-               }                    
+     bam_swap(b, cur->reads[cur->next++]);
+     return 0;
+}
 
-               if (bam_prob_realn_core_ext(b, ma->ref, baq_flag, baq_ext, idaq_flag)) {
-                    LOG_ERROR("bam_prob_realn_core() failed for %s\n", bam1_qname(b));
-               }
 
-#if 0
-               {
-                    uint8_t *baq_aux = NULL;
-                    baq_aux = bam_aux_get(b, BAQ_TAG);
-                    if (! baq_aux) {
-                         LOG_ERROR("bam_prob_realn_core() didn't report an error but %s is missing. Can happen on refskips etc\n", BAQ_TAG);
-                    }
+static read_pool_t *
+read_pool_new(mplp_aux_t *ma, const int num_threads)
+{
+     read_pool_t *pool;
+     int i, j;
 
-               }
-#endif
+     if (NULL == (pool = calloc(1, sizeof(read_pool_t)))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          return NULL;
+     }
+     pool->ma = ma;
+     for (i = 0; i < 2; i++) {
+          pool->batches[i].reads = calloc(READ_BATCH_SIZE, sizeof(bam1_t *));
+          for (j = 0; j < READ_BATCH_SIZE; j++) {
+               pool->batches[i].reads[j] = bam_init1();
+          }
+          pool->batches[i].tid = -1;
+     }
+     pool->cur = & pool->batches[0];
+     pool->pending = bam_init1();
+     pthread_mutex_init(& pool->lock, NULL);
+     pthread_cond_init(& pool->work, NULL);
+     pthread_cond_init(& pool->done, NULL);
+
+     /* lazily initialized tables */
+     kpa_ext_init();
+     init_phred_tables();
+
+     pool->threads = calloc(num_threads, sizeof(pthread_t));
+     for (i = 0; i < num_threads; i++) {
+          if (pthread_create(& pool->threads[i], NULL, read_pool_worker, pool)) {
+               LOG_FATAL("%s\n", "Couldn't create thread");
+               exit(1);
           }
+          pool->num_threads++;
+     }
+     return pool;
+}
 
-#if 0
-          {
-               fprintf(stdout, "after realn\n");
-               samfile_t *fp = samopen("-", "w",  ma->h);
-               samwrite(fp, b);
-               fflush(stdout);
+
+static void
+read_pool_destroy(read_pool_t *pool)
+{
+     int i, j;
+
+     if (! pool) {
+          return;
+     }
+     pthread_mutex_lock(& pool->lock);
+     /* let workers finish a batch in flight */
+     while (pool->ahead && pool->ahead->num_done < pool->ahead->n) {
+          pthread_cond_wait(& pool->done, & pool->lock);
+     }
+     pool->shutdown = 1;
+     pthread_cond_broadcast(& pool->work);
+     pthread_mutex_unlock(& pool->lock);
+     for (i = 0; i < pool->num_threads; i++) {
+          pthread_join(pool->threads[i], NULL);
+     }
+     free(pool->threads);
+
+     for (i = 0; i < 2; i++) {
+          plp_release_ref(pool->ma->conf, pool->batches[i].ref);
+          for (j = 0; j < READ_BATCH_SIZE; j++) {
+               bam_destroy1(pool->batches[i].reads[j]);
           }
-      
-#endif
+          free(pool->batches[i].reads);
+     }
+     bam_destroy1(pool->pending);
+     pthread_cond_destroy(& pool->done);
+     pthread_cond_destroy(& pool->work);
+     pthread_mutex_destroy(& pool->lock);
+     free(pool);
+}
 
-        if (b->core.qual > ma->conf->max_mq) {
-             b->core.qual = ma->conf->max_mq;
-        } else if (b->core.qual < ma->conf->min_mq) {
-             skip = 1;
-        }
-        /* never tried RELAXED_ORPHAN. most examples I saw where orphans matter evaluate to true under both conditions anyway */
-#ifdef RELAXED_ORPHAN
-        /* only orphan if mate is wrongly mapped (but not unmapped) */
-        else if ((ma->conf->flag&MPLP_NO_ORPHAN) && (b->core.flag&BAM_FPAIRED) && !(b->core.flag&BAM_FMUNMAP)) {
-#else
-        /* orphan as in samtools: read is aligned but not as proper pair as defined by aligner */
-        else if ((ma->conf->flag&MPLP_NO_ORPHAN) && (b->core.flag&BAM_FPAIRED) && !(b->core.flag&BAM_FPROPER_PAIR)) {
-#endif
-             skip = 1;
-        }
-    } while (skip);
 
-    /* compute source qual if requested and have ref and attach as aux
-     * to bam. only disadvantage of doing this here is that we don't
-     * have BAQ info yet (only interesting if it's supposed to be used
-     * instead of BQ) only have the ref but not the cons base.
-     */
-    if (ma->ref && ma->ref_id == b->core.tid && ma->conf->flag & MPLP_USE_SQ) {
-         int sq = source_qual(b, ma->ref, ma->conf->def_nm_q,
-                              ma->h->target_name[b->core.tid], DEFAULT_MIN_BQ/* FIXME could use->conf->min_bq which is set to a conservative 3 */);
-         /* -1 indicates error or NA, but can't be stored as uint. hack is to use 0 instead */
-         if (sq<0) {
-              sq=0;
-         }
-         bam_aux_append(b, SRC_QUAL_TAG, 'i', sizeof(sq), (uint8_t*) &sq);
-#if 0
-         int sq2 = bam_aux2i(bam_aux_get(b, SRC_QUAL_TAG));
-         LOG_WARN("sq=%d sq2=%d\n", sq, sq2);
+static int
+mplp_func(void *data, bam1_t *b)
+{
+     mplp_aux_t *ma = (mplp_aux_t*)data;
+     int ret;
+
+     if (ma->pool) {
+          return read_pool_next(ma->pool, b);
+     }
+
+     ret = mplp_read_filtered(ma, b, 1);
+     if (ret >= 0) {
+          mplp_read_finish(ma->conf, b,
+                           (ma->ref && ma->ref_id == b->core.tid &&
+                            b->core.pos >= ma->ref_beg && bam_endpos(b) <= ma->ref_end) ? ma->ref : NULL,
+                           ma->h->target_name[b->core.tid], ma->sq_cache);
+     }
+     return ret;
+}
+
+
+/* bam_mplp_constructor() callback: decode aux fields of a read that
+ * enters the pileup. see plp_read_t */
+static int
+plp_read_construct(void *data, const bam1_t *b, bam_pileup_cd *cd)
+{
+     mplp_aux_t *ma = (mplp_aux_t*)data;
+     plp_read_t *r;
+
+     if (ma->free_reads) {
+          r = ma->free_reads;
+          ma->free_reads = r->next;
+     } else if (NULL == (r = malloc(sizeof(plp_read_t)))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+
+     r->bi = bam_aux_get(b, BI_TAG);
+     r->bd = bam_aux_get(b, BD_TAG);
+     r->ai = bam_aux_get(b, AI_TAG);
+     r->ad = bam_aux_get(b, AD_TAG);
+#ifdef USE_OLD_AI_AD
+     /* temporary fix preventing problems due to the fact that we changed AI AD to ai ad
+      * to be deleted soon
+      */
+     if (! r->ai) {
+          r->ai = bam_aux_get(b, "AI");
+     }
+     if (! r->ad) {
+          r->ad = bam_aux_get(b, "AD");
+     }
 #endif
-    }
+     r->baq = ma->conf->flag & MPLP_BAQ ? bam_aux_get(b, BAQ_TAG) : NULL;
+     r->sq = ma->conf->flag & MPLP_USE_SQ ? bam_aux2i(bam_aux_get(b, SRC_QUAL_TAG)) : -1;
+     r->next = NULL;
 
-    return ret;
+     cd->p = r;
+     return 0;
+}
+
+
+/* bam_mplp_destructor() callback: recycle plp_read_t */
+static int
+plp_read_destruct(void *data, const bam1_t *b, bam_pileup_cd *cd)
+{
+     mplp_aux_t *ma = (mplp_aux_t*)data;
+     plp_read_t *r = (plp_read_t *)cd->p;
+
+     if (r) {
+          r->next = ma->free_reads;
+          ma->free_reads = r;
+          cd->p = NULL;
+     }
+     return 0;
 }
 
+
 /* homopolymer run at (to the right of) current
                 * position. if indels are not left aligned and current
                 * position is already a homopolymer this will be taken
@@ -788,8 +2024,46 @@ get_hrun(const int pos, const char *ref, const int ref_len)
      return hrun;
 }
 
-/* Press pileup info into one data-structure. plp_col members
- * allocated here. Called must free with plp_col_free();
+/* quick scan of a pileup column before compile_plp_col(): returns 1
+ * if the column contains a base differing from the reference or an
+ * indel, 0 otherwise. columns with 'N' or no reference can't be called
+ * against and return 0 as well.
+ */
+static int
+plp_has_nonref(const bam_pileup1_t *plp, const int n_plp,
+               const char *ref, const int pos, const int ref_len)
+{
+     int i, ref_nt4;
+
+     if (! ref || pos >= ref_len || ref[pos] == 'N') {
+          return 0;
+     }
+     ref_nt4 = bam_nt4_table[(int)ref[pos]];
+     if (ref_nt4 == 4) {
+          /* ambiguity code: can't tell */
+          return 1;
+     }
+     for (i = 0; i < n_plp; ++i) {
+          const bam_pileup1_t *p = plp + i;
+          if (p->indel) {
+               return 1;
+          }
+          if (p->is_del || p->is_refskip) {
+               continue;
+          }
+          if (bam_nt16_nt4_table[bam_seqi(bam_get_seq(p->b), p->qpos)] != ref_nt4) {
+               return 1;
+          }
+     }
+     return 0;
+}
+
+
+/* Press pileup info into one data-structure. plp_col must have been
+ * initialized with plp_col_init() and is reset here, i.e. it can (and
+ * should) be reused for consecutive columns. Caller must eventually
+ * free with plp_col_free(); hrun_track is optional (see
+ * ref_file_hrun_track()) and saves rescanning ref for the hrun value.
  *
  * FIXME this used to be a convenience function and turned into a big
  * and slow monster. keeping copies of everything is inefficient and
@@ -799,7 +2073,8 @@ get_hrun(const int pos, const char *ref, const int ref_len)
 void compile_plp_col(plp_col_t *plp_col,
                  const bam_pileup1_t *plp, const int n_plp,
                  const mplp_conf_t *conf, const char *ref, const int pos,
-                 const int ref_len, const char *target_name)
+                 const int ref_len, const uint8_t *hrun_track,
+                 const char *target_name)
 {
      int i;
      char ref_base;
@@ -814,13 +2089,12 @@ void compile_plp_col(plp_col_t *plp_col,
      /* computation of depth (after read-level *and* base-level filtering)
       * samtools-0.1.18/bam2depth.c:
       *   if (p->is_del || p->is_refskip) ++m;
-      *   else if (bam1_qual(p->b)[p->qpos] < bq) ++m
+      *   else if (bam_get_qual(p->b)[p->qpos] < bq) ++m
       * n_plp[i] - m
       */
      ref_base = (ref && pos < ref_len)? ref[pos] : 'N';
 
-     plp_col_init(plp_col);
-     plp_col->target = strdup(target_name);
+     plp_col_reset(plp_col, target_name);
      plp_col->pos = pos;
      plp_col->ref_base = ref_base;
      plp_col->coverage_plp = n_plp;  /* this is coverage as in the original mpileup,
@@ -830,12 +2104,33 @@ void compile_plp_col(plp_col_t *plp_col,
      plp_col->num_non_indels = 0;
      LOG_DEBUG("Processing %s:%d\n", plp_col->target, plp_col->pos+1);
      
-     if (ref) {
+     if (ref && hrun_track && pos+1 < ref_len &&
+         HRUN_TRACK_LEN(hrun_track[pos+1]) < HRUN_TRACK_MAX) {
+          plp_col->hrun = HRUN_TRACK_LEN(hrun_track[pos+1]);
+     } else if (ref) {
           plp_col->hrun = get_hrun(pos, ref, ref_len);
      } else {
           plp_col->hrun = -1;
      }
 
+     /* reserve the maximum number of values per base upfront
+      * (usually a no-op for reused columns) */
+     {
+          int nt4_counts[NUM_NT4] = { 0 };
+          int b;
+          for (i = 0; i < n_plp; ++i) {
+               if (! plp[i].is_del) {
+                    nt4_counts[(int)bam_nt16_nt4_table[bam_seqi(bam_get_seq(plp[i].b), plp[i].qpos)]] += 1;
+               }
+          }
+          for (b = 0; b < NUM_NT4; b++) {
+               if (! nt4_counts[b]) {
+                    continue;
+               }
+               plp_quals_reserve(& plp_col->quals[b], nt4_counts[b]);
+          }
+     }
+
      for (i = 0; i < n_plp; ++i) {
           /* inserted parts of pileup_seq() here.
            * logic there goes like this:
@@ -860,29 +2155,18 @@ void compile_plp_col(plp_col_t *plp_col,
 #ifdef USE_ALNERRPROF
           int aq = 0;
 #endif
-          uint8_t *bi = bam_aux_get(p->b, BI_TAG);
-          uint8_t *bd = bam_aux_get(p->b, BD_TAG);
-          uint8_t *ai = bam_aux_get(p->b, AI_TAG);
-          uint8_t *ad = bam_aux_get(p->b, AD_TAG);
-          uint8_t *baq_aux = NULL; /* full baq value (not offset as "BQ"!) */
+          /* aux fields were decoded by plp_read_construct() */
+          const plp_read_t *r = (const plp_read_t *)p->cd.p;
+          const uint8_t *bi = r->bi;
+          const uint8_t *bd = r->bd;
+          const uint8_t *ai = r->ai;
+          const uint8_t *ad = r->ad;
+          const uint8_t *baq_aux = NULL; /* full baq value (not offset as "BQ"!) */
 
-#ifdef USE_OLD_AI_AD
-          /* temporary fix preventing problems due to the fact that we changed AI AD to ai ad
-           * to be deleted soon
-           */
-          if (! ai) {
-               ai = bam_aux_get(p->b, "AI");
-          }
-          if (! ad) {
-               ad = bam_aux_get(p->b, "AD");
-          }
-#endif
-          if (conf->flag & MPLP_USE_SQ) {
-               sq = bam_aux2i(bam_aux_get(p->b, SRC_QUAL_TAG)); /* lofreq internally computed on the fly */
-          }
+          sq = r->sq; /* lofreq internally computed on the fly */
 
           if (conf->flag & MPLP_BAQ) {
-               baq_aux = bam_aux_get(p->b, BAQ_TAG);
+               baq_aux = r->baq;
                /* should have been recomputed already */
                if (! baq_aux) {
                     if (! missing_baq_warning_printed) {
@@ -899,7 +2183,7 @@ void compile_plp_col(plp_col_t *plp_col,
           LOG_FIXME("At %s:%d %c: p->is_del=%d p->is_refskip=%d p->indel=%d p->is_head=%d p->is_tail=%d\n",
                     plp_col->target,
                     plp_col->pos+1,
-                    bam_nt16_rev_table[bam1_seqi(bam1_seq(p->b), p->qpos)],
+                    seq_nt16_str[bam_seqi(bam_get_seq(p->b), p->qpos)],
                     p->is_del, p->is_refskip, p->indel, p->is_head, p->is_tail);
 #endif
           /* no need for check if mq is within user defined
@@ -919,14 +2203,14 @@ void compile_plp_col(plp_col_t *plp_col,
 
 #if 0
                /* nt for printing */
-               nt = bam_nt16_rev_table[bam1_seqi(bam1_seq(p->b), p->qpos)];
-               nt = bam1_strand(p->b)? tolower(nt) : toupper(nt);
+               nt = seq_nt16_str[bam_seqi(bam_get_seq(p->b), p->qpos)];
+               nt = bam_is_rev(p->b)? tolower(nt) : toupper(nt);
 #endif
 
                /* nt4 for indexing */
-               nt4 = bam_nt16_nt4_table[bam1_seqi(bam1_seq(p->b), p->qpos)];
+               nt4 = bam_nt16_nt4_table[bam_seqi(bam_get_seq(p->b), p->qpos)];
 
-               bq = bam1_qual(p->b)[p->qpos];
+               bq = bam_get_qual(p->b)[p->qpos];
 
                /* minimal base-call quality filtering. doing this here
                 * will make all downstream analysis blind to filtering
@@ -946,17 +2230,15 @@ void compile_plp_col(plp_col_t *plp_col,
                 */
                if (bq > SANGER_PHRED_MAX) {
                     /* bq = SANGER_PHRED_MAX; /@ Sanger/Phred max */
-                    LOG_WARN("Base quality above allowed maximum detected (%d > %d). Using max instead\n", bq, SANGER_PHRED_MAX, bam1_qname(p->b));
+                    LOG_WARN("Base quality above allowed maximum detected (%d > %d). Using max instead\n", bq, SANGER_PHRED_MAX, bam_get_qname(p->b));
                     bq = SANGER_PHRED_MAX;
                }
-               PLP_COL_ADD_QUAL(& plp_col->base_quals[nt4], bq);
 
                if (baq_aux) {
                     baq = baq_aux[p->qpos]-33;
-                    PLP_COL_ADD_QUAL(& plp_col->baq_quals[nt4], baq);
-               } else if (conf->flag & MPLP_BAQ)  {
-                    /* baq was enabled but failed. set to -1 */
-                    PLP_COL_ADD_QUAL(& plp_col->baq_quals[nt4], -1);
+               } else  {
+                    /* baq disabled or enabled but failed. set to -1 */
+                    baq = -1;
                }
 
                /* samtools check to detect Sanger max value: problem
@@ -966,11 +2248,8 @@ void compile_plp_col(plp_col_t *plp_col,
                 * gets executed, which is why we remove it:
                 * if (mq > 126) mq = 126;
                 */
-               PLP_COL_ADD_QUAL(& plp_col->map_quals[nt4], mq);
-
-               if (conf->flag & MPLP_USE_SQ) {
-                    PLP_COL_ADD_QUAL(& plp_col->source_quals[nt4], sq);
-               }
+               /* sq stays -1 (NA) unless MPLP_USE_SQ */
+               plp_quals_add(& plp_col->quals[nt4], bq, baq, mq, sq);
 #ifdef USE_ALNERRPROF
                if (alnerrprof) {
                     int tid = p->b->core.tid;
@@ -994,7 +2273,7 @@ void compile_plp_col(plp_col_t *plp_col,
                count_incr = 1.0 - merge_srcq_baseq_and_mapq(sq, bq, mq);
 #endif
 #else
-               count_incr = 1.0 - PHREDQUAL_TO_PROB(bq);
+               count_incr = 1.0 - phredqual_to_prob(bq);
 #endif
 
                /* FIXME this can't be the proper way to handle cases where count_incr = 0.0 because one of the values is 0? */
@@ -1003,7 +2282,7 @@ void compile_plp_col(plp_col_t *plp_col,
                }
 
                base_counts[nt4] += count_incr;
-               if (bam1_strand(p->b)) {
+               if (bam_is_rev(p->b)) {
                     plp_col->rv_counts[nt4] += 1;
                } else {
                     plp_col->fw_counts[nt4] += 1;
@@ -1068,7 +2347,8 @@ check_indel:
                     /* insertion (+)
                      */
                     if (p->indel > 0) {
-                         char *ins_seq;
+                         char ins_seq[MAX_INDELSIZE];
+                         const int ins_len = p->indel < MAX_INDELSIZE ? p->indel : MAX_INDELSIZE-1;
                          int j;
 
                          if (ai) {
@@ -1080,40 +2360,35 @@ check_indel:
                          plp_col->num_ins += 1;
                          plp_col->sum_ins += p->indel;
 
-                         if ((ins_seq = malloc((p->indel+1) * sizeof(char)))==NULL) {
-                              LOG_FATAL("%s\n", "Memory allocation failed");
-                              exit(1);
-                         }
-
-                         /* get inserted sequence */
-                         for (j = 1; j <= p->indel; ++j) {
-                              int c = bam_nt16_rev_table[bam1_seqi(bam1_seq(p->b), p->qpos+j)];
+                         /* get inserted sequence (truncated to key size) */
+                         for (j = 1; j <= ins_len; ++j) {
+                              int c = seq_nt16_str[bam_seqi(bam_get_seq(p->b), p->qpos+j)];
                               ins_seq[j-1] = toupper(c);
                          }
                          ins_seq[j-1] = '\0';
 
 
                          /*LOG_DEBUG("Insertion of %s at %d with iq %d iaq %d\n", ins_seq, pos, iq, iaq);*/
-                         add_ins_sequence(&plp_col->ins_event_counts,
+                         indel_table_add(& plp_col->ins_events,
                               ins_seq, iq, iaq, mq, sq,
-                              bam1_strand(p->b)? 1: 0);
+                              bam_is_rev(p->b)? 1: 0);
 
                          PLP_COL_ADD_QUAL(& plp_col->del_quals, dq);
                          PLP_COL_ADD_QUAL(& plp_col->del_map_quals, mq);
                          PLP_COL_ADD_QUAL(& plp_col->del_source_quals, sq);
                          del_nonevent_qual += dq;
-                         if (bam1_strand(p->b)) {
+                         if (bam_is_rev(p->b)) {
                               plp_col->non_del_fw_rv[1] += 1;
                          } else {
                               plp_col->non_del_fw_rv[0] += 1;
                          }
-                         free(ins_seq);
 
                     /* deletion (-)
                      */
                     } else if (p->indel < 0) {
-                         /* get deleted sequence */
-                         char *del_seq;
+                         /* get deleted sequence (truncated to key size) */
+                         char del_seq[MAX_INDELSIZE];
+                         const int del_len = -p->indel < MAX_INDELSIZE ? -p->indel : MAX_INDELSIZE-1;
                          int j;
 
                          if (ad) {
@@ -1125,12 +2400,7 @@ check_indel:
                          plp_col->num_dels += 1;
                          plp_col->sum_dels -= p->indel;
 
-                         if ((del_seq = malloc(((-p->indel)+1) * sizeof(char)))==NULL) {
-                              LOG_FATAL("%s\n", "Memory allocation failed");
-                              exit(1);
-                         }
-
-                         for (j = 1; j <= -p->indel; ++j) {
+                         for (j = 1; j <= del_len; ++j) {
                               int c =  (ref && (int)pos+j < ref_len)? ref[pos+j] : 'N';
                               del_seq[j-1] = toupper(c);
                          }
@@ -1150,19 +2420,18 @@ check_indel:
                               }
                          }
 #endif
-                         add_del_sequence(&plp_col->del_event_counts,
+                         indel_table_add(& plp_col->del_events,
                               del_seq, dq, daq, mq, sq,
-                              bam1_strand(p->b)? 1: 0);
+                              bam_is_rev(p->b)? 1: 0);
                          PLP_COL_ADD_QUAL(& plp_col->ins_quals, iq);
                          PLP_COL_ADD_QUAL(& plp_col->ins_map_quals, mq);
                          PLP_COL_ADD_QUAL(& plp_col->ins_source_quals, sq);
                          ins_nonevent_qual += iq;
-                         if (bam1_strand(p->b)) {
+                         if (bam_is_rev(p->b)) {
                               plp_col->non_ins_fw_rv[1] += 1;
                          } else {
                               plp_col->non_ins_fw_rv[0] += 1;
                          }
-                         free(del_seq);
                     }
 
                } else { /* if (p->indel != 0) ... */
@@ -1171,7 +2440,7 @@ check_indel:
                     PLP_COL_ADD_QUAL(& plp_col->ins_quals, iq);
                     PLP_COL_ADD_QUAL(& plp_col->ins_map_quals, mq);
                     ins_nonevent_qual += iq;
-                    if (bam1_strand(p->b)) {
+                    if (bam_is_rev(p->b)) {
                          plp_col->non_ins_fw_rv[1] += 1;
                     } else {
                          plp_col->non_ins_fw_rv[0] += 1;
@@ -1181,7 +2450,7 @@ check_indel:
                     PLP_COL_ADD_QUAL(& plp_col->del_quals, dq);
                     PLP_COL_ADD_QUAL(& plp_col->del_map_quals, mq);
                     del_nonevent_qual += dq;
-                    if (bam1_strand(p->b)) {
+                    if (bam_is_rev(p->b)) {
                          plp_col->non_del_fw_rv[1] += 1;
                     } else {
                          plp_col->non_del_fw_rv[0] += 1;
@@ -1226,19 +2495,19 @@ check_indel:
       * FIXME(AW): why are we using max qualities here and not errprob corrected counts?
       */
 
-     ins_event *ins_it, *ins_it_tmp;
-     char *ins_maxevent_key = NULL;
+     const char *ins_maxevent_key = NULL;
      int ins_maxevent_qual = 0;
-     HASH_ITER(hh_ins, plp_col->ins_event_counts, ins_it, ins_it_tmp) {
+     for (i=0; i<plp_col->ins_events.n; i++) {
+          const indel_event_t *ins_it = & plp_col->ins_events.events[i];
           if (ins_it->cons_quals > ins_maxevent_qual) {
                ins_maxevent_key = ins_it->key;
                ins_maxevent_qual = ins_it->cons_quals;
           }
      }
-     del_event *del_it, *del_it_tmp;
-     char *del_maxevent_key = NULL;
+     const char *del_maxevent_key = NULL;
      int del_maxevent_qual = 0;
-     HASH_ITER(hh_del, plp_col->del_event_counts, del_it, del_it_tmp) {
+     for (i=0; i<plp_col->del_events.n; i++) {
+          const indel_event_t *del_it = & plp_col->del_events.events[i];
           if (del_it->cons_quals > del_maxevent_qual) {
                del_maxevent_key = del_it->key;
                del_maxevent_qual = del_it->cons_quals;
@@ -1277,10 +2546,7 @@ check_indel:
 #endif
 
      for (i = 0; i < NUM_NT4; ++i) {
-          assert(plp_col->fw_counts[i] + plp_col->rv_counts[i] == plp_col->base_quals[i].n);
-          assert(plp_col->base_quals[i].n == plp_col->baq_quals[i].n);
-          assert(plp_col->base_quals[i].n == plp_col->map_quals[i].n);
-          assert(plp_col->map_quals[i].n == plp_col->source_quals[i].n);
+          assert(plp_col->fw_counts[i] + plp_col->rv_counts[i] == plp_col->quals[i].n);
      }
 }
 /* compile_plp_col() */
@@ -1288,6 +2554,232 @@ check_indel:
 
 
 /* not part of offical samtools/htslib API but part of samtools */
+
+
+typedef struct ref_cache_entry_s {
+     char *name;
+     char *seq; /* uppercase */
+     int len;
+     int beg, end; /* part of seq that was fetched */
+     int refcount;
+     struct ref_cache_entry_s *next;
+} ref_cache_entry_t;
+
+struct ref_cache_s {
+     ref_file_t *ref_file; /* faidx isn't thread-safe, i.e. only used with lock held */
+     pthread_mutex_t lock;
+     ref_cache_entry_t *entries;
+};
+
+
+/* Creates a reference cache on top of ref_file (which stays owned by the
+ * caller). Sequences are fetched once, shared by everyone asking for
+ * them and freed as soon as nobody uses them anymore. Returns NULL on
+ * error */
+ref_cache_t *
+ref_cache_new(ref_file_t *ref_file)
+{
+     ref_cache_t *rc;
+
+     if (NULL == (rc = calloc(1, sizeof(ref_cache_t)))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          return NULL;
+     }
+     rc->ref_file = ref_file;
+     pthread_mutex_init(& rc->lock, NULL);
+     return rc;
+}
+
+
+void
+ref_cache_destroy(ref_cache_t *rc)
+{
+     ref_cache_entry_t *e, *next;
+
+     if (! rc) {
+          return;
+     }
+     for (e=rc->entries; e; e=next) {
+          next = e->next;
+          LOG_WARN("Reference sequence %s still in use\n", e->name);
+          free(e->name);
+          free(e->seq);
+          free(e);
+     }
+     pthread_mutex_destroy(& rc->lock);
+     free(rc);
+}
+
+
+/* pads the reference window beg to end (0-based, end exclusive), which
+ * is needed for the reads at hand, by PLP_REF_PAD. if no region was
+ * given in conf, all reads of a sequence are processed, so the window
+ * is the whole sequence instead. */
+static void
+plp_ref_window(const mplp_conf_t *conf, int *beg, int *end)
+{
+     if (! conf->reg) {
+          *beg = 0;
+          *end = INT_MAX;
+          return;
+     }
+     *beg = *beg > PLP_REF_PAD ? *beg - PLP_REF_PAD : 0;
+     *end = *end < INT_MAX - PLP_REF_PAD ? *end + PLP_REF_PAD : INT_MAX;
+}
+
+
+/* fetch uppercase sequence of name, either through the cache if set
+ * up in conf or directly. only beg to end (0-based, end exclusive) is
+ * guaranteed to be filled (see ref_file_fetch_region()). release with
+ * plp_release_ref(). returns NULL on error. */
+static char *
+plp_fetch_ref(const mplp_conf_t *conf, const char *name, int beg, int end, int *len)
+{
+     ref_cache_t *rc = conf->ref_cache;
+     ref_cache_entry_t *e;
+     char *seq;
+
+     if (! rc) {
+          return ref_file_fetch_region(conf->ref_file, name, beg,
+                                       end == INT_MAX ? INT_MAX : end-1, len);
+     }
+
+     pthread_mutex_lock(& rc->lock);
+     for (e=rc->entries; e; e=e->next) {
+          if (0 == strcmp(e->name, name) && e->beg <= beg && e->end >= end) {
+               break;
+          }
+     }
+     if (! e) {
+          seq = ref_file_fetch_region(rc->ref_file, name, beg,
+                                      end == INT_MAX ? INT_MAX : end-1, len);
+          if (! seq) {
+               pthread_mutex_unlock(& rc->lock);
+               return NULL;
+          }
+          if (NULL == (e = calloc(1, sizeof(ref_cache_entry_t)))) {
+               fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                       __FILE__, __FUNCTION__, __LINE__);
+               free(seq);
+               pthread_mutex_unlock(& rc->lock);
+               return NULL;
+          }
+          e->name = strdup(name);
+          e->seq = seq;
+          e->len = *len;
+          e->beg = beg;
+          e->end = end;
+          e->next = rc->entries;
+          rc->entries = e;
+     }
+     e->refcount += 1;
+     *len = e->len;
+     seq = e->seq;
+     pthread_mutex_unlock(& rc->lock);
+
+     return seq;
+}
+
+
+static void
+plp_release_ref(const mplp_conf_t *conf, char *seq)
+{
+     ref_cache_t *rc = conf->ref_cache;
+     ref_cache_entry_t *e, **prev;
+
+     if (! seq) {
+          return;
+     }
+     if (! rc) {
+          free(seq);
+          return;
+     }
+
+     pthread_mutex_lock(& rc->lock);
+     for (prev=& rc->entries, e=rc->entries; e; prev=& e->next, e=e->next) {
+          if (e->seq == seq) {
+               break;
+          }
+     }
+     assert(e);
+     if (e && 0 == --e->refcount) {
+          *prev = e->next;
+          free(e->name);
+          free(e->seq);
+          free(e);
+     }
+     pthread_mutex_unlock(& rc->lock);
+}
+
+
+
+/* index queries for a bed driven pileup: the merged bed intervals of
+ * all sequences in header order (i.e. in order of sorted input),
+ * restricted to tid:beg-end if tid>=0. queries closer than
+ * BED_QUERY_COALESCE_GAP are coalesced to save seeks. columns in
+ * between are still filtered against the bed in mpileup().
+ */
+#define BED_QUERY_COALESCE_GAP 1024
+
+static bed_query_t *
+bed_queries_new(void *bed, const bam_hdr_t *h, const int tid,
+                const int beg, const int end, int *num_queries)
+{
+     bed_query_t *queries = NULL;
+     int alloced = 0;
+     int t, j;
+
+     *num_queries = 0;
+     for (t = 0; t < h->n_targets; t++) {
+          const uint64_t *regs;
+          int num_regs;
+
+          if (tid >= 0 && t != tid) {
+               continue;
+          }
+          num_regs = bed_merged_intervals(bed, h->target_name[t], &regs);
+          for (j = 0; j < num_regs; j++) {
+               int qbeg = regs[j]>>32;
+               int qend = (uint32_t)regs[j];
+               bed_query_t *last = *num_queries ? & queries[*num_queries-1] : NULL;
+
+               if (tid >= 0) {
+                    qbeg = qbeg > beg ? qbeg : beg;
+                    qend = qend < end ? qend : end;
+               }
+               if (qbeg >= qend) {
+                    continue;
+               }
+               if (last && last->tid == t && qbeg - last->end < BED_QUERY_COALESCE_GAP) {
+                    last->end = qend > last->end ? qend : last->end;
+                    continue;
+               }
+               if (*num_queries == alloced) {
+                    alloced = alloced ? 2*alloced : 1024;
+                    if (NULL == (queries = realloc(queries, alloced * sizeof(bed_query_t)))) {
+                         fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                                 __FILE__, __FUNCTION__, __LINE__);
+                         exit(1);
+                    }
+               }
+               queries[*num_queries].tid = t;
+               queries[*num_queries].beg = qbeg;
+               queries[*num_queries].end = qend;
+               *num_queries += 1;
+          }
+     }
+     LOG_VERBOSE("Using %d index queries for bed file\n", *num_queries);
+
+     /* non-NULL even if empty, since NULL means not bed driven */
+     if (! queries && NULL == (queries = malloc(sizeof(bed_query_t)))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     return queries;
+}
+
 int
 mpileup(const mplp_conf_t *mplp_conf,
         void (*plp_proc_func)(const plp_col_t*, void*),
@@ -1298,10 +2790,20 @@ mpileup(const mplp_conf_t *mplp_conf,
     int i, tid, pos, *n_plp, tid0 = -1, beg0 = 0, end0 = 1u<<29, ref_len = -1, ref_tid = -1, max_depth;
     const bam_pileup1_t **plp;
     bam_mplp_t iter;
-    bam_header_t *h = 0;
+    bam_hdr_t *h = 0;
     char *ref;
+    const uint8_t *hrun_track = NULL; /* precomputed homopolymer track for ref, if available */
+    int hrun_track_len = -1;
     kstring_t buf;
     long long int plp_counter = 0; /* note: some cols are simply skipped */
+    plp_col_t plp_col; /* reused for all columns */
+    mplp_conf_t pool_conf; /* copy of mplp_conf with ref_cache, if needed for read pool */
+    bed_query_t *bed_queries = NULL; /* shared by all data[i] */
+    int num_bed_queries = 0;
+    void *col_bed_cursor = NULL; /* column overlap with bed */
+    ref_cache_t *pool_ref_cache = NULL;
+    const int use_pool = mplp_conf->baq_threads > 0 &&
+         mplp_conf->flag & (MPLP_BAQ | MPLP_IDAQ | MPLP_USE_SQ);
 
     /* paranoid exit. n only allowed to be one in our case (not much
      * of an *m*pileup, I know...) */
@@ -1314,6 +2816,17 @@ mpileup(const mplp_conf_t *mplp_conf,
          return 1;
     }
 
+    /* read pool fetches the reference per batch, which needs the
+     * cache to be cheap */
+    if (use_pool && ! mplp_conf->ref_cache && mplp_conf->ref_file) {
+         memcpy(& pool_conf, mplp_conf, sizeof(mplp_conf_t));
+         pool_conf.ref_cache = pool_ref_cache = ref_cache_new(mplp_conf->ref_file);
+         if (! pool_ref_cache) {
+              return 1;
+         }
+         mplp_conf = & pool_conf;
+    }
+
     memset(&buf, 0, sizeof(kstring_t));
     data = calloc(n, sizeof(mplp_aux_t*));
     plp = calloc(n, sizeof(bam_pileup1_t*));
@@ -1329,7 +2842,7 @@ mpileup(const mplp_conf_t *mplp_conf,
      *
      */
     for (i = 0; i < n; ++i) {
-        bam_header_t *h_tmp;
+        bam_hdr_t *h_tmp;
         if (0 != strcmp(fn[i], "-")) {
           if (! file_exists(fn[i])) {
             fprintf(stderr, "File '%s' does not exist. Exiting...\n", fn[i]);
@@ -1337,35 +2850,77 @@ mpileup(const mplp_conf_t *mplp_conf,
           }
         }
         data[i] = calloc(1, sizeof(mplp_aux_t));
-        data[i]->fp = strcmp(fn[i], "-") == 0? bam_dopen(fileno(stdin), "r") : bam_open(fn[i], "r");
+        /* sam_open() handles "-" (stdin) and detects SAM/BAM/CRAM */
+        data[i]->fp = sam_open(fn[i], "r");
+        if (! data[i]->fp) {
+             fprintf(stderr, "[%s] fail to open %s\n", __func__, fn[i]);
+             exit(1);
+        }
+        /* needed for decoding CRAM. harmless otherwise */
+        if (mplp_conf->ref_file && mplp_conf->ref_file->fasta &&
+            hts_set_fai_filename(data[i]->fp, mplp_conf->ref_file->fasta) != 0) {
+             fprintf(stderr, "[%s] fail to set reference %s for %s\n", __func__, mplp_conf->ref_file->fasta, fn[i]);
+             exit(1);
+        }
+        if (mplp_conf->hts_threads > 0) {
+             hts_set_threads(data[i]->fp, mplp_conf->hts_threads);
+        }
         data[i]->conf = mplp_conf;
-        h_tmp = bam_header_read(data[i]->fp);
+        h_tmp = sam_hdr_read(data[i]->fp);
         if ( !h_tmp ) {
              fprintf(stderr,"[%s] fail to read the header of %s\n", __func__, fn[i]);
              exit(1);
         }
         data[i]->h = i? h : h_tmp; /* for i==0, "h" has not been set yet */
 
-        if (mplp_conf->reg) {
-            int beg, end;
-            bam_index_t *idx;
-            idx = bam_index_load(fn[i]);
-            if (idx == 0) {
+        /* with a bed file, query the index for bed intervals only
+         * (within region, if given), instead of streaming everything
+         * and filtering. falls back to streaming if there's no index */
+        if (mplp_conf->reg || (mplp_conf->bed && 0 != strcmp(fn[i], "-"))) {
+            hts_idx_t *idx = NULL;
+            /* index is optional if only bed is given */
+            if (mplp_conf->reg || bam_has_index(fn[i])) {
+                idx = sam_index_load(data[i]->fp, fn[i]);
+            }
+            if (idx == 0 && mplp_conf->reg) {
                 fprintf(stderr, "[%s] fail to load index for %d-th input.\n", __func__, i+1);
                 exit(1);
             }
-            if (bam_parse_region(h_tmp, mplp_conf->reg, &tid, &beg, &end) < 0) {
-                fprintf(stderr, "[%s] malformatted region or wrong seqname for %d-th input.\n", __func__, i+1);
-                exit(1);
+            if (mplp_conf->reg) {
+                data[i]->iter = sam_itr_querys(idx, h_tmp, mplp_conf->reg);
+                if (data[i]->iter == 0) {
+                    fprintf(stderr, "[%s] malformatted region or wrong seqname for %d-th input.\n", __func__, i+1);
+                    exit(1);
+                }
+                if (i == 0) tid0 = data[i]->iter->tid, beg0 = data[i]->iter->beg, end0 = data[i]->iter->end;
+            }
+            if (idx && mplp_conf->bed) {
+                if (! bed_queries) {
+                    if (mplp_conf->reg) {
+                        bed_queries = bed_queries_new(mplp_conf->bed, h_tmp, data[i]->iter->tid,
+                                                      data[i]->iter->beg, data[i]->iter->end, &num_bed_queries);
+                    } else {
+                        bed_queries = bed_queries_new(mplp_conf->bed, h_tmp, -1, 0, 0, &num_bed_queries);
+                    }
+                }
+                if (data[i]->iter) {
+                    hts_itr_destroy(data[i]->iter);
+                    data[i]->iter = NULL;
+                }
+                data[i]->idx = idx;
+                data[i]->bed_queries = bed_queries;
+                data[i]->num_bed_queries = num_bed_queries;
+                data[i]->prev_query_tid = -1;
+            } else if (idx) {
+                hts_idx_destroy(idx);
+            } else {
+                LOG_VERBOSE("No index found for %s. Will read all of it and filter against bed file\n", fn[i]);
             }
-            if (i == 0) tid0 = tid, beg0 = beg, end0 = end;
-            data[i]->iter = bam_iter_query(idx, tid, beg, end);
-            bam_index_destroy(idx);
         }
         if (i == 0) {
              h = h_tmp;
         } else {
-            bam_header_destroy(h_tmp);
+            bam_hdr_destroy(h_tmp);
         }
     }
     LOG_DEBUG("%s\n", "BAM header initialized");
@@ -1374,20 +2929,53 @@ mpileup(const mplp_conf_t *mplp_conf,
               LOG_DEBUG("BAM header target #%d: name=%s len=%d\n", i, h->target_name[i], h->target_len[i]);
          }
     }
-    if (tid0 >= 0 && mplp_conf->fai) { /* region is set */
-         ref = faidx_fetch_seq(mplp_conf->fai, h->target_name[tid0], 0, 0x7fffffff, &ref_len);
+    if (tid0 >= 0 && mplp_conf->ref_file) { /* region is set */
+         int ref_beg = beg0, ref_end = end0;
+         plp_ref_window(mplp_conf, &ref_beg, &ref_end);
+         ref = plp_fetch_ref(mplp_conf, h->target_name[tid0], ref_beg, ref_end, &ref_len);
          if (NULL == ref || h->target_len[tid0] != ref_len) {
               LOG_FATAL("Reference fasta file doesn't seem to contain the right sequence(s) for this BAM file. (mismatch for seq %s listed in BAM header)\n", h->target_name[tid0]);
               return -1;
          }
-         strtoupper(ref);/* safeguard */
          ref_tid = tid0;
-         for (i = 0; i < n; ++i) data[i]->ref = ref, data[i]->ref_id = tid0;
+         hrun_track = ref_file_hrun_track(mplp_conf->ref_file, h->target_name[tid0], &hrun_track_len);
+         for (i = 0; i < n; ++i) {
+              data[i]->ref = ref, data[i]->ref_id = tid0;
+              data[i]->ref_beg = ref_beg, data[i]->ref_end = ref_end;
+         }
     } else {
          ref_tid = -1;
          ref = 0;
     }
+    if (use_pool) {
+         LOG_VERBOSE("Using %d threads for BAQ/IDAQ/source quality\n", mplp_conf->baq_threads);
+         for (i = 0; i < n; ++i) {
+              if (NULL == (data[i]->pool = read_pool_new(data[i], mplp_conf->baq_threads))) {
+                   return 1;
+              }
+         }
+    } else if (mplp_conf->flag & MPLP_USE_SQ) {
+         for (i = 0; i < n; ++i) {
+              data[i]->sq_cache = sq_cache_new();
+         }
+    }
+    if (mplp_conf->bed) {
+         /* reads and columns come sorted, which is what the cursors are made for */
+         col_bed_cursor = bed_cursor_new(mplp_conf->bed);
+         for (i = 0; i < n && col_bed_cursor; ++i) {
+              if (NULL == (data[i]->bed_cursor = bed_cursor_new(mplp_conf->bed))) {
+                   break;
+              }
+         }
+         if (! col_bed_cursor || i < n) {
+              fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                      __FILE__, __FUNCTION__, __LINE__);
+              exit(1);
+         }
+    }
     iter = bam_mplp_init(n, mplp_func, (void**)data);
+    bam_mplp_constructor(iter, plp_read_construct);
+    bam_mplp_destructor(iter, plp_read_destruct);
     max_depth = mplp_conf->max_depth;
     bam_mplp_set_maxcnt(iter, max_depth);
 
@@ -1403,28 +2991,30 @@ mpileup(const mplp_conf_t *mplp_conf,
 #endif
 
     LOG_DEBUG("%s\n", "Starting pileup loop");
+    plp_col_init(& plp_col);
     while (bam_mplp_auto(iter, &tid, &pos, n_plp, plp) > 0) {
-        plp_col_t plp_col;
         int i=0; /* NOTE: mpileup originally iterated over n */
 
         if (mplp_conf->reg && (pos < beg0 || pos >= end0))
              continue; /* out of the region requested */
-        if (mplp_conf->bed && tid >= 0 && !bed_overlap(mplp_conf->bed, h->target_name[tid], pos, pos+1))
+        if (col_bed_cursor && tid >= 0 && !bed_cursor_overlap(col_bed_cursor, tid, h->target_name[tid], pos, pos+1))
              continue;
         if (tid != ref_tid) {
-            free(ref); ref = 0;
-            if (mplp_conf->fai) {
-                 ref = faidx_fetch_seq(mplp_conf->fai, h->target_name[tid], 0, 0x7fffffff, &ref_len);
+            plp_release_ref(mplp_conf, ref); ref = 0;
+            hrun_track = NULL;
+            if (mplp_conf->ref_file) {
+                 ref = plp_fetch_ref(mplp_conf, h->target_name[tid], 0, INT_MAX, &ref_len);
                  if (NULL == ref || h->target_len[tid] != ref_len) {
                       LOG_DEBUG("ref %s at %p h->target_len[tid]=%d ref_len=%d\n", h->target_name[tid], ref, h->target_name[tid], ref_len)
                       LOG_FATAL("Reference fasta file doesn't seem to contain the right sequence(s) for this BAM file. (mismatch for seq %s listed in BAM header).\n", h->target_name[tid]);
                       return -1;
                  }
-                 strtoupper(ref);/* safeguard */
                  LOG_DEBUG("%s\n", "sequence fetched");
+                 hrun_track = ref_file_hrun_track(mplp_conf->ref_file, h->target_name[tid], &hrun_track_len);
             }
             for (i = 0; i < n; ++i)  {
                  data[i]->ref = ref, data[i]->ref_id = tid;
+                 data[i]->ref_beg = 0, data[i]->ref_end = INT_MAX;
             }
             ref_tid = tid;
         }
@@ -1437,14 +3027,21 @@ mpileup(const mplp_conf_t *mplp_conf,
                          " %d of %s...\n", pos+1, h->target_name[tid]);
         }
 
+        if (mplp_conf->flag & MPLP_SKIP_REF_COLS &&
+            ! plp_has_nonref(plp[i], n_plp[i], ref, pos, ref_len)) {
+             __sync_fetch_and_add(& plp_num_ref_cols_skipped, 1);
+             continue;
+        }
+
+        /* compile_plp_col() reads hrun_track[pos+1] */
         compile_plp_col(&plp_col, plp[i], n_plp[i], mplp_conf,
-                        ref, pos, ref_len, h->target_name[tid]);
+                        ref, pos, ref_len, pos+1 < hrun_track_len ? hrun_track : NULL,
+                        h->target_name[tid]);
 
         (*plp_proc_func)(& plp_col, plp_proc_conf);
 
-        plp_col_free(& plp_col);
-
     } /* while bam_mplp_auto */
+    plp_col_free(& plp_col);
 
 #ifdef USE_ALNERRPROF
     if (alnerrprof) {
@@ -1454,13 +3051,29 @@ mpileup(const mplp_conf_t *mplp_conf,
 #endif
     free(buf.s);
     bam_mplp_destroy(iter);
-    bam_header_destroy(h);
     for (i = 0; i < n; ++i) {
-        bam_close(data[i]->fp);
-        if (data[i]->iter) bam_iter_destroy(data[i]->iter);
+        read_pool_destroy(data[i]->pool);
+        sq_cache_destroy(data[i]->sq_cache);
+    }
+    bam_hdr_destroy(h);
+    for (i = 0; i < n; ++i) {
+        sam_close(data[i]->fp);
+        if (data[i]->iter) hts_itr_destroy(data[i]->iter);
+        if (data[i]->idx) hts_idx_destroy(data[i]->idx);
+        bed_cursor_destroy(data[i]->bed_cursor);
+        plp_release_ref(mplp_conf, data[i]->own_ref);
+        while (data[i]->free_reads) {
+             plp_read_t *r = data[i]->free_reads;
+             data[i]->free_reads = r->next;
+             free(r);
+        }
         free(data[i]);
     }
-    free(data); free(plp); free(ref); free(n_plp);
+    free(bed_queries);
+    bed_cursor_destroy(col_bed_cursor);
+    plp_release_ref(mplp_conf, ref);
+    ref_cache_destroy(pool_ref_cache);
+    free(data); free(plp); free(n_plp);
     return 0;
 }
 /* mpileup() */
@@ -29,7 +29,9 @@
 #ifndef PLP_H
 #define PLP_H
 
-#include "htslib/faidx.h"
+#include <stdint.h>
+
+#include "refpack.h"
 #include "utils.h"
 #include "vcf.h"
 #include "utils.h"
@@ -44,6 +46,7 @@
 #define MPLP_REDO_IDAQ   0x200
 #define MPLP_USE_SQ      0x400
 #define MPLP_ILLUMINA13  0x800
+#define MPLP_SKIP_REF_COLS 0x1000 /* don't compile (and process) columns without any mismatch or indel */
 
 
 extern const char *bam_nt4_rev_table; /* similar to bam_nt16_rev_table */
@@ -51,6 +54,63 @@ extern const char *bam_nt4_rev_table; /* similar to bam_nt16_rev_table */
 
 extern const unsigned char bam_nt4_table[256];
 
+extern long long int plp_num_ref_cols_skipped; /* see MPLP_SKIP_REF_COLS */
+
+
+/* reference sequence cache that can be shared by several threads
+ * running mpileup() at the same time. see ref_cache_new() */
+typedef struct ref_cache_s ref_cache_t;
+
+
+/* qualities of all bases of one type in a column, stored as packed
+ * uint8_t arrays (one entry per read, same index in all arrays). this
+ * keeps deep columns small enough to stay in cache. missing values
+ * (-1 elsewhere) are stored as PLP_QUAL_NA.
+ */
+#define PLP_QUAL_NA 255
+#define PLP_QUAL_TO_INT(q) ((q) == PLP_QUAL_NA ? -1 : (int)(q))
+
+typedef struct {
+     unsigned long int n; /* number of entries used */
+     unsigned long int alloced; /* number of entries allocated */
+     uint8_t *bq; /* base-call quality */
+     uint8_t *baq; /* base-alignment quality. NA if not computed or failed */
+     uint8_t *mq; /* mapping quality as given in BAM, i.e. 255 means unknown */
+     uint8_t *sq; /* source quality. NA if not computed */
+} plp_quals_t;
+
+
+/* indel events of one type (insertions or deletions) in a column,
+ * keyed by the inserted or deleted sequence. keys are interned in
+ * blocks of a small arena and found through an open-addressing
+ * index. all storage is kept by indel_table_reset(), so that a
+ * reused column (see plp_col_reset()) doesn't allocate anything.
+ *
+ * iterate in order of first observation:
+ *   for (i=0; i<t->n; i++) { indel_event_t *it = & t->events[i]; ... }
+ */
+typedef struct {
+     const char *key; /* uppercase inserted or deleted sequence. points into key arena */
+     unsigned int hash;
+     int count;
+     int cons_quals; /* sum of indel qualities */
+     long int fw_rv[2];
+     plp_quals_t quals; /* one entry per read: bq is the indel
+                         * quality, baq the indel alignment quality */
+} indel_event_t;
+
+typedef struct indel_key_block_s indel_key_block_t;
+
+typedef struct {
+     int n; /* number of events */
+     int alloced;
+     indel_event_t *events;
+     int *index; /* event index + 1, or 0 if slot is empty */
+     int index_size; /* power of 2 */
+     indel_key_block_t *keys; /* key arena */
+     indel_key_block_t *cur_keys;
+} indel_table_t;
+
 
 /* mpileup configuration structure 
  */
@@ -63,10 +123,13 @@ typedef struct {
      int def_nm_q;
      char *reg;
      char *fa;
-     faidx_t *fai;
+     ref_file_t *ref_file; /* fasta or refpack image, see ref_file_load() */
      void *bed;
      char *alnerrprof_file; /* logically belongs to varcall_conf, but we need it here since only here the bam header is known */
      char cmdline[1024];
+     ref_cache_t *ref_cache; /* optional. if set, reference sequences are fetched through this instead of ref_file */
+     int hts_threads; /* extra threads for decompression of input (hts_set_threads()). 0 = none */
+     int baq_threads; /* threads computing BAQ/IDAQ/source quality ahead of the pileup. 0 = done inline */
 } mplp_conf_t;
 
 
@@ -84,16 +147,13 @@ typedef struct {
       * filtering can become separate step. alternative is to filter
       * during pileup. the latter doesn't work if you want to filter
       * based on a consensus which you don't know in advance */
-     int_varray_t base_quals[NUM_NT4]; 
-     int_varray_t baq_quals[NUM_NT4]; 
-     int_varray_t map_quals[NUM_NT4]; 
-     int_varray_t source_quals[NUM_NT4]; 
+     plp_quals_t quals[NUM_NT4];
 #ifdef USE_ALNERRPROF
      int_varray_t alnerr_qual[NUM_NT4]; /* FIXME this should be precomputed and then build into model */
 #endif
      long int fw_counts[NUM_NT4]; 
      long int rv_counts[NUM_NT4]; 
-     /* fw_counts[b] + rv_counts[b] = x_quals.n = coverage */
+     /* fw_counts[b] + rv_counts[b] = quals[b].n = coverage */
 
      int num_heads; /* number of read starts at this pos */
      int num_tails; /* number of read ends at this pos */
@@ -105,9 +165,8 @@ typedef struct {
       * are stored in *_quals, *_map_quals, *_source_quals. Since no
       * indel was observed, there is no indel alignment quality. If
       * an indel event is observed, the qualities are stored in 
-      * the hash table to which *_event_counts points to and keyed to the
-      * sequence of the indel event. See utils.h for the data structure for storing
-      * indel qualities if an indel event is observed. */
+      * the event table *_events, keyed to the sequence of the indel
+      * event. See indel_table_t. */
 
      int num_non_indels;/* non-indel events for which we have indel qualities */
 
@@ -115,13 +174,13 @@ typedef struct {
      int_varray_t ins_quals; 
      int_varray_t ins_map_quals;
      int_varray_t ins_source_quals;
-     ins_event *ins_event_counts;
+     indel_table_t ins_events;
 
      int num_dels, sum_dels;
      int_varray_t del_quals; 
      int_varray_t del_map_quals;
      int_varray_t del_source_quals;
-     del_event *del_event_counts;
+     indel_table_t del_events;
      
      /* fw or rv counts for all non-indel events 
       * fw = 0, rv = 1*/
@@ -152,9 +211,21 @@ void init_mplp_conf(mplp_conf_t *c);
 int
 base_count(const plp_col_t *p, char base);
 
+int
+plp_quals_median_bq(const plp_quals_t *q);
+
+indel_event_t *
+indel_table_find(const indel_table_t *t, const char *key);
+
 void
 dump_mplp_conf(const mplp_conf_t *c, FILE *stream);
 
+ref_cache_t *
+ref_cache_new(ref_file_t *ref_file);
+
+void
+ref_cache_destroy(ref_cache_t *rc);
+
 int
 mpileup(const mplp_conf_t *mplp_conf, 
         void (*plp_proc_func)(const plp_col_t*, void*),
@@ -162,11 +233,20 @@ mpileup(const mplp_conf_t *mplp_conf,
         const int n, const char **fn);
 
 int
-source_qual_load_ign_vcf(const char *vcf_path, void *bed);
+source_qual_load_ign_vcf(const char *vcf_path, void *bed, const char *reg);
 
 void
 source_qual_free_ign_vars();
 
+/* source quality ignore list (see source_qual_load_ign_vcf()) */
+typedef struct ign_pos_list_s ign_pos_list_t;
+
+const ign_pos_list_t *
+ign_list_for_target(const char *target);
+
+int
+ign_list_has_pos(const ign_pos_list_t *l, const long int pos);
+
 int 
 var_in_ign_list(var_t *var);
 
@@ -0,0 +1,816 @@
+/* -*- c-file-style: "k&r"; indent-tabs-mode: nil; -*- */
+/*********************************************************************
+* The MIT License (MIT)
+* 
+* Copyright (c) 2013,2014 Genome Institute of Singapore
+* 
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation files
+* (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify, merge,
+* publish, distribute, sublicense, and/or sell copies of the Software,
+* and to permit persons to whom the Software is furnished to do so,
+* subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+* BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+* ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+* CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+************************************************************************/
+
+/* packed reference image. see refpack.h
+ *
+ * file layout (native byte order, all offsets from start of file and
+ * 8-byte aligned):
+ *
+ *   refpack_hdr_t
+ *   refpack_seq_t[num_seqs]
+ *   nul-terminated sequence names
+ *   per sequence: 2-bit packed bases (A=0, C=1, G=2, T=3; 4 per byte,
+ *                 first base in lowest bits), followed by
+ *                 refpack_exc_t[num_exc] (sorted runs of non-ACGT
+ *                 characters, which are packed as A), followed by
+ *                 the homopolymer track (one byte per base)
+ *
+ * all characters are stored uppercase.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "htslib/faidx.h"
+#include "htslib/hts_md5.h"
+
+/* lofreq includes */
+#include "log.h"
+#include "utils.h"
+#include "refpack.h"
+
+
+#define REFPACK_MAGIC "LFRP"
+#define REFPACK_VERSION 2
+#define REFPACK_BYTE_ORDER 0x01020304
+#define REFPACK_ALIGN(x) (((x) + 7) & ~((uint64_t)7))
+
+typedef struct {
+     char magic[4];
+     uint32_t version;
+     uint32_t byte_order; /* REFPACK_BYTE_ORDER as written by creator */
+     uint32_t num_seqs;
+     uint64_t file_size;
+} refpack_hdr_t;
+
+typedef struct {
+     uint64_t name_offset;
+     uint64_t bases_offset;
+     uint64_t exc_offset;
+     uint64_t num_exc;
+     uint64_t hrun_offset;
+     int64_t len;
+     unsigned char md5[16]; /* of uppercase sequence, as M5 in SAM header */
+} refpack_seq_t;
+
+typedef struct {
+     uint64_t start;
+     uint32_t len;
+     uint32_t base;
+} refpack_exc_t;
+
+typedef struct {
+     const char *name; /* points into image */
+     int idx;
+     UT_hash_handle hh;
+} refpack_name_t;
+
+struct refpack_s {
+     unsigned char *map;
+     size_t map_size;
+     const refpack_hdr_t *hdr;
+     const refpack_seq_t *seqs;
+     refpack_name_t *names; /* lookup by name */
+     refpack_name_t *name_items; /* storage for names */
+};
+
+
+static const unsigned char refpack_nt4[4] = {'A', 'C', 'G', 'T'};
+static char refpack_unpack_table[256][4];
+static int refpack_unpack_table_initialized = 0;
+
+
+
+static void
+refpack_init_unpack_table(void)
+{
+     int i, j;
+
+     if (refpack_unpack_table_initialized) {
+          return;
+     }
+     for (i=0; i<256; i++) {
+          for (j=0; j<4; j++) {
+               refpack_unpack_table[i][j] = refpack_nt4[(i >> (2*j)) & 3];
+          }
+     }
+     refpack_unpack_table_initialized = 1;
+}
+
+
+static int
+refpack_write_padded(FILE *fh, const void *data, const size_t size)
+{
+     static const char zeros[8] = {0};
+     size_t pad = REFPACK_ALIGN(size) - size;
+
+     if (size && fwrite(data, 1, size, fh) != size) {
+          return -1;
+     }
+     if (pad && fwrite(zeros, 1, pad, fh) != pad) {
+          return -1;
+     }
+     return 0;
+}
+
+
+/* packs seq (uppercase) of length len into bases and appends runs of
+ * non-ACGT characters to exc. returns number of runs or -1 on error */
+static long int
+refpack_pack_seq(const char *seq, const int64_t len, unsigned char *bases,
+                 refpack_exc_t **exc, size_t *exc_alloced)
+{
+     long int num_exc = 0;
+     int64_t i;
+
+     memset(bases, 0, (len+3)/4);
+     for (i=0; i<len; i++) {
+          int code;
+          switch (seq[i]) {
+          case 'A': code = 0; break;
+          case 'C': code = 1; break;
+          case 'G': code = 2; break;
+          case 'T': code = 3; break;
+          default: code = -1; break;
+          }
+          if (code >= 0) {
+               bases[i/4] |= code << (2*(i%4));
+               continue;
+          }
+
+          if (num_exc && (*exc)[num_exc-1].base == (uint32_t)seq[i] &&
+              (*exc)[num_exc-1].start + (*exc)[num_exc-1].len == (uint64_t)i &&
+              (*exc)[num_exc-1].len < UINT32_MAX) {
+               (*exc)[num_exc-1].len += 1;
+               continue;
+          }
+          if ((size_t)num_exc == *exc_alloced) {
+               *exc_alloced = *exc_alloced ? *exc_alloced * 2 : 1024;
+               if (NULL == (*exc = realloc(*exc, *exc_alloced * sizeof(refpack_exc_t)))) {
+                    fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                            __FILE__, __FUNCTION__, __LINE__);
+                    return -1;
+               }
+          }
+          (*exc)[num_exc].start = i;
+          (*exc)[num_exc].len = 1;
+          (*exc)[num_exc].base = (unsigned char)seq[i];
+          num_exc++;
+     }
+     return num_exc;
+}
+
+
+/* fills track (len bytes) with homopolymer info for uppercase seq.
+ * see HRUN_TRACK_LEN */
+void
+hrun_track_compute(const char *seq, const int len, uint8_t *track)
+{
+     int start = 0;
+
+     while (start < len) {
+          int end = start + 1;
+          int run, i;
+          while (end < len && seq[end] == seq[start]) {
+               end++;
+          }
+          run = end - start > HRUN_TRACK_MAX ? HRUN_TRACK_MAX : end - start;
+          for (i=start; i<end; i++) {
+               track[i] = run;
+          }
+          track[start] |= 0x80;
+          start = end;
+     }
+}
+
+
+/* creates refpack image out from fasta (indexed on the fly if
+ * needed). image is written to a temporary file first and renamed
+ * when complete. returns 0 on success, non-zero otherwise */
+int
+refpack_build(const char *fasta, const char *out)
+{
+     faidx_t *fai;
+     FILE *fh = NULL;
+     char *tmp_out = NULL;
+     refpack_hdr_t hdr;
+     refpack_seq_t *seqs = NULL;
+     refpack_exc_t *exc = NULL;
+     size_t exc_alloced = 0;
+     unsigned char *bases = NULL;
+     uint8_t *hrun = NULL;
+     hts_md5_context *md5 = NULL;
+     uint64_t offset;
+     int i, n, rc = 1;
+
+     if (NULL == (fai = fai_load(fasta))) {
+          LOG_ERROR("Couldn't load index for %s\n", fasta);
+          return 1;
+     }
+     n = faidx_nseq(fai);
+
+     if (NULL == (seqs = calloc(n ? n : 1, sizeof(refpack_seq_t))) ||
+         NULL == (tmp_out = malloc(strlen(out) + 5)) ||
+         NULL == (md5 = hts_md5_init())) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          goto free_and_exit;
+     }
+     sprintf(tmp_out, "%s.tmp", out);
+     if (NULL == (fh = fopen(tmp_out, "wb"))) {
+          LOG_ERROR("Couldn't open %s for writing\n", tmp_out);
+          goto free_and_exit;
+     }
+
+     memset(&hdr, 0, sizeof(hdr));
+     memcpy(hdr.magic, REFPACK_MAGIC, 4);
+     hdr.version = REFPACK_VERSION;
+     hdr.byte_order = REFPACK_BYTE_ORDER;
+     hdr.num_seqs = n;
+
+     /* header and table are rewritten once all offsets are known */
+     offset = sizeof(refpack_hdr_t) + n * sizeof(refpack_seq_t);
+     if (refpack_write_padded(fh, &hdr, sizeof(hdr)) ||
+         refpack_write_padded(fh, seqs, n * sizeof(refpack_seq_t))) {
+          goto write_error;
+     }
+     for (i=0; i<n; i++) {
+          const char *name = faidx_iseq(fai, i);
+          size_t name_size = strlen(name) + 1;
+          seqs[i].name_offset = offset;
+          if (refpack_write_padded(fh, name, name_size)) {
+               goto write_error;
+          }
+          offset += REFPACK_ALIGN(name_size);
+     }
+
+     for (i=0; i<n; i++) {
+          const char *name = faidx_iseq(fai, i);
+          char *seq;
+          int len = -1;
+          long int num_exc;
+
+          if (NULL == (seq = faidx_fetch_seq(fai, name, 0, 0x7fffffff, &len)) || len < 0) {
+               LOG_ERROR("Couldn't fetch sequence %s from %s\n", name, fasta);
+               free(seq);
+               goto free_and_exit;
+          }
+          strtoupper(seq);
+
+          hts_md5_reset(md5);
+          hts_md5_update(md5, seq, len);
+          hts_md5_final(seqs[i].md5, md5);
+
+          free(bases);
+          free(hrun);
+          if (NULL == (bases = malloc((len+3)/4 + 1)) ||
+              NULL == (hrun = malloc(len + 1))) {
+               fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                       __FILE__, __FUNCTION__, __LINE__);
+               free(seq);
+               goto free_and_exit;
+          }
+          hrun_track_compute(seq, len, hrun);
+          num_exc = refpack_pack_seq(seq, len, bases, &exc, &exc_alloced);
+          free(seq);
+          if (num_exc < 0) {
+               goto free_and_exit;
+          }
+
+          seqs[i].len = len;
+          seqs[i].bases_offset = offset;
+          if (refpack_write_padded(fh, bases, (len+3)/4)) {
+               goto write_error;
+          }
+          offset += REFPACK_ALIGN((len+3)/4);
+          seqs[i].exc_offset = offset;
+          seqs[i].num_exc = num_exc;
+          if (refpack_write_padded(fh, exc, num_exc * sizeof(refpack_exc_t))) {
+               goto write_error;
+          }
+          offset += num_exc * sizeof(refpack_exc_t);
+          seqs[i].hrun_offset = offset;
+          if (refpack_write_padded(fh, hrun, len)) {
+               goto write_error;
+          }
+          offset += REFPACK_ALIGN(len);
+
+          LOG_VERBOSE("Packed %s (%d bp, %ld non-ACGT runs)\n", name, len, num_exc);
+     }
+
+     hdr.file_size = offset;
+     if (fseeko(fh, 0, SEEK_SET) ||
+         refpack_write_padded(fh, &hdr, sizeof(hdr)) ||
+         refpack_write_padded(fh, seqs, n * sizeof(refpack_seq_t))) {
+          goto write_error;
+     }
+     if (fclose(fh)) {
+          fh = NULL;
+          goto write_error;
+     }
+     fh = NULL;
+     if (rename(tmp_out, out)) {
+          LOG_ERROR("Couldn't rename %s to %s\n", tmp_out, out);
+          goto free_and_exit;
+     }
+     rc = 0;
+     goto free_and_exit;
+
+write_error:
+     LOG_ERROR("Couldn't write to %s\n", tmp_out);
+
+free_and_exit:
+     if (fh) {
+          fclose(fh);
+     }
+     if (rc && tmp_out) {
+          unlink(tmp_out);
+     }
+     free(tmp_out);
+     free(bases);
+     free(hrun);
+     free(exc);
+     free(seqs);
+     if (md5) {
+          hts_md5_destroy(md5);
+     }
+     fai_destroy(fai);
+     return rc;
+}
+
+
+/* returns 1 if fn is a refpack image, 0 otherwise */
+int
+refpack_is_image(const char *fn)
+{
+     char magic[4];
+     FILE *fh;
+     int is_image = 0;
+
+     if (NULL == (fh = fopen(fn, "rb"))) {
+          return 0;
+     }
+     if (fread(magic, 1, 4, fh) == 4 && 0 == memcmp(magic, REFPACK_MAGIC, 4)) {
+          is_image = 1;
+     }
+     fclose(fh);
+     return is_image;
+}
+
+
+refpack_t *
+refpack_open(const char *fn)
+{
+     refpack_t *rp;
+     struct stat st;
+     int fd, i;
+
+     if (NULL == (rp = calloc(1, sizeof(refpack_t)))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          return NULL;
+     }
+
+     if ((fd = open(fn, O_RDONLY)) < 0 || fstat(fd, &st)) {
+          LOG_ERROR("Couldn't open %s\n", fn);
+          if (fd >= 0) {
+               close(fd);
+          }
+          free(rp);
+          return NULL;
+     }
+     rp->map_size = st.st_size;
+     if (rp->map_size < sizeof(refpack_hdr_t)) {
+          LOG_ERROR("%s is not a refpack image\n", fn);
+          close(fd);
+          free(rp);
+          return NULL;
+     }
+     rp->map = mmap(NULL, rp->map_size, PROT_READ, MAP_SHARED, fd, 0);
+     close(fd);
+     if (MAP_FAILED == rp->map) {
+          LOG_ERROR("Couldn't mmap %s\n", fn);
+          free(rp);
+          return NULL;
+     }
+
+     rp->hdr = (const refpack_hdr_t *)rp->map;
+     rp->seqs = (const refpack_seq_t *)(rp->map + sizeof(refpack_hdr_t));
+     if (memcmp(rp->hdr->magic, REFPACK_MAGIC, 4)) {
+          LOG_ERROR("%s is not a refpack image\n", fn);
+          goto error;
+     }
+     if (rp->hdr->byte_order != REFPACK_BYTE_ORDER) {
+          LOG_ERROR("%s was created on a machine with different byte order. Please recreate with lofreq refpack\n", fn);
+          goto error;
+     }
+     if (rp->hdr->version != REFPACK_VERSION) {
+          LOG_ERROR("%s has unsupported version %u. Please recreate with lofreq refpack\n", fn, rp->hdr->version);
+          goto error;
+     }
+     if (rp->hdr->file_size != rp->map_size ||
+         sizeof(refpack_hdr_t) + (uint64_t)rp->hdr->num_seqs * sizeof(refpack_seq_t) > rp->map_size) {
+          LOG_ERROR("%s is truncated or corrupt\n", fn);
+          goto error;
+     }
+
+     if (rp->hdr->num_seqs &&
+         NULL == (rp->name_items = calloc(rp->hdr->num_seqs, sizeof(refpack_name_t)))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          goto error;
+     }
+     for (i=0; i<(int)rp->hdr->num_seqs; i++) {
+          const refpack_seq_t *s = & rp->seqs[i];
+          refpack_name_t *item = & rp->name_items[i];
+
+          if (s->name_offset >= rp->map_size ||
+              NULL == memchr(rp->map + s->name_offset, '\0', rp->map_size - s->name_offset) ||
+              s->len < 0 ||
+              s->bases_offset + (s->len+3)/4 > rp->map_size ||
+              s->exc_offset + s->num_exc * sizeof(refpack_exc_t) > rp->map_size ||
+              s->hrun_offset + s->len > rp->map_size) {
+               LOG_ERROR("%s is truncated or corrupt\n", fn);
+               goto error;
+          }
+          item->name = (const char *)(rp->map + s->name_offset);
+          item->idx = i;
+          HASH_ADD_KEYPTR(hh, rp->names, item->name, strlen(item->name), item);
+     }
+
+     refpack_init_unpack_table();
+     return rp;
+
+error:
+     refpack_close(rp);
+     return NULL;
+}
+
+
+void
+refpack_close(refpack_t *rp)
+{
+     if (! rp) {
+          return;
+     }
+     HASH_CLEAR(hh, rp->names);
+     free(rp->name_items);
+     munmap(rp->map, rp->map_size);
+     free(rp);
+}
+
+
+int
+refpack_nseq(const refpack_t *rp)
+{
+     return rp->hdr->num_seqs;
+}
+
+
+const char *
+refpack_iseq(const refpack_t *rp, const int i)
+{
+     return (const char *)(rp->map + rp->seqs[i].name_offset);
+}
+
+
+static const refpack_seq_t *
+refpack_find(const refpack_t *rp, const char *name)
+{
+     refpack_name_t *item;
+
+     HASH_FIND_STR(rp->names, name, item);
+     return item ? & rp->seqs[item->idx] : NULL;
+}
+
+
+/* returns length of sequence name or -1 if not found */
+int
+refpack_seq_len(const refpack_t *rp, const char *name)
+{
+     const refpack_seq_t *s = refpack_find(rp, name);
+     return s ? (int)s->len : -1;
+}
+
+
+/* hex md5 digest of sequence name (as used for M5 in SAM headers)
+ * is written to md5. returns -1 if not found, 0 otherwise */
+int
+refpack_seq_md5(const refpack_t *rp, const char *name, char md5[33])
+{
+     const refpack_seq_t *s = refpack_find(rp, name);
+
+     if (! s) {
+          return -1;
+     }
+     hts_md5_hex(md5, s->md5);
+     return 0;
+}
+
+
+/* unpacks bases beg to end (0-based, inclusive and within sequence)
+ * of s into dst, i.e. dst[0] is base beg. not nul-terminated */
+static void
+refpack_unpack(const refpack_t *rp, const refpack_seq_t *s,
+               const int64_t beg, const int64_t end, char *dst)
+{
+     const unsigned char *bases = rp->map + s->bases_offset;
+     const refpack_exc_t *exc;
+     int64_t i, lo, hi;
+
+     i = beg;
+     while (i <= end && i % 4) {
+          dst[i-beg] = refpack_unpack_table[bases[i/4]][i%4];
+          i++;
+     }
+     while (i + 3 <= end) {
+          memcpy(& dst[i-beg], refpack_unpack_table[bases[i/4]], 4);
+          i += 4;
+     }
+     while (i <= end) {
+          dst[i-beg] = refpack_unpack_table[bases[i/4]][i%4];
+          i++;
+     }
+
+     /* binary search for first run ending after beg, then apply
+      * overlapping runs */
+     exc = (const refpack_exc_t *)(rp->map + s->exc_offset);
+     lo = 0;
+     hi = s->num_exc;
+     while (lo < hi) {
+          int64_t mid = lo + (hi-lo)/2;
+          if (exc[mid].start + exc[mid].len <= (uint64_t)beg) {
+               lo = mid + 1;
+          } else {
+               hi = mid;
+          }
+     }
+     for (; lo < (int64_t)s->num_exc && exc[lo].start <= (uint64_t)end; lo++) {
+          int64_t from = (int64_t)exc[lo].start > beg ? (int64_t)exc[lo].start : beg;
+          int64_t to = (int64_t)(exc[lo].start + exc[lo].len - 1) < end ?
+               (int64_t)(exc[lo].start + exc[lo].len - 1) : end;
+          memset(& dst[from-beg], exc[lo].base, to - from + 1);
+     }
+}
+
+
+/* analogous to faidx_fetch_seq(): returns uppercase sequence name
+ * from beg to end (0-based, inclusive; clipped to sequence length),
+ * which has to be freed by caller. len is set to length of returned
+ * sequence or -2 if name was not found. thread-safe */
+char *
+refpack_fetch(const refpack_t *rp, const char *name, int beg, int end, int *len)
+{
+     const refpack_seq_t *s = refpack_find(rp, name);
+     char *seq;
+
+     if (! s) {
+          *len = -2;
+          return NULL;
+     }
+     if (beg < 0) {
+          beg = 0;
+     }
+     if (end >= s->len) {
+          end = s->len - 1;
+     }
+     if (end < beg) {
+          end = beg - 1;
+     }
+     *len = end - beg + 1;
+     if (NULL == (seq = malloc(*len + 1))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          *len = -1;
+          return NULL;
+     }
+     refpack_unpack(rp, s, beg, end, seq);
+     seq[*len] = '\0';
+
+     return seq;
+}
+
+/* returns homopolymer track of sequence name (see HRUN_TRACK_LEN),
+ * pointing into the image, or NULL if not found. len is set to the
+ * sequence length */
+const uint8_t *
+refpack_hrun_track(const refpack_t *rp, const char *name, int *len)
+{
+     const refpack_seq_t *s = refpack_find(rp, name);
+
+     if (! s) {
+          *len = -2;
+          return NULL;
+     }
+     *len = s->len;
+     return rp->map + s->hrun_offset;
+}
+
+
+
+/* loads fn as reference: if fn is a refpack image it's used
+ * directly. otherwise an up-to-date image next to it (fn + REFPACK_EXT)
+ * is preferred over the fasta file itself. returns NULL on error */
+ref_file_t *
+ref_file_load(const char *fn)
+{
+     ref_file_t *rf;
+     char *pack_fn;
+
+     if (NULL == (rf = calloc(1, sizeof(ref_file_t)))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          return NULL;
+     }
+
+     if (refpack_is_image(fn)) {
+          if (NULL == (rf->rp = refpack_open(fn))) {
+               free(rf);
+               return NULL;
+          }
+          return rf;
+     }
+
+     rf->fasta = strdup(fn);
+     if (NULL == (pack_fn = malloc(strlen(fn) + strlen(REFPACK_EXT) + 1))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          ref_file_destroy(rf);
+          return NULL;
+     }
+     sprintf(pack_fn, "%s%s", fn, REFPACK_EXT);
+     if (file_exists(pack_fn)) {
+          if (is_newer(fn, pack_fn) == 1) {
+               LOG_WARN("Ignoring %s which is older than %s. Please recreate with lofreq refpack\n",
+                        pack_fn, fn);
+          } else if (refpack_is_image(pack_fn)) {
+               rf->rp = refpack_open(pack_fn);
+               if (rf->rp) {
+                    LOG_VERBOSE("Using packed reference %s\n", pack_fn);
+               }
+          }
+     }
+     free(pack_fn);
+
+     if (! rf->rp && NULL == (rf->fai = fai_load(fn))) {
+          ref_file_destroy(rf);
+          return NULL;
+     }
+     return rf;
+}
+
+
+void
+ref_file_destroy(ref_file_t *rf)
+{
+     if (! rf) {
+          return;
+     }
+     if (rf->fai) {
+          fai_destroy(rf->fai);
+     }
+     refpack_close(rf->rp);
+     free(rf->fasta);
+     free(rf);
+}
+
+
+/* returns whole uppercase sequence name, which has to be freed by
+ * caller, or NULL if not found */
+char *
+ref_file_fetch(const ref_file_t *rf, const char *name, int *len)
+{
+     return ref_file_fetch_region(rf, name, 0, INT_MAX, len);
+}
+
+
+/* like ref_file_fetch(), but only bases beg to end (0-based,
+ * inclusive; clipped to sequence length) are read. the returned
+ * buffer still spans the whole sequence, so that it can be indexed
+ * by position, and len is set to the sequence length. all other
+ * positions are nul, which htslib's BAQ and all of lofreq treat like
+ * an unknown base. the untouched part is allocated with calloc() and
+ * therefore (on systems with lazy zero pages, e.g. Linux) costs
+ * address space but no memory. returns NULL if name wasn't found */
+char *
+ref_file_fetch_region(const ref_file_t *rf, const char *name, int beg, int end, int *len)
+{
+     char *seq;
+     int seq_len;
+
+     if (beg <= 0 && end == INT_MAX && ! rf->rp) {
+          /* whole sequence from fasta, i.e. read directly */
+          seq = faidx_fetch_seq(rf->fai, name, 0, INT_MAX, len);
+          if (seq) {
+               strtoupper(seq);/* safeguard */
+          }
+          return seq;
+     }
+
+     if ((seq_len = ref_file_seq_len(rf, name)) < 0) {
+          *len = -2;
+          return NULL;
+     }
+     if (beg < 0) {
+          beg = 0;
+     }
+     if (end >= seq_len) {
+          end = seq_len - 1;
+     }
+     if (NULL == (seq = calloc(seq_len + 1, 1))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          *len = -1;
+          return NULL;
+     }
+     *len = seq_len;
+     if (end < beg) {
+          return seq;
+     }
+
+     if (rf->rp) {
+          refpack_unpack(rf->rp, refpack_find(rf->rp, name), beg, end, & seq[beg]);
+     } else {
+          int reg_len = -1;
+          char *reg = faidx_fetch_seq(rf->fai, name, beg, end, &reg_len);
+          if (NULL == reg || reg_len != end - beg + 1) {
+               LOG_ERROR("Couldn't fetch %s:%d-%d\n", name, beg+1, end+1);
+               free(reg);
+               free(seq);
+               *len = -1;
+               return NULL;
+          }
+          memcpy(& seq[beg], reg, reg_len);
+          free(reg);
+          strtoupper(& seq[beg]);/* safeguard */
+     }
+     return seq;
+}
+
+
+int
+ref_file_nseq(const ref_file_t *rf)
+{
+     return rf->rp ? refpack_nseq(rf->rp) : faidx_nseq(rf->fai);
+}
+
+
+const char *
+ref_file_iseq(const ref_file_t *rf, const int i)
+{
+     return rf->rp ? refpack_iseq(rf->rp, i) : faidx_iseq(rf->fai, i);
+}
+
+
+/* returns length of sequence name or -1 if not found */
+int
+ref_file_seq_len(const ref_file_t *rf, const char *name)
+{
+     return rf->rp ? refpack_seq_len(rf->rp, name) : faidx_seq_len(rf->fai, name);
+}
+
+
+/* returns precomputed homopolymer track of sequence name or NULL if
+ * not available (i.e. no refpack image is used or name wasn't found) */
+const uint8_t *
+ref_file_hrun_track(const ref_file_t *rf, const char *name, int *len)
+{
+     if (! rf->rp) {
+          return NULL;
+     }
+     return refpack_hrun_track(rf->rp, name, len);
+}
@@ -0,0 +1,123 @@
+/* -*- c-file-style: "k&r"; indent-tabs-mode: nil; -*- */
+/*********************************************************************
+* The MIT License (MIT)
+* 
+* Copyright (c) 2013,2014 Genome Institute of Singapore
+* 
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation files
+* (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify, merge,
+* publish, distribute, sublicense, and/or sell copies of the Software,
+* and to permit persons to whom the Software is furnished to do so,
+* subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+* BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+* ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+* CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+************************************************************************/
+
+#ifndef REFPACK_H
+#define REFPACK_H
+
+#include <stdint.h>
+
+#include "htslib/faidx.h"
+
+/* packed reference image ("refpack"), created with lofreq refpack.
+ * stores all sequences of a fasta file 2-bit packed, with runs of
+ * non-ACGT characters (mostly N) kept separately, plus each sequence's
+ * length and MD5 digest and its homopolymer track (see below). the
+ * image is mmap()ed read-only, so several processes and threads share
+ * its pages through the OS page cache.
+ */
+#define REFPACK_EXT ".lfr"
+
+
+/* homopolymer track: one byte per reference position, giving the
+ * length of the homopolymer run the position is part of (saturated at
+ * HRUN_TRACK_MAX) and whether the position is the first of its run.
+ * get_hrun() at pos is HRUN_TRACK_LEN(track[pos+1]).
+ */
+#define HRUN_TRACK_MAX 127
+#define HRUN_TRACK_LEN(t) ((t) & 0x7f)
+#define HRUN_TRACK_IS_START(t) ((t) & 0x80)
+
+void
+hrun_track_compute(const char *seq, const int len, uint8_t *track);
+
+typedef struct refpack_s refpack_t;
+
+int
+refpack_build(const char *fasta, const char *out);
+
+int
+refpack_is_image(const char *fn);
+
+refpack_t *
+refpack_open(const char *fn);
+
+void
+refpack_close(refpack_t *rp);
+
+int
+refpack_nseq(const refpack_t *rp);
+
+const char *
+refpack_iseq(const refpack_t *rp, const int i);
+
+int
+refpack_seq_len(const refpack_t *rp, const char *name);
+
+int
+refpack_seq_md5(const refpack_t *rp, const char *name, char md5[33]);
+
+char *
+refpack_fetch(const refpack_t *rp, const char *name, int beg, int end, int *len);
+
+const uint8_t *
+refpack_hrun_track(const refpack_t *rp, const char *name, int *len);
+
+
+/* reference as used by all subcommands: either a refpack image or a
+ * faidx indexed fasta file. see ref_file_load() */
+typedef struct {
+     faidx_t *fai; /* NULL if rp is used */
+     refpack_t *rp; /* NULL if fai is used */
+     char *fasta; /* path of fasta file (e.g. for CRAM). NULL if only image was given */
+} ref_file_t;
+
+ref_file_t *
+ref_file_load(const char *fn);
+
+void
+ref_file_destroy(ref_file_t *rf);
+
+char *
+ref_file_fetch(const ref_file_t *rf, const char *name, int *len);
+
+char *
+ref_file_fetch_region(const ref_file_t *rf, const char *name, int beg, int end, int *len);
+
+int
+ref_file_nseq(const ref_file_t *rf);
+
+const char *
+ref_file_iseq(const ref_file_t *rf, const int i);
+
+int
+ref_file_seq_len(const ref_file_t *rf, const char *name);
+
+const uint8_t *
+ref_file_hrun_track(const ref_file_t *rf, const char *name, int *len);
+
+#endif
@@ -30,10 +30,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <string.h>
 #include <assert.h>
 
-/* samtools includes */
-#include "sam.h"
+/* htslib includes */
+#include "htslib/sam.h"
 #include "htslib/kstring.h"
 
 /* lofreq includes */
@@ -42,10 +43,6 @@
 #include "plp.h"
 #include "samutils.h"
 
-/* libbam:bamaux.c */
-extern void bam_init_header_hash(bam_header_t *header);
-extern void bam_destroy_header_hash(bam_header_t *header);
-
 #define INDEL_QUAL_DEFAULT 45
 
 #define BUF_SIZE 1024
@@ -123,23 +120,15 @@ normalize_alnerrprof(alnerrprof_t *alnerrprof)
  * alnerrprof. values are allocated here and should be freed with
  * free_alnerrprof */
 int
-parse_alnerrprof_statsfile(alnerrprof_t *alnerrprof, const char *path, bam_header_t *bam_header)
+parse_alnerrprof_statsfile(alnerrprof_t *alnerrprof, const char *path, bam_hdr_t *bam_header)
 {
      char line[BUF_SIZE];
      int i;
      int *max_obs_pos;
      const int default_read_len = 250;
-     int free_bam_header_hash = 0;
      int rc;
      FILE *in = fopen(path, "r");
 
-
-     /* needed for finding tid from tname */
-     if (bam_header->hash == 0) {
-          bam_init_header_hash(bam_header);             
-          free_bam_header_hash = 1;
-     }
-
      max_obs_pos = calloc(bam_header->n_targets, sizeof(int));
      
      alnerrprof->num_targets = bam_header->n_targets;
@@ -172,7 +161,7 @@ parse_alnerrprof_statsfile(alnerrprof_t *alnerrprof, const char *path, bam_heade
          pos = pos - 1;
          assert(pos<MAX_READ_LEN);
 
-         tid = bam_get_tid(bam_header, tname);
+         tid = bam_name2id(bam_header, tname);
          if (-1 == tid) {
               LOG_ERROR("Target name '%s' found in error profile doesn't match any of the sequences in BAM header. Skipping and trying to continue...\n", tname);
               continue;
@@ -227,10 +216,6 @@ free_and_exit:
      
      free(max_obs_pos);
 
-     free_bam_header_hash = 0; /* FIXME segfaults often for unknown reason */
-     if (free_bam_header_hash) {
-          bam_destroy_header_hash(bam_header);
-     }
      fclose(in);
 
      return rc;
@@ -279,7 +264,7 @@ calc_read_alnerrprof(double *alnerrprof, unsigned long int *used_pos,
      /* modelled after bam.c:bam_calend(), bam_format1_core() and
       * pysam's aligned_pairs (./pysam/csamtools.pyx)
       */
-     uint32_t *cigar = bam1_cigar(b);
+     uint32_t *cigar = bam_get_cigar(b);
      uint32_t k, i;
      const bam1_core_t *c = &b->core;
 #if 0
@@ -289,7 +274,7 @@ calc_read_alnerrprof(double *alnerrprof, unsigned long int *used_pos,
 #endif
      uint32_t pos = c->pos; /* pos on genome */
      uint32_t qpos = 0; /* pos on read/query */
-     uint32_t qpos_org = bam1_strand(b) ? qlen-qpos-1 : qpos;/* original qpos before mapping as possible reverse */
+     uint32_t qpos_org = bam_is_rev(b) ? qlen-qpos-1 : qpos;/* original qpos before mapping as possible reverse */
 
 
      /* loop over cigar to get aligned bases
@@ -309,20 +294,20 @@ calc_read_alnerrprof(double *alnerrprof, unsigned long int *used_pos,
                     assert(qpos < qlen);
                     /* case agnostic */
                     char ref_nt = ref[i];
-                    char read_nt = bam_nt16_rev_table[bam1_seqi(bam1_seq(b), qpos)];
-                    int bq = bam1_qual(b)[qpos];
+                    char read_nt = seq_nt16_str[bam_seqi(bam_get_seq(b), qpos)];
+                    int bq = bam_get_qual(b)[qpos];
 #if 0
                     printf("[M]MATCH qpos,i,ref,read = %d,%d,%c,%c\n", qpos, i, ref_nt, read_nt);
 #endif                    
 
                     if (ref_nt != 'N') {
                          if (ref_nt != read_nt || op == BAM_CDIFF) {
-                              alnerrprof[qpos_org] += (1.0 - PHREDQUAL_TO_PROB(bq));
+                              alnerrprof[qpos_org] += (1.0 - phredqual_to_prob(bq));
                          } /* otherwise leave at 0.0 but count anyway */
                          used_pos[qpos_org] += 1;
                     }
                     qpos += 1;
-                    qpos_org = bam1_strand(b) ? qlen-qpos-1 : qpos;
+                    qpos_org = bam_is_rev(b) ? qlen-qpos-1 : qpos;
                }
                pos += l;
 
@@ -330,13 +315,13 @@ calc_read_alnerrprof(double *alnerrprof, unsigned long int *used_pos,
                for (i=pos; i<pos+l; i++) {
                     assert(qpos < qlen);
                     
-                    alnerrprof[qpos] += (1.0 - PHREDQUAL_TO_PROB(INDEL_QUAL_DEFAULT));
+                    alnerrprof[qpos] += (1.0 - phredqual_to_prob(INDEL_QUAL_DEFAULT));
                     used_pos[qpos] += 1;
 #if 0
                     printf("INS qpos,i = %d,None\n", qpos);
 #endif
                     qpos += 1;
-                    qpos_org = bam1_strand(b) ? qlen-qpos-1 : qpos;
+                    qpos_org = bam_is_rev(b) ? qlen-qpos-1 : qpos;
                }
                
           } else if (op == BAM_CDEL || op == BAM_CREF_SKIP) {
@@ -346,7 +331,7 @@ calc_read_alnerrprof(double *alnerrprof, unsigned long int *used_pos,
 #endif
 
                     if (op == BAM_CDEL) {
-                         alnerrprof[qpos] += (1.0 - PHREDQUAL_TO_PROB(INDEL_QUAL_DEFAULT));
+                         alnerrprof[qpos] += (1.0 - phredqual_to_prob(INDEL_QUAL_DEFAULT));
                          used_pos[qpos] += 1;
                     }
                }
@@ -358,14 +343,14 @@ calc_read_alnerrprof(double *alnerrprof, unsigned long int *used_pos,
                printf("SOFT CLIP qpos = %d\n", qpos);
 #endif
                qpos += l;
-               qpos_org = bam1_strand(b) ? qlen-qpos-1 : qpos;
+               qpos_org = bam_is_rev(b) ? qlen-qpos-1 : qpos;
 
           } else if (op != BAM_CHARD_CLIP) {
                LOG_WARN("Unknown op %d in cigar %s\n", op, cigar_str_from_bam(b));
 
           }
      } /* for k */
-     assert(pos == bam_calend(&b->core, bam1_cigar(b))); /* FIXME correct assert? what if hard clipped? */
+     assert(pos == bam_endpos(b)); /* FIXME correct assert? what if hard clipped? */
      if (qpos != qlen) {
           LOG_FIXME("got qpos=%d and qlen=%d for cigar %s l_qseq %d\n", qpos, qlen, cigar_str_from_bam(b), b->core.l_qseq);
      }
@@ -383,7 +368,7 @@ calc_read_alnerrprof(double *alnerrprof, unsigned long int *used_pos,
 
 
 
-/* from char *bam_format1_core(const bam_header_t *header, const
+/* from char *bam_format1_core(const bam_hdr_t *header, const
  * bam1_t *b, int of) 
  */
 char *
@@ -394,8 +379,8 @@ cigar_str_from_bam(const bam1_t *b)
      int i;
      str.l = str.m = 0; str.s = 0;
      for (i = 0; i < c->n_cigar; ++i) {
-          kputw(bam1_cigar(b)[i]>>BAM_CIGAR_SHIFT, &str);
-          kputc("MIDNSHP=X"[bam1_cigar(b)[i]&BAM_CIGAR_MASK], &str);
+          kputw(bam_get_cigar(b)[i]>>BAM_CIGAR_SHIFT, &str);
+          kputc("MIDNSHP=X"[bam_get_cigar(b)[i]&BAM_CIGAR_MASK], &str);
      }
      return str.s;
 }
@@ -421,8 +406,8 @@ cigar_str_from_bam(const bam1_t *b)
  * number of elements corresponds to the count entry and can be at max
  * readlen.
  * 
- * If target is non-NULL will ignore preloaded variant positions via
- * var_in_ign_list
+ * If target is non-NULL will ignore preloaded variant positions (see
+ * source_qual_load_ign_vcf())
  *
  * WARNING code duplication with calc_read_alnerrprof but merging the
  * two functions was too complicated (and the latter is unused anyway)
@@ -438,7 +423,7 @@ count_cigar_ops(int *counts, int **quals, const bam1_t *b,
      /* modelled after bam.c:bam_calend(), bam_format1_core() and
       * pysam's aligned_pairs (./pysam/csamtools.pyx)
       */
-     uint32_t *cigar = bam1_cigar(b);
+     uint32_t *cigar = bam_get_cigar(b);
      const bam1_core_t *c = &b->core;
      uint32_t tpos = c->pos; /* pos on genome */
      uint32_t qpos = 0; /* pos on read/query */
@@ -448,6 +433,8 @@ count_cigar_ops(int *counts, int **quals, const bam1_t *b,
 #else
      int qlen = b->core.l_qseq; /* read length */
 #endif
+     /* ignore positions for this read's target, looked up once */
+     const ign_pos_list_t *ign = target ? ign_list_for_target(target) : NULL;
 
      if (! ref) {
           return -1;
@@ -476,8 +463,8 @@ count_cigar_ops(int *counts, int **quals, const bam1_t *b,
                     int actual_op;
                     assert(qpos < qlen);
                     char ref_nt = ref[i];
-                    char read_nt = bam_nt16_rev_table[bam1_seqi(bam1_seq(b), qpos)];
-                    int bq = bam1_qual(b)[qpos];
+                    char read_nt = seq_nt16_str[bam_seqi(bam_get_seq(b), qpos)];
+                    int bq = bam_get_qual(b)[qpos];
 
                     if (ref_nt != read_nt || op == BAM_CDIFF) {
                          actual_op = OP_MISMATCH;
@@ -488,23 +475,18 @@ count_cigar_ops(int *counts, int **quals, const bam1_t *b,
                     /* ignoring base if below min_bq, independent of type */
                     if (bq<min_bq) {
 #ifdef TRACE
-                         fprintf(stderr, "TRACE(%s): [M]MATCH ignoring base because of bq=%d at %d (qpos %d)\n", bam1_qname(b), bq, i, qpos);
+                         fprintf(stderr, "TRACE(%s): [M]MATCH ignoring base because of bq=%d at %d (qpos %d)\n", bam_get_qname(b), bq, i, qpos);
 #endif
                          qpos += 1;
                          continue;
                     }
 
                     /* for mismatches only */
-                    if (target && actual_op == OP_MISMATCH) {
-                         var_t fake_var;
-                         memset(&fake_var, 0, sizeof(var_t));
-                         fake_var.chrom = target;
-                         fake_var.pos = i;
-                         /* FIXME evil, evil hack. only works as long as var_in_ign_list only uses chrom and pos */
-                         if (var_in_ign_list(&fake_var)) {
+                    if (ign && actual_op == OP_MISMATCH) {
+                         if (ign_list_has_pos(ign, i)) {
 
 #ifdef TRACE
-                              fprintf(stderr, "TRACE(%s): MM: ignoring because in ign list at %d (qpos %d)\n", bam1_qname(b), i, qpos);
+                              fprintf(stderr, "TRACE(%s): MM: ignoring because in ign list at %d (qpos %d)\n", bam_get_qname(b), i, qpos);
 #endif
                               qpos += 1;
                               continue;
@@ -512,7 +494,7 @@ count_cigar_ops(int *counts, int **quals, const bam1_t *b,
                     }
 
 #ifdef TRACE
-                    fprintf(stderr, "TRACE(%s): adding [M]MATCH qpos,tpos,ref,read,bq = %d,%d,%c,%c,%d\n", bam1_qname(b), qpos, tpos, ref_nt, read_nt, bq);
+                    fprintf(stderr, "TRACE(%s): adding [M]MATCH qpos,tpos,ref,read,bq = %d,%d,%c,%c,%d\n", bam_get_qname(b), qpos, tpos, ref_nt, read_nt, bq);
 #endif                    
                     counts[actual_op] += 1;
                     if (quals) {
@@ -525,31 +507,28 @@ count_cigar_ops(int *counts, int **quals, const bam1_t *b,
 
           } else if (op == BAM_CINS || op == BAM_CDEL) {
 
-               if (target) {
+               if (ign) {
                     /* vcf: 
                      * indel at tpos 1 means, that qpos 2 is an insertion  (e.g. A to AT)
                      * del at tpos 1 means, that qpos 2 is missing (e.g. AT to A)
                      */
-                    var_t fake_var;
-                    fake_var.chrom = target;
-                    fake_var.pos = tpos;
+                    long int ign_pos = tpos;
                     if (op==BAM_CINS) {
-                         fake_var.pos -= 1;
+                         ign_pos -= 1;
                     }
-                    /* FIXME see above: only works as long as var_in_ign_list only uses chrom and pos */
-                    if (var_in_ign_list(&fake_var)) {
+                    if (ign_list_has_pos(ign, ign_pos)) {
                          if (op == BAM_CINS) {
                               qpos += l;
                          }
 #ifdef TRACE
-                         fprintf(stderr, "TRACE(%s): %c: ignoring because in ign list at tpos %d (qpos %d)\n", bam1_qname(b), op == BAM_CINS? 'I':'D', tpos, qpos);
+                         fprintf(stderr, "TRACE(%s): %c: ignoring because in ign list at tpos %d (qpos %d)\n", bam_get_qname(b), op == BAM_CINS? 'I':'D', tpos, qpos);
 #endif
                          continue;
                     }
                }
 
 #ifdef TRACE
-               fprintf(stderr, "TRACE(%s): adding %c qpos,tpos = %d,%d\n", bam1_qname(b), op==BAM_CINS?'I':'D', qpos, tpos);
+               fprintf(stderr, "TRACE(%s): adding %c qpos,tpos = %d,%d\n", bam_get_qname(b), op==BAM_CINS?'I':'D', qpos, tpos);
 #endif                    
 
                if (op == BAM_CINS) {
@@ -586,9 +565,9 @@ count_cigar_ops(int *counts, int **quals, const bam1_t *b,
           }
      } /* for k */
 
-     assert(qpos == bam_calend(&b->core, bam1_cigar(b))); /* FIXME correct assert? what if hard clipped? */
+     assert(qpos == bam_endpos(b)); /* FIXME correct assert? what if hard clipped? */
      if (qpos != qlen) {
-          LOG_WARN("got qpos=%d and qlen=%d for cigar %s l_qseq %d in read %s\n", qpos, qlen, cigar_str_from_bam(b), b->core.l_qseq, bam1_qname(b));
+          LOG_WARN("got qpos=%d and qlen=%d for cigar %s l_qseq %d in read %s\n", qpos, qlen, cigar_str_from_bam(b), b->core.l_qseq, bam_get_qname(b));
      }
      assert(qpos == qlen);
 
@@ -598,7 +577,7 @@ count_cigar_ops(int *counts, int **quals, const bam1_t *b,
 #ifdef TRACE
           int j;
           for (j=0; j<counts[i]; j++) {
-               fprintf(stderr, "TRACE(%s) op %s #%d: %d\n", bam1_qname(b), op_cat_str[i], j, quals[i][j]);
+               fprintf(stderr, "TRACE(%s) op %s #%d: %d\n", bam_get_qname(b), op_cat_str[i], j, quals[i][j]);
           }
 #endif
      }
@@ -608,17 +587,57 @@ count_cigar_ops(int *counts, int **quals, const bam1_t *b,
 #undef TRACE
 
 
+/* copies M5 of @SQ line for name in header text to md5. returns 0
+ * if found, -1 otherwise */
+static int
+sam_header_sq_md5(const char *text, const int l_text, const char *name, char md5[33])
+{
+     const char *line = text;
+     const char *text_end = text + l_text;
+     const size_t name_len = strlen(name);
+
+     while (line && line < text_end) {
+          const char *line_end = memchr(line, '\n', text_end - line);
+          const char *sn, *m5;
+          if (! line_end) {
+               line_end = text_end;
+          }
+          if (0 == strncmp(line, "@SQ\t", 4)) {
+               sn = strstr(line, "\tSN:");
+               if (sn && sn < line_end && 0 == strncmp(sn+4, name, name_len) &&
+                   (sn+4+name_len == line_end || sn[4+name_len] == '\t')) {
+                    m5 = strstr(line, "\tM5:");
+                    if (m5 && m5+4+32 <= line_end) {
+                         int i;
+                         for (i=0; i<32; i++) {
+                              md5[i] = tolower(m5[4+i]);
+                         }
+                         md5[32] = '\0';
+                         return 0;
+                    }
+                    return -1;
+               }
+          }
+          line = line_end + 1;
+     }
+     return -1;
+}
+
+
 /* check match between reference and bam files. prints an error
- * message and return non-zero on mismatch 
+ * message and return non-zero on mismatch. lengths are taken from
+ * the fasta index (or refpack image) and sequences are not
+ * fetched. if a refpack image is used, its digests are also compared
+ * to M5 tags in the BAM header (if present)
 */
 int checkref(char *fasta_file, char *bam_file)
 {
      int i = -1;
-     bam_header_t *header;
-     faidx_t *fai;
-     char *ref;
+     bam_hdr_t *header;
+     ref_file_t *ref_file;
      int ref_len = -1;
-     bamFile bam_fp;
+     samFile *bam_fp;
+     int num_md5_checked = 0;
      
      if (! file_exists(fasta_file)) {
           LOG_FATAL("Fsata file %s does not exist. Exiting...\n", fasta_file);
@@ -630,16 +649,19 @@ int checkref(char *fasta_file, char *bam_file)
           return 1;
      }     
 
-     bam_fp = strcmp(bam_file, "-") == 0 ? bam_dopen(fileno(stdin), "r") : bam_open(bam_file, "r");
-     header = bam_header_read(bam_fp);
+     if (NULL == (bam_fp = sam_open(bam_file, "r"))) {
+          LOG_FATAL("Failed to open %s\n", bam_file);
+          return 1;
+     }
+     header = sam_hdr_read(bam_fp);
      if (!header) {
           LOG_FATAL("Failed to read BAM header from %s\n", bam_file);
           return 1;
      }
      
-     fai = fai_load(fasta_file);
-     if (!fai) {
-          LOG_FATAL("Failed to fasta index for %s\n", fasta_file);
+     ref_file = ref_file_load(fasta_file);
+     if (!ref_file) {
+          LOG_FATAL("Failed to load reference %s\n", fasta_file);
           return 1;
      }
      
@@ -647,9 +669,8 @@ int checkref(char *fasta_file, char *bam_file)
           LOG_DEBUG("BAM header target %d of %d: name=%s len=%d\n", 
                     i+1, header->n_targets, header->target_name[i], header->target_len[i]);
           
-          ref = faidx_fetch_seq(fai, header->target_name[i], 
-                                0, 0x7fffffff, &ref_len);
-          if (NULL == ref) {
+          ref_len = ref_file_seq_len(ref_file, header->target_name[i]);
+          if (ref_len < 0) {
                LOG_FATAL("Failed to fetch sequence %s from fasta file\n", header->target_name[i]);
                return -1;
           }
@@ -658,12 +679,24 @@ int checkref(char *fasta_file, char *bam_file)
                          header->target_name[i], header->target_len[i], ref_len);
                return -1;
           }
-          free(ref);
+          if (ref_file->rp) {
+               char bam_md5[33], ref_md5[33];
+               if (0 == sam_header_sq_md5(header->text, header->l_text, header->target_name[i], bam_md5)
+                   && 0 == refpack_seq_md5(ref_file->rp, header->target_name[i], ref_md5)) {
+                    if (strcmp(bam_md5, ref_md5)) {
+                         LOG_FATAL("MD5 mismatch for sequence %s (%s in reference; %s in bam)\n", 
+                                   header->target_name[i], ref_md5, bam_md5);
+                         return -1;
+                    }
+                    num_md5_checked++;
+               }
+          }
      }
+     LOG_VERBOSE("Checked lengths of %d sequences and MD5 of %d\n", header->n_targets, num_md5_checked);
      
-     fai_destroy(fai);
-     bam_header_destroy(header);
-     bam_close(bam_fp);
+     ref_file_destroy(ref_file);
+     bam_hdr_destroy(header);
+     sam_close(bam_fp);
 
      return 0;
 }
@@ -31,6 +31,10 @@
 
 #include "htslib/sam.h"
 
+/* reads skipped by default (was part of samtools' bam.h) */
+#ifndef BAM_DEF_MASK
+#define BAM_DEF_MASK (BAM_FUNMAP | BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP)
+#endif
 
 
 
@@ -75,7 +79,7 @@ void
 normalize_alnerrprof(alnerrprof_t *alnerrprof);
 
 int
-parse_alnerrprof_statsfile(alnerrprof_t *alnerrprof, const char *path, bam_header_t *bam_header);
+parse_alnerrprof_statsfile(alnerrprof_t *alnerrprof, const char *path, bam_hdr_t *bam_header);
 
 void
 calc_read_alnerrprof(double *alnerrprof, unsigned long int *used_pos, 
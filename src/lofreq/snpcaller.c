@@ -39,8 +39,10 @@
 #include <float.h>
 #include <errno.h>
 #include <fenv.h>
+#include <stdint.h>
 
 #include "fet.h"
+#include "fft.h"
 #include "utils.h"
 #include "log.h"
 
@@ -62,6 +64,29 @@
 /* shouldn't we use something from float.h ? */
 
 
+/* Runtime dispatched SIMD clones (AVX-512, AVX2 and the SSE2 x86-64
+ * baseline) of the Poisson-binomial row kernel. Needs gcc's function
+ * multiversioning (ifunc), otherwise we fall back to whatever the
+ * compiler makes of the plain loop. finite-math-only is safe here
+ * since we never see inf or nan in log space (LOGZERO is finite) and
+ * lets gcc turn the min/max selects into vector instructions.
+ */
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 6 \
+     && defined(__x86_64__) && defined(__linux__)
+#define PB_VEC_CLONES __attribute__((target_clones("avx512f", "avx2", "default"), \
+                                     optimize("tree-vectorize", "finite-math-only", \
+                                              "no-signed-zeros")))
+#define PB_VEC_INLINE static inline __attribute__((always_inline))
+#else
+#define PB_VEC_CLONES
+#define PB_VEC_INLINE static inline
+#endif
+
+
+int pb_engine_flag = 0;
+long long int pb_num_prescreened = 0;
+
+
 #if 0
 #define DEBUG
 #endif
@@ -246,6 +271,10 @@ double probvec_tailsum(const double *probvec, int tail_startindex,
 double *naive_calc_prob_dist(const double *err_probs, int N, int K);
 double *pruned_calc_prob_dist(const double *err_probs, int N, int K,
                       long long int bonf_factor, double sig_level);
+double *grouped_calc_prob_dist(const double *gprobs, const int *gcounts,
+                               const int num_groups, int K,
+                               long long int bonf_factor, double sig_level);
+double *fft_calc_prob_dist(const double *err_probs, int N, int K);
 
 
 
@@ -302,7 +331,7 @@ merge_srcq_mapq_baq_and_bq(const int sq, const int mq, const int baq, const int
      if (-1 == sq) {
           sp = 0.0;
      } else {
-          sp = PHREDQUAL_TO_PROB(sq);
+          sp = phredqual_to_prob(sq);
      }
 
      if (-1 == mq) {
@@ -310,19 +339,19 @@ merge_srcq_mapq_baq_and_bq(const int sq, const int mq, const int baq, const int
      } else if (0 == mq) {
           mp = MQ0_ERRPROB;
      } else {
-          mp = PHREDQUAL_TO_PROB(mq);
+          mp = phredqual_to_prob(mq);
      }
 
      if (-1 == baq) {
           bap = 0.0;
      } else {
-          bap = PHREDQUAL_TO_PROB(baq);
+          bap = phredqual_to_prob(baq);
      }
 
      if (-1 == bq) {
           bp = 0.0;
      } else {
-          bp = PHREDQUAL_TO_PROB(bq);
+          bp = phredqual_to_prob(bq);
      }
 
      /* FIXME do calculations in log space and return Q instead of p */
@@ -337,6 +366,62 @@ merge_srcq_mapq_baq_and_bq(const int sq, const int mq, const int baq, const int
 
 
 
+/* Direct-mapped cache for merge_srcq_mapq_baq_and_bq(). Deep columns
+ * only see a few hundred distinct quality tuples. Keys pack the four
+ * quals (each -1..254) into 32 bits, bit 32 marks the entry as
+ * used. Thread-local, so no locking needed.
+ */
+#define MERGEQ_CACHE_BITS 12
+typedef struct {
+     uint64_t key;
+     double prob;
+     int qual;
+} mergeq_cache_entry_t;
+static __thread mergeq_cache_entry_t mergeq_cache[1<<MERGEQ_CACHE_BITS];
+
+#define MERGEQ_CACHEABLE(q) ((q)>=-1 && (q)<=254)
+
+
+/**
+ * @brief Cached version of merge_srcq_mapq_baq_and_bq(). If not
+ * NULL, merged_qual is set to PROB_TO_PHREDQUAL_SAFE() of the result.
+ */
+double
+merge_srcq_mapq_baq_and_bq_cached(const int sq, const int mq, const int baq, const int bq,
+                                  int *merged_qual)
+{
+     uint64_t key;
+     uint32_t idx;
+     mergeq_cache_entry_t *e;
+
+     if (! (MERGEQ_CACHEABLE(sq) && MERGEQ_CACHEABLE(mq)
+            && MERGEQ_CACHEABLE(baq) && MERGEQ_CACHEABLE(bq))) {
+          double jp = merge_srcq_mapq_baq_and_bq(sq, mq, baq, bq);
+          if (merged_qual) {
+               *merged_qual = PROB_TO_PHREDQUAL_SAFE(jp);
+          }
+          return jp;
+     }
+
+     key = ((uint64_t)1<<32)
+          | (uint64_t)(sq+1)<<24 | (uint64_t)(mq+1)<<16
+          | (uint64_t)(baq+1)<<8 | (uint64_t)(bq+1);
+     idx = ((uint32_t)key * 2654435761U) >> (32-MERGEQ_CACHE_BITS);
+     e = & mergeq_cache[idx];
+     if (e->key != key) {
+          e->prob = merge_srcq_mapq_baq_and_bq(sq, mq, baq, bq);
+          e->qual = PROB_TO_PHREDQUAL_SAFE(e->prob);
+          e->key = key;
+     }
+     if (merged_qual) {
+          *merged_qual = e->qual;
+     }
+     return e->prob;
+}
+/* merge_srcq_mapq_baq_and_bq_cached() */
+
+
+
 void
 plp_to_errprobs(double **err_probs, int *num_err_probs,
                 int *alt_bases, int *alt_counts, int *alt_raw_counts,
@@ -362,11 +447,8 @@ plp_to_errprobs(double **err_probs, int *num_err_probs,
                if (nt != p->ref_base) {
                     continue;
                }
-               if (p->base_quals[i].n) {
-                    int *ref_quals = malloc(sizeof(int) * p->base_quals[i].n);
-                    memcpy(ref_quals, p->base_quals[i].data, sizeof(int) * p->base_quals[i].n);
-                    avg_ref_bq = int_median(ref_quals, p->base_quals[i].n);
-                    free(ref_quals);
+               if (p->quals[i].n) {
+                    avg_ref_bq = plp_quals_median_bq(& p->quals[i]);
                     break; /* there can only be one */
                }
           }
@@ -391,7 +473,7 @@ plp_to_errprobs(double **err_probs, int *num_err_probs,
                alt_raw_counts[alt_idx] = 0;
           }
 
-          for (j=0; j<p->base_quals[i].n; j++) {
+          for (j=0; j<p->quals[i].n; j++) {
                int bq = -1;
                int mq = -1;
                int sq = -1;
@@ -403,35 +485,33 @@ plp_to_errprobs(double **err_probs, int *num_err_probs,
                double merged_err_prob; /* final quality used for snv calling */
                int merged_qual;
 
-               if (p->base_quals[i].n) {
-                    bq = p->base_quals[i].data[j];
+               bq = p->quals[i].bq[j];
 
-                    /* bq filtering for all */
-                    if (bq < conf->min_bq) {
-                         continue;
-                    }
+               /* bq filtering for all */
+               if (bq < conf->min_bq) {
+                    continue;
+               }
 
-                    /* alt bq threshold and overwrite if needed */
-                    if (is_alt_base) {
-                         alt_raw_counts[alt_idx] += 1;
-                         /* ignore altogether if below alt bq threshold */
-                         if (bq < conf->min_alt_bq) {
-                              continue;
-                         } else if (-1 == conf->def_alt_bq)  {
-                              bq = avg_ref_bq;
-                         } else if (0 != conf->def_alt_bq)  {
-                              bq = conf->def_alt_bq;
-                         }
-                         /* 0: keep original */
+               /* alt bq threshold and overwrite if needed */
+               if (is_alt_base) {
+                    alt_raw_counts[alt_idx] += 1;
+                    /* ignore altogether if below alt bq threshold */
+                    if (bq < conf->min_alt_bq) {
+                         continue;
+                    } else if (-1 == conf->def_alt_bq)  {
+                         bq = avg_ref_bq;
+                    } else if (0 != conf->def_alt_bq)  {
+                         bq = conf->def_alt_bq;
                     }
+                    /* 0: keep original */
                }
 
-               if ((conf->flag & VARCALL_USE_BAQ) && p->baq_quals[i].n) {
-                    baq = p->baq_quals[i].data[j];
+               if (conf->flag & VARCALL_USE_BAQ) {
+                    baq = PLP_QUAL_TO_INT(p->quals[i].baq[j]);
                }
 
-               if ((conf->flag & VARCALL_USE_MQ) && p->map_quals[i].n) {
-                    mq = p->map_quals[i].data[j];
+               if (conf->flag & VARCALL_USE_MQ) {
+                    mq = p->quals[i].mq[j];
                     /*according to spec 255 is unknown */
                     if (mq == 255) {
                          mq = -1;
@@ -443,12 +523,11 @@ plp_to_errprobs(double **err_probs, int *num_err_probs,
 #endif
                }
 
-               if ((conf->flag & VARCALL_USE_SQ) && p->source_quals[i].n) {
-                    sq = p->source_quals[i].data[j];
+               if (conf->flag & VARCALL_USE_SQ) {
+                    sq = PLP_QUAL_TO_INT(p->quals[i].sq[j]);
                }
 
-               merged_err_prob = merge_srcq_mapq_baq_and_bq(sq, mq, baq, bq);
-               merged_qual =  PROB_TO_PHREDQUAL_SAFE(merged_err_prob);
+               merged_err_prob = merge_srcq_mapq_baq_and_bq_cached(sq, mq, baq, bq, &merged_qual);
 
                /* min merged q filtering for all */
                if (merged_qual < conf->min_jq) {
@@ -468,7 +547,7 @@ plp_to_errprobs(double **err_probs, int *num_err_probs,
                          LOG_FATAL("%s\n", "median off ref joined q not implemented yet (FIXME)");
                          exit(1);
                     } else if (0 != conf->def_alt_jq)  {
-                         merged_err_prob = PHREDQUAL_TO_PROB(conf->def_alt_jq);
+                         merged_err_prob = phredqual_to_prob(conf->def_alt_jq);
                     }
                     /* 0: keep original */
                     alt_counts[alt_idx] += 1;
@@ -482,130 +561,259 @@ plp_to_errprobs(double **err_probs, int *num_err_probs,
      }
 }
 
-/* FIXME merge with plp_to_del_errprobs */
+/* below this many values qsort() is just as fast as errprobs_sort() */
+#define ERRPROBS_SORT_MIN_N 128
+/* radix sort digit width in bits */
+#define ERRPROBS_SORT_DIGIT_BITS 8
+#define ERRPROBS_SORT_NUM_DIGITS (64/ERRPROBS_SORT_DIGIT_BITS)
+
+
+/* strict version of dbl_cmp (which treats values closer than
+ * DBL_EPSILON as equal) */
+static int
+errprob_cmp(const void *a, const void *b)
+{
+     const double da = *(const double *)a;
+     const double db = *(const double *)b;
+     return da<db ? -1 : da>db ? 1 : 0;
+}
+
+
+/**
+ * @brief Sorts err_probs in ascending order, like qsort() with
+ * dbl_cmp, but in linear time. Unlike dbl_cmp the order is strict,
+ * even for values below DBL_EPSILON.
+ *
+ * LSD radix sort on the bit pattern of the values, which for
+ * non-negative doubles orders like the values themselves. Passes on
+ * digits that are the same for all values are skipped, which for
+ * error probabilities (small domain of integer phred combinations)
+ * removes most of them.
+ */
 void
-plp_to_ins_errprobs(double **err_probs, int *num_err_probs,
-                    const plp_col_t *p, varcall_conf_t *conf,
-                    char key[MAX_INDELSIZE]){
+errprobs_sort(double *err_probs, const int num_err_probs)
+{
+     int hist[ERRPROBS_SORT_NUM_DIGITS][1<<ERRPROBS_SORT_DIGIT_BITS];
+     const uint64_t mask = (1<<ERRPROBS_SORT_DIGIT_BITS)-1;
+     uint64_t *src, *dst, *buf;
+     int d, i;
 
-     if (NULL == ((*err_probs) = malloc(p->coverage_plp * sizeof(double)))) {
-          /* coverage = base-count after read level filtering */
+     if (num_err_probs < ERRPROBS_SORT_MIN_N) {
+          qsort(err_probs, num_err_probs, sizeof(double), errprob_cmp);
+          return;
+     }
+     /* keys are copied to avoid type-punning err_probs */
+     if (NULL == (buf = malloc(2 * num_err_probs * sizeof(uint64_t)))) {
           fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
                   __FILE__, __FUNCTION__, __LINE__);
-          free(err_probs);
-          return;
+          exit(1);
      }
 
-     (*num_err_probs) = 0;
-     int i, j;
-     double final_err_prob;
-     int iq, aq, mq, sq;
-     iq = aq = mq = sq = -1;
+     memcpy(buf, err_probs, num_err_probs * sizeof(uint64_t));
+     memset(hist, 0, sizeof(hist));
+     src = buf;
+     dst = buf + num_err_probs;
+     for (i=0; i<num_err_probs; i++) {
+          for (d=0; d<ERRPROBS_SORT_NUM_DIGITS; d++) {
+               hist[d][(src[i] >> (d*ERRPROBS_SORT_DIGIT_BITS)) & mask]++;
+          }
+     }
 
-     for (i = 0; i < p->ins_quals.n; i++) {
-          iq = mq = -1;
-          iq = p->ins_quals.data[i];
-          if (conf->flag & VARCALL_USE_MQ) {
-               mq = p->ins_map_quals.data[i];
+     for (d=0; d<ERRPROBS_SORT_NUM_DIGITS; d++) {
+          const int shift = d*ERRPROBS_SORT_DIGIT_BITS;
+          int *h = hist[d];
+          uint64_t *swp;
+          int sum = 0;
+
+          if (h[(src[0] >> shift) & mask] == num_err_probs) {
+               continue;
+          }
+          for (i=0; i<=mask; i++) {
+               const int c = h[i];
+               h[i] = sum;
+               sum += c;
           }
-          final_err_prob = merge_srcq_mapq_baq_and_bq(-1, mq, -1, iq);
-          (*err_probs)[(*num_err_probs)++] = final_err_prob;
+          for (i=0; i<num_err_probs; i++) {
+               dst[h[(src[i] >> shift) & mask]++] = src[i];
+          }
+          swp = src; src = dst; dst = swp;
      }
 
-     ins_event *it, *it_tmp;
-     HASH_ITER(hh_ins, p->ins_event_counts, it, it_tmp) {
-          for (j = 0; j < it->ins_quals.n; j++) {
-               iq = aq = mq = sq = -1;
-               iq = it->ins_quals.data[j];
+     memcpy(err_probs, src, num_err_probs * sizeof(uint64_t));
+     free(buf);
+}
+/* errprobs_sort() */
 
-               /* don't use idaq if not wanted or if not indel in question (FIXME does the latter amek sense)? */
-               if ((conf->flag & VARCALL_USE_IDAQ) && (0 == strcmp(it->key, key))) {
-                    aq = it->ins_aln_quals.data[j];
-               }
 
-               if ((conf->flag & VARCALL_USE_MQ) && it->ins_map_quals.n) {
-                    mq = it->ins_map_quals.data[j];
-                    /*according to spec 255 is unknown */
-                    if (mq == 255) {
-                         mq = -1;
-                    }
-               }
+/* error probability of read j of an indel event. the alignment
+ * quality is only used if use_aq */
+static inline double
+indel_event_errprob(const indel_event_t *it, const int j,
+                    const varcall_conf_t *conf, const int use_aq)
+{
+     int iq, aq, mq, sq;
+     iq = aq = mq = sq = -1;
 
-               if ((conf->flag & VARCALL_USE_SQ) && it->ins_source_quals.n)  {
-                    sq = it->ins_source_quals.data[j];
-               }
-               
-               final_err_prob = merge_srcq_mapq_baq_and_bq(sq, mq, aq, iq);
-#ifdef TRACE
-               LOG_DEBUG("+%s IQ:%d IAQ:%d MQ:%d SQ:%d EP:%lg\n",
-                         it->key, iq, aq, mq, sq, final_err_prob);
-#endif
-               (*err_probs)[(*num_err_probs)++] = final_err_prob;
+     iq = PLP_QUAL_TO_INT(it->quals.bq[j]);
+     if (use_aq) {
+          aq = PLP_QUAL_TO_INT(it->quals.baq[j]);
+     }
+     if (conf->flag & VARCALL_USE_MQ) {
+          mq = it->quals.mq[j];
+          /*according to spec 255 is unknown */
+          if (mq == 255) {
+               mq = -1;
           }
      }
+     if (conf->flag & VARCALL_USE_SQ) {
+          sq = PLP_QUAL_TO_INT(it->quals.sq[j]);
+     }
+     return merge_srcq_mapq_baq_and_bq_cached(sq, mq, aq, iq, NULL);
 }
 
-/* FIXME merge with plp_to_ins_errprobs */
-void
-plp_to_del_errprobs(double **err_probs, int *num_err_probs,
-                    const plp_col_t *p, varcall_conf_t *conf,
-                    char key[MAX_INDELSIZE]){
-     if (NULL == ((*err_probs) = malloc(p->coverage_plp * sizeof(double)))) {
-          /* coverage = base-count after read level filtering */
+
+/**
+ * @brief Computes the sorted error probabilities of all insertions
+ * (is_del=0) or deletions (is_del=1) at a column, which are shared
+ * by all events of that type.
+ *
+ * The only event specific part is that indel alignment qualities
+ * (VARCALL_USE_IDAQ) are used for the reads of the tested event
+ * only. The base vector is therefore built without them and patched
+ * per event by indel_errprobs_event(). Without indel alignment
+ * qualities all events use ep->base as is.
+ *
+ * Returns non-zero on error. Free with indel_errprobs_free().
+ */
+int
+indel_errprobs_init(indel_errprobs_t *ep, const plp_col_t *p,
+                    const varcall_conf_t *conf, const int is_del)
+{
+     const int_varray_t *quals = is_del ? & p->del_quals : & p->ins_quals;
+     const int_varray_t *map_quals = is_del ? & p->del_map_quals : & p->ins_map_quals;
+     int max_event_n = 0;
+     int i, j;
+
+     memset(ep, 0, sizeof(indel_errprobs_t));
+     ep->events = is_del ? & p->del_events : & p->ins_events;
+     ep->conf = conf;
+     ep->use_aq = (conf->flag & VARCALL_USE_IDAQ) ? 1 : 0;
+
+     ep->num_base = quals->n;
+     for (i = 0; i < ep->events->n; i++) {
+          ep->num_base += ep->events->events[i].quals.n;
+          if (ep->events->events[i].quals.n > max_event_n) {
+               max_event_n = ep->events->events[i].quals.n;
+          }
+     }
+     if (NULL == (ep->base = malloc((ep->num_base+1) * sizeof(double)))) {
           fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
                   __FILE__, __FUNCTION__, __LINE__);
-          free(err_probs);
-          return;
+          return 1;
+     }
+     if (ep->use_aq) {
+          if (NULL == (ep->probs = malloc((ep->num_base+1) * sizeof(double)))
+              || NULL == (ep->rm = malloc((max_event_n+1) * sizeof(double)))
+              || NULL == (ep->add = malloc((max_event_n+1) * sizeof(double)))) {
+               fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                       __FILE__, __FUNCTION__, __LINE__);
+               indel_errprobs_free(ep);
+               return 1;
+          }
      }
 
-     (*num_err_probs) = 0;
-     int i, j;
-     double final_err_prob;
-     int dq, aq, mq, sq;
-     dq = aq = mq = sq = -1;
-
-     for (i = 0; i < p->del_quals.n; i++) {
-          dq = mq = -1;
-          dq = p->del_quals.data[i];
+     /* non-indel qualities */
+     ep->num_base = 0;
+     for (i = 0; i < quals->n; i++) {
+          int iq, mq;
+          iq = mq = -1;
+          iq = quals->data[i];
           if (conf->flag & VARCALL_USE_MQ) {
-               mq = p->del_map_quals.data[i];
+               mq = map_quals->data[i];
           }
-          final_err_prob = merge_srcq_mapq_baq_and_bq(-1, mq, -1, dq);
-          (*err_probs)[(*num_err_probs)++] = final_err_prob;
+          ep->base[ep->num_base++] = merge_srcq_mapq_baq_and_bq_cached(-1, mq, -1, iq, NULL);
      }
 
-     del_event *it, *it_tmp;
-     HASH_ITER(hh_del, p->del_event_counts, it, it_tmp) {
-          for (j = 0; j < it->del_quals.n; j++) {
-               dq = aq = mq = sq = -1;
-               dq = it->del_quals.data[j];
+     for (i = 0; i < ep->events->n; i++) {
+          const indel_event_t *it = & ep->events->events[i];
+          for (j = 0; j < it->quals.n; j++) {
+               ep->base[ep->num_base++] = indel_event_errprob(it, j, conf, 0);
+#ifdef TRACE
+               LOG_DEBUG("%c%s IQ:%d MQ:%d SQ:%d EP:%lg\n", is_del ? '-' : '+', it->key,
+                         PLP_QUAL_TO_INT(it->quals.bq[j]), it->quals.mq[j],
+                         PLP_QUAL_TO_INT(it->quals.sq[j]), ep->base[ep->num_base-1]);
+#endif
+          }
+     }
 
-               /* don't use idaq if not wanted or if not indel in question (FIXME does the latter amek sense)? */
-               if ((conf->flag & VARCALL_USE_IDAQ) && (0 == strcmp(it->key, key))) {
-                    aq = it->del_aln_quals.data[j];
-               }
+     errprobs_sort(ep->base, ep->num_base);
+     return 0;
+}
+/* indel_errprobs_init() */
 
-               if ((conf->flag & VARCALL_USE_MQ) && it->del_map_quals.n) {
-                    mq = it->del_map_quals.data[j];
-                    /*according to spec 255 is unknown */
-                    if (mq == 255) {
-                         mq = -1;
-                    }
-               }
 
-               if ((conf->flag & VARCALL_USE_SQ) && it->del_source_quals.n) {
-                         sq = it->del_source_quals.data[j];
-               }
+/**
+ * @brief Returns the sorted error probabilities for testing event
+ * ev_idx (index into ep->events). The returned vector is owned by ep
+ * and only valid until the next call.
+ *
+ * With alignment qualities, the event's own values are removed from
+ * the sorted base vector and its values including alignment quality
+ * merged in, which is linear instead of rebuilding and resorting
+ * everything. The result is identical to sorting from scratch.
+ */
+const double *
+indel_errprobs_event(indel_errprobs_t *ep, const int ev_idx, int *num_err_probs)
+{
+     const indel_event_t *it = & ep->events->events[ev_idx];
+     int num_rm = 0, num_add = 0;
+     int i, r, a, n;
 
-               final_err_prob = merge_srcq_mapq_baq_and_bq(sq, mq, aq, dq);
-#ifdef TRACE
-               LOG_DEBUG("+%s DQ:%d DAQ:%d MQ:%d SQ:%d EP:%lg\n",
-                         it->key, dq, aq, mq, sq, final_err_prob);
-#endif
-               (*err_probs)[(*num_err_probs)++] = final_err_prob;
+     *num_err_probs = ep->num_base;
+     if (! ep->use_aq) {
+          return ep->base;
+     }
+
+     for (i = 0; i < it->quals.n; i++) {
+          if (it->quals.baq[i] == PLP_QUAL_NA) {
+               continue; /* same with or without */
           }
+          ep->rm[num_rm++] = indel_event_errprob(it, i, ep->conf, 0);
+          ep->add[num_add++] = indel_event_errprob(it, i, ep->conf, 1);
+     }
+     if (! num_rm) {
+          return ep->base;
      }
+     errprobs_sort(ep->rm, num_rm);
+     errprobs_sort(ep->add, num_add);
+
+     i = r = a = n = 0;
+     while (i < ep->num_base || a < num_add) {
+          if (i < ep->num_base && r < num_rm && ep->base[i] == ep->rm[r]) {
+               i++; r++;
+          } else if (a < num_add && (i == ep->num_base || ep->add[a] < ep->base[i])) {
+               ep->probs[n++] = ep->add[a++];
+          } else {
+               ep->probs[n++] = ep->base[i++];
+          }
+     }
+     assert(r == num_rm && n == ep->num_base);
+
+     return ep->probs;
 }
+/* indel_errprobs_event() */
+
+
+void
+indel_errprobs_free(indel_errprobs_t *ep)
+{
+     free(ep->base);
+     free(ep->probs);
+     free(ep->rm);
+     free(ep->add);
+     memset(ep, 0, sizeof(indel_errprobs_t));
+}
+
 
 /* initialize members of preallocated varcall_conf */
 void
@@ -705,6 +913,128 @@ log_diff(double log_a, double log_b)
 
 
 
+/* Branch-free and libm-free exp(x) for LOGZERO <= x <= 0, which lets
+ * the compiler vectorize its callers. Cody-Waite range reduction
+ * followed by a degree 13 Taylor polynomial on |r| <= ln(2)/2 gives
+ * a relative error of a few ulp. Arguments below -700 are clamped,
+ * which only matters for results that vanish next to 1.0 anyway.
+ */
+PB_VEC_INLINE double
+exp_nonpos_vec(double x)
+{
+     const double log2e = 1.4426950408889634;
+     const double ln2_hi = 6.93147180369123816490e-01;
+     const double ln2_lo = 1.90821492927058770002e-10;
+     const double shifter = 0x1.8p52;
+     union { double d; uint64_t u; } t, scale;
+     double n, r, p;
+
+     x = x < -700.0 ? -700.0 : x;
+
+     /* n = round(x/ln2), computed in a way that leaves n in the low
+      * mantissa bits of t */
+     t.d = x * log2e + shifter;
+     n = t.d - shifter;
+     r = x - n*ln2_hi - n*ln2_lo;
+
+     p = 1.0/6227020800.0;
+     p = p*r + 1.0/479001600.0;
+     p = p*r + 1.0/39916800.0;
+     p = p*r + 1.0/3628800.0;
+     p = p*r + 1.0/362880.0;
+     p = p*r + 1.0/40320.0;
+     p = p*r + 1.0/5040.0;
+     p = p*r + 1.0/720.0;
+     p = p*r + 1.0/120.0;
+     p = p*r + 1.0/24.0;
+     p = p*r + 1.0/6.0;
+     p = p*r + 0.5;
+     p = p*r + 1.0;
+     p = p*r + 1.0;
+
+     /* 2^n: the low 12 bits of the shifter pattern are zero, so
+      * shifting t leaves exactly the biased exponent of n */
+     scale.u = (t.u + 1023) << 52;
+
+     return p * scale.d;
+}
+
+
+/* Branch-free and libm-free log1p(t) for 0 <= t <= 1, via
+ * log(1+t) = 2*atanh(s) with s = t/(2+t) <= 1/3. Seventeen terms of
+ * the atanh series keep the truncation error below 1e-17.
+ */
+PB_VEC_INLINE double
+log1p_unit_vec(double t)
+{
+     double s = t/(2.0+t);
+     double s2 = s*s;
+     double p;
+
+     p = 1.0/33.0;
+     p = p*s2 + 1.0/31.0;
+     p = p*s2 + 1.0/29.0;
+     p = p*s2 + 1.0/27.0;
+     p = p*s2 + 1.0/25.0;
+     p = p*s2 + 1.0/23.0;
+     p = p*s2 + 1.0/21.0;
+     p = p*s2 + 1.0/19.0;
+     p = p*s2 + 1.0/17.0;
+     p = p*s2 + 1.0/15.0;
+     p = p*s2 + 1.0/13.0;
+     p = p*s2 + 1.0/11.0;
+     p = p*s2 + 1.0/9.0;
+     p = p*s2 + 1.0/7.0;
+     p = p*s2 + 1.0/5.0;
+     p = p*s2 + 1.0/3.0;
+     p = p*s2 + 1.0;
+
+     return 2.0*s*p;
+}
+
+
+/**
+ * @brief Vectorizable version of log_sum()
+ *
+ * See pb_row_vec() for accuracy.
+ */
+PB_VEC_INLINE double
+log_sum_vec(double log_a, double log_b)
+{
+     double hi = log_a > log_b ? log_a : log_b;
+     double lo = log_a > log_b ? log_b : log_a;
+
+     return hi + log1p_unit_vec(exp_nonpos_vec(lo-hi));
+}
+
+
+/**
+ * @brief One row of the Poisson-binomial recursion in log space:
+ *
+ * probvec[k] = log_sum(probvec_prev[k] + log_1_pn, probvec_prev[k-1] + log_pn)
+ * for k = 1..kmax
+ *
+ * This is where pruned_calc_prob_dist() spends nearly all of its time.
+ * Processes several k per instruction (see PB_VEC_CLONES).
+ *
+ * Accuracy: log_sum_vec() differs from log_sum() by at most 2 ulp of
+ * max(|log_a|, 1). Over random columns with up to 10^6 reads the
+ * resulting probabilities (above 1e-300) differ from the scalar
+ * log_sum() path by less than 2e-13 (relative).
+ */
+PB_VEC_CLONES static void
+pb_row_vec(double * restrict probvec, const double * restrict probvec_prev,
+           const int kmax, const double log_pn, const double log_1_pn)
+{
+     int k;
+     for (k=1; k<=kmax; k++) {
+          probvec[k] = log_sum_vec(probvec_prev[k] + log_1_pn,
+                                   probvec_prev[k-1] + log_pn);
+     }
+}
+
+
+
 /**
  * @brief Computes sum of probvec values (log space) starting from (including)
  * tail_startindex to (excluding) probvec_len
@@ -818,6 +1148,7 @@ pruned_calc_prob_dist(const double *err_probs, int N, int K,
     double *probvec = NULL;
     double *probvec_prev = NULL;
     double *probvec_swp = NULL;
+    double log_pn, log_1_pn, prev_pn;
     int n;
 
     if (NULL == (probvec = malloc((K+1) * sizeof(double)))) {
@@ -845,23 +1176,29 @@ pruned_calc_prob_dist(const double *err_probs, int N, int K,
 
     /* init */
     probvec_prev[0] = 0.0; /* log(1.0) */
+    log_pn = log_1_pn = 0.0;
+    prev_pn = -1.0;
 
     for (n=1; n<=N; n++) {
         int k;
         double pn = err_probs[n-1];
-        double log_pn, log_1_pn;
 
-        /* if pn=0 log(on) will fail. likewise if pn=1 (Q0) then
-         * log1p(-pn) = log(1-1) = log(0) will fail. therefore test */
-        if (fabs(pn) < DBL_EPSILON) {
-             log_pn = log(DBL_EPSILON);
-        } else {
-             log_pn = log(pn);
-        }
-        if (fabs(pn-1.0) < DBL_EPSILON) {
-             log_1_pn = log1p(-pn+DBL_EPSILON);
-        } else {
-             log_1_pn = log1p(-pn);/* 0.0 = log(1.0) */
+        /* err_probs are usually sorted, i.e. we only need to compute
+         * logs whenever the value changes */
+        if (pn != prev_pn) {
+             /* if pn=0 log(on) will fail. likewise if pn=1 (Q0) then
+              * log1p(-pn) = log(1-1) = log(0) will fail. therefore test */
+             if (fabs(pn) < DBL_EPSILON) {
+                  log_pn = log(DBL_EPSILON);
+             } else {
+                  log_pn = log(pn);
+             }
+             if (fabs(pn-1.0) < DBL_EPSILON) {
+                  log_1_pn = log1p(-pn+DBL_EPSILON);
+             } else {
+                  log_1_pn = log1p(-pn);/* 0.0 = log(1.0) */
+             }
+             prev_pn = pn;
         }
 
 #ifdef TRACE
@@ -873,10 +1210,14 @@ pruned_calc_prob_dist(const double *err_probs, int N, int K,
             probvec_prev[n] = LOGZERO;
         }
 
-        for (k=MIN(n,K-1); k>=1; k--) {
-            assert(probvec_prev[k]<=0.0 && probvec_prev[k-1]<=0.0);
-            probvec[k] = log_sum(probvec_prev[k] + log_1_pn,
-                                 probvec_prev[k-1] + log_pn);
+        if (pb_engine_flag & PB_SCALAR_KERNEL) {
+             for (k=MIN(n,K-1); k>=1; k--) {
+                  assert(probvec_prev[k]<=0.0 && probvec_prev[k-1]<=0.0);
+                  probvec[k] = log_sum(probvec_prev[k] + log_1_pn,
+                                       probvec_prev[k-1] + log_pn);
+             }
+        } else {
+             pb_row_vec(probvec, probvec_prev, MIN(n,K-1), log_pn, log_1_pn);
         }
         k = 0;
         assert(probvec_prev[k]<=0.0);
@@ -956,6 +1297,563 @@ pruned_calc_prob_dist(const double *err_probs, int N, int K,
 /* pruned_calc_prob_dist */
 
 
+/* Stop summing up a binomial upper tail once terms are this much
+ * smaller (in log space) than the sum so far
+ */
+#define PB_TAIL_LOG_EPS -50.0
+
+/* Don't bother sorting unsorted input for the grouped engine if K
+ * is below this (the DP is cheap then anyway)
+ */
+#define PB_GROUPED_MIN_K_UNSORTED 8
+
+/* Grouped engine is only used if it's estimated to be at least this
+ * many times cheaper than the (vectorized) pruned DP
+ */
+#define PB_GROUPED_MIN_GAIN 4
+
+
+/**
+ * @brief Same as pruned_calc_prob_dist(), but works on groups of
+ * identical error probabilities (gprobs[g] occuring gcounts[g]
+ * times), which are added in one step by convolving with their
+ * binomial distribution. Cost is O(sum_g min(gcounts[g], K) * K)
+ * instead of O(N * K), where N is the sum of gcounts.
+ *
+ * As for pruned_calc_prob_dist(), probvec[K] is the tail, i.e. the
+ * (log) probability of K or more failures and the same early exit
+ * rules apply.
+ */
+double *
+grouped_calc_prob_dist(const double *gprobs, const int *gcounts,
+                       const int num_groups, int K,
+                       long long int bonf_factor, double sig_level)
+{
+    double *probvec = NULL;
+    double *probvec_prev = NULL;
+    double *probvec_swp = NULL;
+    double *lpmf = NULL; /* log binomial pmf of current group for 0..K */
+    double *ltail = NULL; /* log binomial upper tail of current group for 0..K */
+    long long int n = 0;
+    int g, k;
+
+    if (NULL == (probvec = malloc((K+1) * sizeof(double)))
+        || NULL == (probvec_prev = malloc((K+1) * sizeof(double)))
+        || NULL == (lpmf = malloc((K+1) * sizeof(double)))
+        || NULL == (ltail = malloc((K+1) * sizeof(double)))) {
+        fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                __FILE__, __FUNCTION__, __LINE__);
+        free(probvec);
+        free(probvec_prev);
+        free(lpmf);
+        return NULL;
+    }
+
+    /* init */
+    probvec_prev[0] = 0.0; /* log(1.0) */
+    for (k=1; k<=K; k++) {
+         probvec_prev[k] = LOGZERO;
+    }
+
+    for (g=0; g<num_groups; g++) {
+        double pn = gprobs[g];
+        int m = gcounts[g];
+        int jmax = MIN(m, K);
+        double log_pn, log_1_pn, log_odds;
+        int j;
+
+        assert(pn + DBL_EPSILON >= 0.0 && pn - DBL_EPSILON <= 1.0);
+        assert(m > 0);
+
+        /* see pruned_calc_prob_dist() */
+        if (fabs(pn) < DBL_EPSILON) {
+             log_pn = log(DBL_EPSILON);
+        } else {
+             log_pn = log(pn);
+        }
+        if (fabs(pn-1.0) < DBL_EPSILON) {
+             log_1_pn = log1p(-pn+DBL_EPSILON);
+        } else {
+             log_1_pn = log1p(-pn);
+        }
+        log_odds = log_pn - log_1_pn;
+
+        /* binomial pmf for 0..min(m,K) failures */
+        lpmf[0] = m * log_1_pn;
+        for (j=1; j<=jmax; j++) {
+             lpmf[j] = lpmf[j-1] + log((double)(m-j+1)/(double)j) + log_odds;
+        }
+
+        /* binomial upper tail P(X>=j) computed top-down to avoid
+         * cancellation. for m>K the tail at K is summed up until
+         * terms become negligible past the mode */
+        if (m > K) {
+             double term = lpmf[K];
+             double sum = term;
+             for (j=K+1; j<=m; j++) {
+                  term += log((double)(m-j+1)/(double)j) + log_odds;
+                  sum = log_sum(sum, term);
+                  if (j > m*pn && term < sum + PB_TAIL_LOG_EPS) {
+                       break;
+                  }
+             }
+             ltail[K] = sum;
+        } else {
+             ltail[jmax] = lpmf[jmax];
+             for (j=jmax+1; j<=K; j++) {
+                  ltail[j] = LOGZERO;
+             }
+        }
+        for (j=jmax-1; j>=1; j--) {
+             ltail[j] = log_sum(ltail[j+1], lpmf[j]);
+        }
+
+        /* convolution for exact counts below K */
+        for (k=0; k<K; k++) {
+             int jmaxk = MIN(k, jmax);
+             double lmax = probvec_prev[k] + lpmf[0];
+             double sum = 0.0;
+             for (j=1; j<=jmaxk; j++) {
+                  double x = probvec_prev[k-j] + lpmf[j];
+                  if (x > lmax) {
+                       lmax = x;
+                  }
+             }
+             for (j=0; j<=jmaxk; j++) {
+                  sum += exp(probvec_prev[k-j] + lpmf[j] - lmax);
+             }
+             probvec[k] = lmax + log(sum);
+        }
+
+        /* tail: once at K or more we stay there */
+        probvec[K] = probvec_prev[K];
+        for (k=MAX(0, K-m); k<K; k++) {
+             probvec[K] = log_sum(probvec[K], probvec_prev[k] + ltail[K-k]);
+        }
+
+        n += m;
+        if (n >= K) {
+             long double pvalue;
+             int errsv = 0;
+
+             errno = 0;
+             feclearexcept(FE_ALL_EXCEPT);
+
+             pvalue = expl(probvec[K]);
+
+             errsv = errno;
+             if (errsv || fetestexcept(FE_INVALID | FE_DIVBYZERO | FE_OVERFLOW | FE_UNDERFLOW)) {
+                  if (pvalue < DBL_EPSILON) {
+                       pvalue = LDBL_MIN;
+                  } else {
+                       pvalue = LDBL_MAX;
+                  }
+             }
+             if (pvalue * (double)bonf_factor > sig_level) {
+#ifdef DEBUG
+                  fprintf(stderr, "DEBUG(%s:%s:%d): early exit at group g=%d (n=%lld) K=%d with pvalue %Lg\n",
+                          __FILE__, __FUNCTION__, __LINE__, g, n, K, pvalue);
+#endif
+                  free(probvec_prev);
+                  free(lpmf);
+                  free(ltail);
+                  return probvec;
+             }
+        }
+
+        /* swap */
+        probvec_swp = probvec;
+        probvec = probvec_prev;
+        probvec_prev = probvec_swp;
+    }
+
+    free(probvec);
+    free(lpmf);
+    free(ltail);
+    return probvec_prev;
+}
+/* grouped_calc_prob_dist() */
+
+
+/**
+ * @brief Runs grouped_calc_prob_dist() on err_probs if that's
+ * estimated to be substantially cheaper than pruned_calc_prob_dist().
+ * Returns NULL if not (or on error), in which case the caller should
+ * fall back to the latter.
+ */
+static double *
+try_grouped_calc_prob_dist(const double *err_probs, int N, int K,
+                           long long int bonf_factor, double sig_level)
+{
+    double *sorted_probs = NULL;
+    const double *probs = err_probs;
+    double *gprobs = NULL;
+    int *gcounts = NULL;
+    double *probvec = NULL;
+    int num_groups = 0;
+    long long int grouped_cost = 0;
+    int i;
+
+    if (N < 2 || K < 1) {
+         return NULL;
+    }
+
+    for (i=1; i<N; i++) {
+         if (err_probs[i] < err_probs[i-1]) {
+              break;
+         }
+    }
+    if (i<N) {
+         if (K < PB_GROUPED_MIN_K_UNSORTED) {
+              return NULL;
+         }
+         if (NULL == (sorted_probs = malloc(N * sizeof(double)))) {
+              fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                      __FILE__, __FUNCTION__, __LINE__);
+              return NULL;
+         }
+         memcpy(sorted_probs, err_probs, N * sizeof(double));
+         qsort(sorted_probs, N, sizeof(double), dbl_cmp);
+         probs = sorted_probs;
+    }
+
+    /* count groups and estimate cost before allocating anything else */
+    for (i=0; i<N; ) {
+         int m = 1;
+         while (i+m<N && probs[i+m]==probs[i]) {
+              m++;
+         }
+         num_groups++;
+         grouped_cost += MIN(m, K) + 1;
+         i += m;
+    }
+    if (PB_GROUPED_MIN_GAIN * grouped_cost >= N) {
+         free(sorted_probs);
+         return NULL;
+    }
+
+    if (NULL == (gprobs = malloc(num_groups * sizeof(double)))
+        || NULL == (gcounts = malloc(num_groups * sizeof(int)))) {
+         fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                 __FILE__, __FUNCTION__, __LINE__);
+         free(gprobs);
+         free(sorted_probs);
+         return NULL;
+    }
+    num_groups = 0;
+    for (i=0; i<N; ) {
+         int m = 1;
+         while (i+m<N && probs[i+m]==probs[i]) {
+              m++;
+         }
+         gprobs[num_groups] = probs[i];
+         gcounts[num_groups] = m;
+         num_groups++;
+         i += m;
+    }
+
+    probvec = grouped_calc_prob_dist(gprobs, gcounts, num_groups, K,
+                                     bonf_factor, sig_level);
+
+    free(gcounts);
+    free(gprobs);
+    free(sorted_probs);
+    return probvec;
+}
+/* try_grouped_calc_prob_dist() */
+
+
+/* FFT/product-tree engine: use it if N is at least PB_FFT_MIN_N and
+ * K is larger than PB_FFT_K_FACTOR * log2(N)^2 (the pruned DP is
+ * O(N*K), the product tree roughly O(N log^2 N))
+ */
+#define PB_FFT_MIN_N 2048
+#define PB_FFT_K_FACTOR 1.0
+/* number of reads handled with a simple DP at the leaves of the tree */
+#define PB_FFT_LEAF_SIZE 32
+/* coefficients below this times the maximum are trimmed from both
+ * ends of intermediate polynomials */
+#define PB_FFT_TRIM 1e-40
+/* max number of Newton iterations when solving for the tilt */
+#define PB_FFT_MAX_ITER 100
+/* fft_calc_prob_dist() only reports probabilities below K whose
+ * tilted coefficient is at least this fraction of the largest one,
+ * i.e. far enough above the FFT noise floor (~1e-16*log2(n)) */
+#define PB_FFT_MIN_REL_COEF 1e-8
+
+
+typedef struct {
+     int off; /* power of first coefficient */
+     int len; /* number of coefficients */
+     double *c;
+} pb_poly_t;
+
+
+/* returns non-zero if poissbin() should use the FFT engine */
+static int
+pb_use_fft(const int N, const int K)
+{
+     double log2n;
+
+     if (pb_engine_flag & PB_NO_FFT) {
+          return 0;
+     }
+     if (N < PB_FFT_MIN_N || K < 1 || K >= N) {
+          return 0;
+     }
+     log2n = log2((double)N);
+     return K > PB_FFT_K_FACTOR * log2n * log2n;
+}
+
+
+/* drop negligible (or negative, i.e. FFT noise) coefficients at both
+ * ends */
+static void
+pb_poly_trim(pb_poly_t *p)
+{
+     double max = 0.0, thresh;
+     int i, start, end;
+
+     for (i=0; i<p->len; i++) {
+          if (p->c[i] > max) {
+               max = p->c[i];
+          }
+     }
+     thresh = max * PB_FFT_TRIM;
+     for (start=0; start<p->len-1 && p->c[start] <= thresh; start++) {
+          ;
+     }
+     for (end=p->len-1; end>start && p->c[end] <= thresh; end--) {
+          ;
+     }
+     if (start > 0) {
+          memmove(p->c, & p->c[start], (end-start+1) * sizeof(double));
+     }
+     p->off += start;
+     p->len = end-start+1;
+}
+
+
+/* product of the Bernoulli polynomials (1-q[i]) + q[i]*x for
+ * lo <= i < hi. returns -1 on error */
+static int
+pb_poly_tree(pb_poly_t *res, const double *q, const int lo, const int hi)
+{
+     pb_poly_t a, b;
+     int i, k;
+
+     res->off = 0;
+     res->len = 0;
+     res->c = NULL;
+
+     if (hi-lo <= PB_FFT_LEAF_SIZE) {
+          if (NULL == (res->c = malloc((hi-lo+1) * sizeof(double)))) {
+               fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                       __FILE__, __FUNCTION__, __LINE__);
+               return -1;
+          }
+          res->c[0] = 1.0;
+          res->len = 1;
+          for (i=lo; i<hi; i++) {
+               res->c[res->len] = res->c[res->len-1] * q[i];
+               for (k=res->len-1; k>=1; k--) {
+                    res->c[k] = res->c[k]*(1.0-q[i]) + res->c[k-1]*q[i];
+               }
+               res->c[0] *= (1.0-q[i]);
+               res->len++;
+          }
+          pb_poly_trim(res);
+          return 0;
+     }
+
+     if (pb_poly_tree(&a, q, lo, lo+(hi-lo)/2)) {
+          return -1;
+     }
+     if (pb_poly_tree(&b, q, lo+(hi-lo)/2, hi)) {
+          free(a.c);
+          return -1;
+     }
+     res->off = a.off + b.off;
+     res->len = a.len + b.len - 1;
+     if (NULL == (res->c = malloc(res->len * sizeof(double)))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          free(a.c);
+          free(b.c);
+          return -1;
+     }
+     if (poly_mult(res->c, a.c, a.len, b.c, b.len)) {
+          free(a.c);
+          free(b.c);
+          free(res->c);
+          res->c = NULL;
+          return -1;
+     }
+     free(a.c);
+     free(b.c);
+     pb_poly_trim(res);
+     return 0;
+}
+
+
+/**
+ * @brief Alternative to pruned_calc_prob_dist() for deep columns with
+ * large K: multiplies the Bernoulli generating polynomials in a
+ * product tree, using FFTs for large nodes.
+ *
+ * Plain FFT convolution has an absolute error relative to the
+ * largest coefficient, which would swamp small tail probabilities.
+ * We therefore exponentially tilt the error probabilities, i.e.
+ * q_i = p_i*e^t/(1-p_i+p_i*e^t), with t chosen such that the tilted
+ * mean equals K, so that the mass around K is computed accurately.
+ * Untilting gives P(X=k) = P_t(X=k) * exp(log M(t) - t*k), where
+ * M(t) is the moment generating function of X.
+ *
+ * Returns the same probvec as pruned_calc_prob_dist(), i.e. log
+ * probabilities for 0..K-1 and the log tail at K. Entries far below
+ * K would lose precision and are set to NAN instead (see
+ * PB_FFT_MIN_REL_COEF), so callers needing tails at such counts
+ * should call again with those counts. No early exit.
+ */
+double *
+fft_calc_prob_dist(const double *err_probs, int N, int K)
+{
+     double *probvec = NULL;
+     double *log_odds = NULL;
+     double *q = NULL;
+     pb_poly_t poly;
+     double theta, theta_lo, theta_hi;
+     double log_m = 0.0;
+     double prev_pn = -1.0, lodds = 0.0, log_1_pn = 0.0;
+     double tmax, cmax;
+     int i, k, iter;
+
+     assert(K >= 1 && K < N);
+
+     if (NULL == (probvec = malloc((K+1) * sizeof(double)))
+         || NULL == (log_odds = malloc(N * sizeof(double)))
+         || NULL == (q = malloc(N * sizeof(double)))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          free(probvec);
+          free(log_odds);
+          return NULL;
+     }
+
+     /* log odds with the same guards as pruned_calc_prob_dist() */
+     for (i=0; i<N; i++) {
+          double pn = err_probs[i];
+          if (pn != prev_pn) {
+               double log_pn;
+               if (fabs(pn) < DBL_EPSILON) {
+                    log_pn = log(DBL_EPSILON);
+               } else {
+                    log_pn = log(pn);
+               }
+               if (fabs(pn-1.0) < DBL_EPSILON) {
+                    log_1_pn = log1p(-pn+DBL_EPSILON);
+               } else {
+                    log_1_pn = log1p(-pn);
+               }
+               lodds = log_pn - log_1_pn;
+               prev_pn = pn;
+          }
+          log_odds[i] = lodds;
+          log_m += log_1_pn; /* untilted part of log M(t) */
+     }
+
+     /* solve sum_i q_i(t) = K for t with a safeguarded Newton: the
+      * tilted mean is increasing in t */
+     theta = 0.0;
+     theta_lo = -800.0;
+     theta_hi = 800.0;
+     for (iter=0; iter<PB_FFT_MAX_ITER; iter++) {
+          double mean = 0.0, var = 0.0, step;
+          double prev_lo = 1.0, qi = 0.0;
+          for (i=0; i<N; i++) {
+               if (log_odds[i] != prev_lo) {
+                    qi = 1.0/(1.0+exp(-(log_odds[i]+theta)));
+                    prev_lo = log_odds[i];
+               }
+               mean += qi;
+               var += qi*(1.0-qi);
+          }
+          if (mean > K) {
+               theta_hi = theta;
+          } else {
+               theta_lo = theta;
+          }
+          if (fabs(mean-K) < 1e-6 * K) {
+               break;
+          }
+          step = (K-mean)/var;
+          if (var <= 0.0 || theta+step <= theta_lo || theta+step >= theta_hi) {
+               theta = 0.5*(theta_lo+theta_hi);
+          } else {
+               theta += step;
+          }
+     }
+
+     /* tilted probabilities and log M(t) = sum_i log(1-p_i) + log(1+e^(lo_i+t)) */
+     for (i=0; i<N; i++) {
+          double x = log_odds[i]+theta;
+          q[i] = 1.0/(1.0+exp(-x));
+          log_m += (x > 0.0 ? x + log1p(exp(-x)) : log1p(exp(x)));
+     }
+     free(log_odds);
+
+     if (pb_poly_tree(&poly, q, 0, N)) {
+          free(q);
+          free(probvec);
+          return NULL;
+     }
+     free(q);
+
+     /* untilt */
+     cmax = 0.0;
+     for (i=0; i<poly.len; i++) {
+          if (poly.c[i] > cmax) {
+               cmax = poly.c[i];
+          }
+     }
+     for (k=0; k<K; k++) {
+          int idx = k - poly.off;
+          if (idx >= 0 && idx < poly.len && poly.c[idx] >= cmax * PB_FFT_MIN_REL_COEF) {
+               probvec[k] = log(poly.c[idx]) + log_m - theta*k;
+          } else {
+               probvec[k] = NAN;
+          }
+     }
+     /* tail: log sum_k>=K c_k e^(-t*(k-K)), shifted by its max term */
+     tmax = LOGZERO;
+     for (k=MAX(K, poly.off); k<poly.off+poly.len; k++) {
+          double c = poly.c[k-poly.off];
+          if (c > 0.0 && log(c) - theta*(k-K) > tmax) {
+               tmax = log(c) - theta*(k-K);
+          }
+     }
+     if (tmax <= LOGZERO) {
+          probvec[K] = LOGZERO;
+     } else {
+          double sum = 0.0;
+          for (k=MAX(K, poly.off); k<poly.off+poly.len; k++) {
+               double c = poly.c[k-poly.off];
+               if (c > 0.0) {
+                    sum += exp(log(c) - theta*(k-K) - tmax);
+               }
+          }
+          probvec[K] = tmax + log(sum) + log_m - theta*K;
+     }
+     if (probvec[K] > 0.0) {
+          probvec[K] = 0.0; /* rounding */
+     }
+
+     free(poly.c);
+     return probvec;
+}
+/* fft_calc_prob_dist() */
+
+
 #ifdef PSEUDO_BINOMIAL
 /* binomial test using poissbin. only good for high n and small prob.
  * returns -1 on error */
@@ -995,7 +1893,8 @@ pseudo_binomial(long double *pvalue,
 /* main logic. return of probvec (needs to be freed by caller allows
  * to check pvalues for other numbers < (original num_failures), like
  * so: exp(probvec_tailsum(probvec, smaller_numl, orig_num+1)) but
- * only if first pvalue was below limits implied by bonf and sig.
+ * only if first pvalue was below limits implied by bonf and sig and
+ * only if the entries used are not NAN (see fft_calc_prob_dist()).
  * default pvalue is DBL_MAX (1 might still be significant).
  *
  *  note: pvalues > sig/bonf are not computed properly
@@ -1020,8 +1919,17 @@ poissbin(long double *pvalue, const double *err_probs,
     probvec = naive_prob_dist(err_probs, num_err_probs,
                                     num_failures);
 #else
-    probvec = pruned_calc_prob_dist(err_probs, num_err_probs,
-                                    num_failures, bonf, sig);
+    if (pb_use_fft(num_err_probs, num_failures)) {
+         probvec = fft_calc_prob_dist(err_probs, num_err_probs, num_failures);
+    }
+    if (! probvec && ! (pb_engine_flag & PB_NO_GROUPED)) {
+         probvec = try_grouped_calc_prob_dist(err_probs, num_err_probs,
+                                              num_failures, bonf, sig);
+    }
+    if (! probvec) {
+         probvec = pruned_calc_prob_dist(err_probs, num_err_probs,
+                                         num_failures, bonf, sig);
+    }
 #endif
 #if TIMING
     msec = (clock() - start) * 1000 / CLOCKS_PER_SEC;
@@ -1047,23 +1955,77 @@ poissbin(long double *pvalue, const double *err_probs,
 
 
 
+/* Upper limit on number of Poisson terms summed in pb_tail_lower_bound() */
+#define PB_PRESCREEN_MAX_TERMS 10000
+
+
 /**
- * @brief
+ * @brief Cheap lower bound for P(X>=K), where X is the
+ * Poisson-binomial defined by err_probs.
  *
- * pvalues computed for each of the NUM_NONCONS_BASES noncons_counts
- * will be written to snp_pvalues in the same order. If pvalue was not
- * computed (always insignificant) its value will be set to LDBL_MAX
+ * Uses the Barbour-Hall bound on the total variation distance
+ * between X and a Poisson Y with the same mean mu:
+ * d_TV(X,Y) <= (1-exp(-mu))/mu * sum(p_i^2). Therefore P(X>=K) >=
+ * P(Y>=K) - d_TV. Any partial sum of the Poisson tail is a lower
+ * bound as well, so we only sum terms around max(K, mu). Runs in
+ * O(N) and allocates nothing. May return negative values.
+ */
+static double
+pb_tail_lower_bound(const double *err_probs, const int N, const int K)
+{
+     double mu = 0.0;
+     double sum_sq = 0.0;
+     double tv, log_mu, log_term, log_tail;
+     int i, j, j0;
+
+     for (i=0; i<N; i++) {
+          mu += err_probs[i];
+          sum_sq += err_probs[i] * err_probs[i];
+     }
+     if (mu <= 0.0) {
+          return 0.0;
+     }
+     tv = sum_sq * (-expm1(-mu)) / mu;
+
+     log_mu = log(mu);
+     j0 = MAX(K, (int)floor(mu));
+     log_term = j0*log_mu - mu - lgamma(j0+1.0);
+     log_tail = log_term;
+     for (j=j0+1; j<j0+PB_PRESCREEN_MAX_TERMS; j++) {
+          log_term += log_mu - log((double)j);
+          log_tail = log_sum(log_tail, log_term);
+          if (log_term < log_tail + PB_TAIL_LOG_EPS) {
+               break;
+          }
+     }
+
+     /* a little slack for rounding errors in lgamma() etc. */
+     return exp(log_tail) * (1.0-1e-9) - tv;
+}
+/* pb_tail_lower_bound() */
+
+
+
+/**
+ * @brief Like snpcaller(), but for num_counts counts, which all share
+ * err_probs and therefore one poissbin() run.
  *
+ * pvalues computed for each of the num_counts counts will be written
+ * to pvalues in the same order. If pvalue was not computed (always
+ * insignificant or count is 0) its value will be set to LDBL_MAX.
+ *
+ * Note: bonf_factor is only used for pruning and should be the
+ * smallest factor any of the counts will be tested with.
  */
 int
-snpcaller(long double *snp_pvalues,
-          const double *err_probs, const int num_err_probs,
-          const int *noncons_counts,
-          const long long int bonf_factor, const double sig_level)
+snpcaller_counts(long double *pvalues,
+                 const double *err_probs, const int num_err_probs,
+                 const int *counts, const int num_counts,
+                 const long long int bonf_factor, const double sig_level)
 {
     double *probvec = NULL;
     int i;
-    int max_noncons_count = 0;
+    int max_count = 0;
     long double pvalue;
 
 #if 0
@@ -1074,34 +2036,49 @@ snpcaller(long double *snp_pvalues,
 #endif
 
 #ifdef DEBUG
-    fprintf(stderr, "DEBUG(%s:%s():%d): num_err_probs=%d noncons_counts=%d,%d,%d bonf_factor=%lld sig_level=%f\n",
+    fprintf(stderr, "DEBUG(%s:%s():%d): num_err_probs=%d num_counts=%d bonf_factor=%lld sig_level=%f\n",
             __FILE__, __FUNCTION__, __LINE__,
-            num_err_probs, noncons_counts[0], noncons_counts[1], noncons_counts[2],
-            bonf_factor, sig_level);
+            num_err_probs, num_counts, bonf_factor, sig_level);
 #endif
 
     /* initialise empty results so that we can return anytime */
-    for (i=0; i<NUM_NONCONS_BASES; i++) {
-        snp_pvalues[i] = LDBL_MAX;
+    for (i=0; i<num_counts; i++) {
+        pvalues[i] = LDBL_MAX;
     }
 
     /* determine max non-consensus count */
-    for (i=0; i<NUM_NONCONS_BASES; i++) {
-        if (noncons_counts[i] > max_noncons_count) {
-            max_noncons_count = noncons_counts[i];
+    for (i=0; i<num_counts; i++) {
+        if (counts[i] > max_count) {
+            max_count = counts[i];
         }
     }
 
     /* no need to do anything if no snp bases */
-    if (0==max_noncons_count) {
+    if (0==max_count) {
         goto free_and_exit;
     }
 
+    /* columns that can't possibly become significant don't need the
+     * exact (and expensive) computation */
+    if (! (pb_engine_flag & PB_NO_PRESCREEN)) {
+         double lower_bound = pb_tail_lower_bound(err_probs, num_err_probs,
+                                                  max_count);
+         if (lower_bound * (double)bonf_factor > sig_level) {
+#ifdef DEBUG
+              fprintf(stderr, "DEBUG(%s:%s():%d): pre-screen: pvalue >= %g for count %d. Skipping\n",
+                      __FILE__, __FUNCTION__, __LINE__,
+                      lower_bound, max_count);
+#endif
+              __sync_fetch_and_add(& pb_num_prescreened, 1);
+              goto free_and_exit;
+         }
+    }
+
     probvec = poissbin(&pvalue, err_probs, num_err_probs,
-                       max_noncons_count, bonf_factor, sig_level);
+                       max_count, bonf_factor, sig_level);
 
 #if 0
-    for (i=1; i<max_noncons_count+1; i++) {
+    for (i=1; i<max_count+1; i++) {
         fprintf(stderr, "DEBUG(%s:%s():%d): prob for count %d=%Lg\n",
                 __FILE__, __FUNCTION__, __LINE__,
                 i, expl(probvec[i]));
@@ -1120,13 +2097,35 @@ snpcaller(long double *snp_pvalues,
 
     /* report p-value for each non-consensus base
      */
-    for (i=0; i<NUM_NONCONS_BASES; i++) {
-        if (0 != noncons_counts[i]) {
+    for (i=0; i<num_counts; i++) {
+        if (0 != counts[i]) {
              int errsv;
+             int k;
+
+             /* tilted FFT result is only exact around max_count and
+              * entries too far below are NAN: compute this count's
+              * tail separately if needed, else reuse probvec */
+             for (k=counts[i]; k<max_count && ! isnan(probvec[k]); k++) {
+                  ;
+             }
+             if (k < max_count) {
+                  double *probvec2;
+                  if (! (pb_engine_flag & PB_NO_PRESCREEN)
+                      && pb_tail_lower_bound(err_probs, num_err_probs, counts[i])
+                      * (double)bonf_factor > sig_level) {
+                       continue;
+                  }
+                  probvec2 = poissbin(&pvalue, err_probs, num_err_probs,
+                                      counts[i], bonf_factor, sig_level);
+                  free(probvec2);
+                  pvalues[i] = pvalue;
+                  continue;
+             }
+
              errno = 0;
              feclearexcept(FE_ALL_EXCEPT);
 
-             pvalue = expl(probvec_tailsum(probvec, noncons_counts[i], max_noncons_count+1));
+             pvalue = expl(probvec_tailsum(probvec, counts[i], max_count+1));
 
              errsv = errno;
              if (errsv || fetestexcept(FE_INVALID | FE_DIVBYZERO | FE_OVERFLOW | FE_UNDERFLOW)) {
@@ -1143,11 +2142,11 @@ snpcaller(long double *snp_pvalues,
                        pvalue = LDBL_MAX; /* otherwise set to 1 which might pass filters */
                   }
              }
-            snp_pvalues[i] = pvalue;
+            pvalues[i] = pvalue;
 #ifdef DEBUG
-            fprintf(stderr, "DEBUG(%s:%s():%d): i=%d noncons_counts=%d max_noncons_count=%d pvalue=%Lg\n",
+            fprintf(stderr, "DEBUG(%s:%s():%d): i=%d count=%d max_count=%d pvalue=%Lg\n",
                     __FILE__, __FUNCTION__, __LINE__,
-                    i, noncons_counts[i], max_noncons_count, pvalue);
+                    i, counts[i], max_count, pvalue);
 #endif
         }
     }
@@ -1159,6 +2158,27 @@ snpcaller(long double *snp_pvalues,
 
     return 0;
 }
+/* snpcaller_counts() */
+
+
+/**
+ * @brief
+ *
+ * pvalues computed for each of the NUM_NONCONS_BASES noncons_counts
+ * will be written to snp_pvalues in the same order. If pvalue was not
+ * computed (always insignificant) its value will be set to LDBL_MAX
+ *
+ */
+int
+snpcaller(long double *snp_pvalues,
+          const double *err_probs, const int num_err_probs,
+          const int *noncons_counts,
+          const long long int bonf_factor, const double sig_level)
+{
+     return snpcaller_counts(snp_pvalues, err_probs, num_err_probs,
+                             noncons_counts, NUM_NONCONS_BASES,
+                             bonf_factor, sig_level);
+}
 /* snpcaller() */
 
 
@@ -1220,6 +2240,7 @@ int main(int argc, char *argv[]) {
      const float sig = 1.0 ;
 
      verbose = 1;
+     init_phred_tables();
 
      if (argc<4) {
           LOG_FATAL("%s\n", "need: num_trials num_errs p_e1 ... p_en");
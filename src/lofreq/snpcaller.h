@@ -30,6 +30,7 @@
 #define SNPCALLER_H
 
 #include "vcf.h"
+#include "varspool.h"
 #include "plp.h"
 #include "defaults.h"
 
@@ -52,6 +53,7 @@ typedef struct {
      long long int bonf_indel;
      float sig;
      vcf_file_t vcf_out;
+     var_spool_t *spool; /* if set, variants are added here instead of being written to vcf_out */
      int flag; /* FIXME doc? */
 
      /* FIXME the following two logically don't belong her but
@@ -62,6 +64,39 @@ typedef struct {
 } varcall_conf_t;
 
 
+/* error probabilities of all insertions or deletions at a column,
+ * shared by all events of that type. see indel_errprobs_init()
+ */
+typedef struct {
+     const indel_table_t *events;
+     const varcall_conf_t *conf;
+     int use_aq; /* use indel alignment quality of tested event */
+     double *base; /* sorted, without alignment qualities */
+     int num_base;
+     double *probs; /* base patched for one event. only if use_aq */
+     double *rm, *add; /* scratch for patching */
+} indel_errprobs_t;
+
+
+/* Poisson-binomial engine switches (pb_engine_flag), mainly useful
+ * for validating the fast paths against the reference implementation
+ */
+#define PB_SCALAR_KERNEL 1 /* scalar log_sum() instead of SIMD row kernel */
+#define PB_NO_GROUPED 2 /* never use quality-grouped engine */
+#define PB_NO_PRESCREEN 4 /* don't reject hopeless columns before running the DP */
+#define PB_NO_FFT 8 /* never use FFT/product-tree engine */
+
+extern int pb_engine_flag;
+extern long long int pb_num_prescreened; /* columns rejected by snpcaller() pre-screen */
+
+
+double
+merge_srcq_mapq_baq_and_bq(const int sq, const int mq, const int baq, const int bq);
+
+double
+merge_srcq_mapq_baq_and_bq_cached(const int sq, const int mq, const int baq, const int bq,
+                                  int *merged_qual);
+
 double
 merge_srcq_baseq_and_mapq(const int sq, const int bq, const int mq);
 
@@ -72,15 +107,19 @@ void
 plp_to_errprobs(double **err_probs, int *num_err_probs, 
                 int *alt_bases, int *alt_counts, int *alt_raw_counts,
                 const plp_col_t *p, varcall_conf_t *conf);
-void 
-plp_to_ins_errprobs(double **err_probs, int *num_err_probs, 
-                    const plp_col_t *p, varcall_conf_t *conf,
-                    char key[MAX_INDELSIZE]);
 
-void 
-plp_to_del_errprobs(double **err_probs, int *num_err_probs, 
-                    const plp_col_t *p, varcall_conf_t *conf,
-                    char key[MAX_INDELSIZE]);
+int
+indel_errprobs_init(indel_errprobs_t *ep, const plp_col_t *p,
+                    const varcall_conf_t *conf, const int is_del);
+
+const double *
+indel_errprobs_event(indel_errprobs_t *ep, const int ev_idx, int *num_err_probs);
+
+void
+indel_errprobs_free(indel_errprobs_t *ep);
+
+void
+errprobs_sort(double *err_probs, const int num_err_probs);
 
 void
 init_varcall_conf(varcall_conf_t *c);
@@ -98,6 +137,11 @@ snpcaller(long double *snp_pvalues, const double *err_probs,
           const int num_err_probs, const int *noncons_counts,
           const long long int bonf_factor,
           const double sig_level);
+extern int
+snpcaller_counts(long double *pvalues, const double *err_probs,
+                 const int num_err_probs, const int *counts,
+                 const int num_counts, const long long int bonf_factor,
+                 const double sig_level);
 
 
 #endif
@@ -39,7 +39,25 @@
 #define HAS_GZIP_EXT(f)  (strlen(f)>3 && 0==strncmp(& f[strlen(f)-3], ".gz", 3))
 
 
-#define PHREDQUAL_TO_PROB(phred) (phred==INT_MAX ? DBL_MIN : pow(10.0, -1.0*(phred)/10.0))
+/* lookup table for integer phred values 0..PHRED_TABLE_SIZE-1, set
+ * up by init_phred_tables() */
+#define PHRED_TABLE_SIZE 256
+extern double phred_prob_table[PHRED_TABLE_SIZE]; /* p = 10^(-q/10) */
+extern int phred_tables_initialized;
+void init_phred_tables(void);
+
+/* falls back to pow() if out of table range or table not initialized */
+static inline double
+phredqual_to_prob(int phred)
+{
+     if (phred>=0 && phred<PHRED_TABLE_SIZE && phred_tables_initialized) {
+          return phred_prob_table[phred];
+     } else if (phred==INT_MAX) {
+          return DBL_MIN;
+     } else {
+          return pow(10.0, -1.0*phred/10.0);
+     }
+}
 
 /* requires that prob comes out of our functions is is never zero! */
 #define PROB_TO_PHREDQUAL(prob) (int)(-10.0 * log10l(prob))
@@ -56,6 +74,7 @@ int int_cmp(const void *a, const void *b);
 int dbl_cmp(const void *a, const void *b);
 int argmax_d(const double *arr, const int n);
 long int count_lines(const char *filename);
+long int peak_rss_kb(void);
 
 typedef struct {
      unsigned long int n; /* number of elements stored */
@@ -69,6 +88,7 @@ void int_varray_add_value(int_varray_t *a, const int value);
 void int_varray_free(int_varray_t *a);
 void int_varray_init(int_varray_t *a, 
                      const size_t grow_by_size);
+void int_varray_reset(int_varray_t *a);
 
 int
 ls_dir(char ***matches, const char *path, const char *pattern,
@@ -96,44 +116,6 @@ strstrip(char *str);
 int
 is_newer(const char *p1, const char *p2);
 
-/* utility hash functions for indel calling */
-
-typedef struct {
-  char key[MAX_INDELSIZE];
-  int count;
-  int cons_quals;
-  int_varray_t ins_quals;
-  int_varray_t ins_aln_quals;
-  int_varray_t ins_map_quals;
-  int_varray_t ins_source_quals;
-  long int fw_rv[2];
-  UT_hash_handle hh_ins;
-} ins_event;
-
-void add_ins_sequence(ins_event **head_ins_count, char seq[], 
-  int ins_qual, int ins_aln_qual, int ins_map_qual, int ins_source_qual, 
-  int fw_rv);
-ins_event *find_ins_sequence(ins_event *const *head_ins_counts, char seq[]);
-void destruct_ins_event_counts(ins_event **head_ins_counts);
-
-typedef struct {
-  char key[MAX_INDELSIZE];
-  int count;
-  int cons_quals;
-  int_varray_t del_quals;
-  int_varray_t del_aln_quals;
-  int_varray_t del_map_quals;
-  int_varray_t del_source_quals;
-  long int fw_rv[2];
-  UT_hash_handle hh_del;
-} del_event;
-
-void add_del_sequence(del_event **head_del_counts, char seq[], 
-  int del_qual, int del_aln_qual, int del_map_qual, int del_source_qual, 
-  int fw_rv);
-del_event * find_del_sequence(del_event *const *head_del_counts, char seq[]);
-void destruct_del_event_counts(del_event **head_del_counts);
-
 void
 strtoupper(char *s);
 
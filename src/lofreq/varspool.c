@@ -0,0 +1,330 @@
+/* -*- c-file-style: "k&r"; indent-tabs-mode: nil; -*- */
+/*********************************************************************
+* The MIT License (MIT)
+* 
+* Copyright (c) 2013,2014 Genome Institute of Singapore
+* 
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation files
+* (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify, merge,
+* publish, distribute, sublicense, and/or sell copies of the Software,
+* and to permit persons to whom the Software is furnished to do so,
+* subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+* BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+* ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+* CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+************************************************************************/
+
+/* append-only store of variants. see varspool.h
+ *
+ * records are binary variant records (see vcf_bin_encode_var()),
+ * with chrom ids from the spool's own dictionary. spill files never
+ * outlive the process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "varspool.h"
+
+
+
+static void
+var_spool_grow(char **buf, size_t *alloced, const size_t need)
+{
+     size_t new_alloced = *alloced ? *alloced : 65536;
+
+     if (need <= *alloced) {
+          return;
+     }
+     while (new_alloced < need) {
+          new_alloced *= 2;
+     }
+     if (NULL == (*buf = realloc(*buf, new_alloced))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     *alloced = new_alloced;
+}
+
+
+/* moves all in-memory records to the spill file, which is created
+ * and immediately unlinked on first use. returns 0 on success */
+static int
+var_spool_spill(var_spool_t *s)
+{
+     if (! s->spill) {
+          const char *dir = s->spill_dir ? s->spill_dir : ".";
+          const char *name = "/lofreq2-spool.XXXXXX";
+          char *path;
+          int fd;
+
+          path = malloc(strlen(dir) + strlen(name) + 1);
+          if (NULL == path) {
+               fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                       __FILE__, __FUNCTION__, __LINE__);
+               exit(1);
+          }
+          sprintf(path, "%s%s", dir, name);
+          if (-1 == (fd = mkstemp(path))) {
+               LOG_ERROR("Couldn't create spill file %s: %s\n", path, strerror(errno));
+               free(path);
+               return -1;
+          }
+          /* gone as soon as we close it or exit */
+          (void) unlink(path);
+          if (NULL == (s->spill = fdopen(fd, "w+b"))) {
+               LOG_ERROR("Couldn't open spill file %s: %s\n", path, strerror(errno));
+               close(fd);
+               free(path);
+               return -1;
+          }
+          LOG_VERBOSE("Spooled variants exceed %lu bytes. Spilling to %s\n",
+                      (unsigned long)s->max_mem, path);
+          free(path);
+     }
+
+     if (fseek(s->spill, 0, SEEK_END)) {
+          LOG_ERROR("Couldn't seek in spill file: %s\n", strerror(errno));
+          return -1;
+     }
+     if (s->len && 1 != fwrite(s->buf, s->len, 1, s->spill)) {
+          LOG_ERROR("Couldn't write to spill file: %s\n", strerror(errno));
+          return -1;
+     }
+     s->len = 0;
+     return 0;
+}
+
+
+/* appends len bytes of complete records. records never straddle
+ * spill file and memory. returns 0 on success */
+static int
+var_spool_write(var_spool_t *s, const char *data, const size_t len)
+{
+     if (s->max_mem && s->len + len > s->max_mem) {
+          if (var_spool_spill(s)) {
+               return -1;
+          }
+          if (len > s->max_mem) {
+               if (1 != fwrite(data, len, 1, s->spill)) {
+                    LOG_ERROR("Couldn't write to spill file: %s\n", strerror(errno));
+                    return -1;
+               }
+               return 0;
+          }
+     }
+     var_spool_grow(& s->buf, & s->alloced, s->len + len);
+     memcpy(s->buf + s->len, data, len);
+     s->len += len;
+     return 0;
+}
+
+
+/* points *rec to the next record, including its length prefix, and
+ * sets *len to its total size. returns 0 on success, 1 if there are
+ * no more records and -1 on error */
+static int
+var_spool_next_raw(var_spool_t *s, const char **rec, size_t *len)
+{
+     uint32_t rec_len;
+
+     if (s->reading_spill) {
+          if (1 == fread(& rec_len, sizeof(uint32_t), 1, s->spill)) {
+               var_spool_grow(& s->rec, & s->rec_alloced, sizeof(uint32_t) + rec_len);
+               memcpy(s->rec, & rec_len, sizeof(uint32_t));
+               if (1 != fread(s->rec + sizeof(uint32_t), rec_len, 1, s->spill)) {
+                    LOG_ERROR("%s\n", "Truncated record in spill file");
+                    return -1;
+               }
+               *rec = s->rec;
+               *len = sizeof(uint32_t) + rec_len;
+               return 0;
+          }
+          if (ferror(s->spill)) {
+               LOG_ERROR("Couldn't read from spill file: %s\n", strerror(errno));
+               return -1;
+          }
+          s->reading_spill = 0;
+     }
+
+     if (s->read_off >= s->len) {
+          return 1;
+     }
+     memcpy(& rec_len, s->buf + s->read_off, sizeof(uint32_t));
+     *rec = s->buf + s->read_off;
+     *len = sizeof(uint32_t) + rec_len;
+     s->read_off += *len;
+     return 0;
+}
+
+
+/* spill_dir: where to create a spill file if needed (NULL for
+ * current directory). max_mem: in-memory size limit (0 for
+ * none). returns 0 on success */
+int
+var_spool_init(var_spool_t *s, const char *spill_dir, const size_t max_mem)
+{
+     memset(s, 0, sizeof(var_spool_t));
+     s->max_mem = max_mem;
+     if (spill_dir && NULL == (s->spill_dir = strdup(spill_dir))) {
+          return -1;
+     }
+     return 0;
+}
+
+
+void
+var_spool_free(var_spool_t *s)
+{
+     free(s->buf);
+     free(s->rec);
+     free(s->enc.s);
+     free(s->spill_dir);
+     vcf_chrom_dict_free(& s->chroms);
+     if (s->spill) {
+          fclose(s->spill);
+     }
+     memset(s, 0, sizeof(var_spool_t));
+}
+
+
+/* returns 0 on success */
+int
+var_spool_add(var_spool_t *s, const var_t *var)
+{
+     int chrom_id = vcf_chrom_dict_get(& s->chroms,
+                                       var->chrom ? var->chrom : VCF_MISSING_VAL_STR,
+                                       NULL);
+     if (vcf_bin_encode_var(& s->enc, var, chrom_id)) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     if (var_spool_write(s, s->enc.s, s->enc.l)) {
+          return -1;
+     }
+     s->num_vars += 1;
+     return 0;
+}
+
+
+/* appends all records of src to dst, translating chrom ids. src is
+ * rewound. returns 0 on success */
+int
+var_spool_append(var_spool_t *dst, var_spool_t *src)
+{
+     const char *rec;
+     size_t len;
+     int *chrom_map;
+     int same_ids = 1;
+     int i, rc;
+
+     if (NULL == (chrom_map = malloc((src->chroms.n+1) * sizeof(int)))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     for (i=0; i<src->chroms.n; i++) {
+          chrom_map[i] = vcf_chrom_dict_get(& dst->chroms, src->chroms.names[i], NULL);
+          if (chrom_map[i] != i) {
+               same_ids = 0;
+          }
+     }
+
+     if (! src->spill && same_ids) {
+          free(chrom_map);
+          if (src->len && var_spool_write(dst, src->buf, src->len)) {
+               return -1;
+          }
+          dst->num_vars += src->num_vars;
+          return 0;
+     }
+
+     if (var_spool_rewind(src)) {
+          free(chrom_map);
+          return -1;
+     }
+     while (0 == (rc = var_spool_next_raw(src, & rec, & len))) {
+          uint32_t chrom_id = vcf_bin_rec_chrom_id(rec);
+          if (chrom_id >= (uint32_t)src->chroms.n) {
+               LOG_ERROR("%s\n", "Corrupt record in variant spool");
+               rc = -1;
+               break;
+          }
+          dst->enc.l = 0;
+          kputsn(rec, len, & dst->enc);
+          vcf_bin_rec_set_chrom_id(dst->enc.s, chrom_map[chrom_id]);
+          if (var_spool_write(dst, dst->enc.s, len)) {
+               rc = -1;
+               break;
+          }
+          dst->num_vars += 1;
+     }
+     free(chrom_map);
+     return rc < 0 ? -1 : 0;
+}
+
+
+/* prepares reading from the first record. no records must be added
+ * while reading. returns 0 on success */
+int
+var_spool_rewind(var_spool_t *s)
+{
+     s->read_off = 0;
+     s->reading_spill = 0;
+     if (s->spill) {
+          if (fflush(s->spill) || fseek(s->spill, 0, SEEK_SET)) {
+               LOG_ERROR("Couldn't rewind spill file: %s\n", strerror(errno));
+               return -1;
+          }
+          s->reading_spill = 1;
+     }
+     return 0;
+}
+
+
+/* reads the next record into var, which should come fresh from
+ * vcf_new_var() and be freed with vcf_free_var(). info is left NULL
+ * if typed (see var_t). returns 0 on success, 1 if there are no more
+ * records and -1 on error */
+int
+var_spool_next(var_spool_t *s, var_t *var)
+{
+     const char *rec;
+     size_t len;
+     int chrom_id, rc;
+
+     if (0 != (rc = var_spool_next_raw(s, & rec, & len))) {
+          return rc;
+     }
+     if (vcf_bin_decode_var(var, & chrom_id, rec, len)) {
+          return -1;
+     }
+     if (chrom_id < 0 || chrom_id >= s->chroms.n) {
+          LOG_ERROR("%s\n", "Corrupt record in variant spool");
+          return -1;
+     }
+     if (NULL == (var->chrom = strdup(s->chroms.names[chrom_id]))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     return 0;
+}
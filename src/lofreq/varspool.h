@@ -0,0 +1,90 @@
+/* -*- c-file-style: "k&r"; indent-tabs-mode: nil; -*- */
+/*********************************************************************
+* The MIT License (MIT)
+* 
+* Copyright (c) 2013,2014 Genome Institute of Singapore
+* 
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation files
+* (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify, merge,
+* publish, distribute, sublicense, and/or sell copies of the Software,
+* and to permit persons to whom the Software is furnished to do so,
+* subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+* BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+* ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+* CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+************************************************************************/
+
+#ifndef VARSPOOL_H
+#define VARSPOOL_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "vcf.h"
+
+
+/* default memory limit of a spool before records are spilled to disk */
+#define VAR_SPOOL_DEF_MAX_MEM ((size_t)512*1024*1024)
+
+
+/* append-only store of variants, e.g. candidates kept by lofreq call
+ * until the final filter thresholds are known. records are kept in
+ * memory in binary form (see vcf_bin_encode_var()) and moved to an
+ * unlinked spill file once max_mem is exceeded. format and samples
+ * of a variant are not kept. not thread safe.
+ *
+ *   var_spool_init(&s, dir, VAR_SPOOL_DEF_MAX_MEM);
+ *   var_spool_add(&s, var); ...
+ *   var_spool_rewind(&s);
+ *   while (0 == var_spool_next(&s, var)) { ... }
+ *   var_spool_free(&s);
+ */
+typedef struct {
+     char *buf; /* in-memory records, after any spilled ones */
+     size_t len, alloced;
+     size_t max_mem; /* 0 = never spill */
+     char *spill_dir; /* where to create spill file. NULL = cwd */
+     FILE *spill;
+     long int num_vars;
+     vcf_chrom_dict_t chroms; /* chrom ids used in records */
+     kstring_t enc; /* scratch for encoding */
+
+     /* read state, see var_spool_next() */
+     int reading_spill;
+     size_t read_off;
+     char *rec; /* scratch for record read from spill */
+     size_t rec_alloced;
+} var_spool_t;
+
+
+int
+var_spool_init(var_spool_t *s, const char *spill_dir, const size_t max_mem);
+
+void
+var_spool_free(var_spool_t *s);
+
+int
+var_spool_add(var_spool_t *s, const var_t *var);
+
+int
+var_spool_append(var_spool_t *dst, var_spool_t *src);
+
+int
+var_spool_rewind(var_spool_t *s);
+
+int
+var_spool_next(var_spool_t *s, var_t *var);
+
+#endif
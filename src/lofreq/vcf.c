@@ -36,6 +36,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <math.h>
 #include <assert.h>
 
 #include "htslib/bgzf.h"
@@ -59,6 +61,358 @@
 const char *VCF_HEADER = "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO";
 
 
+/* binary variant streams: magic and byte order marker, followed by
+ * items made of a one character tag, an uint32 payload length and the payload. a chrom
+ * item defines the name of the next chrom id. a var item's payload
+ * is a record as written by vcf_bin_encode_var() without its length
+ * prefix.
+ */
+#define VCF_BIN_MAGIC "LFB\2"
+#define VCF_BIN_MAGIC_LEN 4
+/* stored as native uint32 after magic. reads differently on machines
+ * with other byte order, see refpack */
+#define VCF_BIN_BYTE_ORDER 0x01020304
+#define VCF_BIN_ITEM_HEADER 'H'
+#define VCF_BIN_ITEM_CHROM 'C'
+#define VCF_BIN_ITEM_VAR 'V'
+
+/* record flags */
+#define VCF_BIN_REC_TYPED 0x1 /* typed info follows fixed fields */
+#define VCF_BIN_REC_INFO 0x2 /* info string follows other strings */
+
+/* see vcf_file_index_on_the_fly() */
+struct vcf_idx_s {
+     hts_idx_t *idx; /* created when first record is written */
+     int min_shift; /* > 0 for csi */
+     vcf_chrom_dict_t chroms; /* tids */
+     kstring_t name; /* scratch for chrom name */
+     int failed; /* fall back to indexing after close */
+};
+
+struct vcf_bin_s {
+     vcf_chrom_dict_t dict;
+     kstring_t item; /* last read item, or scratch for writing */
+     char item_tag;
+     int item_pending; /* item was read but not consumed yet */
+};
+
+
+typedef struct {
+     char *key; /* points to name in dict */
+     int id;
+     UT_hash_handle hh;
+} chrom_hash_t;
+
+
+/* appends f like printf("%f") would, i.e. with six decimals. a
+ * float times 1e6 is exact in double precision, so rounding it to
+ * the nearest integer (ties to even) gives the same digits */
+static void
+kput_float6(const float f, kstring_t *s)
+{
+     double r = (double)f * 1e6;
+     int64_t v;
+     char frac[8];
+     int i;
+
+     /* integer part has to fit into a 32-bit long for kputl() */
+     if (! (fabs(r) < 1e15)) {
+          /* also nan and inf */
+          ksprintf(s, "%f", f);
+          return;
+     }
+     v = (int64_t) fabs(nearbyint(r));
+     if (signbit(f)) {
+          kputc('-', s);
+     }
+     kputl((long int)(v / 1000000), s);
+     v %= 1000000;
+     frac[0] = '.';
+     for (i=6; i>0; i--) {
+          frac[i] = '0' + v % 10;
+          v /= 10;
+     }
+     kputsn(frac, 7, s);
+}
+
+
+/* appends info string for typed info to s */
+static void
+kput_typed_info(kstring_t *s, const var_info_t *ti)
+{
+     kputs("DP=", s);
+     kputw(ti->dp, s);
+     kputs(";AF=", s);
+     kput_float6(ti->af, s);
+     kputs(";SB=", s);
+     kputw(ti->sb, s);
+     kputs(";DP4=", s);
+     kputw(ti->dp4.ref_fw, s);
+     kputc(',', s);
+     kputw(ti->dp4.ref_rv, s);
+     kputc(',', s);
+     kputw(ti->dp4.alt_fw, s);
+     kputc(',', s);
+     kputw(ti->dp4.alt_rv, s);
+     if (ti->flags & VAR_INFO_INDEL) {
+          kputs(";INDEL;HRUN=", s);
+          kputw(ti->hrun, s);
+     }
+     if (ti->flags & VAR_INFO_CONSVAR) {
+          kputs(";CONSVAR", s);
+     }
+}
+
+
+/* returns a newly allocated info string for typed info */
+static char *
+typed_info_str(const var_info_t *ti)
+{
+     kstring_t s = {0, 0, NULL};
+     kput_typed_info(& s, ti);
+     if (NULL == s.s) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     return s.s;
+}
+
+
+/* returns id of name, which is added if new (*added is then set,
+ * if not NULL). ids are handed out consecutively from 0 */
+int
+vcf_chrom_dict_get(vcf_chrom_dict_t *d, const char *name, int *added)
+{
+     chrom_hash_t *hash = (chrom_hash_t *) d->hash;
+     chrom_hash_t *match = NULL;
+
+     if (added) {
+          *added = 0;
+     }
+     if (d->n && 0 == strcmp(d->names[d->last], name)) {
+          return d->last;
+     }
+     HASH_FIND_STR(hash, name, match);
+     if (match) {
+          d->last = match->id;
+          return match->id;
+     }
+
+     if (d->n == d->alloced) {
+          d->alloced = d->alloced ? d->alloced*2 : 16;
+          d->names = realloc(d->names, d->alloced * sizeof(char *));
+     }
+     match = malloc(sizeof(chrom_hash_t));
+     if (! d->names || ! match || NULL == (d->names[d->n] = strdup(name))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     match->key = d->names[d->n];
+     match->id = d->n;
+     HASH_ADD_KEYPTR(hh, hash, match->key, strlen(match->key), match);
+     d->hash = hash;
+     d->last = d->n;
+     d->n += 1;
+     if (added) {
+          *added = 1;
+     }
+     return match->id;
+}
+
+
+/* frees members. d can be reused afterwards */
+void
+vcf_chrom_dict_free(vcf_chrom_dict_t *d)
+{
+     chrom_hash_t *hash = (chrom_hash_t *) d->hash;
+     chrom_hash_t *cur, *tmp;
+     int i;
+
+     HASH_ITER(hh, hash, cur, tmp) {
+          HASH_DEL(hash, cur);
+          free(cur);
+     }
+     for (i=0; i<d->n; i++) {
+          free(d->names[i]);
+     }
+     free(d->names);
+     memset(d, 0, sizeof(vcf_chrom_dict_t));
+}
+
+
+/* binary record layout: uint32 length of the rest, uint32 chrom id,
+ * int64 pos, int32 qual, uint32 flags (VCF_BIN_REC_*), typed info if
+ * VCF_BIN_REC_TYPED (int32 dp, sb, 4 dp4 counts, hrun and info
+ * flags, float af, double pvalue), then id, ref, alt,
+ * filter and, if VCF_BIN_REC_INFO, info as nul-terminated strings.
+ * missing strings are stored as VCF_MISSING_VAL_STR
+ */
+#define VCF_BIN_REC_FIXED_LEN (2*sizeof(uint32_t) + sizeof(int64_t) + sizeof(int32_t) + sizeof(uint32_t))
+#define VCF_BIN_REC_TYPED_LEN (8*sizeof(int32_t) + sizeof(float) + sizeof(double))
+
+#define KPUT_VAL(v, ks) kputsn((const char *) & (v), sizeof(v), (ks))
+#define GET_VAL(v, p) do { memcpy(& (v), (p), sizeof(v)); (p) += sizeof(v); } while (0)
+
+
+/* encodes var as binary record with given chrom id into rec, which
+ * is overwritten. returns 0 on success */
+int
+vcf_bin_encode_var(kstring_t *rec, const var_t *var, const int chrom_id)
+{
+     const char *str[5];
+     uint32_t len = 0, chrom = chrom_id, flags = 0;
+     int64_t pos = var->pos;
+     int32_t qual = var->qual;
+     int num_str = 4;
+     int i, rc = 0;
+
+     str[0] = var->id;
+     str[1] = var->ref;
+     str[2] = var->alt;
+     str[3] = var->filter;
+     if (var->has_typed_info) {
+          flags |= VCF_BIN_REC_TYPED;
+     }
+     if (! var->info_is_typed) {
+          flags |= VCF_BIN_REC_INFO;
+          str[num_str++] = var->info;
+     }
+
+     rec->l = 0;
+     rc |= KPUT_VAL(len, rec) < 0;
+     rc |= KPUT_VAL(chrom, rec) < 0;
+     rc |= KPUT_VAL(pos, rec) < 0;
+     rc |= KPUT_VAL(qual, rec) < 0;
+     rc |= KPUT_VAL(flags, rec) < 0;
+     if (flags & VCF_BIN_REC_TYPED) {
+          const var_info_t *ti = & var->typed_info;
+          int32_t ival[8];
+          float af = ti->af;
+          double pvalue = ti->pvalue;
+          ival[0] = ti->dp;
+          ival[1] = ti->sb;
+          ival[2] = ti->dp4.ref_fw;
+          ival[3] = ti->dp4.ref_rv;
+          ival[4] = ti->dp4.alt_fw;
+          ival[5] = ti->dp4.alt_rv;
+          ival[6] = ti->hrun;
+          ival[7] = ti->flags;
+          rc |= kputsn((const char *) ival, 8*sizeof(int32_t), rec) < 0;
+          rc |= KPUT_VAL(af, rec) < 0;
+          rc |= KPUT_VAL(pvalue, rec) < 0;
+     }
+     for (i=0; i<num_str; i++) {
+          const char *sp = str[i] ? str[i] : VCF_MISSING_VAL_STR;
+          rc |= kputsn(sp, strlen(sp)+1, rec) < 0;
+     }
+     if (rc) {
+          return -1;
+     }
+     len = rec->l - sizeof(uint32_t);
+     memcpy(rec->s, & len, sizeof(uint32_t));
+     return 0;
+}
+
+
+/* decodes binary record rec of total size len (including length
+ * prefix) into var (fresh from vcf_new_var()), except for chrom,
+ * whose id is stored in chrom_id. if info is typed, var->info is
+ * left NULL. returns 0 on success */
+int
+vcf_bin_decode_var(var_t *var, int *chrom_id, const char *rec, const size_t len)
+{
+     char **str[5];
+     const char *p = rec;
+     const char *end = rec + len;
+     uint32_t rec_len, chrom, flags;
+     int64_t pos;
+     int32_t qual;
+     int num_str = 4;
+     int i;
+
+     if (len < VCF_BIN_REC_FIXED_LEN) {
+          goto corrupt;
+     }
+     GET_VAL(rec_len, p);
+     GET_VAL(chrom, p);
+     GET_VAL(pos, p);
+     GET_VAL(qual, p);
+     GET_VAL(flags, p);
+     if (rec_len + sizeof(uint32_t) != len) {
+          goto corrupt;
+     }
+     *chrom_id = chrom;
+     var->pos = pos;
+     var->qual = qual;
+
+     if (flags & VCF_BIN_REC_TYPED) {
+          var_info_t *ti = & var->typed_info;
+          int32_t ival[8];
+          if (p + VCF_BIN_REC_TYPED_LEN > end) {
+               goto corrupt;
+          }
+          memcpy(ival, p, sizeof(ival));
+          p += sizeof(ival);
+          ti->dp = ival[0];
+          ti->sb = ival[1];
+          ti->dp4.ref_fw = ival[2];
+          ti->dp4.ref_rv = ival[3];
+          ti->dp4.alt_fw = ival[4];
+          ti->dp4.alt_rv = ival[5];
+          ti->hrun = ival[6];
+          ti->flags = ival[7];
+          GET_VAL(ti->af, p);
+          GET_VAL(ti->pvalue, p);
+          var->has_typed_info = 1;
+     }
+
+     str[0] = & var->id;
+     str[1] = & var->ref;
+     str[2] = & var->alt;
+     str[3] = & var->filter;
+     if (flags & VCF_BIN_REC_INFO) {
+          str[num_str++] = & var->info;
+     } else {
+          var->info_is_typed = 1;
+     }
+     for (i=0; i<num_str; i++) {
+          size_t str_len = strnlen(p, end - p);
+          if (p + str_len >= end) {
+               goto corrupt;
+          }
+          if (NULL == (*str[i] = malloc(str_len + 1))) {
+               fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                       __FILE__, __FUNCTION__, __LINE__);
+               exit(1);
+          }
+          memcpy(*str[i], p, str_len + 1);
+          p += str_len + 1;
+     }
+     return 0;
+
+corrupt:
+     LOG_ERROR("%s\n", "Corrupt binary variant record");
+     return -1;
+}
+
+
+uint32_t
+vcf_bin_rec_chrom_id(const char *rec)
+{
+     uint32_t chrom;
+     memcpy(& chrom, rec + sizeof(uint32_t), sizeof(uint32_t));
+     return chrom;
+}
+
+
+void
+vcf_bin_rec_set_chrom_id(char *rec, const uint32_t chrom_id)
+{
+     memcpy(rec + sizeof(uint32_t), & chrom_id, sizeof(uint32_t));
+}
+
 
 void 
 var_hash_free_table(var_hash_t *var_hash)
@@ -151,9 +505,301 @@ int vcf_printf(vcf_file_t *f, char *fmt, ...)
      }
 }
 
+static void
+vcf_idx_create(vcf_idx_t *x, const uint64_t offset0)
+{
+     if (x->min_shift > 0) {
+          x->idx = hts_idx_init(0, HTS_FMT_CSI, offset0, x->min_shift,
+                                (31 - x->min_shift + 2) / 3);
+     } else {
+          x->idx = hts_idx_init(0, HTS_FMT_TBI, offset0, 14, 5);
+     }
+     if (NULL == x->idx) {
+          x->failed = 1;
+     }
+}
+
+
+/* adds record line of length len (w/o newline), which ends at offset */
+static void
+vcf_idx_push(vcf_file_t *f, const char *line, const size_t len, const uint64_t offset)
+{
+     vcf_idx_t *x = f->idx;
+     const char *end = line + len;
+     const char *tab, *ref;
+     long int pos;
+     int tid, i;
+
+     if (NULL == (tab = memchr(line, '\t', len))) {
+          goto unparseable;
+     }
+     x->name.l = 0;
+     kputsn(line, tab - line, & x->name);
+     tid = vcf_chrom_dict_get(& x->chroms, x->name.s, NULL);
+     pos = strtol(tab+1, NULL, 10);
+     /* ref is fourth field */
+     ref = tab;
+     for (i=0; i<2 && ref; i++) {
+          ref = memchr(ref+1, '\t', end - ref - 1);
+     }
+     if (! ref || pos < 1) {
+          goto unparseable;
+     }
+     ref += 1;
+     tab = memchr(ref, '\t', end - ref);
+     if (hts_idx_push(x->idx, tid, pos-1, pos-1 + ((tab ? tab : end) - ref),
+                      offset, 1) < 0) {
+          LOG_WARN("Can't index %s on the fly (unsorted?)\n", f->path);
+          x->failed = 1;
+     }
+     return;
+
+unparseable:
+     LOG_WARN("Can't index %s on the fly: unparseable record\n", f->path);
+     x->failed = 1;
+}
+
+
+/* as vcf_file_write() but writes line by line, adding each record to
+ * the index */
+static int
+vcf_file_write_indexed(vcf_file_t *f, const char *buf, size_t len)
+{
+     vcf_idx_t *x = f->idx;
+     const char *line = buf;
+     const char *end = buf + len;
+
+     while (line < end) {
+          const char *nl = memchr(line, '\n', end - line);
+          size_t line_len = nl ? (size_t)(nl - line + 1) : (size_t)(end - line);
+          int is_rec = ! x->failed && line[0] != '#' && line[0] != '\n';
+
+          if (is_rec && ! x->idx) {
+               vcf_idx_create(x, bgzf_tell(f->fh_bgz));
+               is_rec = ! x->failed;
+          }
+          if (bgzf_write(f->fh_bgz, line, line_len) != (ssize_t)line_len) {
+               return -1;
+          }
+          if (is_rec) {
+               vcf_idx_push(f, line, nl ? line_len-1 : line_len, bgzf_tell(f->fh_bgz));
+          }
+          line += line_len;
+     }
+     return len;
+}
+
+
+/* write len bytes of buf unformatted (unlike vcf_printf() there's no
+ * size limit). returns number of bytes written or negative on error */
+int
+vcf_file_write(vcf_file_t *f, const char *buf, size_t len)
+{
+     if (f->idx) {
+          return vcf_file_write_indexed(f, buf, len);
+     }
+     if (f->is_bgz) {
+          return bgzf_write(f->fh_bgz, buf, len);
+     } else {
+          return fwrite(buf, 1, len, f->fh);
+     }
+}
+
+/* returns 1 if path asks for binary format, see VCF_BIN_EXT */
+int
+vcf_has_bin_ext(const char *path)
+{
+     const char *ext;
+     if (NULL == (ext = strstr(path, VCF_BIN_EXT))) {
+          return 0;
+     }
+     /* use last occurence */
+     while (NULL != strstr(ext+1, VCF_BIN_EXT)) {
+          ext = strstr(ext+1, VCF_BIN_EXT);
+     }
+     ext += strlen(VCF_BIN_EXT);
+     return (0 == strcmp(ext, "") || 0 == strcmp(ext, ".gz"));
+}
+
+
+/* reads len bytes into buf. returns 0 on success, 1 on eof before
+ * first byte and -1 on error or truncation */
+static int
+vcf_file_read(vcf_file_t *f, void *buf, const size_t len)
+{
+     size_t n;
+     if (f->is_bgz) {
+          ssize_t rc = bgzf_read(f->fh_bgz, buf, len);
+          if (rc < 0) {
+               return -1;
+          }
+          n = rc;
+     } else {
+          n = fread(buf, 1, len, f->fh);
+     }
+     if (n == len) {
+          return 0;
+     } else if (n == 0 && (f->is_bgz || ! ferror(f->fh))) {
+          return 1;
+     }
+     return -1;
+}
+
+
+static int
+vcf_bin_write_item(vcf_file_t *f, const char tag, const char *data, const uint32_t len)
+{
+     if (vcf_file_write(f, & tag, 1) != 1
+         || vcf_file_write(f, (const char *) & len, sizeof(uint32_t)) != sizeof(uint32_t)
+         || (len && vcf_file_write(f, data, len) != (int)len)) {
+          LOG_ERROR("Couldn't write to %s\n", f->path);
+          return -1;
+     }
+     return 0;
+}
+
+
+/* reads next item into f->bin->item, prefixed by its length (as
+ * var records are). returns 0 on success, 1 on eof and -1 on
+ * error. */
+static int
+vcf_bin_read_item(vcf_file_t *f)
+{
+     vcf_bin_t *b = f->bin;
+     uint32_t len;
+     int rc;
+
+     if (b->item_pending) {
+          b->item_pending = 0;
+          return 0;
+     }
+     if (0 != (rc = vcf_file_read(f, & b->item_tag, 1))) {
+          return rc;
+     }
+     if (0 != vcf_file_read(f, & len, sizeof(uint32_t))) {
+          LOG_ERROR("Truncated item in %s\n", f->path);
+          return -1;
+     }
+     b->item.l = 0;
+     ks_resize(& b->item, sizeof(uint32_t) + len + 1);
+     if (NULL == b->item.s) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     memcpy(b->item.s, & len, sizeof(uint32_t));
+     if (len && 0 != vcf_file_read(f, b->item.s + sizeof(uint32_t), len)) {
+          LOG_ERROR("Truncated item in %s\n", f->path);
+          return -1;
+     }
+     b->item.l = sizeof(uint32_t) + len;
+     b->item.s[b->item.l] = '\0';
+     return 0;
+}
+
+
+/* resets binary stream state and writes or checks magic */
+static int
+vcf_bin_start(vcf_file_t *f)
+{
+     char magic[VCF_BIN_MAGIC_LEN];
+     uint32_t byte_order = VCF_BIN_BYTE_ORDER;
+
+     vcf_chrom_dict_free(& f->bin->dict);
+     f->bin->item_pending = 0;
+     if (f->mode == 'w') {
+          if (vcf_file_write(f, VCF_BIN_MAGIC, VCF_BIN_MAGIC_LEN) != VCF_BIN_MAGIC_LEN
+              || vcf_file_write(f, (const char *) &byte_order, sizeof(byte_order)) != (int) sizeof(byte_order)) {
+               LOG_ERROR("Couldn't write to %s\n", f->path);
+               return -1;
+          }
+     } else {
+          if (0 != vcf_file_read(f, magic, VCF_BIN_MAGIC_LEN)
+              || 0 != memcmp(magic, VCF_BIN_MAGIC, VCF_BIN_MAGIC_LEN)
+              || 0 != vcf_file_read(f, &byte_order, sizeof(byte_order))) {
+               LOG_ERROR("%s is not a binary variant file (or was written by an incompatible lofreq version)\n", f->path);
+               return -1;
+          }
+          if (byte_order != VCF_BIN_BYTE_ORDER) {
+               LOG_ERROR("%s was created on a machine with different byte order. Please recreate it or use VCF instead\n", f->path);
+               return -1;
+          }
+     }
+     return 0;
+}
+
+
+/* returns 0 on success */
+static int
+vcf_bin_write_var(vcf_file_t *f, const var_t *var)
+{
+     vcf_bin_t *b = f->bin;
+     int added;
+     int chrom_id = vcf_chrom_dict_get(& b->dict,
+                                       var->chrom ? var->chrom : VCF_MISSING_VAL_STR,
+                                       & added);
+     if (added) {
+          const char *name = b->dict.names[chrom_id];
+          if (vcf_bin_write_item(f, VCF_BIN_ITEM_CHROM, name, strlen(name))) {
+               return -1;
+          }
+     }
+     if (vcf_bin_encode_var(& b->item, var, chrom_id)) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     return vcf_bin_write_item(f, VCF_BIN_ITEM_VAR, b->item.s + sizeof(uint32_t),
+                               b->item.l - sizeof(uint32_t));
+}
+
+
+/* returns 0 on success, -1 on error or eof (like vcf_parse_var()) */
+static int
+vcf_bin_read_var(vcf_file_t *f, var_t *var)
+{
+     vcf_bin_t *b = f->bin;
+     int chrom_id, added;
+
+     while (0 == vcf_bin_read_item(f)) {
+          if (b->item_tag == VCF_BIN_ITEM_CHROM) {
+               if (vcf_chrom_dict_get(& b->dict, b->item.s + sizeof(uint32_t), & added) != b->dict.n-1
+                   || ! added) {
+                    LOG_ERROR("Duplicate chromosome in %s\n", f->path);
+                    return -1;
+               }
+          } else if (b->item_tag == VCF_BIN_ITEM_VAR) {
+               if (vcf_bin_decode_var(var, & chrom_id, b->item.s, b->item.l)) {
+                    return -1;
+               }
+               if (chrom_id < 0 || chrom_id >= b->dict.n) {
+                    LOG_ERROR("Undefined chromosome id in %s\n", f->path);
+                    return -1;
+               }
+               var->chrom = strdup(b->dict.names[chrom_id]);
+               return 0;
+          } else {
+               LOG_ERROR("Unexpected item '%c' in %s\n", b->item_tag, f->path);
+               return -1;
+          }
+     }
+     return -1;
+}
+
+
 int
 vcf_file_seek(vcf_file_t *f, long int offset, int whence) 
 {
+     if (f->bin) {
+          /* can only rewind */
+          if (offset != 0 || whence != SEEK_SET) {
+               return -1;
+          }
+          if ((f->is_bgz ? bgzf_seek(f->fh_bgz, 0, SEEK_SET) : fseek(f->fh, 0, SEEK_SET)) < 0) {
+               return -1;
+          }
+          return vcf_bin_start(f);
+     }
      if (f->is_bgz) {
           return bgzf_seek(f->fh_bgz, offset, whence);
      } else {
@@ -180,6 +826,9 @@ vcf_file_open(vcf_file_t *f, const char *path, const int bgzip, char mode)
 
      f->path = strdup(path);
      f->mode =mode;
+     f->bin = NULL;
+     f->idx = NULL;
+     memset(& f->line, 0, sizeof(kstring_t));
      
      if (bgzip) {
           if (path[0] == '-') {
@@ -214,9 +863,95 @@ vcf_file_open(vcf_file_t *f, const char *path, const int bgzip, char mode)
 
      if (! f->fh && ! f->fh_bgz) {
           return -1;
-     } else {
+     }
+
+     if (vcf_has_bin_ext(path)) {
+          if (NULL == (f->bin = calloc(1, sizeof(vcf_bin_t)))) {
+               fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                       __FILE__, __FUNCTION__, __LINE__);
+               exit(1);
+          }
+          return vcf_bin_start(f);
+     }
+     return 0;
+}
+
+
+/* compresses bgzip output with n_threads threads (htslib's bgzf
+ * thread pool). no-op for anything else. returns 0 on success */
+int
+vcf_file_set_threads(vcf_file_t *f, const int n_threads)
+{
+     if (! f->is_bgz || f->mode != 'w' || n_threads < 2) {
+          return 0;
+     }
+     if (f->idx) {
+          /* virtual offsets aren't known until blocks are compressed */
+          LOG_VERBOSE("Not compressing %s with threads, since it's indexed on the fly\n", f->path);
           return 0;
      }
+     return bgzf_mt(f->fh_bgz, n_threads, 256);
+}
+
+
+/* builds the tabix index (csi if min_shift > 0) while writing bgzip
+ * output, instead of reading the file again after closing it. has to
+ * be called before anything is written and writes have to consist of
+ * complete lines. if indexing on the fly fails (e.g. unsorted
+ * output) the index is built after closing as usual. returns 0 on
+ * success */
+int
+vcf_file_index_on_the_fly(vcf_file_t *f, const int min_shift)
+{
+     if (! f->is_bgz || f->mode != 'w' || f->bin || f->path[0] == '-') {
+          return -1;
+     }
+     if (NULL == (f->idx = calloc(1, sizeof(vcf_idx_t)))) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     f->idx->min_shift = min_shift;
+     return 0;
+}
+
+
+/* sets tabix meta data, i.e. vcf config and sequence names. ints
+ * are stored little-endian, as in tbx.c */
+static void
+vcf_idx_set_meta(vcf_idx_t *x)
+{
+     tbx_conf_t conf = tbx_conf_vcf;
+     kstring_t meta = {0, 0, NULL};
+     int32_t h[7];
+     int i;
+
+     h[0] = conf.preset;
+     h[1] = conf.sc;
+     h[2] = conf.bc;
+     h[3] = conf.ec;
+     h[4] = conf.meta_char;
+     h[5] = conf.line_skip;
+     h[6] = 0;
+     for (i=0; i<x->chroms.n; i++) {
+          h[6] += strlen(x->chroms.names[i]) + 1;
+     }
+     if (ed_is_big()) {
+          for (i=0; i<7; i++) {
+               ed_swap_4p(&h[i]);
+          }
+     }
+     kputsn((const char *) h, sizeof(h), & meta);
+     for (i=0; i<x->chroms.n; i++) {
+          kputsn(x->chroms.names[i], strlen(x->chroms.names[i]) + 1, & meta);
+     }
+     if (NULL == meta.s) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     /* idx takes ownership */
+     hts_idx_set_meta(x->idx, meta.l, (uint8_t *) meta.s, 0);
 }
 
 
@@ -231,14 +966,33 @@ vcf_file_flush(vcf_file_t *f)
 }
 
 
-/* note: tries to tabix index and also frees path */
+/* note: tries to tabix index (unless done on the fly already) and
+ * also frees path */
 int
 vcf_file_close(vcf_file_t *f) 
 {
      int rc = 0;
+     vcf_idx_t *x = f->idx;
+
+     if (x && ! x->failed) {
+          if (! x->idx) {
+               /* no records */
+               vcf_idx_create(x, bgzf_tell(f->fh_bgz));
+          }
+          if (! x->failed) {
+               hts_idx_finish(x->idx, bgzf_tell(f->fh_bgz));
+               vcf_idx_set_meta(x);
+          }
+     }
+
      if (f->is_bgz) {          
           rc = bgzf_close(f->fh_bgz);
-          if (rc==0 && f->mode=='w' && f->path && f->path[0] != '-') {
+          if (rc==0 && x && ! x->failed) {
+               rc = hts_idx_save(x->idx, f->path, x->min_shift > 0 ? HTS_FMT_CSI : HTS_FMT_TBI);
+               if (rc) {
+                    LOG_WARN("saving index of %s failed\n", f->path);
+               }
+          } else if (rc==0 && f->mode=='w' && f->path && f->path[0] != '-' && ! f->bin) {
                int min_shift = -1;
                tbx_conf_t conf = tbx_conf_vcf;
                rc = tbx_index_build(f->path, min_shift, &conf);
@@ -253,6 +1007,23 @@ vcf_file_close(vcf_file_t *f)
                rc = 0;
           }
      }
+     if (f->bin) {
+          vcf_chrom_dict_free(& f->bin->dict);
+          free(f->bin->item.s);
+          free(f->bin);
+          f->bin = NULL;
+     }
+     if (x) {
+          if (x->idx) {
+               hts_idx_destroy(x->idx);
+          }
+          vcf_chrom_dict_free(& x->chroms);
+          free(x->name.s);
+          free(x);
+          f->idx = NULL;
+     }
+     free(f->line.s);
+     f->line.s = NULL;
      free(f->path);
      return rc;
 }
@@ -262,6 +1033,10 @@ vcf_file_close(vcf_file_t *f)
 char *
 vcf_file_gets(vcf_file_t *f, int len, char *line) 
 {
+     if (f->bin) {
+          LOG_ERROR("Can't read lines from binary file %s\n", f->path);
+          return NULL;
+     }
      if (f->is_bgz) {
           kstring_t str = {0, 0, 0};
           if (bgzf_getline(f->fh_bgz, '\n', &str) > 0) {
@@ -305,6 +1080,13 @@ int vcf_var_filtered(const var_t *var)
 
 int vcf_var_is_indel(const var_t *var)
 {
+     if (var->has_typed_info) {
+          if (strlen(var->ref)>1 || strlen(var->alt)>1
+              || (var->typed_info.flags & VAR_INFO_INDEL)) {
+               return 1;
+          }
+          return 0;
+     }
      if (strlen(var->ref)>1 ||
          strlen(var->alt)>1 ||
          vcf_var_has_info_key(NULL, var, "INDEL")) {
@@ -329,13 +1111,19 @@ vcf_var_has_info_key(char **value, const var_t *var, const char *key) {
           (*value) = NULL;
      }
 
-     if (! var->info || ! key) {
+     if (! key) {
           return 0;
      }
-     if (strlen(var->info)<2) {
+     if (var->info) {
+          if (strlen(var->info)<2) {
+               return 0;
+          }
+          info = strdup(var->info);
+     } else if (var->info_is_typed) {
+          info = typed_info_str(& var->typed_info);
+     } else {
           return 0;
      }
-     info = strdup(var->info);
      if (! info) {
           LOG_FATAL("%s\n", "insufficient memory");
           exit(1);
@@ -376,6 +1164,10 @@ void vcf_new_var(var_t **var)
      (*var)->qual = -1; /* -1 == missing */
      (*var)->filter = NULL;
      (*var)->info = NULL;
+     (*var)->has_typed_info = 0;
+     (*var)->info_is_typed = 0;
+     memset(& (*var)->typed_info, 0, sizeof(var_info_t));
+     (*var)->typed_info.pvalue = -1;
 
      (*var)->format = NULL;
      (*var)->num_samples = 0;
@@ -429,6 +1221,9 @@ void vcf_cp_var(var_t **dest, var_t *src)
      if (src->info) {
           (*dest)->info = strdup(src->info);
      }
+     (*dest)->has_typed_info = src->has_typed_info;
+     (*dest)->info_is_typed = src->info_is_typed;
+     (*dest)->typed_info = src->typed_info;
      if (src->format) {
           (*dest)->format = strdup(src->format);
      }
@@ -441,34 +1236,60 @@ void vcf_cp_var(var_t **dest, var_t *src)
      }
 }
 
-void vcf_write_var(vcf_file_t *vcf_file, const var_t *var)
+/* formats the whole record into vcf_file->line and writes it in
+ * one go. returns 0 on success, -1 on write error */
+int vcf_write_var(vcf_file_t *vcf_file, const var_t *var)
 {
-     /* in theory all values are optional */
+     kstring_t *line = & vcf_file->line;
+
+     if (vcf_file->bin) {
+          return vcf_bin_write_var(vcf_file, var) ? -1 : 0;
+     }
 
-     vcf_printf(vcf_file, "%s\t%ld\t%s\t%s\t%s\t",
-             NULL == var->chrom ? VCF_MISSING_VAL_STR : var->chrom,
-             var->pos + 1,
-             NULL == var->id ? VCF_MISSING_VAL_STR : var->id,
-             var->ref,
-             var->alt);
+     /* in theory all values are optional */
+     line->l = 0;
+     kputs(var->chrom ? var->chrom : VCF_MISSING_VAL_STR, line);
+     kputc('\t', line);
+     kputl(var->pos + 1, line);
+     kputc('\t', line);
+     kputs(var->id ? var->id : VCF_MISSING_VAL_STR, line);
+     kputc('\t', line);
+     kputs(var->ref ? var->ref : VCF_MISSING_VAL_STR, line);
+     kputc('\t', line);
+     kputs(var->alt ? var->alt : VCF_MISSING_VAL_STR, line);
+     kputc('\t', line);
      if (var->qual>-1) {
-          vcf_printf(vcf_file, "%d", var->qual);
+          kputw(var->qual, line);
      } else {
-          vcf_printf(vcf_file, "%c", VCF_MISSING_VAL_CHAR);
+          kputc(VCF_MISSING_VAL_CHAR, line);
+     }
+     kputc('\t', line);
+     kputs(var->filter ? var->filter : VCF_MISSING_VAL_STR, line);
+     kputc('\t', line);
+     if (var->info) {
+          kputs(var->info, line);
+     } else if (var->info_is_typed) {
+          kput_typed_info(line, & var->typed_info);
+     } else {
+          kputc(VCF_MISSING_VAL_CHAR, line);
      }
-
-     vcf_printf(vcf_file, "\t%s\t%s",
-             var->filter ? var->filter : VCF_MISSING_VAL_STR,
-             var->info ? var->info : VCF_MISSING_VAL_STR);
 
      if (var->format) {
           int i=0;
-          vcf_printf(vcf_file, "\t%s", var->format);
+          kputc('\t', line);
+          kputs(var->format, line);
           for (i=0; i<var->num_samples; i++) {
-               vcf_printf(vcf_file, "\t%s", var->samples[i]);
+               kputc('\t', line);
+               kputs(var->samples[i], line);
           }
      }
-     vcf_printf(vcf_file, "\n");
+     kputc('\n', line);
+     if (NULL == line->s) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     return vcf_file_write(vcf_file, line->s, line->l) == (int)line->l ? 0 : -1;
 }
 
 
@@ -478,6 +1299,10 @@ vcf_var_add_to_info(var_t *var, const char *info_str)
      if (!var || !info_str) {
           return NULL;
      }
+     if (! var->info && var->info_is_typed) {
+          var->info = typed_info_str(& var->typed_info);
+     }
+     var->info_is_typed = 0;
      var->info = realloc(var->info,
                          (strlen(var->info) + strlen(info_str)
                           + 1/*;*/ + 1/*\0*/) * sizeof(char));
@@ -546,6 +1371,10 @@ int vcf_get_dp4(dp4_counts_t *dp4, var_t *var)
      char *dp4_char_cp;
      int i = 0;
 
+     if (var->has_typed_info) {
+          *dp4 = var->typed_info.dp4;
+          return 0;
+     }
      if ( ! vcf_var_has_info_key(&dp4_char, var, "DP4")) {
           memset(dp4, -1, sizeof(dp4_counts_t)); /* -1 = error */
           return 1;
@@ -579,33 +1408,113 @@ int vcf_get_dp4(dp4_counts_t *dp4, var_t *var)
 }
 
 
-/* var->info allocated here. caller has to free */
+/* the following return info values written by lofreq call, from
+ * typed info if available. return 0 on success, 1 if missing and -1
+ * if the value couldn't be parsed */
+int vcf_var_get_dp(const var_t *var, int *dp)
+{
+     char *val = NULL;
+     int rc = 0;
+
+     if (var->has_typed_info) {
+          *dp = var->typed_info.dp;
+          return 0;
+     }
+     if (! vcf_var_has_info_key(&val, var, "DP")) {
+          return 1;
+     }
+     errno = 0;
+     if (! val) {
+          rc = -1;
+     } else {
+          *dp = strtol(val, (char **) NULL, 10);
+          rc = errno ? -1 : 0;
+     }
+     free(val);
+     return rc;
+}
+
+
+int vcf_var_get_af(const var_t *var, float *af)
+{
+     char *val = NULL;
+     int rc = 0;
+
+     if (var->has_typed_info) {
+          *af = var->typed_info.af;
+          return 0;
+     }
+     if (! vcf_var_has_info_key(&val, var, "AF")) {
+          return 1;
+     }
+     errno = 0;
+     if (! val) {
+          rc = -1;
+     } else {
+          *af = strtof(val, (char **) NULL);
+          rc = errno ? -1 : 0;
+     }
+     free(val);
+     return rc;
+}
+
+
+int vcf_var_get_sb(const var_t *var, int *sb)
+{
+     char *val = NULL;
+     int rc = 0;
+
+     if (var->has_typed_info) {
+          *sb = var->typed_info.sb;
+          return 0;
+     }
+     if (! vcf_var_has_info_key(&val, var, "SB")) {
+          return 1;
+     }
+     if (! val) {
+          rc = -1;
+     } else {
+          *sb = atoi(val);
+     }
+     free(val);
+     return rc;
+}
+
+
+/* var->info allocated here. caller has to free. also sets typed
+ * info (pvalue is left missing) */
 void vcf_var_sprintf_info(var_t *var,
                           const int dp, const float af, const int sb,
                           const dp4_counts_t *dp4,
                           const int indel, const int hrun, 
                           const int consvar)
 {
-     char buf[LINE_BUF_SIZE];
-     snprintf(buf, sizeof(buf)-32, /* leave some for INDEL and other flags below */
-              "DP=%d;AF=%f;SB=%d;DP4=%d,%d,%d,%d",
-              dp, af, sb, dp4->ref_fw, dp4->ref_rv, dp4->alt_fw, dp4->alt_rv);
-     if (indel) {
-          sprintf(buf, "%s;INDEL", buf);
-          sprintf(buf, "%s;HRUN=%d", buf, hrun);
-     }
-     if (consvar) {
-          sprintf(buf, "%s;CONSVAR", buf);
-     }
-
-     var->info = strdup(buf);
+     char buf[32];
+     var_info_t *ti = & var->typed_info;
+
+     ti->dp = dp;
+     /* keep af as printed, so that text and typed info agree */
+     snprintf(buf, sizeof(buf), "%f", af);
+     ti->af = strtof(buf, NULL);
+     ti->sb = sb;
+     ti->dp4 = *dp4;
+     ti->hrun = hrun;
+     ti->flags = (indel ? VAR_INFO_INDEL : 0) | (consvar ? VAR_INFO_CONSVAR : 0);
+     var->has_typed_info = 1;
+     var->info_is_typed = 1;
+     /* text info is only made when needed, see vcf_var_add_to_info() */
 
      /* FIXME format and samples not supported */
 }
 
 
-void vcf_write_header(vcf_file_t *vcf_file, const char *header)
+/* returns 0 on success, -1 on write error */
+int vcf_write_header(vcf_file_t *vcf_file, const char *header)
 {
+     if (vcf_file->bin) {
+          return vcf_bin_write_item(vcf_file, VCF_BIN_ITEM_HEADER,
+                                    header, strlen(header)) ? -1 : 0;
+     }
 #if 0
      fprintf(stderr, "TMP DEBUG: writing header %s", header);
      fprintf(stderr, "TMP DEBUG: vcf_file path = %s\n", vcf_file->path);
@@ -614,39 +1523,57 @@ void vcf_write_header(vcf_file_t *vcf_file, const char *header)
      fprintf(stderr, "TMP DEBUG: vcf_file fh_bgz = %p\n", vcf_file->fh_bgz);
      fprintf(stderr, "TMP DEBUG: vcf_file mode = %c\n", vcf_file->mode);
 #endif
-     vcf_printf(vcf_file, "%s", header);
+     return vcf_file_write(vcf_file, header, strlen(header)) == (int)strlen(header) ? 0 : -1;
 }
 
 
-/* src can either be the program or the command. that's at least what
- * the vcftools folks do as well.
+/* returns a new header (meta info and header line), which has to be
+ * freed by caller. src can either be the program or the command.
+ * that's at least what the vcftools folks do as well.
  */
-void vcf_write_new_header(vcf_file_t *vcf_file, const char *src, const char *reffa)
+char *vcf_new_header(const char *src, const char *reffa)
 {
      char tbuf[9];
      struct tm tm;
      time_t t;
+     kstring_t header = {0, 0, NULL};
 
      t = time(0);
      localtime_r(&t, &tm);
      strftime(tbuf, 9, "%Y%m%d", &tm);
 
-     vcf_printf(vcf_file, "##fileformat=VCFv4.0\n");
-     vcf_printf(vcf_file, "##fileDate=%s\n", tbuf);
+     ksprintf(&header, "##fileformat=VCFv4.0\n");
+     ksprintf(&header, "##fileDate=%s\n", tbuf);
      if (src) {
-          vcf_printf(vcf_file, "##source=%s\n", src);
+          ksprintf(&header, "##source=%s\n", src);
      }
      if (reffa) {
-          vcf_printf(vcf_file, "##reference=%s\n", reffa);
+          ksprintf(&header, "##reference=%s\n", reffa);
      }
-     vcf_printf(vcf_file, "##INFO=<ID=DP,Number=1,Type=Integer,Description=\"Raw Depth\">\n");
-     vcf_printf(vcf_file, "##INFO=<ID=AF,Number=1,Type=Float,Description=\"Allele Frequency\">\n");
-     vcf_printf(vcf_file, "##INFO=<ID=SB,Number=1,Type=Integer,Description=\"Phred-scaled strand bias at this position\">\n");
-     vcf_printf(vcf_file, "##INFO=<ID=DP4,Number=4,Type=Integer,Description=\"Counts for ref-forward bases, ref-reverse, alt-forward and alt-reverse bases\">\n");
-     vcf_printf(vcf_file, "##INFO=<ID=INDEL,Number=0,Type=Flag,Description=\"Indicates that the variant is an INDEL.\">\n");
-     vcf_printf(vcf_file, "##INFO=<ID=CONSVAR,Number=0,Type=Flag,Description=\"Indicates that the variant is a consensus variant (as opposed to a low frequency variant).\">\n");
-     vcf_printf(vcf_file, "##INFO=<ID=HRUN,Number=1,Type=Integer,Description=\"Homopolymer length to the right of report indel position\">\n");
-     vcf_printf(vcf_file, "%s\n", VCF_HEADER);
+     ksprintf(&header, "##INFO=<ID=DP,Number=1,Type=Integer,Description=\"Raw Depth\">\n");
+     ksprintf(&header, "##INFO=<ID=AF,Number=1,Type=Float,Description=\"Allele Frequency\">\n");
+     ksprintf(&header, "##INFO=<ID=SB,Number=1,Type=Integer,Description=\"Phred-scaled strand bias at this position\">\n");
+     ksprintf(&header, "##INFO=<ID=DP4,Number=4,Type=Integer,Description=\"Counts for ref-forward bases, ref-reverse, alt-forward and alt-reverse bases\">\n");
+     ksprintf(&header, "##INFO=<ID=INDEL,Number=0,Type=Flag,Description=\"Indicates that the variant is an INDEL.\">\n");
+     ksprintf(&header, "##INFO=<ID=CONSVAR,Number=0,Type=Flag,Description=\"Indicates that the variant is a consensus variant (as opposed to a low frequency variant).\">\n");
+     ksprintf(&header, "##INFO=<ID=HRUN,Number=1,Type=Integer,Description=\"Homopolymer length to the right of report indel position\">\n");
+     ksprintf(&header, "%s\n", VCF_HEADER);
+     if (NULL == header.s) {
+          fprintf(stderr, "FATAL: couldn't allocate memory at %s:%s():%d\n",
+                  __FILE__, __FUNCTION__, __LINE__);
+          exit(1);
+     }
+     return header.s;
+}
+
+
+/* see vcf_new_header() */
+int vcf_write_new_header(vcf_file_t *vcf_file, const char *src, const char *reffa)
+{
+     char *header = vcf_new_header(src, reffa);
+     int rc = vcf_write_header(vcf_file, header);
+     free(header);
+     return rc;
 }
 
 
@@ -661,6 +1588,21 @@ int vcf_parse_header(char **header, vcf_file_t *vcf_file)
      const int MAX_HEADER_LEN = 10000;
      int line_no = 0;
 
+     if (vcf_file->bin) {
+          vcf_bin_t *b = vcf_file->bin;
+          if (0 == vcf_bin_read_item(vcf_file)) {
+               if (b->item_tag == VCF_BIN_ITEM_HEADER) {
+                    (*header) = strdup(b->item.s + sizeof(uint32_t));
+                    return 0;
+               }
+               b->item_pending = 1;
+          }
+          (*header) = malloc((strlen(VCF_HEADER) + 1 + 1 /* \n+\0 */) * sizeof(char));
+          (void) strcpy(*header, VCF_HEADER);
+          (void) strcat(*header, "\n");
+          return -1;
+     }
+
      /* make sure strlen below will work on header */
      (*header) = malloc(sizeof(char));
      (*header)[0] = '\0';
@@ -792,6 +1734,9 @@ int vcf_parse_var(vcf_file_t *vcf_file, var_t *var)
      char line[LINE_BUF_SIZE];
      char *rc;
 
+     if (vcf_file->bin) {
+          return vcf_bin_read_var(vcf_file, var);
+     }
      rc = vcf_file_gets(vcf_file, sizeof(line), line);
      if (NULL == rc) {
           return -1;
@@ -30,20 +30,56 @@
 #define VCF_H
 
 #include <stdarg.h>
+#include <stdint.h>
 
 #include "htslib/bgzf.h"
+#include "htslib/kstring.h"
 /*#include "zlib.h"*/
 #include "uthash.h"
 
 
+/* state of a binary variant stream, see vcf_bin_encode_var() */
+typedef struct vcf_bin_s vcf_bin_t;
+
+/* index built while writing, see vcf_file_index_on_the_fly() */
+typedef struct vcf_idx_s vcf_idx_t;
+
 typedef struct {
      char *path;
      int is_bgz;
      FILE *fh;
      BGZF *fh_bgz;
      char mode;
+     vcf_bin_t *bin; /* NULL for text vcf */
+     kstring_t line; /* record formatting buffer, see vcf_write_var() */
+     vcf_idx_t *idx; /* NULL unless indexing on the fly */
 } vcf_file_t;
 
+typedef struct {
+     int ref_fw;
+     int ref_rv;
+     int alt_fw;
+     int alt_rv;
+} dp4_counts_t;
+
+
+/* typed values of the info fields written by lofreq call (see
+ * vcf_var_sprintf_info()), so that consumers don't have to parse
+ * the info string. use vcf_var_get_*() to access them.
+ */
+#define VAR_INFO_INDEL   0x1
+#define VAR_INFO_CONSVAR 0x2
+
+typedef struct {
+     int dp;
+     float af; /* as printed, i.e. rounded to six decimals */
+     int sb;
+     dp4_counts_t dp4;
+     int hrun; /* only printed for indels */
+     int flags; /* VAR_INFO_* */
+     double pvalue; /* unscaled pvalue behind qual. -1 = missing */
+} var_info_t;
+
 typedef struct {
      char *chrom;
      long int pos; /* zero offset */
@@ -54,20 +90,19 @@ typedef struct {
      char *filter;
      char *info;
 
+     /* only valid if has_typed_info. if info_is_typed, info is what
+      * vcf_var_sprintf_info() makes of it and may be NULL until
+      * needed */
+     int has_typed_info;
+     int info_is_typed;
+     var_info_t typed_info;
+
      /* genotyping info (not used in lofreq) */
      char *format;
      int num_samples;
      char **samples;
 } var_t;
 
-typedef struct {
-     int ref_fw;
-     int ref_rv;
-     int alt_fw;
-     int alt_rv;
-} dp4_counts_t;
-
-
 typedef struct {
      char *key; /* according to uthash doc this should be const but then we can't free it */
      var_t *var;
@@ -84,15 +119,39 @@ void  var_hash_free_table(var_hash_t *var_hash);
 #define VCF_MISSING_VAL_CHAR VCF_MISSING_VAL_STR[0]
 
 
+/* variants can also be stored in a compact binary form, which is
+ * chosen by file extension (optionally followed by .gz for bgzip).
+ * meant for passing variants between lofreq commands: only lofreq's
+ * own info fields are kept typed, anything else as string. format
+ * and samples are not kept. native byte order: files are rejected
+ * on machines with different byte order.
+ */
+#define VCF_BIN_EXT ".lfb"
+
+/* chromosome names of a binary stream and their ids */
+typedef struct {
+     char **names;
+     int n, alloced;
+     void *hash; /* name to id */
+     int last; /* id of last lookup */
+} vcf_chrom_dict_t;
+
+
 #define VCF_VAR_PASSES(v) ((v)->filter[0]==VCF_MISSING_VAL_CHAR || 0==strncmp((v)->filter, "PASS", 4))
 
 
 
+int
+vcf_has_bin_ext(const char *path);
 int
 vcf_file_seek(vcf_file_t *f, long int offset, int whence);
 int
 vcf_file_open(vcf_file_t *f, const char *path, const int gzip, const char mode);
 int
+vcf_file_set_threads(vcf_file_t *f, const int n_threads);
+int
+vcf_file_index_on_the_fly(vcf_file_t *f, const int min_shift);
+int
 vcf_file_flush(vcf_file_t *f);
 int
 vcf_file_close(vcf_file_t *f);
@@ -100,8 +159,13 @@ char *
 vcf_file_gets(vcf_file_t *f, int len, char *line);
 int
 vcf_printf(vcf_file_t *f, char *fmt, ...);
+int
+vcf_file_write(vcf_file_t *f, const char *buf, size_t len);
 
 int vcf_get_dp4(dp4_counts_t *dp4, var_t *var);
+int vcf_var_get_dp(const var_t *var, int *dp);
+int vcf_var_get_af(const var_t *var, float *af);
+int vcf_var_get_sb(const var_t *var, int *sb);
 
 void vcf_new_var(var_t **var);
 void vcf_free_var(var_t **var);
@@ -125,8 +189,16 @@ void vcf_var_sprintf_info(var_t *var,
                           const int dp, const float af, const int sb,
                           const dp4_counts_t *dp4,
                           const int is_indel, const int hrun, const int is_consvar);
-void vcf_write_var(vcf_file_t *vcf_file, const var_t *var);
-void vcf_write_header(vcf_file_t *vcf_file, const char *header);
-void vcf_write_new_header(vcf_file_t *vcf_file, const char *srcprog, const char *reffa);
+int vcf_write_var(vcf_file_t *vcf_file, const var_t *var);
+int vcf_write_header(vcf_file_t *vcf_file, const char *header);
+char *vcf_new_header(const char *srcprog, const char *reffa);
+int vcf_write_new_header(vcf_file_t *vcf_file, const char *srcprog, const char *reffa);
 void vcf_header_add(char **header, const char *info);
+
+int vcf_chrom_dict_get(vcf_chrom_dict_t *d, const char *name, int *added);
+void vcf_chrom_dict_free(vcf_chrom_dict_t *d);
+int vcf_bin_encode_var(kstring_t *rec, const var_t *var, const int chrom_id);
+int vcf_bin_decode_var(var_t *var, int *chrom_id, const char *rec, const size_t len);
+uint32_t vcf_bin_rec_chrom_id(const char *rec);
+void vcf_bin_rec_set_chrom_id(char *rec, const uint32_t chrom_id);
 #endif
@@ -0,0 +1,58 @@
+#!/bin/bash
+
+# Make sure bgzipped output compressed with threads is a valid bgzip
+# file with the same content as single-threaded output
+
+source lib.sh || exit 1
+
+
+basedir=data/denv2-simulation
+bam=$basedir/denv2-10haplo.bam
+reffa=$basedir/denv2-refseq.fa
+
+outdir=$(mktemp -d -t $(basename $0).XXXXXX)
+outraw_threads=$outdir/raw_threads.vcf.gz
+outraw_single=$outdir/raw_single.vcf.gz
+log=$outdir/log.txt
+
+KEEP_TMP=0
+
+cmd="$LOFREQ call --threads $threads -f $reffa -o $outraw_threads $bam"
+if ! eval $cmd >> $log 2>&1; then
+    echoerror "The following command failed (see $log for more): $cmd"
+    exit 1
+fi
+cmd="$LOFREQ call -f $reffa -o $outraw_single $bam"
+if ! eval $cmd >> $log 2>&1; then
+    echoerror "The following command failed (see $log for more): $cmd"
+    exit 1
+fi
+
+for f in $outraw_threads $outraw_single; do
+    if ! $zcat -t $f >> $log 2>&1; then
+        echoerror "$f is not a valid gzip file"
+        exit 1
+    fi
+    if ! tabix -p vcf -f $f >> $log 2>&1; then
+        echoerror "tabix can't index $f"
+        exit 1
+    fi
+done
+
+# only date and command line in header are allowed to differ
+md5_threads=$($zcat $outraw_threads | grep -v '^##fileDate\|^##source' | $md5)
+md5_single=$($zcat $outraw_single | grep -v '^##fileDate\|^##source' | $md5)
+if [ "$md5_threads" != "$md5_single" ]; then
+    echoerror "Threaded and single-threaded bgzip output differ. Check $outraw_threads and $outraw_single"
+    exit 1
+else
+    echook "Threaded and single-threaded bgzip output are identical."
+fi
+
+
+if [ $KEEP_TMP -eq 1 ]; then
+    echowarn "Not deleting tmp dir $outdir"
+else
+    rm  $outdir/*
+    rmdir $outdir
+fi
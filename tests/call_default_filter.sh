@@ -0,0 +1,55 @@
+#!/bin/bash
+
+# Make sure the default filter run inside lofreq call gives the same
+# result as calling without it and running lofreq filter afterwards
+
+source lib.sh || exit 1
+
+
+basedir=data/denv2-simulation
+bam=$basedir/denv2-10haplo.bam
+reffa=$basedir/denv2-refseq.fa
+# fixed bonferroni: otherwise call passes dynamic quality thresholds
+# to the filter
+bonf=32169
+
+outdir=$(mktemp -d -t $(basename $0).XXXXXX)
+outfinal_call=$outdir/final_call.vcf
+outraw=$outdir/raw.vcf
+outfinal_filter=$outdir/final_filter.vcf
+log=$outdir/log.txt
+
+KEEP_TMP=0
+
+cmd="$LOFREQ call -b $bonf -f $reffa -o $outfinal_call $bam"
+if ! eval $cmd >> $log 2>&1; then
+    echoerror "The following command failed (see $log for more): $cmd"
+    exit 1
+fi
+cmd="$LOFREQ call --no-default-filter -b $bonf -f $reffa -o $outraw $bam"
+if ! eval $cmd >> $log 2>&1; then
+    echoerror "The following command failed (see $log for more): $cmd"
+    exit 1
+fi
+cmd="$LOFREQ filter -i $outraw -o $outfinal_filter"
+if ! eval $cmd >> $log 2>&1; then
+    echoerror "The following command failed (see $log for more): $cmd"
+    exit 1
+fi
+
+md5_call=$(grep -v '^#' $outfinal_call | $md5)
+md5_filter=$(grep -v '^#' $outfinal_filter | $md5)
+if [ "$md5_call" != "$md5_filter" ]; then
+    echoerror "In-process and separate filtering differ. Check $outfinal_call and $outfinal_filter"
+    exit 1
+else
+    echook "In-process and separate filtering give identical results."
+fi
+
+
+if [ $KEEP_TMP -eq 1 ]; then
+    echowarn "Not deleting tmp dir $outdir"
+else
+    rm  $outdir/*
+    rmdir $outdir
+fi
@@ -0,0 +1,64 @@
+#!/bin/bash
+
+# Make sure a tabix index built while writing (--index-on-the-fly)
+# answers queries the same way as one built afterwards
+
+source lib.sh || exit 1
+
+
+basedir=data/denv2-simulation
+bam=$basedir/denv2-10haplo.bam
+reffa=$basedir/denv2-refseq.fa
+
+outdir=$(mktemp -d -t $(basename $0).XXXXXX)
+outraw_fly=$outdir/raw_fly.vcf.gz
+outraw_post=$outdir/raw_post.vcf.gz
+log=$outdir/log.txt
+
+KEEP_TMP=0
+
+cmd="$LOFREQ call --index-on-the-fly -f $reffa -o $outraw_fly $bam"
+if ! eval $cmd >> $log 2>&1; then
+    echoerror "The following command failed (see $log for more): $cmd"
+    exit 1
+fi
+cmd="$LOFREQ call -f $reffa -o $outraw_post $bam"
+if ! eval $cmd >> $log 2>&1; then
+    echoerror "The following command failed (see $log for more): $cmd"
+    exit 1
+fi
+for f in $outraw_fly $outraw_post; do
+    if [ ! -s $f.tbi ]; then
+        echoerror "Missing index $f.tbi"
+        exit 1
+    fi
+done
+
+seqs_fly=$(tabix -l $outraw_fly)
+seqs_post=$(tabix -l $outraw_post)
+if [ "$seqs_fly" != "$seqs_post" ]; then
+    echoerror "Indices list different sequences: $seqs_fly vs $seqs_post"
+    exit 1
+fi
+
+# whole sequences and windows across them, incl. empty ones
+for chrom in $seqs_post; do
+    len=$(awk -v s=$chrom '$1==s {print $2}' $reffa.fai)
+    for reg in $chrom $($seq 1 1000 $len | awk -v s=$chrom '{printf "%s:%d-%d\n", s, $1, $1+1499}'); do
+        md5_fly=$(tabix $outraw_fly $reg | $md5)
+        md5_post=$(tabix $outraw_post $reg | $md5)
+        if [ "$md5_fly" != "$md5_post" ]; then
+            echoerror "Query $reg differs between on-the-fly and post-built index. Check $outdir"
+            exit 1
+        fi
+    done
+done
+echook "On-the-fly and post-built index give identical query results."
+
+
+if [ $KEEP_TMP -eq 1 ]; then
+    echowarn "Not deleting tmp dir $outdir"
+else
+    rm  $outdir/*
+    rmdir $outdir
+fi
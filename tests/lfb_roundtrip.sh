@@ -0,0 +1,70 @@
+#!/bin/bash
+
+# Make sure the binary variant format (.lfb) gives the same variants
+# as VCF when passed through call, filter, uniq and vcfset
+
+source lib.sh || exit 1
+
+
+basedir=data/denv2-simulation
+bam=$basedir/denv2-10haplo.bam
+reffa=$basedir/denv2-refseq.fa
+truesnv=$basedir/denv2-10haplo_true-snp.vcf.gz
+
+outdir=$(mktemp -d -t $(basename $0).XXXXXX)
+log=$outdir/log.txt
+
+KEEP_TMP=0
+
+run() {
+    cmd="$@"
+    if ! eval $cmd >> $log 2>&1; then
+        echoerror "The following command failed (see $log for more): $cmd"
+        exit 1
+    fi
+}
+
+# compares variants in $1 (.lfb) and $2 (.vcf) after converting $1
+# to vcf with a no-op filter
+cmp_lfb_vcf() {
+    run $LOFREQ filter --no-defaults -i $1 -o ${1%.lfb}.conv.vcf
+    md5_lfb=$(grep -v '^#' ${1%.lfb}.conv.vcf | $md5)
+    md5_vcf=$(grep -v '^#' $2 | $md5)
+    if [ "$md5_lfb" != "$md5_vcf" ]; then
+        echoerror "Binary and VCF output differ. Check $1 and $2"
+        exit 1
+    fi
+}
+
+for ext in lfb vcf; do
+    run $LOFREQ call -f $reffa -o $outdir/call.$ext $bam
+done
+cmp_lfb_vcf $outdir/call.lfb $outdir/call.vcf
+echook "call: binary and VCF output identical"
+
+for ext in lfb vcf; do
+    run $LOFREQ filter -a 0.05 -i $outdir/call.$ext -o $outdir/filter.$ext
+done
+cmp_lfb_vcf $outdir/filter.lfb $outdir/filter.vcf
+echook "filter: binary and VCF output identical"
+
+for ext in lfb vcf; do
+    run $LOFREQ uniq -v $outdir/call.$ext -o $outdir/uniq.$ext $bam
+done
+cmp_lfb_vcf $outdir/uniq.lfb $outdir/uniq.vcf
+echook "uniq: binary and VCF output identical"
+
+# vcf2 has to be tabix indexed, i.e. can't be binary
+for ext in lfb vcf; do
+    run $LOFREQ vcfset -a intersect -1 $outdir/call.$ext -2 $truesnv -o $outdir/vcfset.$ext
+done
+cmp_lfb_vcf $outdir/vcfset.lfb $outdir/vcfset.vcf
+echook "vcfset: binary and VCF output identical"
+
+
+if [ $KEEP_TMP -eq 1 ]; then
+    echowarn "Not deleting tmp dir $outdir"
+else
+    rm  $outdir/*
+    rmdir $outdir
+fi
@@ -0,0 +1,69 @@
+#!/bin/bash
+
+# Make sure the default Poisson-binomial engines (vectorized kernel,
+# quality-grouped engine, pre-screen and FFT) call the same variants
+# as the plain scalar DP. Needs a deep dataset so that the FFT engine
+# kicks in (N >= 2048 and K > log2(N)^2)
+
+source lib.sh || exit 1
+
+
+basedir=data/denv2-dpcr-validated
+bam=$basedir/CTTGTA_2_remap_razers-i92_peakrem_corr.bam
+reffa=$basedir/consensus.fa
+
+outdir=$(mktemp -d -t $(basename $0).XXXXXX)
+outfinal_def=$outdir/final_def.vcf
+outfinal_ref=$outdir/final_ref.vcf
+log=$outdir/log.txt
+
+KEEP_TMP=0
+
+cmd="$LOFREQ call -f $reffa -o $outfinal_def $bam"
+if ! eval $cmd >> $log 2>&1; then
+    echoerror "The following command failed (see $log for more): $cmd"
+    exit 1
+fi
+cmd="$LOFREQ call --pb-scalar --pb-no-grouped --pb-no-prescreen --pb-no-fft -f $reffa -o $outfinal_ref $bam"
+if ! eval $cmd >> $log 2>&1; then
+    echoerror "The following command failed (see $log for more): $cmd"
+    exit 1
+fi
+
+# N and K taken from DP4 of the reference run
+num_fft=$(grep -v '^#' $outfinal_ref | \
+    awk '{match($8, /DP4=[0-9,]+/); split(substr($8, RSTART+4, RLENGTH-4), c, ",");
+          n=c[1]+c[2]+c[3]+c[4]; k=c[3]+c[4];
+          if (n>=2048 && k>(log(n)/log(2))^2) {x++}} END {print x+0}')
+if [ "$num_fft" -eq 0 ]; then
+    echoerror "No variant in $bam reaches the FFT engine. Need a deeper dataset"
+    exit 1
+fi
+
+n_def=$(grep -vc '^#' $outfinal_def)
+n_ref=$(grep -vc '^#' $outfinal_ref)
+if [ "$n_def" -ne "$n_ref" ]; then
+    echoerror "Default engines called $n_def and scalar DP $n_ref variants. Check $outdir"
+    exit 1
+fi
+
+# all columns identical, except for QUAL which may differ by one
+# because of rounding
+ndiff=$(paste <(grep -v '^#' $outfinal_def) <(grep -v '^#' $outfinal_ref) | \
+    awk -F'\t' '{for (i=1; i<=8; i++) {
+                     if (i==6) {d=$i-$(i+8); if (d<-1 || d>1) {x++; break}}
+                     else if ($i != $(i+8)) {x++; break}}} END {print x+0}')
+if [ "$ndiff" -ne 0 ]; then
+    echoerror "$ndiff records differ between default engines and scalar DP. Check $outfinal_def and $outfinal_ref"
+    exit 1
+else
+    echook "Default engines and scalar DP give identical results ($num_fft variants via FFT gate)."
+fi
+
+
+if [ $KEEP_TMP -eq 1 ]; then
+    echowarn "Not deleting tmp dir $outdir"
+else
+    rm  $outdir/*
+    rmdir $outdir
+fi
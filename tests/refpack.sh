@@ -0,0 +1,68 @@
+#!/bin/bash
+
+# Make sure calls using a packed reference image are identical to
+# calls using the fasta file and that checkref works with both
+
+source lib.sh || exit 1
+
+
+basedir=data/denv2-pseudoclonal
+bam=$basedir/denv2-pseudoclonal.bam
+reffa=$basedir/denv2-pseudoclonal_cons.fa
+
+outdir=$(mktemp -d -t $(basename $0).XXXXXX)
+refpack=$outdir/ref.lfr
+outraw_fa=$outdir/raw_fa.vcf
+outraw_pack=$outdir/raw_pack.vcf
+log=$outdir/log.txt
+
+KEEP_TMP=0
+
+cmd="$LOFREQ refpack -o $refpack $reffa"
+if ! eval $cmd >> $log 2>&1; then
+    echoerror "The following command failed (see $log for more): $cmd"
+    exit 1
+fi
+
+for ref in $reffa $refpack; do
+    if ! $LOFREQ checkref $ref $bam >> $log 2>&1; then
+        echoerror "checkref failed for $ref (see $log for more)"
+        exit 1
+    fi
+done
+
+cmd="$LOFREQ call -f $reffa -o $outraw_fa $bam"
+if ! eval $cmd >> $log 2>&1; then
+    echoerror "The following command failed (see $log for more): $cmd"
+    exit 1
+fi
+cmd="$LOFREQ call -f $refpack -o $outraw_pack $bam"
+if ! eval $cmd >> $log 2>&1; then
+    echoerror "The following command failed (see $log for more): $cmd"
+    exit 1
+fi
+
+nup=$($LOFREQ vcfset -a complement -1 $outraw_fa -2 $outraw_pack --count-only)
+nus=$($LOFREQ vcfset -a complement -2 $outraw_fa -1 $outraw_pack --count-only)
+if [ $nup -ne 0 ] || [ $nus -ne 0 ] ; then
+    echoerror "Fasta and refpack calls differ. Check $outdir"
+    exit 1
+fi
+
+# dindel indel qualities use the precomputed homopolymer track
+md5_fa=$($LOFREQ indelqual --dindel -f $reffa $bam | samtools view - | $md5)
+md5_pack=$($LOFREQ indelqual --dindel -f $refpack $bam | samtools view - | $md5)
+if [ "$md5_fa" != "$md5_pack" ]; then
+    echoerror "Fasta and refpack indel qualities differ"
+    exit 1
+fi
+
+
+echook "Tests passed"
+
+if [ $KEEP_TMP -eq 1 ]; then
+    echowarn "Not deleting tmp dir $outdir"
+else 
+    rm  $outdir/*
+    rmdir $outdir
+fi
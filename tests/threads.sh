@@ -0,0 +1,47 @@
+#!/bin/bash
+
+# Make sure lofreq call --threads produces the same variants as a
+# single-threaded run
+
+source lib.sh || exit 1
+
+
+basedir=data/denv2-simulation
+bam=$basedir/denv2-10haplo.bam
+reffa=$basedir/denv2-refseq.fa
+
+outdir=$(mktemp -d -t $(basename $0).XXXXXX)
+outraw_threads=$outdir/raw_threads.vcf
+outraw_single=$outdir/raw_single.vcf
+log=$outdir/log.txt
+
+KEEP_TMP=0
+
+cmd="$LOFREQ call --threads $threads -f $reffa -o $outraw_threads $bam"
+if ! eval $cmd >> $log 2>&1; then
+    echoerror "The following command failed (see $log for more): $cmd"
+    exit 1
+fi
+cmd="$LOFREQ call -f $reffa -o $outraw_single $bam"
+if ! eval $cmd >> $log 2>&1; then
+    echoerror "The following command failed (see $log for more): $cmd"
+    exit 1
+fi
+
+# header differs in date and command line only
+md5_threads=$(grep -v '^#' $outraw_threads | $md5)
+md5_single=$(grep -v '^#' $outraw_single | $md5)
+if [ "$md5_threads" != "$md5_single" ]; then
+    echoerror "Threaded and single-threaded calls differ. Check $outraw_threads and $outraw_single"
+    exit 1
+else
+    echook "Threaded and single-threaded run give identical results."
+fi
+
+
+if [ $KEEP_TMP -eq 1 ]; then
+    echowarn "Not deleting tmp dir $outdir"
+else
+    rm  $outdir/*
+    rmdir $outdir
+fi